@@ -60,13 +60,17 @@ static void usage() {
             "usage: dumpsys\n"
             "         To dump all services.\n"
             "or:\n"
-            "       dumpsys [-t TIMEOUT] [--priority LEVEL] [--pid] [--help | -l | --skip SERVICES "
-            "| SERVICE [ARGS]]\n"
+            "       dumpsys [-t TIMEOUT] [--priority LEVEL] [--pid] [--binder-stats] "
+            "[--binder-trace] [--help | -l | --skip SERVICES | SERVICE [ARGS]]\n"
             "         --help: shows this help\n"
             "         -l: only list services, do not dump them\n"
             "         -t TIMEOUT_SEC: TIMEOUT to use in seconds instead of default 10 seconds\n"
             "         -T TIMEOUT_MS: TIMEOUT to use in milliseconds instead of default 10 seconds\n"
             "         --pid: dump PID instead of usual dump\n"
+            "         --binder-stats: dump binder transaction stats of the service's process\n"
+            "               instead of usual dump\n"
+            "         --binder-trace: dump the service's process's recent binder transactions\n"
+            "               instead of usual dump\n"
             "         --proto: filter services that support dumping data in proto format. Dumps\n"
             "               will be in proto format.\n"
             "         --priority LEVEL: filter services based on specified priority\n"
@@ -126,6 +130,8 @@ int Dumpsys::main(int argc, char* const argv[]) {
     int timeoutArgMs = 10000;
     int priorityFlags = IServiceManager::DUMP_FLAG_PRIORITY_ALL;
     static struct option longOptions[] = {{"pid", no_argument, 0, 0},
+                                          {"binder-stats", no_argument, 0, 0},
+                                          {"binder-trace", no_argument, 0, 0},
                                           {"priority", required_argument, 0, 0},
                                           {"proto", no_argument, 0, 0},
                                           {"skip", no_argument, 0, 0},
@@ -163,6 +169,10 @@ int Dumpsys::main(int argc, char* const argv[]) {
                 }
             } else if (!strcmp(longOptions[optionIndex].name, "pid")) {
                 type = Type::PID;
+            } else if (!strcmp(longOptions[optionIndex].name, "binder-stats")) {
+                type = Type::BINDER_STATS;
+            } else if (!strcmp(longOptions[optionIndex].name, "binder-trace")) {
+                type = Type::BINDER_TRACE;
             }
             break;
 
@@ -329,6 +339,17 @@ static status_t dumpPidToFd(const sp<IBinder>& service, const unique_fd& fd) {
      return OK;
 }
 
+static status_t dumpTransactionStatsToFd(const sp<IBinder>& service, const unique_fd& fd,
+                                         bool recent) {
+    Parcel data, reply;
+    status_t status = data.writeFileDescriptor(fd.get());
+    if (status != OK) {
+        return status;
+    }
+    data.writeBool(recent);
+    return service->transact(IBinder::DEBUG_STATS_TRANSACTION, data, &reply);
+}
+
 status_t Dumpsys::startDumpThread(Type type, const String16& serviceName,
                                   const Vector<String16>& args) {
     sp<IBinder> service = sm_->checkService(serviceName);
@@ -359,6 +380,10 @@ status_t Dumpsys::startDumpThread(Type type, const String16& serviceName,
         case Type::PID:
             err = dumpPidToFd(service, remote_end);
             break;
+        case Type::BINDER_STATS:
+        case Type::BINDER_TRACE:
+            err = dumpTransactionStatsToFd(service, remote_end, type == Type::BINDER_TRACE);
+            break;
         default:
             std::cerr << "Unknown dump type" << static_cast<int>(type) << std::endl;
             return;
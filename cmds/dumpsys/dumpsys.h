@@ -54,6 +54,8 @@ class Dumpsys {
     enum class Type {
         DUMP,  // dump using `dump` function
         PID,   // dump pid of server only
+        BINDER_STATS,  // dump binder transaction stats of the server's process
+        BINDER_TRACE,  // dump recent binder transactions of the server's process
     };
 
     /**
@@ -573,6 +573,35 @@ TEST_F(DumpsysTest, ListServiceWithPid) {
     AssertOutput(std::to_string(getpid()) + "\n");
 }
 
+// Tests 'dumpsys --binder-stats service_name'
+TEST_F(DumpsysTest, BinderStatsOfService) {
+    sp<BinderMock> binder_mock = ExpectCheckService("Locksmith");
+    EXPECT_CALL(*binder_mock, dump(_, _)).Times(0);
+
+    CallMain({"--binder-stats", "Locksmith"});
+
+    AssertOutputContains("Binder transactions of pid " + std::to_string(getpid()));
+}
+
+// Tests 'dumpsys --binder-trace service_name'
+TEST_F(DumpsysTest, BinderTraceOfService) {
+    sp<BinderMock> binder_mock = ExpectCheckService("Locksmith");
+    EXPECT_CALL(*binder_mock, dump(_, _)).Times(0);
+
+    CallMain({"--binder-trace", "Locksmith"});
+
+    AssertOutputContains("binder transactions of pid " + std::to_string(getpid()));
+}
+
+// '--binder-stats' after the service name belongs to the service.
+TEST_F(DumpsysTest, BinderStatsArgGoesToService) {
+    ExpectDumpWithArgs("Locksmith", {"--binder-stats"}, "I DO!");
+
+    CallMain({"Locksmith", "--binder-stats"});
+
+    AssertOutput("I DO!");
+}
+
 TEST_F(DumpsysTest, GetBytesWritten) {
     const char* serviceName = "service2";
     const char* dumpContents = "dump1";
@@ -43,10 +43,10 @@ static std::string getPidcon(pid_t pid) {
     return result;
 }
 
-static struct selabel_handle* getSehandle() {
+static struct selabel_handle* getSehandle(bool policyUpdated) {
     static struct selabel_handle* gSehandle = nullptr;
 
-    if (gSehandle != nullptr && selinux_status_updated()) {
+    if (gSehandle != nullptr && policyUpdated) {
         selabel_close(gSehandle);
         gSehandle = nullptr;
     }
@@ -136,14 +136,33 @@ bool Access::actionAllowed(const CallingContext& sctx, const char* tctx, const c
 }
 
 bool Access::actionAllowedFromLookup(const CallingContext& sctx, const std::string& name, const char *perm) {
+    // selinux_status_updated() only reports each reload once, so it is
+    // checked here for both the handle and the cache.
+    const bool policyUpdated = selinux_status_updated() > 0;
+    if (policyUpdated || mAllowedLookups.size() >= kMaxAllowedLookups) {
+        mAllowedLookups.clear();
+    }
+
+    std::string key = sctx.sid;
+    key.append(1, '\0').append(perm).append(1, '\0').append(name);
+    if (mAllowedLookups.count(key) != 0) {
+        return true;
+    }
+
     char *tctx = nullptr;
-    if (selabel_lookup(getSehandle(), &tctx, name.c_str(), SELABEL_CTX_ANDROID_SERVICE) != 0) {
+    if (selabel_lookup(getSehandle(policyUpdated), &tctx, name.c_str(),
+            SELABEL_CTX_ANDROID_SERVICE) != 0) {
         LOG(ERROR) << "SELinux: No match for " << name << " in service_contexts.\n";
         return false;
     }
 
     bool allowed = actionAllowed(sctx, tctx, perm, name);
     freecon(tctx);
+
+    // an empty sid means getpidcon failed, never remember that
+    if (allowed && !sctx.sid.empty()) {
+        mAllowedLookups.insert(std::move(key));
+    }
     return allowed;
 }
 
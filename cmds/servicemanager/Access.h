@@ -18,6 +18,7 @@
 
 #include <string>
 #include <sys/types.h>
+#include <unordered_set>
 
 namespace android {
 
@@ -51,6 +52,13 @@ private:
             const char *perm);
 
     char* mThisProcessContext = nullptr;
+
+    // (caller sid, permission, service name) triples that were allowed, so
+    // repeated lookups skip service_contexts matching and the access check.
+    // Denials are not cached so they keep being audited. Cleared when the
+    // policy is reloaded or the cache grows past kMaxAllowedLookups.
+    static constexpr size_t kMaxAllowedLookups = 4096;
+    std::unordered_set<std::string> mAllowedLookups;
 };
 
 };
@@ -245,6 +245,14 @@ Status ServiceManager::registerForNotifications(
         return Status::fromExceptionCode(Status::EX_SECURITY);
     }
 
+    // Callbacks are given the binder without checking allowIsolated, so
+    // isolated apps can't register for them. They only get services through
+    // getService()/checkService(), which do check it.
+    if (multiuser_get_app_id(ctx.uid) >= AID_ISOLATED_START &&
+            multiuser_get_app_id(ctx.uid) <= AID_ISOLATED_END) {
+        return Status::fromExceptionCode(Status::EX_SECURITY);
+    }
+
     if (!isValidServiceName(name)) {
         LOG(ERROR) << "Invalid service name: " << name;
         return Status::fromExceptionCode(Status::EX_ILLEGAL_ARGUMENT);
@@ -390,7 +398,20 @@ Status ServiceManager::registerClientCallback(const std::string& name, const sp<
         return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
     }
 
-    mNameToClientCallback[name].push_back(cb);
+    auto& clientCallbacks = mNameToClientCallback[name];
+    clientCallbacks.push_back(cb);
+
+    // Processes caching the service learn that it is lazy now.
+    if (clientCallbacks.size() == 1) {
+        auto it = mNameToRegistrationCallback.find(name);
+        if (it != mNameToRegistrationCallback.end()) {
+            for (const sp<IServiceCallback>& registrationCb : it->second) {
+                serviceIt->second.guaranteeClient = true;
+                // permission checked in registerForNotifications
+                registrationCb->onRegistration(name, service);
+            }
+        }
+    }
 
     return Status::ok();
 }
@@ -547,4 +568,15 @@ Status ServiceManager::tryUnregisterService(const std::string& name, const sp<IB
     return Status::ok();
 }
 
+Status ServiceManager::isLazyService(const std::string& name, bool* outReturn) {
+    auto ctx = mAccess->getCallingContext();
+
+    if (!mAccess->canFind(ctx, name)) {
+        return Status::fromExceptionCode(Status::EX_SECURITY);
+    }
+
+    *outReturn = mNameToClientCallback.count(name) != 0;
+    return Status::ok();
+}
+
 }  // namespace android
\ No newline at end of file
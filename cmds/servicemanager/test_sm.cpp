@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <android/os/BnClientCallback.h>
 #include <android/os/BnServiceCallback.h>
 #include <binder/Binder.h>
 #include <binder/ProcessState.h>
@@ -21,6 +22,7 @@
 #include <cutils/android_filesystem_config.h>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <unistd.h>
 
 #include "Access.h"
 #include "ServiceManager.h"
@@ -31,6 +33,7 @@ using android::BBinder;
 using android::IBinder;
 using android::ServiceManager;
 using android::binder::Status;
+using android::os::BnClientCallback;
 using android::os::BnServiceCallback;
 using android::os::IServiceManager;
 using testing::_;
@@ -317,6 +320,22 @@ TEST(ServiceNotifications, NoPermissionsRegister) {
         Status::EX_SECURITY);
 }
 
+TEST(ServiceNotifications, NotAllowedFromIsolated) {
+    std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
+
+    EXPECT_CALL(*access, getCallingContext()).WillOnce(Return(Access::CallingContext{
+        .uid = AID_ISOLATED_START,
+    }));
+    EXPECT_CALL(*access, canFind(_,_)).WillOnce(Return(true));
+
+    sp<ServiceManager> sm = new ServiceManager(std::move(access));
+
+    sp<CallbackHistorian> cb = new CallbackHistorian;
+
+    EXPECT_EQ(sm->registerForNotifications("foofoo", cb).exceptionCode(),
+        Status::EX_SECURITY);
+}
+
 TEST(ServiceNotifications, NoPermissionsUnregister) {
     std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
 
@@ -427,3 +446,47 @@ TEST(ServiceNotifications, GetMultipleNotification) {
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
     EXPECT_THAT(cb->registrations, ElementsAre("asdfasdf", "asdfasdf"));
 }
+
+class NoopClientCallback : public BnClientCallback {
+    Status onClients(const sp<IBinder>& /*service*/, bool /*clients*/) override {
+        return Status::ok();
+    }
+
+    android::status_t linkToDeath(const sp<DeathRecipient>&, void*, uint32_t) override {
+        // let SM linkToDeath
+        return android::OK;
+    }
+};
+
+TEST(ServiceNotifications, NotifiedAgainWhenServiceBecomesLazy) {
+    std::unique_ptr<MockAccess> access = std::make_unique<NiceMock<MockAccess>>();
+
+    // client callbacks can only be registered from the service's process
+    ON_CALL(*access, getCallingContext()).WillByDefault(Return(Access::CallingContext{
+        .debugPid = getpid(),
+    }));
+    ON_CALL(*access, canAdd(_, _)).WillByDefault(Return(true));
+    ON_CALL(*access, canFind(_, _)).WillByDefault(Return(true));
+
+    sp<ServiceManager> sm = new NiceMock<MockServiceManager>(std::move(access));
+
+    sp<CallbackHistorian> cb = new CallbackHistorian;
+    sp<IBinder> service = getBinder();
+
+    EXPECT_TRUE(sm->addService("asdfasdf", service,
+        false /*allowIsolated*/, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT).isOk());
+    EXPECT_TRUE(sm->registerForNotifications("asdfasdf", cb).isOk());
+
+    bool lazy = true;
+    EXPECT_TRUE(sm->isLazyService("asdfasdf", &lazy).isOk());
+    EXPECT_FALSE(lazy);
+
+    EXPECT_TRUE(sm->registerClientCallback("asdfasdf", service, new NoopClientCallback).isOk());
+    EXPECT_TRUE(sm->isLazyService("asdfasdf", &lazy).isOk());
+    EXPECT_TRUE(lazy);
+    EXPECT_THAT(cb->binders, ElementsAre(service, service));
+
+    // only the first client callback makes the service lazy
+    EXPECT_TRUE(sm->registerClientCallback("asdfasdf", service, new NoopClientCallback).isOk());
+    EXPECT_THAT(cb->binders, ElementsAre(service, service));
+}
@@ -20,9 +20,13 @@
 #include <utils/misc.h>
 #include <binder/BpBinder.h>
 #include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
 #include <binder/IResultReceiver.h>
+#include <binder/IServiceManager.h>
 #include <binder/IShellCallback.h>
 #include <binder/Parcel.h>
+#include <binder/TransactionStats.h>
+#include <cutils/android_filesystem_config.h>
 
 #include <stdio.h>
 
@@ -164,6 +168,26 @@ const String16& BBinder::getInterfaceDescriptor() const
     return sEmptyDescriptor;
 }
 
+// The stats cover every interface this process serves, not just the target
+// binder, so only callers that may dump any service get them.
+static status_t dumpTransactionStats(const Parcel& data)
+{
+    const uid_t uid = IPCThreadState::self()->getCallingUid();
+    bool allowed = uid == AID_ROOT || uid == AID_SHELL || uid == AID_SYSTEM;
+#if !defined(__ANDROID_VNDK__) && defined(__ANDROID__)
+    allowed = allowed || checkCallingPermission(String16("android.permission.DUMP"));
+#endif
+    if (!allowed) {
+        return PERMISSION_DENIED;
+    }
+
+    int fd = data.readFileDescriptor();
+    if (fd < 0) {
+        return BAD_VALUE;
+    }
+    return data.readBool() ? TransactionStats::dumpRecent(fd) : TransactionStats::dump(fd);
+}
+
 // NOLINTNEXTLINE(google-default-arguments)
 status_t BBinder::transact(
     uint32_t code, const Parcel& data, Parcel* reply, uint32_t flags)
@@ -181,6 +205,9 @@ status_t BBinder::transact(
         case DEBUG_PID_TRANSACTION:
             err = reply->writeInt32(getDebugPid());
             break;
+        case DEBUG_STATS_TRANSACTION:
+            err = dumpTransactionStats(data);
+            break;
         default:
             err = onTransact(code, data, reply, flags);
             break;
@@ -31,6 +31,7 @@
 
 #include <private/binder/binder_module.h>
 
+#include <algorithm>
 #include <atomic>
 #include <errno.h>
 #include <inttypes.h>
@@ -115,6 +116,10 @@ static const char *kCommandStrings[] = {
 
 static const int64_t kWorkSourcePropagatedBitIndex = 32;
 
+// Bounds the memory held by an OnewayBatch; the batch is flushed early once
+// this many transactions are queued.
+static const size_t kMaxOnewayBatchSize = 32;
+
 static const char* getReturnString(uint32_t cmd)
 {
     size_t idx = cmd & _IOC_NRMASK;
@@ -507,17 +512,19 @@ status_t IPCThreadState::getAndExecuteCommand()
 
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount++;
-        if (mProcess->mExecutingThreadsCount >= mProcess->mMaxThreads &&
+        if (mProcess->busyThreadsLocked() >= mProcess->mMaxThreads &&
                 mProcess->mStarvationStartTimeMs == 0) {
             mProcess->mStarvationStartTimeMs = uptimeMillis();
         }
         pthread_mutex_unlock(&mProcess->mThreadCountLock);
 
+        mExecutingPoolCommand = true;
         result = executeCommand(cmd);
+        mExecutingPoolCommand = false;
 
         pthread_mutex_lock(&mProcess->mThreadCountLock);
         mProcess->mExecutingThreadsCount--;
-        if (mProcess->mExecutingThreadsCount < mProcess->mMaxThreads &&
+        if (mProcess->busyThreadsLocked() < mProcess->mMaxThreads &&
                 mProcess->mStarvationStartTimeMs != 0) {
             int64_t starvationTimeMs = uptimeMillis() - mProcess->mStarvationStartTimeMs;
             if (starvationTimeMs > 100) {
@@ -525,6 +532,17 @@ status_t IPCThreadState::getAndExecuteCommand()
                       mProcess->mMaxThreads, starvationTimeMs);
             }
             mProcess->mStarvationStartTimeMs = 0;
+            mProcess->onStarvationEndedLocked(starvationTimeMs);
+        }
+        // A pooled thread leaves if it timed out, if the pool shrank, or if
+        // it was spawned while a BULK transaction borrowed a thread.
+        if (mIsPooledThread && !mLeavingThreadPool) {
+            if (result == TIMED_OUT) {
+                mProcess->onPooledThreadExitedLocked();
+                mLeavingThreadPool = true;
+            } else {
+                mLeavingThreadPool = mProcess->releasePooledThreadLocked();
+            }
         }
         pthread_cond_broadcast(&mProcess->mThreadCountDecrement);
         pthread_mutex_unlock(&mProcess->mThreadCountLock);
@@ -588,6 +606,10 @@ void IPCThreadState::joinThreadPool(bool isMain)
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS JOINING THE THREAD POOL\n", (void*)pthread_self(), getpid());
 
     mOut.writeInt32(isMain ? BC_ENTER_LOOPER : BC_REGISTER_LOOPER);
+    if (!isMain) {
+        mProcess->onPooledThreadStarted();
+        mIsPooledThread = true;
+    }
 
     status_t result;
     do {
@@ -602,11 +624,17 @@ void IPCThreadState::joinThreadPool(bool isMain)
 
         // Let this thread exit the thread pool if it is no longer
         // needed and it is not the main process thread.
-        if(result == TIMED_OUT && !isMain) {
+        if (mLeavingThreadPool) {
             break;
         }
     } while (result != -ECONNREFUSED && result != -EBADF);
 
+    if (mIsPooledThread && !mLeavingThreadPool) {
+        mProcess->onPooledThreadExited();
+    }
+    mIsPooledThread = false;
+    mLeavingThreadPool = false;
+
     LOG_THREADPOOL("**** THREAD %p (PID %d) IS LEAVING THE THREAD POOL err=%d\n",
         (void*)pthread_self(), getpid(), result);
 
@@ -665,6 +693,40 @@ status_t IPCThreadState::transact(int32_t handle,
 
     LOG_ONEWAY(">>>> SEND from pid %d uid %d %s", getpid(), getuid(),
         (flags & TF_ONE_WAY) == 0 ? "READ REPLY" : "ONE WAY");
+
+    if ((flags & TF_ONE_WAY) != 0 && mOnewayBatchDepth > 0 && data.errorCheck() == NO_ERROR) {
+        err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, nullptr);
+        if (err != NO_ERROR) {
+            return (mLastError = err);
+        }
+        mOnewayBatchQueued++;
+
+        // mOut only points at the data. Parcels from
+        // obtainOnewayBatchParcel() are kept until the batch is flushed,
+        // anything else may be freed as soon as we return and has to be
+        // sent now, along with what was queued before it.
+        auto it = std::find_if(mOnewayBatchParcels.begin(), mOnewayBatchParcels.end(),
+                               [&data](const std::unique_ptr<Parcel>& parcel) {
+                                   return parcel.get() == &data;
+                               });
+        if (it == mOnewayBatchParcels.end()) {
+            flushOnewayBatch();
+        } else {
+            mOnewayBatchQueuedParcels.push_back(std::move(*it));
+            mOnewayBatchParcels.erase(it);
+            if (mOnewayBatchQueued >= kMaxOnewayBatchSize) {
+                flushOnewayBatch();
+            }
+        }
+        return NO_ERROR;
+    }
+
+    if ((flags & TF_ONE_WAY) == 0 && mOnewayBatchQueued > 0) {
+        flushOnewayBatch();
+    }
+
+    const nsecs_t startNs = TransactionStats::isEnabled() ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+
     err = writeTransactionData(BC_TRANSACTION, flags, handle, code, data, nullptr);
 
     if (err != NO_ERROR) {
@@ -715,6 +777,71 @@ status_t IPCThreadState::transact(int32_t handle,
         err = waitForResponse(nullptr, nullptr);
     }
 
+    if (startNs != 0) {
+        size_t descriptorLen = 0;
+        const char16_t* descriptor = data.peekInterfaceToken(&descriptorLen);
+        TransactionStats::recordClient(mTransactionStats, descriptor, descriptorLen, code, flags,
+                                       startNs, err);
+    }
+
+    return err;
+}
+
+Parcel* IPCThreadState::obtainOnewayBatchParcel()
+{
+    if (mOnewayBatchDepth == 0) {
+        return nullptr;
+    }
+    mOnewayBatchParcels.push_back(std::make_unique<Parcel>());
+    return mOnewayBatchParcels.back().get();
+}
+
+void IPCThreadState::flushOnewayBatch()
+{
+    // The driver answers each queued transaction with exactly one
+    // BR_TRANSACTION_COMPLETE (or a failure), so after the first write all
+    // of them are usually read back by the same ioctl.
+    //
+    // Incoming transactions handled while waiting must not queue behind
+    // the batch being flushed, so batching is off until we are done.
+    const size_t queued = mOnewayBatchQueued;
+    mOnewayBatchQueued = 0;
+    const size_t depth = mOnewayBatchDepth;
+    mOnewayBatchDepth = 0;
+
+    for (size_t i = 0; i < queued; i++) {
+        const status_t err = waitForResponse(nullptr, nullptr);
+        if (err != NO_ERROR && mOnewayBatchError == NO_ERROR) {
+            mOnewayBatchError = err;
+        }
+    }
+
+    // The driver has copied the data, the queued Parcels can go.
+    mOnewayBatchQueuedParcels.clear();
+    mOnewayBatchDepth = depth;
+}
+
+IPCThreadState::OnewayBatch::OnewayBatch(IPCThreadState* state)
+    : mState(state)
+{
+    mState->mOnewayBatchDepth++;
+}
+
+IPCThreadState::OnewayBatch::~OnewayBatch()
+{
+    if (mState->mOnewayBatchDepth == 1) {
+        const status_t err = flush();
+        ALOGW_IF(err != NO_ERROR, "Unchecked error %d sending oneway batch", err);
+        mState->mOnewayBatchParcels.clear();
+    }
+    mState->mOnewayBatchDepth--;
+}
+
+status_t IPCThreadState::OnewayBatch::flush()
+{
+    mState->flushOnewayBatch();
+    const status_t err = mState->mOnewayBatchError;
+    mState->mOnewayBatchError = NO_ERROR;
     return err;
 }
 
@@ -802,12 +929,21 @@ status_t IPCThreadState::clearDeathNotification(int32_t handle, BpBinder* proxy)
 
 IPCThreadState::IPCThreadState()
     : mProcess(ProcessState::self()),
+      mParcelPoolClosed(false),
       mServingStackPointer(nullptr),
       mWorkSource(kUnsetWorkSource),
       mPropagateWorkSource(false),
       mStrictModePolicy(0),
       mLastTransactionBinderFlags(0),
-      mCallRestriction(mProcess->mCallRestriction)
+      mCallRestriction(mProcess->mCallRestriction),
+      mIsPooledThread(false),
+      mLeavingThreadPool(false),
+      mExecutingPoolCommand(false),
+      mBorrowedForDispatch(false),
+      mOnewayBatchDepth(0),
+      mOnewayBatchQueued(0),
+      mOnewayBatchError(NO_ERROR),
+      mTransactionStats(TransactionStats::attachThread())
 {
     pthread_setspecific(gTLS, this);
     clearCaller();
@@ -817,6 +953,56 @@ IPCThreadState::IPCThreadState()
 
 IPCThreadState::~IPCThreadState()
 {
+    // mIn and mOut are destroyed after this, they must free their buffers
+    // directly.
+    mParcelPoolClosed = true;
+    while (mParcelPoolStats.pooled > 0) {
+        free(mParcelPool[--mParcelPoolStats.pooled]);
+    }
+    TransactionStats::detachThread(mTransactionStats);
+}
+
+void* IPCThreadState::borrowParcelBuffer()
+{
+    if (mParcelPoolStats.pooled > 0) {
+        mParcelPoolStats.hits++;
+        return mParcelPool[--mParcelPoolStats.pooled];
+    }
+    mParcelPoolStats.misses++;
+    return malloc(kParcelPoolBufferSize);
+}
+
+bool IPCThreadState::returnParcelBuffer(void* data)
+{
+    if (mParcelPoolClosed) {
+        return false;
+    }
+    if (mParcelPoolStats.pooled >= kParcelPoolSize) {
+        mParcelPoolStats.overflows++;
+        return false;
+    }
+    mParcelPoolStats.returns++;
+    mParcelPool[mParcelPoolStats.pooled++] = data;
+    return true;
+}
+
+IPCThreadState::ParcelPoolStats IPCThreadState::getParcelPoolStats() const
+{
+    return mParcelPoolStats;
+}
+
+void IPCThreadState::dump(TextOutput& to) const
+{
+    to << "IPCThreadState " << (const void*)this << ":" << endl
+        << indent
+        << "mIn: " << mIn.dataSize() << "/" << mIn.dataCapacity() << " bytes" << endl
+        << "mOut: " << mOut.dataSize() << "/" << mOut.dataCapacity() << " bytes" << endl
+        << "Parcel pool: " << mParcelPoolStats.pooled << "/" << kParcelPoolSize
+        << " buffers of " << kParcelPoolBufferSize << " bytes, "
+        << mParcelPoolStats.hits << " hits, " << mParcelPoolStats.misses << " misses, "
+        << mParcelPoolStats.returns << " returns, " << mParcelPoolStats.overflows
+        << " overflows" << endl
+        << dedent;
 }
 
 status_t IPCThreadState::sendReply(const Parcel& reply, uint32_t flags)
@@ -1066,6 +1252,22 @@ void IPCThreadState::setTheContextObject(sp<BBinder> obj)
     the_context_object = obj;
 }
 
+bool IPCThreadState::beginDispatch(const BBinder* target, uint32_t code)
+{
+    // Only a command read by the pool loop is counted as executing, and a
+    // nested transaction must not borrow a second thread for this one.
+    const bool borrowed = mProcess->beginDispatch(target, code,
+            mExecutingPoolCommand && !mBorrowedForDispatch);
+    if (borrowed) mBorrowedForDispatch = true;
+    return borrowed;
+}
+
+void IPCThreadState::endBorrowedDispatch()
+{
+    mBorrowedForDispatch = false;
+    mProcess->endBorrowedDispatch();
+}
+
 status_t IPCThreadState::executeCommand(int32_t cmd)
 {
     BBinder* obj;
@@ -1211,15 +1413,36 @@ status_t IPCThreadState::executeCommand(int32_t cmd)
                 // safely acquire a strong reference before doing anything else with it.
                 if (reinterpret_cast<RefBase::weakref_type*>(
                         tr.target.ptr)->attemptIncStrong(this)) {
-                    error = reinterpret_cast<BBinder*>(tr.cookie)->transact(tr.code, buffer,
-                            &reply, tr.flags);
-                    reinterpret_cast<BBinder*>(tr.cookie)->decStrong(this);
+                    BBinder* target = reinterpret_cast<BBinder*>(tr.cookie);
+                    const bool borrowed = beginDispatch(target, tr.code);
+                    const nsecs_t startNs = TransactionStats::isEnabled() ?
+                            systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+                    error = target->transact(tr.code, buffer, &reply, tr.flags);
+                    if (startNs != 0) {
+                        size_t descriptorLen = 0;
+                        const char16_t* descriptor = buffer.peekInterfaceToken(&descriptorLen);
+                        TransactionStats::recordServer(mTransactionStats, descriptor,
+                                                       descriptorLen, tr.code, tr.flags, startNs,
+                                                       error);
+                    }
+                    if (borrowed) endBorrowedDispatch();
+                    target->decStrong(this);
                 } else {
                     error = UNKNOWN_TRANSACTION;
                 }
 
             } else {
+                const bool borrowed = beginDispatch(the_context_object.get(), tr.code);
+                const nsecs_t startNs = TransactionStats::isEnabled() ?
+                        systemTime(SYSTEM_TIME_MONOTONIC) : 0;
                 error = the_context_object->transact(tr.code, buffer, &reply, tr.flags);
+                if (startNs != 0) {
+                    size_t descriptorLen = 0;
+                    const char16_t* descriptor = buffer.peekInterfaceToken(&descriptorLen);
+                    TransactionStats::recordServer(mTransactionStats, descriptor, descriptorLen,
+                                                   tr.code, tr.flags, startNs, error);
+                }
+                if (borrowed) endBorrowedDispatch();
             }
 
             //ALOGI("<<<< TRANSACT from pid %d restore pid %d sid %s uid %d\n",
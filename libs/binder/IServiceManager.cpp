@@ -21,6 +21,7 @@
 #include <android/os/BnServiceCallback.h>
 #include <android/os/IServiceManager.h>
 #include <binder/IPCThreadState.h>
+#include <binder/IServiceManagerUnitTestHelper.h>
 #include <binder/Parcel.h>
 #include <utils/Log.h>
 #include <utils/String8.h>
@@ -36,6 +37,12 @@
 
 #include "Static.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+
 #include <unistd.h>
 
 namespace android {
@@ -65,6 +72,7 @@ class ServiceManagerShim : public IServiceManager
 {
 public:
     explicit ServiceManagerShim (const sp<AidlServiceManager>& impl);
+    ~ServiceManagerShim() override;
 
     sp<IBinder> getService(const String16& name) const override;
     sp<IBinder> checkService(const String16& name) const override;
@@ -82,7 +90,85 @@ public:
         return IInterface::asBinder(mTheRealServiceManager).get();
     }
 private:
+    class CacheInvalidator;
+
+    // Upper bound on cached names, and so on the notifications registered
+    // with servicemanager on behalf of the cache.
+    static constexpr size_t kMaxCachedServices = 64;
+
+    sp<IBinder> lookupCachedService(const std::string& name) const;
+    void cacheService(const std::string& name, const sp<IBinder>& binder) const;
+    void updateCachedService(const std::string& name, const sp<IBinder>& binder) const;
+    void dropCachedService(const wp<IBinder>& who) const;
+    void dropLazyService(const std::string& name) const;
+    void unregisterCacheNotifications(const std::vector<std::string>& names) const;
+    // Returns nullptr with *registered == false if servicemanager refused the
+    // notification (for instance for isolated callers), so the caller can
+    // fall back to polling.
+    sp<IBinder> waitForRegistration(const String16& name16, int64_t deadline,
+                                    bool* registered) const;
+
     sp<AidlServiceManager> mTheRealServiceManager;
+
+    // Services resolved by checkService() and getService(). Entries are
+    // dropped by death notifications and replaced by
+    // registerForNotifications() callbacks, which both need the binder thread
+    // pool, so the cache is only used once it is started. A name is only
+    // cached while its notification is registered, and the notification is
+    // unregistered when the entry is dropped.
+    //
+    // The cache holds strong references, which would keep lazy services from
+    // ever shutting down. Every notification asks servicemanager whether the
+    // service is lazy, and servicemanager notifies again once a service
+    // registers its client callback; lazy services are dropped and their
+    // names are never cached again.
+    mutable std::mutex mCacheMutex;
+    mutable std::map<std::string, sp<IBinder>> mCache;
+    mutable std::set<std::string> mCacheNotifications;
+    mutable std::set<std::string> mLazyServices;
+    sp<CacheInvalidator> mCacheInvalidator;
+};
+
+// Receives onRegistration() for every service name that is in the cache, and
+// the death notifications of the cached binders.
+class ServiceManagerShim::CacheInvalidator : public IBinder::DeathRecipient,
+                                             public android::os::BnServiceCallback {
+public:
+    explicit CacheInvalidator(const wp<ServiceManagerShim>& shim) : mShim(shim) {}
+
+    void binderDied(const wp<IBinder>& who) override {
+        if (sp<ServiceManagerShim> shim = mShim.promote()) {
+            shim->dropCachedService(who);
+        }
+    }
+
+    Status onRegistration(const std::string& name, const sp<IBinder>& binder) override {
+        if (sp<ServiceManagerShim> shim = mShim.promote()) {
+            shim->updateCachedService(name, binder);
+        }
+        return Status::ok();
+    }
+
+private:
+    const wp<ServiceManagerShim> mShim;
+};
+
+// Wakes up a thread waiting for a service to be registered.
+class ServiceWaiter : public android::os::BnServiceCallback {
+public:
+    Status onRegistration(const std::string& /*name*/, const sp<IBinder>& binder) override {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mBinder = binder;
+        lock.unlock();
+        // Flushing here helps ensure the service's ref count remains accurate
+        IPCThreadState::self()->flushCommands();
+        mCv.notify_one();
+        return Status::ok();
+    }
+
+    sp<IBinder> mBinder;
+    std::mutex mMutex;
+    std::condition_variable mCv;
 };
 
 static std::once_flag gSmOnce;
@@ -201,10 +287,210 @@ bool checkPermission(const String16& permission, pid_t pid, uid_t uid)
 
 // ----------------------------------------------------------------------
 
+sp<IServiceManager> getServiceManagerShimFromAidlServiceManagerForTests(
+        const sp<AidlServiceManager>& sm) {
+    return new ServiceManagerShim(sm);
+}
+
 ServiceManagerShim::ServiceManagerShim(const sp<AidlServiceManager>& impl)
- : mTheRealServiceManager(impl)
+ : mTheRealServiceManager(impl),
+   mCacheInvalidator(new CacheInvalidator(this))
 {}
 
+ServiceManagerShim::~ServiceManagerShim()
+{
+    std::vector<std::string> names(mCacheNotifications.begin(), mCacheNotifications.end());
+    unregisterCacheNotifications(names);
+}
+
+sp<IBinder> ServiceManagerShim::lookupCachedService(const std::string& name) const
+{
+    if (!ProcessState::self()->isThreadPoolStarted()) {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        auto it = mCache.find(name);
+        if (it == mCache.end()) {
+            return nullptr;
+        }
+        if (it->second->isBinderAlive()) {
+            return it->second;
+        }
+        mCache.erase(it);
+        mCacheNotifications.erase(name);
+    }
+
+    unregisterCacheNotifications({name});
+    return nullptr;
+}
+
+void ServiceManagerShim::cacheService(const std::string& name, const sp<IBinder>& binder) const
+{
+    if (binder == nullptr || !ProcessState::self()->isThreadPoolStarted()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        if (mCacheNotifications.count(name) != 0 || mLazyServices.count(name) != 0 ||
+                mCacheNotifications.size() >= kMaxCachedServices) {
+            return;
+        }
+        mCacheNotifications.insert(name);
+    }
+
+    // servicemanager delivers the current binder right away, which fills in
+    // the entry through updateCachedService(). Only cache if it accepts the
+    // notification: without it, a re-registration would go unnoticed.
+    if (!mTheRealServiceManager->registerForNotifications(name, mCacheInvalidator).isOk()) {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        mCache.erase(name);
+        mCacheNotifications.erase(name);
+        return;
+    }
+
+    bool added;
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        // Already dropped if the notification found the service to be lazy.
+        added = mCacheNotifications.count(name) != 0 && mCache.emplace(name, binder).second;
+    }
+    if (added && binder->remoteBinder() != nullptr &&
+            binder->linkToDeath(mCacheInvalidator) != OK) {
+        dropCachedService(binder);
+    }
+}
+
+void ServiceManagerShim::updateCachedService(const std::string& name,
+                                             const sp<IBinder>& binder) const
+{
+    if (binder == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        if (mCacheNotifications.count(name) == 0) {
+            return;
+        }
+    }
+
+    bool lazy = false;
+    if (!mTheRealServiceManager->isLazyService(name, &lazy).isOk() || lazy) {
+        dropLazyService(name);
+        return;
+    }
+
+    sp<IBinder> previous;
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        if (mCacheNotifications.count(name) == 0) {
+            return;
+        }
+        auto it = mCache.find(name);
+        if (it != mCache.end()) {
+            previous = it->second;
+            if (previous == binder) {
+                return;
+            }
+        }
+        mCache[name] = binder;
+    }
+
+    if (previous != nullptr && previous->remoteBinder() != nullptr) {
+        previous->unlinkToDeath(mCacheInvalidator);
+    }
+    if (binder->remoteBinder() != nullptr && binder->linkToDeath(mCacheInvalidator) != OK) {
+        dropCachedService(binder);
+    }
+}
+
+void ServiceManagerShim::dropCachedService(const wp<IBinder>& who) const
+{
+    std::vector<std::string> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        for (auto it = mCache.begin(); it != mCache.end();) {
+            if (who == it->second) {
+                mCacheNotifications.erase(it->first);
+                dropped.push_back(it->first);
+                it = mCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    unregisterCacheNotifications(dropped);
+}
+
+void ServiceManagerShim::dropLazyService(const std::string& name) const
+{
+    sp<IBinder> binder;
+    {
+        std::lock_guard<std::mutex> lock(mCacheMutex);
+        if (mCacheNotifications.erase(name) == 0) {
+            return;
+        }
+        if (mLazyServices.size() < kMaxCachedServices) {
+            mLazyServices.insert(name);
+        }
+        auto it = mCache.find(name);
+        if (it != mCache.end()) {
+            binder = it->second;
+            mCache.erase(it);
+        }
+    }
+
+    if (binder != nullptr && binder->remoteBinder() != nullptr) {
+        binder->unlinkToDeath(mCacheInvalidator);
+    }
+    unregisterCacheNotifications({name});
+}
+
+void ServiceManagerShim::unregisterCacheNotifications(const std::vector<std::string>& names) const
+{
+    for (const std::string& name : names) {
+        mTheRealServiceManager->unregisterForNotifications(name, mCacheInvalidator);
+    }
+}
+
+sp<IBinder> ServiceManagerShim::waitForRegistration(const String16& name16,
+                                                    int64_t deadline, bool* registered) const
+{
+    const std::string name = String8(name16).c_str();
+
+    sp<ServiceWaiter> waiter = new ServiceWaiter;
+    *registered = mTheRealServiceManager->registerForNotifications(name, waiter).isOk();
+    if (!*registered) {
+        return nullptr;
+    }
+
+    sp<IBinder> out;
+    int64_t now;
+    while (out == nullptr && (now = uptimeMillis()) < deadline) {
+        ALOGI("Waiting for service '%s' on '%s'...", name.c_str(),
+            ProcessState::self()->getDriverName().c_str());
+        std::unique_lock<std::mutex> lock(waiter->mMutex);
+        waiter->mCv.wait_for(lock, std::chrono::milliseconds(std::min<int64_t>(deadline - now, 1000)),
+                             [&] { return waiter->mBinder != nullptr; });
+        out = waiter->mBinder;
+        lock.unlock();
+
+        if (out != nullptr) {
+            cacheService(name, out);
+        } else {
+            // A registration racing with registerForNotifications() may not
+            // be reported, so check again every second.
+            out = checkService(name16);
+        }
+    }
+
+    mTheRealServiceManager->unregisterForNotifications(name, waiter);
+    return out;
+}
+
 sp<IBinder> ServiceManagerShim::getService(const String16& name) const
 {
     static bool gSystemBootCompleted = false;
@@ -225,6 +511,18 @@ sp<IBinder> ServiceManagerShim::getService(const String16& name) const
         gSystemBootCompleted = true;
 #endif
     }
+    // With a thread pool, wait for the registration callback instead of
+    // polling. Callers that can't register for notifications still poll.
+    if (ProcessState::self()->isThreadPoolStarted()) {
+        bool registered;
+        svc = waitForRegistration(name, timeout, &registered);
+        if (svc != nullptr) return svc;
+        if (registered) {
+            ALOGW("Service %s didn't start. Returning NULL", String8(name).string());
+            return nullptr;
+        }
+    }
+
     // retry interval in millisecond; note that vendor services stay at 100ms
     const long sleepTime = gSystemBootCompleted ? 1000 : 100;
 
@@ -242,12 +540,17 @@ sp<IBinder> ServiceManagerShim::getService(const String16& name) const
     return nullptr;
 }
 
-sp<IBinder> ServiceManagerShim::checkService(const String16& name) const
+sp<IBinder> ServiceManagerShim::checkService(const String16& name16) const
 {
-    sp<IBinder> ret;
-    if (!mTheRealServiceManager->checkService(String8(name).c_str(), &ret).isOk()) {
+    const std::string name = String8(name16).c_str();
+
+    sp<IBinder> ret = lookupCachedService(name);
+    if (ret != nullptr) return ret;
+
+    if (!mTheRealServiceManager->checkService(name, &ret).isOk()) {
         return nullptr;
     }
+    cacheService(name, ret);
     return ret;
 }
 
@@ -276,23 +579,6 @@ Vector<String16> ServiceManagerShim::listServices(int dumpsysPriority)
 
 sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
 {
-    class Waiter : public android::os::BnServiceCallback {
-        Status onRegistration(const std::string& /*name*/,
-                              const sp<IBinder>& binder) override {
-            std::unique_lock<std::mutex> lock(mMutex);
-            mBinder = binder;
-            lock.unlock();
-            // Flushing here helps ensure the service's ref count remains accurate
-            IPCThreadState::self()->flushCommands();
-            mCv.notify_one();
-            return Status::ok();
-        }
-    public:
-        sp<IBinder> mBinder;
-        std::mutex mMutex;
-        std::condition_variable mCv;
-    };
-
     // Simple RAII object to ensure a function call immediately before going out of scope
     class Defer {
     public:
@@ -310,7 +596,7 @@ sp<IBinder> ServiceManagerShim::waitForService(const String16& name16)
     }
     if (out != nullptr) return out;
 
-    sp<Waiter> waiter = new Waiter;
+    sp<ServiceWaiter> waiter = new ServiceWaiter;
     if (!mTheRealServiceManager->registerForNotifications(
             name, waiter).isOk()) {
         return nullptr;
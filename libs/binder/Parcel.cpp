@@ -524,6 +524,35 @@ status_t Parcel::writeInterfaceToken(const String16& interface)
     return writeString16(interface);
 }
 
+const char16_t* Parcel::peekInterfaceToken(size_t* outLen) const
+{
+    // writeInterfaceToken() puts the header and the descriptor's length
+    // right after the strict mode policy and the work source, followed by
+    // the NUL-terminated string. Read them in place so the data position
+    // isn't touched.
+    const size_t headerPos = mRequestHeaderPresent
+            ? mWorkSourceRequestHeaderPosition + sizeof(int32_t)
+            : 2 * sizeof(int32_t);
+    const size_t stringPos = headerPos + 2 * sizeof(int32_t);
+    if (stringPos > mDataSize) {
+        return nullptr;
+    }
+    int32_t header;
+    int32_t len;
+    memcpy(&header, mData + headerPos, sizeof(header));
+    memcpy(&len, mData + headerPos + sizeof(header), sizeof(len));
+    if (header != kHeader || len < 0 ||
+            static_cast<size_t>(len) >= (mDataSize - stringPos) / sizeof(char16_t)) {
+        return nullptr;
+    }
+    const char16_t* interface = reinterpret_cast<const char16_t*>(mData + stringPos);
+    if (interface[len] != 0) {
+        return nullptr;
+    }
+    *outLen = static_cast<size_t>(len);
+    return interface;
+}
+
 bool Parcel::replaceCallingWorkSourceUid(uid_t uid)
 {
     if (!mRequestHeaderPresent) {
@@ -768,12 +797,35 @@ status_t Parcel::writeByteVectorInternal(const int8_t* data, size_t size) {
         return BAD_VALUE;
     }
 
-    status_t status = writeInt32(size);
-    if (status != OK) {
-        return status;
+    // Reserve the size prefix and the payload together, so the buffer grows
+    // (and is copied) at most once.
+    uint8_t* out = reinterpret_cast<uint8_t*>(writeInplace(sizeof(int32_t) + size));
+    if (out == nullptr) {
+        return NO_MEMORY;
+    }
+    const int32_t count = static_cast<int32_t>(size);
+    memcpy(out, &count, sizeof(count));
+    if (size > 0) {
+        memcpy(out + sizeof(count), data, size);
     }
+    return NO_ERROR;
+}
 
-    return write(data, size);
+status_t Parcel::writeCharVectorInternal(const char16_t* data, size_t size) {
+    if (size > std::numeric_limits<int32_t>::max() / sizeof(int32_t)) {
+        return BAD_VALUE;
+    }
+
+    // Each char16_t is widened to an int32_t, matching writeChar().
+    int32_t* out = reinterpret_cast<int32_t*>(writeInplace((size + 1) * sizeof(int32_t)));
+    if (out == nullptr) {
+        return NO_MEMORY;
+    }
+    out[0] = static_cast<int32_t>(size);
+    for (size_t i = 0; i < size; i++) {
+        out[i + 1] = static_cast<int32_t>(data[i]);
+    }
+    return NO_ERROR;
 }
 
 status_t Parcel::writeByteVector(const std::vector<int8_t>& val) {
@@ -810,77 +862,87 @@ status_t Parcel::writeByteVector(const std::unique_ptr<std::vector<uint8_t>>& va
 
 status_t Parcel::writeInt32Vector(const std::vector<int32_t>& val)
 {
-    return writeTypedVector(val, &Parcel::writeInt32);
+    return writeTrivialVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeInt32Vector(const std::optional<std::vector<int32_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeInt32);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeInt32Vector(const std::unique_ptr<std::vector<int32_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeInt32);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeInt64Vector(const std::vector<int64_t>& val)
 {
-    return writeTypedVector(val, &Parcel::writeInt64);
+    return writeTrivialVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeInt64Vector(const std::optional<std::vector<int64_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeInt64);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeInt64Vector(const std::unique_ptr<std::vector<int64_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeInt64);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeUint64Vector(const std::vector<uint64_t>& val)
 {
-    return writeTypedVector(val, &Parcel::writeUint64);
+    return writeTrivialVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeUint64Vector(const std::optional<std::vector<uint64_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeUint64);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeUint64Vector(const std::unique_ptr<std::vector<uint64_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeUint64);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeFloatVector(const std::vector<float>& val)
 {
-    return writeTypedVector(val, &Parcel::writeFloat);
+    return writeTrivialVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeFloatVector(const std::optional<std::vector<float>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeFloat);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeFloatVector(const std::unique_ptr<std::vector<float>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeFloat);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeDoubleVector(const std::vector<double>& val)
 {
-    return writeTypedVector(val, &Parcel::writeDouble);
+    return writeTrivialVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeDoubleVector(const std::optional<std::vector<double>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeDouble);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeDoubleVector(const std::unique_ptr<std::vector<double>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeDouble);
+    if (!val) return writeInt32(-1);
+    return writeTrivialVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeBoolVector(const std::vector<bool>& val)
@@ -900,17 +962,19 @@ status_t Parcel::writeBoolVector(const std::unique_ptr<std::vector<bool>>& val)
 
 status_t Parcel::writeCharVector(const std::vector<char16_t>& val)
 {
-    return writeTypedVector(val, &Parcel::writeChar);
+    return writeCharVectorInternal(val.data(), val.size());
 }
 
 status_t Parcel::writeCharVector(const std::optional<std::vector<char16_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeChar);
+    if (!val) return writeInt32(-1);
+    return writeCharVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeCharVector(const std::unique_ptr<std::vector<char16_t>>& val)
 {
-    return writeNullableTypedVector(val, &Parcel::writeChar);
+    if (!val) return writeInt32(-1);
+    return writeCharVectorInternal(val->data(), val->size());
 }
 
 status_t Parcel::writeString16Vector(const std::vector<String16>& val)
@@ -1242,13 +1306,14 @@ status_t Parcel::writeBlob(size_t len, bool mutableCopy, WritableBlob* outBlob)
     status_t status;
     if (!mAllowFds || len <= BLOB_INPLACE_LIMIT) {
         ALOGV("writeBlob: write in place");
-        status = writeInt32(BLOB_INPLACE);
-        if (status) return status;
-
-        void* ptr = writeInplace(len);
+        // The type and the payload are reserved together, as in
+        // writeByteVector().
+        uint8_t* ptr = reinterpret_cast<uint8_t*>(writeInplace(sizeof(int32_t) + len));
         if (!ptr) return NO_MEMORY;
 
-        outBlob->init(-1, ptr, len, false);
+        const int32_t type = BLOB_INPLACE;
+        memcpy(ptr, &type, sizeof(type));
+        outBlob->init(-1, ptr + sizeof(type), len, false);
         return NO_ERROR;
     }
 
@@ -1546,6 +1611,22 @@ restart_write:
     return err;
 }
 
+status_t Parcel::readCharVectorInternal(std::vector<char16_t>* val) const {
+    const void* bytes;
+    size_t size;
+    status_t status = readTrivialVectorView<int32_t>(&bytes, &size);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    // Narrow each int32_t back to a char16_t, matching readChar().
+    const int32_t* data = static_cast<const int32_t*>(bytes);
+    val->resize(size);
+    for (size_t i = 0; i < size; i++) {
+        (*val)[i] = static_cast<char16_t>(data[i]);
+    }
+    return NO_ERROR;
+}
+
 status_t Parcel::readByteVector(std::vector<int8_t>* val) const {
     size_t size;
     if (status_t status = reserveOutVector(val, &size); status != OK) return status;
@@ -1603,63 +1684,100 @@ status_t Parcel::readByteVector(std::unique_ptr<std::vector<uint8_t>>* val) cons
 }
 
 status_t Parcel::readInt32Vector(std::optional<std::vector<int32_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readInt32);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<int32_t>);
 }
 
 status_t Parcel::readInt32Vector(std::unique_ptr<std::vector<int32_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readInt32);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<int32_t>);
 }
 
 status_t Parcel::readInt32Vector(std::vector<int32_t>* val) const {
-    return readTypedVector(val, &Parcel::readInt32);
+    return readTrivialVectorInternal(val);
+}
+
+status_t Parcel::readInt32VectorView(const int32_t** data, size_t* size) const {
+    // 4-byte elements are always aligned in the parcel.
+    const void* bytes;
+    status_t status = readTrivialVectorView<int32_t>(&bytes, size);
+    if (status == NO_ERROR) *data = static_cast<const int32_t*>(bytes);
+    return status;
 }
 
 status_t Parcel::readInt64Vector(std::optional<std::vector<int64_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readInt64);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<int64_t>);
 }
 
 status_t Parcel::readInt64Vector(std::unique_ptr<std::vector<int64_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readInt64);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<int64_t>);
 }
 
 status_t Parcel::readInt64Vector(std::vector<int64_t>* val) const {
-    return readTypedVector(val, &Parcel::readInt64);
+    return readTrivialVectorInternal(val);
+}
+
+status_t Parcel::readInt64VectorView(const uint8_t** data, size_t* size) const {
+    const void* bytes;
+    status_t status = readTrivialVectorView<int64_t>(&bytes, size);
+    if (status == NO_ERROR) *data = static_cast<const uint8_t*>(bytes);
+    return status;
 }
 
 status_t Parcel::readUint64Vector(std::optional<std::vector<uint64_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readUint64);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<uint64_t>);
 }
 
 status_t Parcel::readUint64Vector(std::unique_ptr<std::vector<uint64_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readUint64);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<uint64_t>);
 }
 
 status_t Parcel::readUint64Vector(std::vector<uint64_t>* val) const {
-    return readTypedVector(val, &Parcel::readUint64);
+    return readTrivialVectorInternal(val);
+}
+
+status_t Parcel::readUint64VectorView(const uint8_t** data, size_t* size) const {
+    const void* bytes;
+    status_t status = readTrivialVectorView<uint64_t>(&bytes, size);
+    if (status == NO_ERROR) *data = static_cast<const uint8_t*>(bytes);
+    return status;
 }
 
 status_t Parcel::readFloatVector(std::optional<std::vector<float>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readFloat);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<float>);
 }
 
 status_t Parcel::readFloatVector(std::unique_ptr<std::vector<float>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readFloat);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<float>);
 }
 
 status_t Parcel::readFloatVector(std::vector<float>* val) const {
-    return readTypedVector(val, &Parcel::readFloat);
+    return readTrivialVectorInternal(val);
+}
+
+status_t Parcel::readFloatVectorView(const float** data, size_t* size) const {
+    // 4-byte elements are always aligned in the parcel.
+    const void* bytes;
+    status_t status = readTrivialVectorView<float>(&bytes, size);
+    if (status == NO_ERROR) *data = static_cast<const float*>(bytes);
+    return status;
 }
 
 status_t Parcel::readDoubleVector(std::optional<std::vector<double>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readDouble);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<double>);
 }
 
 status_t Parcel::readDoubleVector(std::unique_ptr<std::vector<double>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readDouble);
+    return readNullableVector(val, &Parcel::readTrivialVectorInternal<double>);
 }
 
 status_t Parcel::readDoubleVector(std::vector<double>* val) const {
-    return readTypedVector(val, &Parcel::readDouble);
+    return readTrivialVectorInternal(val);
+}
+
+status_t Parcel::readDoubleVectorView(const uint8_t** data, size_t* size) const {
+    const void* bytes;
+    status_t status = readTrivialVectorView<double>(&bytes, size);
+    if (status == NO_ERROR) *data = static_cast<const uint8_t*>(bytes);
+    return status;
 }
 
 status_t Parcel::readBoolVector(std::optional<std::vector<bool>>* val) const {
@@ -1737,15 +1855,15 @@ status_t Parcel::readBoolVector(std::vector<bool>* val) const {
 }
 
 status_t Parcel::readCharVector(std::optional<std::vector<char16_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readChar);
+    return readNullableVector(val, &Parcel::readCharVectorInternal);
 }
 
 status_t Parcel::readCharVector(std::unique_ptr<std::vector<char16_t>>* val) const {
-    return readNullableTypedVector(val, &Parcel::readChar);
+    return readNullableVector(val, &Parcel::readCharVectorInternal);
 }
 
 status_t Parcel::readCharVector(std::vector<char16_t>* val) const {
-    return readTypedVector(val, &Parcel::readChar);
+    return readCharVectorInternal(val);
 }
 
 status_t Parcel::readString16Vector(
@@ -2592,12 +2710,38 @@ void Parcel::freeDataNoInit()
               gParcelGlobalAllocCount--;
             }
             pthread_mutex_unlock(&gParcelGlobalAllocSizeLock);
-            free(mData);
+            freeDataBuffer(mData, mDataCapacity);
         }
         if (mObjects) free(mObjects);
     }
 }
 
+uint8_t* Parcel::allocDataBuffer(size_t* capacity)
+{
+    if (*capacity <= IPCThreadState::kParcelPoolBufferSize) {
+        IPCThreadState* threadState = IPCThreadState::selfOrNull();
+        if (threadState) {
+            uint8_t* data = (uint8_t*)threadState->borrowParcelBuffer();
+            if (data) {
+                *capacity = IPCThreadState::kParcelPoolBufferSize;
+            }
+            return data;
+        }
+    }
+    return (uint8_t*)malloc(*capacity);
+}
+
+void Parcel::freeDataBuffer(uint8_t* data, size_t capacity)
+{
+    if (capacity == IPCThreadState::kParcelPoolBufferSize) {
+        IPCThreadState* threadState = IPCThreadState::selfOrNull();
+        if (threadState && threadState->returnParcelBuffer(data)) {
+            return;
+        }
+    }
+    free(data);
+}
+
 status_t Parcel::growData(size_t len)
 {
     if (len > INT32_MAX) {
@@ -2625,7 +2769,7 @@ status_t Parcel::restartWrite(size_t desired)
         return continueWrite(desired);
     }
 
-    uint8_t* data = (uint8_t*)realloc(mData, desired);
+    uint8_t* data = mData ? (uint8_t*)realloc(mData, desired) : allocDataBuffer(&desired);
     if (!data && desired > mDataCapacity) {
         mError = NO_MEMORY;
         return NO_MEMORY;
@@ -2803,7 +2947,7 @@ status_t Parcel::continueWrite(size_t desired)
 
     } else {
         // This is the first data.  Easy!
-        uint8_t* data = (uint8_t*)malloc(desired);
+        uint8_t* data = allocDataBuffer(&desired);
         if (!data) {
             mError = NO_MEMORY;
             return NO_MEMORY;
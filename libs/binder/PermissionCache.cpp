@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
 #include <binder/PermissionCache.h>
@@ -31,47 +32,182 @@ ANDROID_SINGLETON_STATIC_INSTANCE(PermissionCache) ;
 
 // ----------------------------------------------------------------------------
 
-PermissionCache::PermissionCache() {
+// A reader gives up and treats the lookup as a miss after this many
+// concurrent writes; the caller then simply asks the permission controller.
+static constexpr int kMaxReadRetries = 4;
+
+static inline uint64_t mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
+static inline uint64_t makeKey(uid_t uid, uint32_t id) {
+    return (uint64_t(uid) << 32) | id;
+}
+
+static size_t hashPermission(const String16& permission) {
+    // FNV-1a
+    size_t hash = 2166136261u;
+    const char16_t* chars = permission.string();
+    for (size_t i = 0; i < permission.size(); i++) {
+        hash = (hash ^ chars[i]) * 16777619u;
+    }
+    return hash;
+}
+
+PermissionCache::PermissionCache()
+    : mPermissionCount(0) {
+    for (Shard& shard : mShards) {
+        shard.seq.store(0, std::memory_order_relaxed);
+        for (Slot& slot : shard.slots) {
+            slot.key.store(0, std::memory_order_relaxed);
+            slot.expiresAt.store(0, std::memory_order_relaxed);
+            slot.granted.store(false, std::memory_order_relaxed);
+        }
+    }
+    for (auto& index : mPermissionIndex) {
+        index.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t PermissionCache::findPermission(const String16& permission, size_t hash) const {
+    constexpr size_t mask = kMaxPermissions * 2 - 1;
+    for (size_t i = 0; i < kMaxPermissions * 2; i++) {
+        const uint32_t id = mPermissionIndex[(hash + i) & mask].load(std::memory_order_acquire);
+        if (id == 0) {
+            return 0;
+        }
+        if (mPermissionNames[id - 1] == permission) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+uint32_t PermissionCache::internPermission(const String16& permission) {
+    const size_t hash = hashPermission(permission);
+    uint32_t id = findPermission(permission, hash);
+    if (id != 0) {
+        return id;
+    }
+
+    Mutex::Autolock _l(mPermissionsLock);
+    id = findPermission(permission, hash);
+    if (id != 0 || mPermissionCount == kMaxPermissions) {
+        return id;
+    }
+    // The index is never more than half full, so there is always a free slot.
+    constexpr size_t mask = kMaxPermissions * 2 - 1;
+    size_t index = hash & mask;
+    while (mPermissionIndex[index].load(std::memory_order_relaxed) != 0) {
+        index = (index + 1) & mask;
+    }
+    mPermissionNames[mPermissionCount] = permission;
+    id = ++mPermissionCount;
+    mPermissionIndex[index].store(id, std::memory_order_release);
+    return id;
 }
 
 status_t PermissionCache::check(bool* granted,
-        const String16& permission, uid_t uid) const {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    e.name = permission;
-    e.uid  = uid;
-    ssize_t index = mCache.indexOf(e);
-    if (index >= 0) {
-        *granted = mCache.itemAt(index).granted;
-        return NO_ERROR;
+        const String16& permission, uid_t uid, nsecs_t now) const {
+    const uint32_t id = findPermission(permission, hashPermission(permission));
+    if (id == 0) {
+        return NAME_NOT_FOUND;
+    }
+    const uint64_t key = makeKey(uid, id);
+    const Shard& shard = mShards[mix(uid) % kShardCount];
+    const size_t home = mix(key);
+
+    for (int attempt = 0; attempt < kMaxReadRetries; attempt++) {
+        const uint32_t seq = shard.seq.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        status_t result = NAME_NOT_FOUND;
+        for (size_t i = 0; i < kProbeCount; i++) {
+            const Slot& slot = shard.slots[(home + i) % kShardSlots];
+            if (slot.key.load(std::memory_order_relaxed) == key) {
+                if (slot.expiresAt.load(std::memory_order_relaxed) > now) {
+                    *granted = slot.granted.load(std::memory_order_relaxed);
+                    result = NO_ERROR;
+                }
+                break;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shard.seq.load(std::memory_order_relaxed) == seq) {
+            return result;
+        }
     }
     return NAME_NOT_FOUND;
 }
 
 void PermissionCache::cache(const String16& permission,
-        uid_t uid, bool granted) {
-    Mutex::Autolock _l(mLock);
-    Entry e;
-    ssize_t index = mPermissionNamesPool.indexOf(permission);
-    if (index > 0) {
-        e.name = mPermissionNamesPool.itemAt(index);
-    } else {
-        mPermissionNamesPool.add(permission);
-        e.name = permission;
+        uid_t uid, bool granted, nsecs_t now) {
+    const uint32_t id = internPermission(permission);
+    if (id == 0) {
+        return;
     }
     // note, we don't need to store the pid, which is not actually used in
     // permission checks
-    e.uid  = uid;
-    e.granted = granted;
-    index = mCache.indexOf(e);
-    if (index < 0) {
-        mCache.add(e);
+    const uint64_t key = makeKey(uid, id);
+    Shard& shard = mShards[mix(uid) % kShardCount];
+    const size_t home = mix(key);
+
+    Mutex::Autolock _l(shard.lock);
+    // Reuse this key's slot if it has one, otherwise take the slot that
+    // expires first; empty slots have expired at time 0.
+    Slot* victim = nullptr;
+    for (size_t i = 0; i < kProbeCount; i++) {
+        Slot& slot = shard.slots[(home + i) % kShardSlots];
+        if (slot.key.load(std::memory_order_relaxed) == key) {
+            victim = &slot;
+            break;
+        }
+        if (victim == nullptr || slot.expiresAt.load(std::memory_order_relaxed) <
+                victim->expiresAt.load(std::memory_order_relaxed)) {
+            victim = &slot;
+        }
     }
+
+    const uint32_t seq = shard.seq.load(std::memory_order_relaxed);
+    shard.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    victim->key.store(key, std::memory_order_relaxed);
+    victim->expiresAt.store(now + kEntryTtlNs, std::memory_order_relaxed);
+    victim->granted.store(granted, std::memory_order_relaxed);
+    shard.seq.store(seq + 2, std::memory_order_release);
 }
 
 void PermissionCache::purge() {
-    Mutex::Autolock _l(mLock);
-    mCache.clear();
+    for (Shard& shard : mShards) {
+        Mutex::Autolock _l(shard.lock);
+        const uint32_t seq = shard.seq.load(std::memory_order_relaxed);
+        shard.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (Slot& slot : shard.slots) {
+            slot.key.store(0, std::memory_order_relaxed);
+            slot.expiresAt.store(0, std::memory_order_relaxed);
+        }
+        shard.seq.store(seq + 2, std::memory_order_release);
+    }
+}
+
+void PermissionCache::purge(uid_t uid) {
+    Shard& shard = mShards[mix(uid) % kShardCount];
+    Mutex::Autolock _l(shard.lock);
+    const uint32_t seq = shard.seq.load(std::memory_order_relaxed);
+    shard.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (Slot& slot : shard.slots) {
+        if ((slot.key.load(std::memory_order_relaxed) >> 32) == uid) {
+            slot.key.store(0, std::memory_order_relaxed);
+            slot.expiresAt.store(0, std::memory_order_relaxed);
+        }
+    }
+    shard.seq.store(seq + 2, std::memory_order_release);
 }
 
 bool PermissionCache::checkCallingPermission(const String16& permission) {
@@ -97,17 +233,24 @@ bool PermissionCache::checkPermission(
 
     PermissionCache& pc(PermissionCache::getInstance());
     bool granted = false;
-    if (pc.check(&granted, permission, uid) != NO_ERROR) {
+    if (pc.check(&granted, permission, uid, systemTime(SYSTEM_TIME_MONOTONIC)) != NO_ERROR) {
         nsecs_t t = -systemTime();
         granted = android::checkPermission(permission, pid, uid);
         t += systemTime();
         ALOGD("checking %s for uid=%d => %s (%d us)",
                 String8(permission).string(), uid,
                 granted?"granted":"denied", (int)ns2us(t));
-        pc.cache(permission, uid, granted);
+        pc.cache(permission, uid, granted, systemTime(SYSTEM_TIME_MONOTONIC));
     }
     return granted;
 }
 
+void PermissionCache::purgeUid(uid_t uid) {
+    if (!hasInstance()) {
+        return;
+    }
+    PermissionCache::getInstance().purge(uid);
+}
+
 // ---------------------------------------------------------------------------
 } // namespace android
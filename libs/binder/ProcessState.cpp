@@ -18,6 +18,7 @@
 
 #include <binder/ProcessState.h>
 
+#include <binder/Binder.h>
 #include <binder/BpBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
@@ -25,11 +26,13 @@
 #include <cutils/atomic.h>
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/SystemClock.h>
 #include <utils/threads.h>
 
 #include <private/binder/binder_module.h>
 #include "Static.h"
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -43,6 +46,13 @@
 #define BINDER_VM_SIZE ((1 * 1024 * 1024) - sysconf(_SC_PAGE_SIZE) * 2)
 #define DEFAULT_MAX_BINDER_THREADS 15
 
+// An adaptive pool grows when all threads have been busy for this long...
+static constexpr int64_t kAdaptiveGrowStarvationMs = 10;
+// ...and gives back one thread after each period without starvation.
+static constexpr int64_t kAdaptiveShrinkIdleMs = 10000;
+// Maximum number of BULK transactions that may run on borrowed threads.
+static constexpr size_t kMaxBorrowedThreads = 4;
+
 #ifdef __ANDROID_VNDK__
 const char* kDefaultDriver = "/dev/vndbinder";
 #else
@@ -132,6 +142,12 @@ void ProcessState::startThreadPool()
     }
 }
 
+bool ProcessState::isThreadPoolStarted() const
+{
+    AutoMutex _l(mLock);
+    return mThreadPoolStarted;
+}
+
 bool ProcessState::becomeContextManager(context_check_func checkFunc, void* userData)
 {
     AutoMutex _l(mLock);
@@ -330,16 +346,194 @@ void ProcessState::spawnPooledThread(bool isMain)
 status_t ProcessState::setThreadPoolMaxThreadCount(size_t maxThreads) {
     LOG_ALWAYS_FATAL_IF(mThreadPoolStarted && maxThreads < mMaxThreads,
            "Binder threadpool cannot be shrunk after starting");
-    status_t result = NO_ERROR;
-    if (ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &maxThreads) != -1) {
-        mMaxThreads = maxThreads;
+    pthread_mutex_lock(&mThreadCountLock);
+    const size_t oldMaxThreads = mMaxThreads;
+    mMaxThreads = maxThreads;
+    mAdaptiveMaxThreads = 0;
+    status_t result = updateKernelMaxThreadsLocked();
+    if (result != NO_ERROR) {
+        mMaxThreads = oldMaxThreads;
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return result;
+}
+
+status_t ProcessState::setThreadPoolAdaptive(size_t minThreads, size_t maxThreads) {
+    if (minThreads == 0 || minThreads > maxThreads) {
+        return BAD_VALUE;
+    }
+    pthread_mutex_lock(&mThreadCountLock);
+    const size_t oldMaxThreads = mMaxThreads;
+    mMaxThreads = mThreadPoolStarted ? std::clamp(mMaxThreads, minThreads, maxThreads)
+                                     : minThreads;
+    status_t result = updateKernelMaxThreadsLocked();
+    if (result == NO_ERROR) {
+        mAdaptiveMinThreads = minThreads;
+        mAdaptiveMaxThreads = maxThreads;
+        mLastPoolActivityTimeMs = uptimeMillis();
     } else {
-        result = -errno;
-        ALOGE("Binder ioctl to set max threads failed: %s", strerror(-result));
+        mMaxThreads = oldMaxThreads;
     }
+    pthread_mutex_unlock(&mThreadCountLock);
     return result;
 }
 
+void ProcessState::setInterfaceDispatchClass(const String16& descriptor,
+                                             DispatchClass dispatchClass) {
+    pthread_mutex_lock(&mThreadCountLock);
+    mDispatchClasses[descriptor] = dispatchClass;
+    mHasDispatchClasses.store(true, std::memory_order_release);
+    pthread_mutex_unlock(&mThreadCountLock);
+}
+
+ProcessState::DispatchClass ProcessState::getDispatchClass(const String16& descriptor,
+                                                           uint32_t code) {
+    pthread_mutex_lock(&mThreadCountLock);
+    const DispatchClass dispatchClass = dispatchClassForLocked(descriptor, code);
+    pthread_mutex_unlock(&mThreadCountLock);
+    return dispatchClass;
+}
+
+ProcessState::ThreadPoolStats ProcessState::getThreadPoolStats() {
+    pthread_mutex_lock(&mThreadCountLock);
+    const ThreadPoolStats stats = {
+        .maxThreads = mMaxThreads,
+        .executingThreads = mExecutingThreadsCount,
+        .borrowedThreads = mBorrowedThreadsCount,
+        .spawnedThreads = mSpawnedThreadsCount,
+    };
+    pthread_mutex_unlock(&mThreadCountLock);
+    return stats;
+}
+
+ProcessState::DispatchClass ProcessState::dispatchClassForLocked(const String16& descriptor,
+                                                                 uint32_t code) const {
+    if (code == IBinder::DUMP_TRANSACTION || code == IBinder::SHELL_COMMAND_TRANSACTION) {
+        return DispatchClass::BULK;
+    }
+    auto it = mDispatchClasses.find(descriptor);
+    return it != mDispatchClasses.end() ? it->second : DispatchClass::NORMAL;
+}
+
+bool ProcessState::beginDispatch(const BBinder* target, uint32_t code, bool canBorrow) {
+    const bool alwaysBulk =
+            code == IBinder::DUMP_TRANSACTION || code == IBinder::SHELL_COMMAND_TRANSACTION;
+    // Processes without a started pool serve everything on their own
+    // threads; the driver can't spawn threads for them.
+    if (!mThreadPoolStarted || (!alwaysBulk && (target == nullptr ||
+            !mHasDispatchClasses.load(std::memory_order_acquire)))) {
+        return false;
+    }
+    // getInterfaceDescriptor() is virtual, so don't call it under the lock.
+    const String16 descriptor = alwaysBulk ? String16() : target->getInterfaceDescriptor();
+
+    bool borrowed = false;
+    pthread_mutex_lock(&mThreadCountLock);
+    const DispatchClass dispatchClass = dispatchClassForLocked(descriptor, code);
+    if (dispatchClass == DispatchClass::BULK) {
+        // Raise the driver's limit for as long as this call runs, so it can
+        // spawn another thread for whatever queues behind it.
+        if (canBorrow && mMaxThreads > 0 && mBorrowedThreadsCount < kMaxBorrowedThreads) {
+            mBorrowedThreadsCount++;
+            borrowed = updateKernelMaxThreadsLocked() == NO_ERROR;
+            if (!borrowed) {
+                mBorrowedThreadsCount--;
+            }
+        }
+    } else if (dispatchClass == DispatchClass::LATENCY_CRITICAL &&
+            busyThreadsLocked() >= mMaxThreads) {
+        growThreadPoolLocked();
+    }
+    pthread_mutex_unlock(&mThreadCountLock);
+    return borrowed;
+}
+
+void ProcessState::endBorrowedDispatch() {
+    pthread_mutex_lock(&mThreadCountLock);
+    mBorrowedThreadsCount--;
+    updateKernelMaxThreadsLocked();
+    pthread_mutex_unlock(&mThreadCountLock);
+}
+
+void ProcessState::onPooledThreadStarted() {
+    pthread_mutex_lock(&mThreadCountLock);
+    mSpawnedThreadsCount++;
+    pthread_mutex_unlock(&mThreadCountLock);
+}
+
+void ProcessState::onPooledThreadExited() {
+    pthread_mutex_lock(&mThreadCountLock);
+    onPooledThreadExitedLocked();
+    pthread_mutex_unlock(&mThreadCountLock);
+}
+
+void ProcessState::onPooledThreadExitedLocked() {
+    mSpawnedThreadsCount--;
+    mExitedThreadsCount++;
+    updateKernelMaxThreadsLocked();
+}
+
+bool ProcessState::releasePooledThreadLocked() {
+    if (mAdaptiveMaxThreads > 0 && mMaxThreads > mAdaptiveMinThreads &&
+            mStarvationStartTimeMs == 0) {
+        const int64_t now = uptimeMillis();
+        if (now - mLastPoolActivityTimeMs >= kAdaptiveShrinkIdleMs) {
+            mMaxThreads--;
+            mLastPoolActivityTimeMs = now;
+            updateKernelMaxThreadsLocked();
+        }
+    }
+    // Threads beyond the limit are left over from a borrowed dispatch or a
+    // shrunk pool.
+    if (mSpawnedThreadsCount <= mMaxThreads + mBorrowedThreadsCount) {
+        return false;
+    }
+    onPooledThreadExitedLocked();
+    return true;
+}
+
+size_t ProcessState::busyThreadsLocked() const {
+    // A thread only borrows while it is counted as executing, and at most
+    // once, so this can't underflow.
+    return mExecutingThreadsCount - mBorrowedThreadsCount;
+}
+
+void ProcessState::onStarvationEndedLocked(int64_t starvationTimeMs) {
+    mLastPoolActivityTimeMs = uptimeMillis();
+    if (starvationTimeMs >= kAdaptiveGrowStarvationMs) {
+        growThreadPoolLocked();
+    }
+}
+
+status_t ProcessState::growThreadPoolLocked() {
+    if (mAdaptiveMaxThreads == 0 || mMaxThreads >= mAdaptiveMaxThreads || !mThreadPoolStarted) {
+        return INVALID_OPERATION;
+    }
+    mMaxThreads++;
+    status_t result = updateKernelMaxThreadsLocked();
+    if (result != NO_ERROR) {
+        mMaxThreads--;
+        return result;
+    }
+    mLastPoolActivityTimeMs = uptimeMillis();
+    ALOGV("Binder thread pool grown to %zu threads", mMaxThreads);
+    return NO_ERROR;
+}
+
+status_t ProcessState::updateKernelMaxThreadsLocked() {
+    size_t maxThreads = mMaxThreads + mBorrowedThreadsCount + mExitedThreadsCount;
+    if (maxThreads == mKernelMaxThreads) {
+        return NO_ERROR;
+    }
+    if (ioctl(mDriverFD, BINDER_SET_MAX_THREADS, &maxThreads) == -1) {
+        status_t result = -errno;
+        ALOGE("Binder ioctl to set max threads failed: %s", strerror(-result));
+        return result;
+    }
+    mKernelMaxThreads = maxThreads;
+    return NO_ERROR;
+}
+
 void ProcessState::giveThreadPoolName() {
     androidSetThreadName( makeBinderThreadName().string() );
 }
@@ -385,6 +579,14 @@ ProcessState::ProcessState(const char *driver)
     , mExecutingThreadsCount(0)
     , mMaxThreads(DEFAULT_MAX_BINDER_THREADS)
     , mStarvationStartTimeMs(0)
+    , mSpawnedThreadsCount(0)
+    , mExitedThreadsCount(0)
+    , mBorrowedThreadsCount(0)
+    , mKernelMaxThreads(DEFAULT_MAX_BINDER_THREADS)
+    , mAdaptiveMinThreads(0)
+    , mAdaptiveMaxThreads(0)
+    , mLastPoolActivityTimeMs(0)
+    , mHasDispatchClasses(false)
     , mBinderContextCheckFunc(nullptr)
     , mBinderContextUserData(nullptr)
     , mThreadPoolStarted(false)
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "TransactionStats"
+
+#include <binder/TransactionStats.h>
+
+#include <utils/Log.h>
+#include <utils/String8.h>
+
+#include <algorithm>
+#include <atomic>
+#include <inttypes.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace android {
+
+namespace {
+
+using Key = uint64_t;
+
+Key makeKey(TransactionStats::Side side, uint16_t interfaceId, uint32_t code) {
+    return (uint64_t(side) << 48) | (uint64_t(interfaceId) << 32) | code;
+}
+
+TransactionStats::Side sideOf(Key key) {
+    return TransactionStats::Side(key >> 48);
+}
+
+uint16_t interfaceIdOf(Key key) {
+    return uint16_t(key >> 32);
+}
+
+uint32_t codeOf(Key key) {
+    return uint32_t(key);
+}
+
+struct Entry {
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    uint64_t totalUs = 0;
+    uint32_t maxUs = 0;
+    uint32_t buckets[TransactionStats::kHistogramBuckets] = {};
+
+    void add(uint32_t durationUs, status_t result) {
+        const size_t bucket = durationUs == 0 ? 0 : 32 - __builtin_clz(durationUs);
+        buckets[std::min(bucket, TransactionStats::kHistogramBuckets - 1)]++;
+        count++;
+        errors += result != NO_ERROR;
+        totalUs += durationUs;
+        maxUs = std::max(maxUs, durationUs);
+    }
+
+    void merge(const Entry& other) {
+        for (size_t i = 0; i < TransactionStats::kHistogramBuckets; i++) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        errors += other.errors;
+        totalUs += other.totalUs;
+        maxUs = std::max(maxUs, other.maxUs);
+    }
+
+    // Upper bound of the bucket holding the given percentile.
+    uint32_t percentileUs(uint32_t percent) const {
+        const uint64_t rank = std::max<uint64_t>(1, (count * percent + 99) / 100);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < TransactionStats::kHistogramBuckets - 1; i++) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(uint32_t(1) << i, maxUs);
+            }
+        }
+        return maxUs;
+    }
+};
+
+struct Slot {
+    // 2n+1 while record n is being written, 2n+2 once it is complete.
+    std::atomic<uint64_t> seq{0};
+    TransactionStats::Record record;
+};
+
+struct Globals {
+    std::atomic<bool> enabled{true};
+
+    std::atomic<uint64_t> ringHead{0};
+    Slot ring[TransactionStats::kRingSize];
+
+    std::mutex lock; // protects everything below
+    // Interned descriptors, indexed by interface id. Id 0 is used for
+    // transactions without an interface token. Entries are never removed, so
+    // views of them stay valid.
+    std::vector<std::unique_ptr<std::u16string>> interfaces;
+    std::unordered_map<std::u16string_view, uint16_t> interfaceIds;
+    std::vector<TransactionStats::ThreadStats*> threads;
+    // Totals of threads that have exited.
+    std::unordered_map<Key, Entry> retired;
+
+    Globals() {
+        interfaces.push_back(std::make_unique<std::u16string>());
+    }
+};
+
+Globals& globals() {
+    // Leaked, so threads that exit during static destruction can still detach.
+    static Globals* sGlobals = new Globals();
+    return *sGlobals;
+}
+
+const char* sideName(TransactionStats::Side side) {
+    return side == TransactionStats::Side::CLIENT ? "client" : "server";
+}
+
+status_t writeFully(int fd, const String8& text) {
+    const char* data = text.string();
+    size_t left = text.size();
+    while (left > 0) {
+        const ssize_t written = TEMP_FAILURE_RETRY(write(fd, data, left));
+        if (written < 0) {
+            return -errno;
+        }
+        data += written;
+        left -= written;
+    }
+    return NO_ERROR;
+}
+
+} // namespace
+
+struct TransactionStats::ThreadStats {
+    // Held by the owning thread while it records, and by dump() while it reads.
+    std::mutex lock;
+    std::unordered_map<Key, Entry> entries;
+    // Descriptors this thread has already interned; the keys view the
+    // interned strings, so no lock is needed to look them up.
+    std::unordered_map<std::u16string_view, uint16_t> interfaceIds;
+};
+
+static uint16_t interfaceIdFor(TransactionStats::ThreadStats* stats,
+                               std::u16string_view descriptor) {
+    if (descriptor.empty()) {
+        return 0;
+    }
+    auto it = stats->interfaceIds.find(descriptor);
+    if (it != stats->interfaceIds.end()) {
+        return it->second;
+    }
+
+    Globals& g = globals();
+    std::lock_guard<std::mutex> _l(g.lock);
+    uint16_t id = 0;
+    auto interned = g.interfaceIds.find(descriptor);
+    if (interned != g.interfaceIds.end()) {
+        id = interned->second;
+    } else if (g.interfaces.size() <= UINT16_MAX) {
+        id = static_cast<uint16_t>(g.interfaces.size());
+        g.interfaces.push_back(std::make_unique<std::u16string>(descriptor));
+        g.interfaceIds.emplace(*g.interfaces.back(), id);
+    } else {
+        ALOGW("Too many interfaces, accounting %s as unknown",
+              String8(descriptor.data(), descriptor.size()).string());
+        return 0;
+    }
+    stats->interfaceIds.emplace(*g.interfaces[id], id);
+    return id;
+}
+
+static void record(TransactionStats::ThreadStats* stats, TransactionStats::Side side,
+                   std::u16string_view descriptor, uint32_t code, uint32_t flags,
+                   nsecs_t startNs, status_t result) {
+    const nsecs_t durationNs = systemTime(SYSTEM_TIME_MONOTONIC) - startNs;
+    const uint32_t durationUs =
+            static_cast<uint32_t>(std::min<nsecs_t>(durationNs / 1000, UINT32_MAX));
+    const uint16_t interfaceId = interfaceIdFor(stats, descriptor);
+
+    {
+        std::lock_guard<std::mutex> _l(stats->lock);
+        stats->entries[makeKey(side, interfaceId, code)].add(durationUs, result);
+    }
+
+    Globals& g = globals();
+    const uint64_t n = g.ringHead.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = g.ring[n % TransactionStats::kRingSize];
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.record = {startNs, durationUs, code, flags, result, interfaceId, side};
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+void TransactionStats::setEnabled(bool enabled) {
+    globals().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool TransactionStats::isEnabled() {
+    return globals().enabled.load(std::memory_order_relaxed);
+}
+
+TransactionStats::ThreadStats* TransactionStats::attachThread() {
+    ThreadStats* stats = new ThreadStats();
+    Globals& g = globals();
+    std::lock_guard<std::mutex> _l(g.lock);
+    g.threads.push_back(stats);
+    return stats;
+}
+
+void TransactionStats::detachThread(ThreadStats* stats) {
+    Globals& g = globals();
+    {
+        std::lock_guard<std::mutex> _l(g.lock);
+        g.threads.erase(std::remove(g.threads.begin(), g.threads.end(), stats), g.threads.end());
+        std::lock_guard<std::mutex> _sl(stats->lock);
+        for (const auto& [key, entry] : stats->entries) {
+            g.retired[key].merge(entry);
+        }
+    }
+    delete stats;
+}
+
+void TransactionStats::recordClient(ThreadStats* stats, const char16_t* descriptor,
+                                    size_t descriptorLen, uint32_t code, uint32_t flags,
+                                    nsecs_t startNs, status_t result) {
+    record(stats, Side::CLIENT,
+           descriptor ? std::u16string_view(descriptor, descriptorLen) : std::u16string_view(),
+           code, flags, startNs, result);
+}
+
+void TransactionStats::recordServer(ThreadStats* stats, const char16_t* descriptor,
+                                    size_t descriptorLen, uint32_t code, uint32_t flags,
+                                    nsecs_t startNs, status_t result) {
+    record(stats, Side::SERVER,
+           descriptor ? std::u16string_view(descriptor, descriptorLen) : std::u16string_view(),
+           code, flags, startNs, result);
+}
+
+size_t TransactionStats::exportRecent(std::vector<Record>* out) {
+    Globals& g = globals();
+    const uint64_t head = g.ringHead.load(std::memory_order_acquire);
+    const uint64_t first = head > kRingSize ? head - kRingSize : 0;
+    size_t copied = 0;
+    for (uint64_t n = first; n < head; n++) {
+        const Slot& slot = g.ring[n % kRingSize];
+        // Skip records that are still being written or were overwritten
+        // while we copied them.
+        if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2) {
+            continue;
+        }
+        const Record record = slot.record;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != 2 * n + 2) {
+            continue;
+        }
+        out->push_back(record);
+        copied++;
+    }
+    return copied;
+}
+
+String16 TransactionStats::interfaceName(uint16_t interfaceId) {
+    Globals& g = globals();
+    std::lock_guard<std::mutex> _l(g.lock);
+    if (interfaceId >= g.interfaces.size()) {
+        return String16();
+    }
+    const std::u16string& name = *g.interfaces[interfaceId];
+    return String16(name.data(), name.size());
+}
+
+status_t TransactionStats::dump(int fd) {
+    std::unordered_map<Key, Entry> totals;
+    std::vector<String8> names;
+    {
+        Globals& g = globals();
+        std::lock_guard<std::mutex> _l(g.lock);
+        totals = g.retired;
+        for (ThreadStats* stats : g.threads) {
+            std::lock_guard<std::mutex> _sl(stats->lock);
+            for (const auto& [key, entry] : stats->entries) {
+                totals[key].merge(entry);
+            }
+        }
+        names.reserve(g.interfaces.size());
+        for (const auto& name : g.interfaces) {
+            names.emplace_back(name->data(), name->size());
+        }
+    }
+
+    std::vector<std::pair<Key, const Entry*>> sorted;
+    sorted.reserve(totals.size());
+    for (const auto& [key, entry] : totals) {
+        sorted.emplace_back(key, &entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+        return a.second->totalUs > b.second->totalUs;
+    });
+
+    String8 out;
+    out.appendFormat("Binder transactions of pid %d%s, by total time:\n", getpid(),
+                     isEnabled() ? "" : " (accounting disabled)");
+    out.append("  side      count   errors    total_ms   mean_us    p50_us    p90_us    p99_us"
+               "    max_us  interface:code\n");
+    for (const auto& [key, entry] : sorted) {
+        const uint16_t interfaceId = interfaceIdOf(key);
+        out.appendFormat("  %-6s %9" PRIu64 " %8" PRIu64 " %11.1f %9" PRIu64
+                         " %9u %9u %9u %9u  %s:%u\n",
+                         sideName(sideOf(key)), entry->count, entry->errors,
+                         entry->totalUs / 1000.0, entry->totalUs / entry->count,
+                         entry->percentileUs(50), entry->percentileUs(90),
+                         entry->percentileUs(99), entry->maxUs,
+                         interfaceId == 0 ? "<none>" : names[interfaceId].string(),
+                         codeOf(key));
+    }
+    return writeFully(fd, out);
+}
+
+status_t TransactionStats::dumpRecent(int fd) {
+    std::vector<Record> records;
+    records.reserve(kRingSize);
+    exportRecent(&records);
+
+    String8 out;
+    out.appendFormat("Last %zu binder transactions of pid %d:\n", records.size(), getpid());
+    out.append("  start_ns         side    duration_us  flags  result  interface:code\n");
+    for (const Record& record : records) {
+        const String8 name(interfaceName(record.interfaceId));
+        out.appendFormat("  %-16" PRId64 " %-6s %12u  0x%02x  %6d  %s:%u\n", record.startNs,
+                         sideName(record.side), record.durationUs, record.flags, record.result,
+                         record.interfaceId == 0 ? "<none>" : name.string(), record.code);
+    }
+    return writeFully(fd, out);
+}
+
+} // namespace android
@@ -60,6 +60,9 @@ public:
         SYSPROPS_TRANSACTION    = B_PACK_CHARS('_', 'S', 'P', 'R'),
         EXTENSION_TRANSACTION   = B_PACK_CHARS('_', 'E', 'X', 'T'),
         DEBUG_PID_TRANSACTION   = B_PACK_CHARS('_', 'P', 'I', 'D'),
+        // Writes the process's TransactionStats to a file descriptor; used
+        // by dumpsys --binder-stats and --binder-trace.
+        DEBUG_STATS_TRANSACTION = B_PACK_CHARS('_', 'S', 'T', 'T'),
 
         // Corresponds to TF_ONE_WAY -- an asynchronous call.
         FLAG_ONEWAY             = 0x00000001,
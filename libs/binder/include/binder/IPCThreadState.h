@@ -20,8 +20,12 @@
 #include <utils/Errors.h>
 #include <binder/Parcel.h>
 #include <binder/ProcessState.h>
+#include <binder/TransactionStats.h>
 #include <utils/Vector.h>
 
+#include <memory>
+#include <vector>
+
 #if defined(_WIN32)
 typedef  int  uid_t;
 #endif
@@ -29,6 +33,8 @@ typedef  int  uid_t;
 // ---------------------------------------------------------------------------
 namespace android {
 
+class TextOutput;
+
 class IPCThreadState
 {
 public:
@@ -99,6 +105,36 @@ public:
                                          uint32_t code, const Parcel& data,
                                          Parcel* reply, uint32_t flags);
 
+            // While an OnewayBatch is alive on this thread, oneway
+            // transactions written into Parcels from
+            // obtainOnewayBatchParcel() are only queued, and are sent to the
+            // driver together, with a single BINDER_WRITE_READ, when the
+            // outermost batch is destroyed or flushed.  Any other oneway
+            // transaction is sent right away along with what was queued.
+            // transact() returns NO_ERROR for these calls; delivery errors
+            // are only reported by flush().  A two-way transaction flushes
+            // the batch first so ordering is preserved.
+            class OnewayBatch {
+            public:
+                explicit OnewayBatch(IPCThreadState* state = IPCThreadState::self());
+                ~OnewayBatch();
+
+                status_t flush();
+
+            private:
+                OnewayBatch(const OnewayBatch&) = delete;
+                OnewayBatch& operator=(const OnewayBatch&) = delete;
+
+                IPCThreadState* const mState;
+            };
+
+            // Returns a Parcel to write a oneway transaction into, owned by
+            // the current OnewayBatch, or null if there is none.  Passing it
+            // to transact() queues the transaction without copying it.  The
+            // Parcel is freed once that transaction has been sent, or when
+            // the outermost batch ends.
+            Parcel*             obtainOnewayBatchParcel();
+
             void                incStrongHandle(int32_t handle, BpBinder *proxy);
             void                decStrongHandle(int32_t handle);
             void                incWeakHandle(int32_t handle, BpBinder *proxy);
@@ -141,7 +177,29 @@ public:
             // side.
             static const int32_t kUnsetWorkSource = -1;
 
+            // Parcels written on a thread that has an IPCThreadState take
+            // their first buffer from a small per-thread pool, and give it
+            // back when they are freed, so the common small transaction
+            // (including the data and reply Parcels of AIDL proxies) does
+            // not go through malloc/free.
+            static constexpr size_t kParcelPoolSize = 8;
+            static constexpr size_t kParcelPoolBufferSize = 1024;
+
+            struct ParcelPoolStats {
+                size_t pooled = 0;      // buffers currently in the pool
+                size_t hits = 0;        // borrows served from the pool
+                size_t misses = 0;      // borrows that had to allocate
+                size_t returns = 0;     // buffers given back to the pool
+                size_t overflows = 0;   // buffers freed because the pool was full
+            };
+            ParcelPoolStats     getParcelPoolStats() const;
+
+            // Prints the state of this thread, for debugging.
+            void                dump(TextOutput& to) const;
+
 private:
+    friend class Parcel;
+
                                 IPCThreadState();
                                 ~IPCThreadState();
 
@@ -157,11 +215,18 @@ private:
                                                      status_t* statusBuffer);
             status_t            getAndExecuteCommand();
             status_t            executeCommand(int32_t command);
+            bool                beginDispatch(const BBinder* target, uint32_t code);
+            void                endBorrowedDispatch();
             void                processPendingDerefs();
             void                processPostWriteDerefs();
 
             void                clearCaller();
 
+            void                flushOnewayBatch();
+
+            void*               borrowParcelBuffer();
+            bool                returnParcelBuffer(void* data);
+
     static  void                threadDestructor(void *st);
     static  void                freeBuffer(Parcel* parcel,
                                            const uint8_t* data, size_t dataSize,
@@ -173,6 +238,10 @@ private:
             Vector<RefBase::weakref_type*> mPendingWeakDerefs;
             Vector<RefBase*>    mPostWriteStrongDerefs;
             Vector<RefBase::weakref_type*> mPostWriteWeakDerefs;
+            // Declared before mIn/mOut so it outlives them.
+            void*               mParcelPool[kParcelPoolSize];
+            ParcelPoolStats     mParcelPoolStats;
+            bool                mParcelPoolClosed;
             Parcel              mIn;
             Parcel              mOut;
             status_t            mLastError;
@@ -189,6 +258,27 @@ private:
             int32_t             mLastTransactionBinderFlags;
 
             ProcessState::CallRestriction mCallRestriction;
+
+            // Thread pool state of this thread: whether it is a pooled
+            // (non-main) thread, whether it has to leave the pool, whether
+            // it is counted in mExecutingThreadsCount, and whether it is
+            // running a BULK transaction on a borrowed thread.
+            bool                mIsPooledThread;
+            bool                mLeavingThreadPool;
+            bool                mExecutingPoolCommand;
+            bool                mBorrowedForDispatch;
+
+            // Oneway transactions queued in mOut by OnewayBatch.  Queued
+            // Parcels are kept until the driver has consumed them, Parcels
+            // handed out but not sent yet until the outermost batch ends.
+            // The first delivery error is kept for OnewayBatch::flush().
+            size_t              mOnewayBatchDepth;
+            size_t              mOnewayBatchQueued;
+            status_t            mOnewayBatchError;
+            std::vector<std::unique_ptr<Parcel>> mOnewayBatchParcels;
+            std::vector<std::unique_ptr<Parcel>> mOnewayBatchQueuedParcels;
+
+            TransactionStats::ThreadStats* mTransactionStats;
 };
 
 } // namespace android
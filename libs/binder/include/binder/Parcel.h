@@ -111,6 +111,7 @@ public:
     status_t            write(const void* data, size_t len);
     void*               writeInplace(size_t len);
     status_t            writeUnpadded(const void* data, size_t len);
+
     status_t            writeInt32(int32_t val);
     status_t            writeUint32(uint32_t val);
     status_t            writeInt64(int64_t val);
@@ -390,6 +391,18 @@ public:
     status_t            readCharVector(std::optional<std::vector<char16_t>>* val) const;
     status_t            readCharVector(std::unique_ptr<std::vector<char16_t>>* val) const;
     status_t            readCharVector(std::vector<char16_t>* val) const;
+
+    // Zero-copy variants of the primitive vector readers. On success |*data|
+    // points at |*size| elements inside this parcel's buffer and is valid
+    // only until the parcel is next modified or freed. A null vector returns
+    // UNEXPECTED_NULL. The parcel only guarantees 4-byte alignment, so 64-bit
+    // elements are returned as raw bytes (|*size| * 8 of them) to be copied
+    // out with memcpy().
+    status_t            readInt32VectorView(const int32_t** data, size_t* size) const;
+    status_t            readInt64VectorView(const uint8_t** data, size_t* size) const;
+    status_t            readUint64VectorView(const uint8_t** data, size_t* size) const;
+    status_t            readFloatVectorView(const float** data, size_t* size) const;
+    status_t            readDoubleVectorView(const uint8_t** data, size_t* size) const;
     status_t            readString16Vector(
                             std::optional<std::vector<std::optional<String16>>>* val) const;
     status_t            readString16Vector(
@@ -509,10 +522,17 @@ private:
     status_t            readPointer(uintptr_t *pArg) const;
     uintptr_t           readPointer() const;
     void                freeDataNoInit();
+    static uint8_t*     allocDataBuffer(size_t* capacity);
+    static void         freeDataBuffer(uint8_t* data, size_t capacity);
     void                initState();
     void                scanForFds() const;
     status_t            validateReadData(size_t len) const;
     void                updateWorkSourceRequestHeaderPosition() const;
+    // Returns the interface descriptor written by writeInterfaceToken(),
+    // or nullptr if there is none. Parcels that were not written locally,
+    // like incoming transactions, are expected to start with the token.
+    // The data position is left unchanged.
+    const char16_t*     peekInterfaceToken(size_t* outLen) const;
 
     status_t            finishFlattenBinder(const sp<IBinder>& binder,
                                             const flat_binder_object& flat);
@@ -545,6 +565,22 @@ private:
     template<typename T>
     status_t readByteVectorInternal(std::vector<T>* val, size_t size) const;
 
+    // Bulk paths for vectors whose elements are written at their natural,
+    // 4-byte padded size. The size prefix and the payload are reserved with
+    // a single writeInplace() and copied with memcpy().
+    template<typename T>
+    status_t writeTrivialVectorInternal(const T* data, size_t size);
+    template<typename T>
+    status_t readTrivialVectorView(const void** data, size_t* size) const;
+    template<typename T>
+    status_t readTrivialVectorInternal(std::vector<T>* val) const;
+    // Reads a vector written with a size of -1 for null into |val|, a
+    // std::optional or std::unique_ptr of std::vector, with |read_func|.
+    template<typename T, typename U>
+    status_t readNullableVector(T* val, status_t(Parcel::*read_func)(U*) const) const;
+    status_t writeCharVectorInternal(const char16_t* data, size_t size);
+    status_t readCharVectorInternal(std::vector<char16_t>* val) const;
+
     template<typename T, typename U>
     status_t            unsafeReadTypedVector(std::vector<T>* val,
                                               status_t(Parcel::*read_func)(U*) const) const;
@@ -1273,6 +1309,88 @@ inline status_t Parcel::readByteVectorInternal(std::vector<T>* val, size_t size)
   return NO_ERROR;
 }
 
+template<typename T>
+status_t Parcel::writeTrivialVectorInternal(const T* data, size_t size) {
+    static_assert(std::is_trivially_copyable_v<T> && sizeof(T) % sizeof(int32_t) == 0,
+                  "element must be trivially copyable and a multiple of 4 bytes");
+    if (size > std::numeric_limits<int32_t>::max() / sizeof(T)) {
+        return BAD_VALUE;
+    }
+
+    const int32_t count = static_cast<int32_t>(size);
+    const size_t bytes = size * sizeof(T);
+    uint8_t* out = reinterpret_cast<uint8_t*>(writeInplace(sizeof(count) + bytes));
+    if (out == nullptr) {
+        return NO_MEMORY;
+    }
+    memcpy(out, &count, sizeof(count));
+    if (bytes > 0) {
+        memcpy(out + sizeof(count), data, bytes);
+    }
+    return NO_ERROR;
+}
+
+template<typename T>
+status_t Parcel::readTrivialVectorView(const void** data, size_t* size) const {
+    int32_t count;
+    status_t status = readInt32(&count);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    if (count < 0) {
+        return UNEXPECTED_NULL;
+    }
+    if (static_cast<size_t>(count) > std::numeric_limits<int32_t>::max() / sizeof(T)) {
+        return BAD_VALUE;
+    }
+
+    const void* payload = readInplace(count * sizeof(T));
+    if (payload == nullptr) {
+        return BAD_VALUE;
+    }
+    *data = payload;
+    *size = static_cast<size_t>(count);
+    return NO_ERROR;
+}
+
+template<typename T>
+status_t Parcel::readTrivialVectorInternal(std::vector<T>* val) const {
+    const void* data;
+    size_t size;
+    status_t status = readTrivialVectorView<T>(&data, &size);
+    if (status != NO_ERROR) {
+        return status;
+    }
+    // The payload is validated before the vector is sized, so a bogus count
+    // can't trigger a huge allocation. memcpy copes with 64-bit elements
+    // that are only 4-byte aligned in the parcel.
+    val->resize(size);
+    if (size > 0) {
+        memcpy(val->data(), data, size * sizeof(T));
+    }
+    return NO_ERROR;
+}
+
+template<typename T, typename U>
+status_t Parcel::readNullableVector(T* val, status_t(Parcel::*read_func)(U*) const) const {
+    U out;
+    status_t status = (this->*read_func)(&out);
+    val->reset();
+    if (status == UNEXPECTED_NULL) {
+        // A null vector is written as a size of -1.
+        return OK;
+    }
+    if (status != OK) {
+        return status;
+    }
+    if constexpr (std::is_same_v<T, std::optional<U>>) {
+        val->emplace(std::move(out));
+    } else {
+        val->reset(new U(std::move(out)));
+    }
+    return OK;
+}
+
 template<typename T, std::enable_if_t<std::is_enum_v<T> && std::is_same_v<typename std::underlying_type_t<T>,int8_t>, bool>>
 status_t Parcel::readEnumVector(std::vector<T>* val) const {
     size_t size;
@@ -22,9 +22,12 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <atomic>
+
+#include <utils/Errors.h>
 #include <utils/String16.h>
 #include <utils/Singleton.h>
-#include <utils/SortedVector.h>
+#include <utils/Timers.h>
 
 namespace android {
 // ---------------------------------------------------------------------------
@@ -32,8 +35,8 @@ namespace android {
 /*
  * PermissionCache caches permission checks for a given uid.
  *
- * Currently the cache is not updated when there is a permission change,
- * for instance when an application is uninstalled.
+ * Entries expire after a minute and can be dropped with purgeUid() when a uid
+ * goes away, but the cache is not otherwise updated when a permission changes.
  *
  * IMPORTANT: for the reason stated above, only system permissions are safe
  * to cache. This restriction may be lifted at a later time.
@@ -41,28 +44,58 @@ namespace android {
  */
 
 class PermissionCache : Singleton<PermissionCache> {
-    struct Entry {
-        String16    name;
-        uid_t       uid;
-        bool        granted;
-        inline bool operator < (const Entry& e) const {
-            return (uid == e.uid) ? (name < e.name) : (uid < e.uid);
-        }
+    friend class PermissionCacheTest;
+
+    // Cached results are re-checked after this long.
+    static constexpr nsecs_t kEntryTtlNs = 60 * 1000000000LL;
+    // The cache is a fixed set of shards, selected by uid. Each shard is a
+    // small open-addressed table keyed by (uid, permission id). Lookups
+    // take no lock: they retry if the shard's sequence number shows a
+    // concurrent write. Writers serialize on the shard lock. When a probe
+    // window is full, the entry that expires first is evicted.
+    static constexpr size_t kShardCount = 16;
+    static constexpr size_t kShardSlots = 64;
+    static constexpr size_t kProbeCount = 8;
+    // Permission names are interned once and never freed, so the cache
+    // stores a small id instead of a String16.
+    static constexpr size_t kMaxPermissions = 256;
+
+    struct Slot {
+        std::atomic<uint64_t>   key;        // (uid << 32) | id, 0 when empty
+        std::atomic<int64_t>    expiresAt;
+        std::atomic<bool>       granted;
+    };
+
+    struct Shard {
+        Mutex                   lock;       // serializes writers
+        std::atomic<uint32_t>   seq;        // odd while a writer updates slots
+        Slot                    slots[kShardSlots];
     };
-    mutable Mutex mLock;
-    // we pool all the permission names we see, as many permissions checks
-    // will have identical names
-    SortedVector< String16 > mPermissionNamesPool;
-    // this is our cache per say. it stores pooled names.
-    SortedVector< Entry > mCache;
+
+    Shard mShards[kShardCount];
+
+    // mPermissionNames[id - 1] is written before id is published in
+    // mPermissionIndex and never changes afterwards.
+    Mutex mPermissionsLock;
+    size_t mPermissionCount;
+    String16 mPermissionNames[kMaxPermissions];
+    std::atomic<uint32_t> mPermissionIndex[kMaxPermissions * 2];
+
+    uint32_t findPermission(const String16& permission, size_t hash) const;
+    uint32_t internPermission(const String16& permission);
 
     // free the whole cache, but keep the permission name pool
     void purge();
 
+    // free every entry cached for uid
+    void purge(uid_t uid);
+
+    // |now| is SYSTEM_TIME_MONOTONIC; entries cached at t expire at
+    // t + kEntryTtlNs.
     status_t check(bool* granted,
-            const String16& permission, uid_t uid) const;
+            const String16& permission, uid_t uid, nsecs_t now) const;
 
-    void cache(const String16& permission, uid_t uid, bool granted);
+    void cache(const String16& permission, uid_t uid, bool granted, nsecs_t now);
 
 public:
     PermissionCache();
@@ -74,6 +107,9 @@ public:
 
     static bool checkPermission(const String16& permission,
             pid_t pid, uid_t uid);
+
+    // Drops every cached result for uid, e.g. when it is uninstalled.
+    static void purgeUid(uid_t uid);
 };
 
 // ---------------------------------------------------------------------------
@@ -26,9 +26,13 @@
 
 #include <pthread.h>
 
+#include <atomic>
+#include <map>
+
 // ---------------------------------------------------------------------------
 namespace android {
 
+class BBinder;
 class IPCThreadState;
 
 class ProcessState : public virtual RefBase
@@ -48,6 +52,7 @@ public:
             sp<IBinder>         getContextObject(const sp<IBinder>& caller);
 
             void                startThreadPool();
+            bool                isThreadPoolStarted() const;
                         
     typedef bool (*context_check_func)(const String16& name,
                                        const sp<IBinder>& caller,
@@ -63,6 +68,12 @@ public:
             void                spawnPooledThread(bool isMain);
             
             status_t            setThreadPoolMaxThreadCount(size_t maxThreads);
+
+            // Lets the pool size follow demand. It starts at minThreads,
+            // grows by one thread each time incoming transactions queue
+            // because all threads are busy, and releases idle threads after
+            // a quiet period. It never grows past maxThreads.
+            status_t            setThreadPoolAdaptive(size_t minThreads, size_t maxThreads);
             void                giveThreadPoolName();
 
             String8             getDriverName();
@@ -89,6 +100,37 @@ public:
             // before any threads are spawned.
             void setCallRestriction(CallRestriction restriction);
 
+            enum class DispatchClass {
+                // counted against the thread pool like any other call
+                NORMAL,
+                // if the pool is saturated when one of these arrives, an
+                // adaptive pool grows immediately
+                LATENCY_CRITICAL,
+                // runs on a borrowed thread that doesn't count against the
+                // pool size, so slow calls can't occupy every thread
+                BULK,
+            };
+            // Assigns a dispatch class to every incoming transaction on
+            // interfaces with this descriptor. DUMP and SHELL_COMMAND
+            // transactions are always BULK.
+            void setInterfaceDispatchClass(const String16& descriptor,
+                                           DispatchClass dispatchClass);
+            // The dispatch class of a transaction with this code on an
+            // interface with this descriptor.
+            DispatchClass getDispatchClass(const String16& descriptor, uint32_t code);
+
+            struct ThreadPoolStats {
+                // current size of the pool
+                size_t maxThreads;
+                // threads running a command they read in the pool loop
+                size_t executingThreads;
+                // BULK transactions running on borrowed threads
+                size_t borrowedThreads;
+                // pooled (non-main) threads in the pool
+                size_t spawnedThreads;
+            };
+            ThreadPoolStats getThreadPoolStats();
+
 private:
     friend class IPCThreadState;
     
@@ -106,6 +148,29 @@ private:
 
             handle_entry*       lookupHandleLocked(int32_t handle);
 
+            // Thread pool bookkeeping used by IPCThreadState. All of these
+            // take mThreadCountLock, except the ones ending in Locked, which
+            // expect the caller to hold it.
+            DispatchClass       dispatchClassForLocked(const String16& descriptor,
+                                                       uint32_t code) const;
+            // Returns true if the transaction runs on a borrowed thread, in
+            // which case endBorrowedDispatch() must be called once it is
+            // done. Only a thread counted in mExecutingThreadsCount, and not
+            // borrowed already, may borrow (canBorrow).
+            bool                beginDispatch(const BBinder* target, uint32_t code,
+                                              bool canBorrow);
+            void                endBorrowedDispatch();
+            void                onPooledThreadStarted();
+            void                onPooledThreadExited();
+            void                onPooledThreadExitedLocked();
+            // Returns true if the calling pooled thread has to leave the pool,
+            // after accounting for its exit.
+            bool                releasePooledThreadLocked();
+            size_t              busyThreadsLocked() const;
+            void                onStarvationEndedLocked(int64_t starvationTimeMs);
+            status_t            growThreadPoolLocked();
+            status_t            updateKernelMaxThreadsLocked();
+
             String8             mDriverName;
             int                 mDriverFD;
             void*               mVMStart;
@@ -119,6 +184,27 @@ private:
             size_t              mMaxThreads;
             // Time when thread pool was emptied
             int64_t             mStarvationStartTimeMs;
+            // Pooled (non-main) threads that are currently running.
+            size_t              mSpawnedThreadsCount;
+            // Pooled threads that have left the pool. The driver keeps
+            // counting them as started, so they are added back to the limit
+            // it is given.
+            size_t              mExitedThreadsCount;
+            // BULK transactions running on threads that don't count
+            // against mMaxThreads.
+            size_t              mBorrowedThreadsCount;
+            // Limit last passed to BINDER_SET_MAX_THREADS.
+            size_t              mKernelMaxThreads;
+            // Bounds of the adaptive pool; mAdaptiveMaxThreads is 0 when the
+            // pool has a fixed size.
+            size_t              mAdaptiveMinThreads;
+            size_t              mAdaptiveMaxThreads;
+            // Time the pool was last starved or resized.
+            int64_t             mLastPoolActivityTimeMs;
+            std::map<String16, DispatchClass> mDispatchClasses;
+            // Set once mDispatchClasses has entries, so transactions can skip
+            // the lock in the common case.
+            std::atomic<bool>   mHasDispatchClasses;
 
     mutable Mutex               mLock;  // protects everything below.
 
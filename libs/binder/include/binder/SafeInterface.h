@@ -17,6 +17,7 @@
 #pragma once
 
 #include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
 #include <binder/Parcel.h>
 #include <cutils/compiler.h>
 
@@ -311,8 +312,11 @@ protected:
         static_assert(ArgsMatchParams<std::tuple<Args...>, ParamTuple>::value,
                       "Invalid argument type");
 
-        // Write the input arguments to the data Parcel
-        Parcel data;
+        // Write the input arguments to the data Parcel. Inside an IPCThreadState::OnewayBatch
+        // it is the batch's, so the call is queued with the others instead of sent right away.
+        Parcel localData;
+        Parcel* batchData = IPCThreadState::self()->obtainOnewayBatchParcel();
+        Parcel& data = batchData != nullptr ? *batchData : localData;
         data.writeInterfaceToken(this->getInterfaceDescriptor());
         status_t error = writeInputs(&data, std::forward<Args>(args)...);
         if (CC_UNLIKELY(error != NO_ERROR)) {
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <utils/Errors.h>
+#include <utils/String16.h>
+#include <utils/Timers.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace android {
+
+// Always-on accounting of the binder transactions made and served by this
+// process. Each thread keeps its own counters and latency histograms, keyed
+// by interface descriptor and transaction code, so recording a transaction
+// never contends with other threads. The most recent transactions are also
+// kept in a fixed-size ring buffer that can be exported without stopping
+// the writers.
+//
+// The stats of any service can be read with
+//   dumpsys <service> --binder-stats
+//   dumpsys <service> --binder-trace
+class TransactionStats final {
+public:
+    enum class Side : uint8_t {
+        CLIENT,     // made by this process
+        SERVER,     // served by this process
+    };
+
+    struct Record {
+        nsecs_t     startNs;        // SYSTEM_TIME_MONOTONIC
+        uint32_t    durationUs;
+        uint32_t    code;
+        uint32_t    flags;
+        int32_t     result;
+        uint16_t    interfaceId;    // see interfaceName()
+        Side        side;
+    };
+
+    static constexpr size_t kRingSize = 1024;
+    // Bucket i counts transactions that took less than 2^i us; the last one
+    // also counts everything slower.
+    static constexpr size_t kHistogramBuckets = 24;
+
+    // Accounting is enabled by default; turning it off makes transact()
+    // skip it entirely, which is how its cost is measured.
+    static void             setEnabled(bool enabled);
+    static bool             isEnabled();
+
+    // Copies the records still in the ring buffer to |out|, oldest first,
+    // and returns how many were copied.
+    static size_t           exportRecent(std::vector<Record>* out);
+    static String16         interfaceName(uint16_t interfaceId);
+
+    // Writes the per interface and code totals, slowest first, to |fd|.
+    static status_t         dump(int fd);
+    // Writes the records still in the ring buffer to |fd|.
+    static status_t         dumpRecent(int fd);
+
+    // Per-thread state, owned by IPCThreadState.
+    struct ThreadStats;
+
+private:
+    friend class IPCThreadState;
+
+    static ThreadStats*     attachThread();
+    static void             detachThread(ThreadStats* stats);
+
+    // |descriptor| is the interface token of the transaction, if it has one.
+    // Transactions without one are accounted under interface id 0.
+    static void             recordClient(ThreadStats* stats, const char16_t* descriptor,
+                                         size_t descriptorLen, uint32_t code, uint32_t flags,
+                                         nsecs_t startNs, status_t result);
+    static void             recordServer(ThreadStats* stats, const char16_t* descriptor,
+                                         size_t descriptorLen, uint32_t code, uint32_t flags,
+                                         nsecs_t startNs, status_t result);
+};
+
+} // namespace android
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+
+namespace android {
+
+// HDR-style latency histogram with a fixed memory footprint. Values below
+// kSubBuckets are recorded exactly; larger values are recorded with a
+// relative error of at most 1 / (kSubBuckets / 2), about 3%, over the whole
+// uint64_t range. The type is trivially copyable so it can be sent across
+// a pipe from a worker process.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBucketBits = 6;
+    static constexpr uint64_t kSubBuckets = 1ull << kSubBucketBits;
+    static constexpr uint64_t kHalfSubBuckets = kSubBuckets / 2;
+    static constexpr size_t kBuckets = (64 - kSubBucketBits + 2) * kHalfSubBuckets;
+
+    void add(uint64_t value) {
+        mCounts[indexOf(value)]++;
+        mCount++;
+        mSum += value;
+        mMin = std::min(mMin, value);
+        mMax = std::max(mMax, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < kBuckets; i++) {
+            mCounts[i] += other.mCounts[i];
+        }
+        mCount += other.mCount;
+        mSum += other.mSum;
+        mMin = std::min(mMin, other.mMin);
+        mMax = std::max(mMax, other.mMax);
+    }
+
+    uint64_t count() const { return mCount; }
+    uint64_t min() const { return mCount ? mMin : 0; }
+    uint64_t max() const { return mMax; }
+    double mean() const { return mCount ? double(mSum) / mCount : 0; }
+
+    // Returns the value at the given percentile (0-100), never more than
+    // the largest recorded value.
+    uint64_t percentile(double percent) const {
+        if (mCount == 0) {
+            return 0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, uint64_t(percent / 100.0 * mCount + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; i++) {
+            seen += mCounts[i];
+            if (seen >= rank) {
+                return std::min(highestValueOf(i), mMax);
+            }
+        }
+        return mMax;
+    }
+
+    // Writes a JSON object with the summary percentiles and all non-empty
+    // buckets as [lowest value, count] pairs.
+    void writeJson(std::ostream& out) const {
+        out << "{\"count\":" << mCount << ",\"min\":" << min() << ",\"mean\":" << mean()
+            << ",\"p50\":" << percentile(50) << ",\"p90\":" << percentile(90)
+            << ",\"p99\":" << percentile(99) << ",\"p99.9\":" << percentile(99.9)
+            << ",\"max\":" << mMax << ",\"buckets\":[";
+        bool first = true;
+        for (size_t i = 0; i < kBuckets; i++) {
+            if (mCounts[i] == 0) continue;
+            out << (first ? "" : ",") << "[" << lowestValueOf(i) << "," << mCounts[i] << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+
+private:
+    static size_t indexOf(uint64_t value) {
+        if (value < kSubBuckets) {
+            return value;
+        }
+        const int shift = (63 - __builtin_clzll(value)) - (kSubBucketBits - 1);
+        return shift * kHalfSubBuckets + (value >> shift);
+    }
+
+    static uint64_t lowestValueOf(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        const int shift = index / kHalfSubBuckets - 1;
+        return (index - shift * kHalfSubBuckets) << shift;
+    }
+
+    static uint64_t highestValueOf(size_t index) {
+        if (index < kSubBuckets) {
+            return index;
+        }
+        const int shift = index / kHalfSubBuckets - 1;
+        return lowestValueOf(index) + ((1ull << shift) - 1);
+    }
+
+    std::array<uint64_t, kBuckets> mCounts = {};
+    uint64_t mCount = 0;
+    uint64_t mSum = 0;
+    uint64_t mMin = std::numeric_limits<uint64_t>::max();
+    uint64_t mMax = 0;
+};
+
+} // namespace android
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <android/os/BnServiceManager.h>
+#include <binder/Binder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/IServiceManagerUnitTestHelper.h>
+#include <binder/ProcessState.h>
+#include <gtest/gtest.h>
+
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace android;
+using android::binder::Status;
+using android::os::IServiceCallback;
+using android::os::IClientCallback;
+
+static const String16 kRemoteServiceName = String16("binderCacheUnitTest.remote");
+static pid_t gRemoteServicePid = -1;
+
+// In-process servicemanager with just enough behavior for the cache in
+// ServiceManagerShim. Counts lookups so tests can tell hits from misses.
+class FakeServiceManager : public os::BnServiceManager {
+public:
+    Status getService(const std::string& name, sp<IBinder>* outBinder) override {
+        return checkService(name, outBinder);
+    }
+
+    Status checkService(const std::string& name, sp<IBinder>* outBinder) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLookups++;
+        auto it = mServices.find(name);
+        *outBinder = it == mServices.end() ? nullptr : it->second;
+        return Status::ok();
+    }
+
+    Status addService(const std::string& name, const sp<IBinder>& binder,
+                      bool /*allowIsolated*/, int32_t /*dumpPriority*/) override {
+        std::vector<sp<IServiceCallback>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mServices[name] = binder;
+            callbacks = mCallbacks[name];
+        }
+        for (const sp<IServiceCallback>& cb : callbacks) {
+            cb->onRegistration(name, binder);
+        }
+        return Status::ok();
+    }
+
+    Status listServices(int32_t /*dumpPriority*/, std::vector<std::string>* outList) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const auto& [name, binder] : mServices) {
+            (void) binder;
+            outList->push_back(name);
+        }
+        return Status::ok();
+    }
+
+    Status registerForNotifications(const std::string& name,
+                                    const sp<IServiceCallback>& callback) override {
+        sp<IBinder> binder;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            // what servicemanager does for isolated callers
+            if (mDenyNotifications) {
+                return Status::fromExceptionCode(Status::EX_SECURITY);
+            }
+            mCallbacks[name].push_back(callback);
+            auto it = mServices.find(name);
+            if (it != mServices.end()) binder = it->second;
+        }
+        if (binder != nullptr) {
+            callback->onRegistration(name, binder);
+        }
+        return Status::ok();
+    }
+
+    Status unregisterForNotifications(const std::string& name,
+                                      const sp<IServiceCallback>& callback) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto& callbacks = mCallbacks[name];
+        auto it = std::find_if(callbacks.begin(), callbacks.end(), [&](const auto& cb) {
+            return IInterface::asBinder(cb) == IInterface::asBinder(callback);
+        });
+        if (it == callbacks.end()) {
+            return Status::fromExceptionCode(Status::EX_ILLEGAL_STATE);
+        }
+        callbacks.erase(it);
+        return Status::ok();
+    }
+
+    Status isDeclared(const std::string& /*name*/, bool* outReturn) override {
+        *outReturn = false;
+        return Status::ok();
+    }
+
+    // Makes the service lazy, and notifies again like servicemanager does.
+    Status registerClientCallback(const std::string& name, const sp<IBinder>& service,
+                                  const sp<IClientCallback>& /*cb*/) override {
+        std::vector<sp<IServiceCallback>> callbacks;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (!mLazyServices.insert(name).second) {
+                return Status::ok();
+            }
+            callbacks = mCallbacks[name];
+        }
+        for (const sp<IServiceCallback>& cb : callbacks) {
+            cb->onRegistration(name, service);
+        }
+        return Status::ok();
+    }
+
+    Status tryUnregisterService(const std::string& /*name*/,
+                                const sp<IBinder>& /*binder*/) override {
+        return Status::fromExceptionCode(Status::EX_UNSUPPORTED_OPERATION);
+    }
+
+    Status isLazyService(const std::string& name, bool* outReturn) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        *outReturn = mLazyServices.count(name) != 0;
+        return Status::ok();
+    }
+
+    void setDenyNotifications(bool deny) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDenyNotifications = deny;
+    }
+
+    size_t lookups() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mLookups;
+    }
+
+    size_t callbacks(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mCallbacks[name].size();
+    }
+
+private:
+    std::mutex mMutex;
+    std::map<std::string, sp<IBinder>> mServices;
+    std::map<std::string, std::vector<sp<IServiceCallback>>> mCallbacks;
+    std::set<std::string> mLazyServices;
+    bool mDenyNotifications = false;
+    size_t mLookups = 0;
+};
+
+class DeathWaiter : public IBinder::DeathRecipient {
+public:
+    void binderDied(const wp<IBinder>& /*who*/) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDied = true;
+        mCv.notify_all();
+    }
+
+    bool waitForDeath() {
+        std::unique_lock<std::mutex> lock(mMutex);
+        return mCv.wait_for(lock, std::chrono::seconds(5), [&] { return mDied; });
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCv;
+    bool mDied = false;
+};
+
+class BinderCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mFake = new FakeServiceManager;
+        mSm = getServiceManagerShimFromAidlServiceManagerForTests(mFake);
+    }
+
+    sp<FakeServiceManager> mFake;
+    sp<IServiceManager> mSm;
+};
+
+TEST_F(BinderCacheTest, RepeatedLookupIsCacheHit) {
+    sp<IBinder> service = new BBinder;
+    mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(service, mSm->getService(String16("foo")));
+    EXPECT_EQ(1u, mFake->lookups());
+}
+
+TEST_F(BinderCacheTest, MissingServiceIsNotCached) {
+    EXPECT_EQ(nullptr, mSm->checkService(String16("foo")));
+    EXPECT_EQ(nullptr, mSm->checkService(String16("foo")));
+    EXPECT_EQ(2u, mFake->lookups());
+    EXPECT_EQ(0u, mFake->callbacks("foo"));
+}
+
+TEST_F(BinderCacheTest, ReRegistrationReplacesEntry) {
+    sp<IBinder> first = new BBinder;
+    sp<IBinder> second = new BBinder;
+    mFake->addService("foo", first, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(first, mSm->checkService(String16("foo")));
+
+    mFake->addService("foo", second, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(second, mSm->checkService(String16("foo")));
+    EXPECT_EQ(1u, mFake->lookups());
+}
+
+TEST_F(BinderCacheTest, ReleasedServiceIsStillCached) {
+    wp<IBinder> weak;
+    {
+        sp<IBinder> service = new BBinder;
+        weak = service;
+        mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+        EXPECT_EQ(service, mSm->checkService(String16("foo")));
+        mFake->addService("foo", nullptr, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    }
+    // Only the cache holds the service now, and looking it up again is a hit.
+    sp<IBinder> service = weak.promote();
+    ASSERT_NE(nullptr, service);
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(1u, mFake->lookups());
+    EXPECT_EQ(1u, mFake->callbacks("foo"));
+}
+
+TEST_F(BinderCacheTest, LazyServiceIsNotCached) {
+    sp<IBinder> service = new BBinder;
+    mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    mFake->registerClientCallback("foo", service, nullptr);
+
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(0u, mFake->callbacks("foo"));
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(2u, mFake->lookups());
+    // Known to be lazy, so not even registered for again.
+    EXPECT_EQ(0u, mFake->callbacks("foo"));
+}
+
+TEST_F(BinderCacheTest, ServiceBecomingLazyIsDropped) {
+    sp<IBinder> service = new BBinder;
+    mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(1u, mFake->callbacks("foo"));
+
+    // a lazy service registers its client callback after addService()
+    mFake->registerClientCallback("foo", service, nullptr);
+    EXPECT_EQ(0u, mFake->callbacks("foo"));
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(2u, mFake->lookups());
+}
+
+TEST_F(BinderCacheTest, DeniedNotificationsDisableCaching) {
+    mFake->setDenyNotifications(true);
+
+    sp<IBinder> service = new BBinder;
+    mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(service, mSm->checkService(String16("foo")));
+    EXPECT_EQ(2u, mFake->lookups());
+}
+
+TEST_F(BinderCacheTest, GetServicePollsWhenNotificationsAreDenied) {
+    mFake->setDenyNotifications(true);
+
+    sp<IBinder> service = new BBinder;
+    std::thread adder([&] {
+        usleep(500000);
+        mFake->addService("foo", service, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    });
+    EXPECT_EQ(service, mSm->getService(String16("foo")));
+    adder.join();
+}
+
+TEST_F(BinderCacheTest, DeathDropsEntry) {
+    ASSERT_GT(gRemoteServicePid, 0);
+    sp<IBinder> remote = defaultServiceManager()->getService(kRemoteServiceName);
+    ASSERT_NE(nullptr, remote);
+    ASSERT_NE(nullptr, remote->remoteBinder());
+
+    mFake->addService("foo", remote, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(remote, mSm->checkService(String16("foo")));
+    EXPECT_EQ(1u, mFake->callbacks("foo"));
+
+    // Linked after the cache, so it is notified after the entry is dropped.
+    sp<DeathWaiter> waiter = new DeathWaiter;
+    ASSERT_EQ(OK, remote->linkToDeath(waiter));
+    kill(gRemoteServicePid, SIGKILL);
+    waitpid(gRemoteServicePid, nullptr, 0);
+    gRemoteServicePid = -1;
+    ASSERT_TRUE(waiter->waitForDeath());
+
+    EXPECT_EQ(0u, mFake->callbacks("foo"));
+    mFake->addService("foo", nullptr, false, IServiceManager::DUMP_FLAG_PRIORITY_DEFAULT);
+    EXPECT_EQ(nullptr, mSm->checkService(String16("foo")));
+    EXPECT_EQ(2u, mFake->lookups());
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+
+    gRemoteServicePid = fork();
+    if (gRemoteServicePid == 0) {
+        // child process
+        prctl(PR_SET_PDEATHSIG, SIGHUP);
+
+        defaultServiceManager()->addService(kRemoteServiceName, new BBinder);
+        IPCThreadState::self()->joinThreadPool(true);
+        exit(1);  // should not reach
+    }
+
+    // the cache is only used once the thread pool is started
+    ProcessState::self()->startThreadPool();
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sweeps binder transaction latency over payload size, thread count,
+// oneway vs two-way and the number of file descriptors and binder objects
+// per transaction. Every run is written as one JSON object per line with
+// an HDR-style latency histogram and the CPU time spent per call by the
+// client and the server. Runs can be repeated with TransactionStats
+// accounting turned off in both processes to measure what it costs.
+
+#include <binder/Binder.h>
+#include <binder/IBinder.h>
+#include <binder/IPCThreadState.h>
+#include <binder/IServiceManager.h>
+#include <binder/ProcessState.h>
+#include <binder/TransactionStats.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "LatencyHistogram.h"
+
+using namespace android;
+
+enum BenchmarkServiceCode {
+    BENCHMARK_CALL = IBinder::FIRST_CALL_TRANSACTION,
+    BENCHMARK_RESET,
+    BENCHMARK_ONEWAY_FENCE,
+    BENCHMARK_GET_CPU_TIME,
+    BENCHMARK_SET_TRANSACTION_STATS,
+    BENCHMARK_EXIT,
+};
+
+static const String16 kDescriptor("android.binder.ILatencyBenchmark");
+
+// Oneway calls are throttled so the server's async buffer space never runs
+// out: every kOnewayWindow calls the client waits until the server caught up.
+static const int kOnewayWindow = 32;
+
+#define ASSERT_TRUE(cond) \
+do { \
+    if (!(cond)) {\
+       std::cerr << __func__ << ":" << __LINE__ << " condition:" << #cond << " failed" \
+                 << std::endl; \
+       exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+static uint64_t nowNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static String16 serviceName(int threads) {
+    return String16(("binderLatencyBenchmark-" + std::to_string(threads)).c_str());
+}
+
+class BenchmarkService : public BBinder {
+public:
+    const String16& getInterfaceDescriptor() const override { return kDescriptor; }
+
+    status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                        uint32_t flags = 0) override {
+        switch (code) {
+            case BENCHMARK_CALL:
+                if (flags & TF_ONE_WAY) {
+                    std::lock_guard<std::mutex> lock(mLock);
+                    mOnewayProcessed++;
+                    mCondition.notify_all();
+                }
+                return NO_ERROR;
+            case BENCHMARK_RESET: {
+                std::lock_guard<std::mutex> lock(mLock);
+                mOnewayProcessed = 0;
+                return NO_ERROR;
+            }
+            case BENCHMARK_ONEWAY_FENCE: {
+                const uint64_t expected = data.readUint64();
+                std::unique_lock<std::mutex> lock(mLock);
+                mCondition.wait(lock, [&] { return mOnewayProcessed >= expected; });
+                return NO_ERROR;
+            }
+            case BENCHMARK_GET_CPU_TIME:
+                return reply->writeUint64(nowNs(CLOCK_PROCESS_CPUTIME_ID));
+            case BENCHMARK_SET_TRANSACTION_STATS:
+                TransactionStats::setEnabled(data.readBool());
+                return NO_ERROR;
+            case BENCHMARK_EXIT:
+                exit(EXIT_SUCCESS);
+            default:
+                return UNKNOWN_TRANSACTION;
+        }
+    }
+
+private:
+    std::mutex mLock;
+    std::condition_variable mCondition;
+    uint64_t mOnewayProcessed = 0;
+};
+
+struct RunConfig {
+    int threads;
+    size_t payloadSize;
+    bool oneway;
+    int fdCount;
+    int binderCount;
+    bool transactionStats;
+};
+
+struct RunResult {
+    LatencyHistogram latency;
+    uint64_t wallNs = 0;
+    uint64_t clientCpuNs = 0;
+    uint64_t serverCpuNs = 0;
+};
+
+static uint64_t serverCpuTime(const sp<IBinder>& server) {
+    Parcel data, reply;
+    ASSERT_TRUE(server->transact(BENCHMARK_GET_CPU_TIME, data, &reply) == NO_ERROR);
+    return reply.readUint64();
+}
+
+static void clientThread(const sp<IBinder>& server, const RunConfig& config, int iterations,
+                         std::atomic<uint64_t>* onewaySent, LatencyHistogram* latency) {
+    const sp<IBinder> local = new BBinder();
+    const std::vector<uint8_t> payload(config.payloadSize, 0xa5);
+    const int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    ASSERT_TRUE(fd >= 0);
+
+    for (int i = 0; i < iterations; i++) {
+        Parcel data, reply;
+        data.writeInterfaceToken(kDescriptor);
+        data.write(payload.data(), payload.size());
+        for (int j = 0; j < config.fdCount; j++) {
+            data.writeFileDescriptor(fd);
+        }
+        for (int j = 0; j < config.binderCount; j++) {
+            data.writeStrongBinder(local);
+        }
+
+        const uint64_t start = nowNs(CLOCK_MONOTONIC);
+        const status_t ret = server->transact(BENCHMARK_CALL, data, &reply,
+                                              config.oneway ? IBinder::FLAG_ONEWAY : 0);
+        latency->add(nowNs(CLOCK_MONOTONIC) - start);
+        ASSERT_TRUE(ret == NO_ERROR);
+
+        if (config.oneway) {
+            const uint64_t sent = ++*onewaySent;
+            if (i % kOnewayWindow == kOnewayWindow - 1) {
+                Parcel fence;
+                fence.writeUint64(sent);
+                ASSERT_TRUE(server->transact(BENCHMARK_ONEWAY_FENCE, fence, &reply) == NO_ERROR);
+            }
+        }
+    }
+    close(fd);
+}
+
+static RunResult run(const sp<IBinder>& server, const RunConfig& config, int iterations) {
+    Parcel data, reply;
+    ASSERT_TRUE(server->transact(BENCHMARK_RESET, data, &reply) == NO_ERROR);
+    Parcel stats;
+    stats.writeBool(config.transactionStats);
+    ASSERT_TRUE(server->transact(BENCHMARK_SET_TRANSACTION_STATS, stats, &reply) == NO_ERROR);
+    TransactionStats::setEnabled(config.transactionStats);
+
+    RunResult result;
+    std::vector<LatencyHistogram> latencies(config.threads);
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> onewaySent(0);
+
+    const uint64_t serverCpuStart = serverCpuTime(server);
+    const uint64_t clientCpuStart = nowNs(CLOCK_PROCESS_CPUTIME_ID);
+    const uint64_t wallStart = nowNs(CLOCK_MONOTONIC);
+    for (int i = 0; i < config.threads; i++) {
+        threads.emplace_back(clientThread, server, config, iterations, &onewaySent,
+                             &latencies[i]);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (config.oneway) {
+        // Account for the server work of calls still in flight.
+        Parcel fence;
+        fence.writeUint64(onewaySent);
+        ASSERT_TRUE(server->transact(BENCHMARK_ONEWAY_FENCE, fence, &reply) == NO_ERROR);
+    }
+    result.wallNs = nowNs(CLOCK_MONOTONIC) - wallStart;
+    result.clientCpuNs = nowNs(CLOCK_PROCESS_CPUTIME_ID) - clientCpuStart;
+    result.serverCpuNs = serverCpuTime(server) - serverCpuStart;
+
+    for (const auto& latency : latencies) {
+        result.latency.merge(latency);
+    }
+    return result;
+}
+
+static void writeResult(std::ostream& out, const RunConfig& config, const RunResult& result) {
+    const uint64_t calls = result.latency.count();
+    out << "{\"threads\":" << config.threads << ",\"payload_size\":" << config.payloadSize
+        << ",\"oneway\":" << (config.oneway ? "true" : "false")
+        << ",\"fds\":" << config.fdCount << ",\"binders\":" << config.binderCount
+        << ",\"transaction_stats\":" << (config.transactionStats ? "true" : "false")
+        << ",\"calls\":" << calls
+        << ",\"calls_per_sec\":" << (result.wallNs ? calls * 1.0E9 / result.wallNs : 0)
+        << ",\"client_cpu_ns_per_call\":" << (calls ? result.clientCpuNs / calls : 0)
+        << ",\"server_cpu_ns_per_call\":" << (calls ? result.serverCpuNs / calls : 0)
+        << ",\"latency_ns\":";
+    result.latency.writeJson(out);
+    out << "}" << std::endl;
+}
+
+static std::vector<int> parseList(const char* arg) {
+    std::vector<int> values;
+    std::stringstream stream(arg);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(atoi(item.c_str()));
+    }
+    ASSERT_TRUE(!values.empty());
+    return values;
+}
+
+static pid_t startServer(int threads) {
+    pid_t pid = fork();
+    ASSERT_TRUE(pid >= 0);
+    if (pid == 0) {
+        sp<ProcessState> proc = ProcessState::self();
+        proc->setThreadPoolMaxThreadCount(threads);
+        ASSERT_TRUE(defaultServiceManager()->addService(serviceName(threads),
+                                                        new BenchmarkService()) == NO_ERROR);
+        proc->startThreadPool();
+        IPCThreadState::self()->joinThreadPool();
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = 1000;
+    std::vector<int> payloadSizes = {0, 256, 4096, 65536};
+    std::vector<int> threadCounts = {1, 4};
+    std::vector<int> fdCounts = {0, 4};
+    std::vector<int> binderCounts = {0, 4};
+    std::vector<bool> onewayModes = {false, true};
+    std::vector<bool> statsModes = {true};
+    const char* outputPath = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--help" || !hasValue) {
+            std::cout << "Usage: binderLatencyBenchmark [OPTIONS]" << std::endl
+                      << "\t-i N       : Iterations per thread and run." << std::endl
+                      << "\t-s N,N,... : Payload sizes in bytes." << std::endl
+                      << "\t-t N,N,... : Client threads (and server pool size)." << std::endl
+                      << "\t-f N,N,... : File descriptors per transaction." << std::endl
+                      << "\t-b N,N,... : Binder objects per transaction." << std::endl
+                      << "\t-m MODE    : twoway, oneway or both." << std::endl
+                      << "\t-a MODE    : Transaction stats on, off or both." << std::endl
+                      << "\t-o FILE    : Write results to FILE instead of stdout." << std::endl;
+            return arg == "--help" ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "-i") {
+            iterations = atoi(value);
+        } else if (arg == "-s") {
+            payloadSizes = parseList(value);
+        } else if (arg == "-t") {
+            threadCounts = parseList(value);
+        } else if (arg == "-f") {
+            fdCounts = parseList(value);
+        } else if (arg == "-b") {
+            binderCounts = parseList(value);
+        } else if (arg == "-m") {
+            const std::string mode = value;
+            ASSERT_TRUE(mode == "twoway" || mode == "oneway" || mode == "both");
+            onewayModes.clear();
+            if (mode != "oneway") onewayModes.push_back(false);
+            if (mode != "twoway") onewayModes.push_back(true);
+        } else if (arg == "-a") {
+            const std::string mode = value;
+            ASSERT_TRUE(mode == "on" || mode == "off" || mode == "both");
+            statsModes.clear();
+            if (mode != "off") statsModes.push_back(true);
+            if (mode != "on") statsModes.push_back(false);
+        } else if (arg == "-o") {
+            outputPath = value;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Servers have to be forked before this process opens the binder driver.
+    std::vector<pid_t> servers;
+    for (int threads : threadCounts) {
+        servers.push_back(startServer(threads));
+    }
+
+    std::ofstream file;
+    if (outputPath) {
+        file.open(outputPath);
+        ASSERT_TRUE(file.is_open());
+    }
+    std::ostream& out = outputPath ? file : std::cout;
+
+    ProcessState::self()->startThreadPool();
+    for (int threads : threadCounts) {
+        sp<IBinder> server = defaultServiceManager()->getService(serviceName(threads));
+        ASSERT_TRUE(server != nullptr);
+
+        for (bool oneway : onewayModes) {
+            for (int payloadSize : payloadSizes) {
+                for (int fdCount : fdCounts) {
+                    for (int binderCount : binderCounts) {
+                        for (bool transactionStats : statsModes) {
+                            const RunConfig config = {threads, size_t(payloadSize), oneway,
+                                                      fdCount, binderCount, transactionStats};
+                            writeResult(out, config, run(server, config, iterations));
+                        }
+                    }
+                }
+            }
+        }
+
+        Parcel data, reply;
+        server->transact(BENCHMARK_EXIT, data, &reply, IBinder::FLAG_ONEWAY);
+    }
+
+    for (pid_t pid : servers) {
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    return EXIT_SUCCESS;
+}
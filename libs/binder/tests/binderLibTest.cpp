@@ -27,6 +27,7 @@
 #include <binder/IBinder.h>
 #include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
+#include <binder/TransactionStats.h>
 
 #include <private/binder/binder_module.h>
 #include <sys/epoll.h>
@@ -376,6 +377,46 @@ class BinderLibTestCallBack : public BBinder, public BinderLibTestEvent
         const uint8_t *m_prev_end;
 };
 
+// Records the thread pool counters seen while serving a callback. If it has a
+// nested recorder, it passes it to the server for a synchronous callback
+// before returning, so the nested one is dispatched on the same thread.
+class BinderLibTestDispatchRecorder : public BBinder, public BinderLibTestEvent
+{
+    public:
+        static const String16 kDescriptor;
+
+        BinderLibTestDispatchRecorder(const sp<IBinder>& server = nullptr,
+                                      const sp<IBinder>& nested = nullptr)
+            : m_server(server), m_nested(nested), m_stats() {}
+        const String16& getInterfaceDescriptor() const override {
+            return kDescriptor;
+        }
+        ProcessState::ThreadPoolStats getStats() {
+            return m_stats;
+        }
+    private:
+        status_t onTransact(uint32_t code, const Parcel& data, Parcel* reply,
+                            uint32_t flags = 0) override {
+            if (code != BINDER_LIB_TEST_CALL_BACK) {
+                return BBinder::onTransact(code, data, reply, flags);
+            }
+            m_stats = ProcessState::self()->getThreadPoolStats();
+            if (m_nested != nullptr) {
+                Parcel data2, reply2;
+                data2.writeStrongBinder(m_nested);
+                m_server->transact(BINDER_LIB_TEST_NOP_CALL_BACK, data2, &reply2);
+            }
+            triggerEvent();
+            return NO_ERROR;
+        }
+
+        sp<IBinder> m_server;
+        sp<IBinder> m_nested;
+        ProcessState::ThreadPoolStats m_stats;
+};
+
+const String16 BinderLibTestDispatchRecorder::kDescriptor("test.binderLib.IDispatchRecorder");
+
 class TestDeathRecipient : public IBinder::DeathRecipient, public BinderLibTestEvent
 {
     private:
@@ -901,6 +942,63 @@ TEST_F(BinderLibTest, OnewayQueueing)
     EXPECT_EQ(NO_ERROR, ret);
 }
 
+TEST_F(BinderLibTest, OnewayBatch)
+{
+    status_t ret;
+    sp<IBinder> pollServer = addPollServer();
+    sp<BinderLibTestCallBack> callBack = new BinderLibTestCallBack();
+    sp<BinderLibTestCallBack> callBack2 = new BinderLibTestCallBack();
+
+    {
+        IPCThreadState::OnewayBatch batch;
+        for (const auto& cb : {callBack, callBack2}) {
+            // The batch owns the Parcel, and keeps it until it is sent.
+            Parcel* data = IPCThreadState::self()->obtainOnewayBatchParcel();
+            ASSERT_TRUE(data != nullptr);
+            data->writeStrongBinder(cb);
+            data->writeInt32(0); // delay in us
+            ret = pollServer->transact(BINDER_LIB_TEST_DELAYED_CALL_BACK, *data, nullptr,
+                                       TF_ONE_WAY);
+            EXPECT_EQ(NO_ERROR, ret);
+        }
+        EXPECT_EQ(NO_ERROR, batch.flush());
+    }
+    EXPECT_EQ(nullptr, IPCThreadState::self()->obtainOnewayBatchParcel());
+
+    ret = callBack->waitEvent(2);
+    EXPECT_EQ(NO_ERROR, ret);
+    ret = callBack->getResult();
+    EXPECT_EQ(NO_ERROR, ret);
+
+    ret = callBack2->waitEvent(2);
+    EXPECT_EQ(NO_ERROR, ret);
+    ret = callBack2->getResult();
+    EXPECT_EQ(NO_ERROR, ret);
+}
+
+TEST_F(BinderLibTest, OnewayBatchSendsOtherParcelsRightAway)
+{
+    status_t ret;
+    sp<IBinder> pollServer = addPollServer();
+    sp<BinderLibTestCallBack> callBack = new BinderLibTestCallBack();
+
+    IPCThreadState::OnewayBatch batch;
+    {
+        // The Parcel goes away before the batch is flushed.
+        Parcel data;
+        data.writeStrongBinder(callBack);
+        data.writeInt32(0); // delay in us
+        ret = pollServer->transact(BINDER_LIB_TEST_DELAYED_CALL_BACK, data, nullptr, TF_ONE_WAY);
+        EXPECT_EQ(NO_ERROR, ret);
+    }
+
+    ret = callBack->waitEvent(2);
+    EXPECT_EQ(NO_ERROR, ret);
+    ret = callBack->getResult();
+    EXPECT_EQ(NO_ERROR, ret);
+    EXPECT_EQ(NO_ERROR, batch.flush());
+}
+
 TEST_F(BinderLibTest, WorkSourceUnsetByDefault)
 {
     status_t ret;
@@ -1027,6 +1125,179 @@ TEST_F(BinderLibTest, VectorSent) {
     EXPECT_EQ(readValue, testValue);
 }
 
+TEST_F(BinderLibTest, ParcelPoolReusesBuffers) {
+    IPCThreadState* threadState = IPCThreadState::self();
+    {
+        Parcel warmup;
+        warmup.writeInt32(0);
+    }
+    const IPCThreadState::ParcelPoolStats before = threadState->getParcelPoolStats();
+    for (int i = 0; i < 10; i++) {
+        Parcel data;
+        data.writeInt32(i);
+        EXPECT_EQ(IPCThreadState::kParcelPoolBufferSize, data.dataCapacity());
+    }
+    const IPCThreadState::ParcelPoolStats after = threadState->getParcelPoolStats();
+    EXPECT_EQ(before.hits + 10, after.hits);
+    EXPECT_EQ(before.misses, after.misses);
+    EXPECT_EQ(before.pooled, after.pooled);
+}
+
+TEST_F(BinderLibTest, TransactionStatsRecordsCalls) {
+    ASSERT_TRUE(TransactionStats::isEnabled());
+    Parcel data, reply;
+    data.writeInterfaceToken(String16("test.binderLib.ITransactionStats"));
+    EXPECT_EQ(NO_ERROR, m_server->transact(BINDER_LIB_TEST_NOP_TRANSACTION, data, &reply));
+
+    std::vector<TransactionStats::Record> records;
+    ASSERT_GT(TransactionStats::exportRecent(&records), 0u);
+    const TransactionStats::Record& last = records.back();
+    EXPECT_EQ(TransactionStats::Side::CLIENT, last.side);
+    EXPECT_EQ(uint32_t(BINDER_LIB_TEST_NOP_TRANSACTION), last.code);
+    EXPECT_EQ(NO_ERROR, last.result);
+    EXPECT_EQ(String16("test.binderLib.ITransactionStats"),
+              TransactionStats::interfaceName(last.interfaceId));
+}
+
+TEST_F(BinderLibTest, AdaptiveThreadPoolRejectsBadBounds) {
+    EXPECT_EQ(BAD_VALUE, ProcessState::self()->setThreadPoolAdaptive(0, 4));
+    EXPECT_EQ(BAD_VALUE, ProcessState::self()->setThreadPoolAdaptive(4, 2));
+}
+
+TEST_F(BinderLibTest, DispatchClassRouting) {
+    using DispatchClass = ProcessState::DispatchClass;
+    sp<ProcessState> proc = ProcessState::self();
+    const String16 descriptor("test.binderLib.IDispatchClassRouting");
+
+    EXPECT_EQ(DispatchClass::NORMAL,
+              proc->getDispatchClass(descriptor, IBinder::FIRST_CALL_TRANSACTION));
+    EXPECT_EQ(DispatchClass::BULK, proc->getDispatchClass(descriptor, IBinder::DUMP_TRANSACTION));
+    EXPECT_EQ(DispatchClass::BULK,
+              proc->getDispatchClass(descriptor, IBinder::SHELL_COMMAND_TRANSACTION));
+
+    proc->setInterfaceDispatchClass(descriptor, DispatchClass::LATENCY_CRITICAL);
+    EXPECT_EQ(DispatchClass::LATENCY_CRITICAL,
+              proc->getDispatchClass(descriptor, IBinder::FIRST_CALL_TRANSACTION));
+    EXPECT_EQ(DispatchClass::NORMAL,
+              proc->getDispatchClass(String16("test.binderLib.IOther"),
+                                     IBinder::FIRST_CALL_TRANSACTION));
+
+    proc->setInterfaceDispatchClass(descriptor, DispatchClass::BULK);
+    EXPECT_EQ(DispatchClass::BULK,
+              proc->getDispatchClass(descriptor, IBinder::FIRST_CALL_TRANSACTION));
+    proc->setInterfaceDispatchClass(descriptor, DispatchClass::NORMAL);
+}
+
+TEST_F(BinderLibTest, BulkDispatchCountersUnderNestedDispatch) {
+    sp<ProcessState> proc = ProcessState::self();
+    proc->setInterfaceDispatchClass(BinderLibTestDispatchRecorder::kDescriptor,
+                                    ProcessState::DispatchClass::BULK);
+
+    // Served on this thread while it waits for the reply, so it isn't
+    // counted as executing and can't borrow a thread.
+    {
+        sp<BinderLibTestDispatchRecorder> callBack = new BinderLibTestDispatchRecorder();
+        Parcel data, reply;
+        data.writeStrongBinder(callBack);
+        EXPECT_EQ(NO_ERROR, m_server->transact(BINDER_LIB_TEST_NOP_CALL_BACK, data, &reply));
+        EXPECT_EQ(NO_ERROR, callBack->waitEvent(5));
+        EXPECT_EQ(0u, callBack->getStats().borrowedThreads);
+    }
+
+    // Served on a pool thread, which borrows once; the nested callback runs
+    // on the same thread and must not borrow again.
+    {
+        sp<BinderLibTestDispatchRecorder> inner = new BinderLibTestDispatchRecorder();
+        sp<BinderLibTestDispatchRecorder> outer =
+                new BinderLibTestDispatchRecorder(m_server, inner);
+        Parcel data, reply;
+        data.writeStrongBinder(outer);
+        EXPECT_EQ(NO_ERROR, m_server->transact(BINDER_LIB_TEST_NOP_CALL_BACK, data, &reply,
+                                               TF_ONE_WAY));
+        EXPECT_EQ(NO_ERROR, outer->waitEvent(5));
+        EXPECT_EQ(NO_ERROR, inner->waitEvent(5));
+
+        const ProcessState::ThreadPoolStats outerStats = outer->getStats();
+        const ProcessState::ThreadPoolStats innerStats = inner->getStats();
+        EXPECT_EQ(1u, outerStats.borrowedThreads);
+        EXPECT_EQ(1u, innerStats.borrowedThreads);
+        EXPECT_GE(outerStats.executingThreads, outerStats.borrowedThreads);
+        EXPECT_GE(innerStats.executingThreads, innerStats.borrowedThreads);
+    }
+
+    // The borrowed thread is returned once the outer call has finished.
+    size_t borrowed = proc->getThreadPoolStats().borrowedThreads;
+    for (int i = 0; i < 100 && borrowed != 0; i++) {
+        usleep(10000);
+        borrowed = proc->getThreadPoolStats().borrowedThreads;
+    }
+    EXPECT_EQ(0u, borrowed);
+
+    proc->setInterfaceDispatchClass(BinderLibTestDispatchRecorder::kDescriptor,
+                                    ProcessState::DispatchClass::NORMAL);
+}
+
+TEST_F(BinderLibTest, PrimitiveVectorFastPaths) {
+    Parcel data;
+    std::vector<float> const floats = {1.5f, -2.0f, 3.25f};
+    std::vector<char16_t> const chars = {u'a', u'\xffff', u'z'};
+    std::vector<int64_t> const longs = {-1, 1ll << 40};
+
+    EXPECT_EQ(NO_ERROR, data.writeFloatVector(floats));
+    EXPECT_EQ(NO_ERROR, data.writeCharVector(chars));
+    EXPECT_EQ(NO_ERROR, data.writeInt64Vector(longs));
+    EXPECT_EQ(NO_ERROR, data.writeInt32Vector(std::optional<std::vector<int32_t>>()));
+
+    // The bulk writers must keep the element-by-element wire format.
+    data.setDataPosition(0);
+    EXPECT_EQ(3, data.readInt32());
+    for (float f : floats) EXPECT_EQ(f, data.readFloat());
+    EXPECT_EQ(3, data.readInt32());
+    for (char16_t c : chars) EXPECT_EQ(int32_t(c), data.readInt32());
+    EXPECT_EQ(2, data.readInt32());
+    for (int64_t l : longs) EXPECT_EQ(l, data.readInt64());
+    EXPECT_EQ(-1, data.readInt32());
+
+    data.setDataPosition(0);
+    const float* floatView;
+    size_t floatCount;
+    ASSERT_EQ(NO_ERROR, data.readFloatVectorView(&floatView, &floatCount));
+    ASSERT_EQ(floats.size(), floatCount);
+    EXPECT_EQ(0, memcmp(floats.data(), floatView, floatCount * sizeof(float)));
+    std::vector<char16_t> readChars;
+    EXPECT_EQ(NO_ERROR, data.readCharVector(&readChars));
+    EXPECT_EQ(chars, readChars);
+    const size_t longsPos = data.dataPosition();
+    std::vector<int64_t> readLongs;
+    EXPECT_EQ(NO_ERROR, data.readInt64Vector(&readLongs));
+    EXPECT_EQ(longs, readLongs);
+    std::optional<std::vector<int32_t>> readInts = std::vector<int32_t>{1};
+    EXPECT_EQ(NO_ERROR, data.readInt32Vector(&readInts));
+    EXPECT_FALSE(readInts);
+
+    // 64-bit elements are only 4-byte aligned, so their view is raw bytes.
+    data.setDataPosition(longsPos);
+    const uint8_t* longBytes;
+    size_t longCount;
+    ASSERT_EQ(NO_ERROR, data.readInt64VectorView(&longBytes, &longCount));
+    ASSERT_EQ(longs.size(), longCount);
+    std::vector<int64_t> copiedLongs(longCount);
+    memcpy(copiedLongs.data(), longBytes, longCount * sizeof(int64_t));
+    EXPECT_EQ(longs, copiedLongs);
+    std::unique_ptr<std::vector<int32_t>> nullInts;
+    EXPECT_EQ(NO_ERROR, data.readInt32Vector(&nullInts));
+    EXPECT_EQ(nullptr, nullInts);
+
+    // A truncated payload fails before the out vector is sized.
+    Parcel truncated;
+    truncated.writeInt32(1000);
+    truncated.writeFloat(1.0f);
+    truncated.setDataPosition(0);
+    std::vector<float> readFloats;
+    EXPECT_EQ(BAD_VALUE, truncated.readFloatVector(&readFloats));
+    EXPECT_TRUE(readFloats.empty());
+}
+
 class BinderLibTestService : public BBinder
 {
     public:
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <binder/PermissionCache.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+static const String16 kPermission("android.permission.DUMP");
+static const String16 kOtherPermission("android.permission.HARDWARE_TEST");
+static constexpr nsecs_t kNow = 1000000000LL;
+
+class PermissionCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mCache = std::make_unique<PermissionCache>();
+    }
+
+    // Returns -1 on a miss, otherwise whether the permission was granted.
+    int check(const String16& permission, uid_t uid, nsecs_t now = kNow) {
+        bool granted = false;
+        if (mCache->check(&granted, permission, uid, now) != NO_ERROR) {
+            return -1;
+        }
+        return granted ? 1 : 0;
+    }
+
+    void cache(const String16& permission, uid_t uid, bool granted, nsecs_t now = kNow) {
+        mCache->cache(permission, uid, granted, now);
+    }
+
+    void purge() {
+        mCache->purge();
+    }
+
+    void purge(uid_t uid) {
+        mCache->purge(uid);
+    }
+
+    static constexpr nsecs_t kTtl = PermissionCache::kEntryTtlNs;
+
+    std::unique_ptr<PermissionCache> mCache;
+};
+
+TEST_F(PermissionCacheTest, HitOnlyForSameUidAndPermission) {
+    EXPECT_EQ(-1, check(kPermission, 10001));
+
+    cache(kPermission, 10001, true);
+    cache(kPermission, 10002, false);
+
+    EXPECT_EQ(1, check(kPermission, 10001));
+    EXPECT_EQ(0, check(kPermission, 10002));
+    EXPECT_EQ(-1, check(kPermission, 10003));
+    EXPECT_EQ(-1, check(kOtherPermission, 10001));
+}
+
+TEST_F(PermissionCacheTest, EntriesExpire) {
+    cache(kPermission, 10001, true);
+
+    EXPECT_EQ(1, check(kPermission, 10001, kNow + kTtl - 1));
+    EXPECT_EQ(-1, check(kPermission, 10001, kNow + kTtl));
+
+    // A fresh check replaces the expired result.
+    cache(kPermission, 10001, false, kNow + kTtl);
+    EXPECT_EQ(0, check(kPermission, 10001, kNow + kTtl));
+}
+
+TEST_F(PermissionCacheTest, RecachingReplacesResult) {
+    cache(kPermission, 10001, true);
+    cache(kPermission, 10001, false);
+    EXPECT_EQ(0, check(kPermission, 10001));
+}
+
+TEST_F(PermissionCacheTest, PurgeDropsEverything) {
+    cache(kPermission, 10001, true);
+    cache(kOtherPermission, 10002, true);
+
+    purge();
+
+    EXPECT_EQ(-1, check(kPermission, 10001));
+    EXPECT_EQ(-1, check(kOtherPermission, 10002));
+    // Permission names stay interned.
+    cache(kPermission, 10001, false);
+    EXPECT_EQ(0, check(kPermission, 10001));
+}
+
+TEST_F(PermissionCacheTest, PurgeUidDropsOnlyThatUid) {
+    cache(kPermission, 10001, true);
+    cache(kOtherPermission, 10001, false);
+    cache(kPermission, 10002, true);
+
+    purge(10001);
+
+    EXPECT_EQ(-1, check(kPermission, 10001));
+    EXPECT_EQ(-1, check(kOtherPermission, 10001));
+    EXPECT_EQ(1, check(kPermission, 10002));
+}
+
+TEST_F(PermissionCacheTest, EvictionNeverReturnsOtherEntries) {
+    // Far more entries than slots: lookups may miss, but never return the
+    // result of another uid.
+    constexpr uid_t kUids = 4096;
+    for (uid_t uid = 0; uid < kUids; uid++) {
+        cache(kPermission, 10000 + uid, uid % 3 == 0, kNow + uid);
+    }
+    size_t hits = 0;
+    for (uid_t uid = 0; uid < kUids; uid++) {
+        const int result = check(kPermission, 10000 + uid, kNow + kUids);
+        if (result != -1) {
+            EXPECT_EQ(uid % 3 == 0 ? 1 : 0, result) << "uid " << 10000 + uid;
+            hits++;
+        }
+    }
+    EXPECT_GT(hits, 0u);
+}
+
+TEST_F(PermissionCacheTest, ConcurrentReadersSeeConsistentEntries) {
+    // Writers keep evicting each other's entries while readers look them
+    // up. A torn read would pair a key with another entry's result.
+    constexpr uid_t kUids = 2048;
+    constexpr int kWriters = 4;
+    constexpr int kReaders = 4;
+    const std::vector<String16> permissions = {kPermission, kOtherPermission};
+    auto expected = [](uid_t uid, size_t permission) { return (uid + permission) % 2 == 0; };
+
+    std::atomic<bool> done = false;
+    std::atomic<size_t> hits = 0;
+    std::atomic<size_t> mismatches = 0;
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < kWriters; w++) {
+        threads.emplace_back([&, w] {
+            for (int round = 0; round < 50; round++) {
+                for (uid_t uid = w; uid < kUids; uid += kWriters) {
+                    for (size_t p = 0; p < permissions.size(); p++) {
+                        cache(permissions[p], 10000 + uid, expected(uid, p), kNow + round);
+                    }
+                }
+            }
+        });
+    }
+    for (int r = 0; r < kReaders; r++) {
+        threads.emplace_back([&] {
+            while (!done) {
+                for (uid_t uid = 0; uid < kUids; uid++) {
+                    for (size_t p = 0; p < permissions.size(); p++) {
+                        const int result = check(permissions[p], 10000 + uid);
+                        if (result == -1) continue;
+                        hits++;
+                        if (result != (expected(uid, p) ? 1 : 0)) mismatches++;
+                    }
+                }
+            }
+        });
+    }
+    for (int w = 0; w < kWriters; w++) {
+        threads[w].join();
+    }
+    done = true;
+    for (size_t i = kWriters; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    EXPECT_EQ(0u, mismatches.load());
+    EXPECT_GT(hits.load(), 0u);
+}
+
+} // namespace android
@@ -64,6 +64,20 @@ bool checkGlError(const char* op, int lineNumber) {
 
 static constexpr bool outputDebugPPMs = false;
 
+/**
+ * Allows to turn off generating programs on a background thread; they are
+ * then all generated on the rendering thread, when first used.
+ */
+#define PROPERTY_PROGRAM_WARMUP "debug.renderengine.program_warmup"
+
+/**
+ * Where the keys of the programs used are kept across boots, to generate
+ * them ahead of time. The directory has to be writable by SurfaceFlinger.
+ */
+#define PROPERTY_PROGRAM_KEYS_PATH "debug.renderengine.program_keys_path"
+static constexpr char kDefaultProgramKeysPath[] =
+        "/data/misc/surfaceflinger/renderengine_program_keys";
+
 void writePPM(const char* basename, GLuint width, GLuint height) {
     ALOGV("writePPM #%s: %d x %d", basename, width, height);
 
@@ -279,6 +293,25 @@ std::unique_ptr<GLESRenderEngine> GLESRenderEngine::create(int hwcFormat, uint32
         ALOGE_IF(protectedDummy == EGL_NO_SURFACE, "can't create protected dummy pbuffer");
     }
 
+    EGLContext warmupContext = EGL_NO_CONTEXT;
+    EGLSurface warmupDummy = EGL_NO_SURFACE;
+    if ((featureFlags & RenderEngine::ENABLE_PROGRAM_WARMUP) &&
+        property_get_bool(PROPERTY_PROGRAM_WARMUP, true)) {
+        // Not a high priority context: it must not hold up composition.
+        warmupContext = createEglContext(display, config, ctxt, /*useContextPriority*/ false,
+                                         Protection::UNPROTECTED);
+        ALOGE_IF(warmupContext == EGL_NO_CONTEXT, "Can't create program warmup context");
+        if (warmupContext != EGL_NO_CONTEXT && !extensions.hasSurfacelessContext()) {
+            warmupDummy = createDummyEglPbufferSurface(display, config, hwcFormat,
+                                                       Protection::UNPROTECTED);
+            if (warmupDummy == EGL_NO_SURFACE) {
+                ALOGE("can't create program warmup dummy pbuffer");
+                eglDestroyContext(display, warmupContext);
+                warmupContext = EGL_NO_CONTEXT;
+            }
+        }
+    }
+
     // now figure out what version of GL did we actually get
     GlesVersion version = parseGlesVersion(extensions.getVersion());
 
@@ -293,6 +326,7 @@ std::unique_ptr<GLESRenderEngine> GLESRenderEngine::create(int hwcFormat, uint32
         case GLES_VERSION_3_0:
             engine = std::make_unique<GLESRenderEngine>(featureFlags, display, config, ctxt, dummy,
                                                         protectedContext, protectedDummy,
+                                                        warmupContext, warmupDummy,
                                                         imageCacheSize);
             break;
     }
@@ -349,7 +383,8 @@ EGLConfig GLESRenderEngine::chooseEglConfig(EGLDisplay display, int format, bool
 
 GLESRenderEngine::GLESRenderEngine(uint32_t featureFlags, EGLDisplay display, EGLConfig config,
                                    EGLContext ctxt, EGLSurface dummy, EGLContext protectedContext,
-                                   EGLSurface protectedDummy, uint32_t imageCacheSize)
+                                   EGLSurface protectedDummy, EGLContext warmupContext,
+                                   EGLSurface warmupDummy, uint32_t imageCacheSize)
       : renderengine::impl::RenderEngine(featureFlags),
         mEGLDisplay(display),
         mEGLConfig(config),
@@ -357,6 +392,8 @@ GLESRenderEngine::GLESRenderEngine(uint32_t featureFlags, EGLDisplay display, EG
         mDummySurface(dummy),
         mProtectedEGLContext(protectedContext),
         mProtectedDummySurface(protectedDummy),
+        mWarmupEGLContext(warmupContext),
+        mWarmupDummySurface(warmupDummy),
         mVpWidth(0),
         mVpHeight(0),
         mFramebufferImageCacheSize(imageCacheSize),
@@ -430,6 +467,8 @@ GLESRenderEngine::GLESRenderEngine(uint32_t featureFlags, EGLDisplay display, EG
 GLESRenderEngine::~GLESRenderEngine() {
     // Destroy the image manager first.
     mImageManager = nullptr;
+    // The warmup context goes away with the display.
+    ProgramCache::getInstance().stopWarmup();
     std::lock_guard<std::mutex> lock(mRenderingMutex);
     unbindFrameBuffer(mDrawingBuffer.get());
     mDrawingBuffer = nullptr;
@@ -459,6 +498,13 @@ Framebuffer* GLESRenderEngine::getFramebufferForDrawing() {
 void GLESRenderEngine::primeCache() const {
     ProgramCache::getInstance().primeCache(mInProtectedContext ? mProtectedEGLContext : mEGLContext,
                                            mFeatureFlags & USE_COLOR_MANAGEMENT);
+
+    if (mWarmupEGLContext != EGL_NO_CONTEXT) {
+        char keysPath[PROPERTY_VALUE_MAX];
+        property_get(PROPERTY_PROGRAM_KEYS_PATH, keysPath, kDefaultProgramKeysPath);
+        ProgramCache::getInstance().startWarmup(mEGLDisplay, mEGLContext, mWarmupEGLContext,
+                                                mWarmupDummySurface, keysPath);
+    }
 }
 
 bool GLESRenderEngine::isCurrent() const {
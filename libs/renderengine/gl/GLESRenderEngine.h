@@ -56,7 +56,7 @@ public:
     GLESRenderEngine(uint32_t featureFlags, // See RenderEngine::FeatureFlag
                      EGLDisplay display, EGLConfig config, EGLContext ctxt, EGLSurface dummy,
                      EGLContext protectedContext, EGLSurface protectedDummy,
-                     uint32_t imageCacheSize);
+                     EGLContext warmupContext, EGLSurface warmupDummy, uint32_t imageCacheSize);
     ~GLESRenderEngine() override EXCLUDES(mRenderingMutex);
 
     std::unique_ptr<Framebuffer> createFramebuffer() override;
@@ -183,6 +183,10 @@ private:
     EGLSurface mDummySurface;
     EGLContext mProtectedEGLContext;
     EGLSurface mProtectedDummySurface;
+    // Shares objects with mEGLContext; ProgramCache generates programs on it
+    // in the background.
+    EGLContext mWarmupEGLContext;
+    EGLSurface mWarmupDummySurface;
     GLuint mProtectedTexName;
     GLint mMaxViewportDims[2];
     GLint mMaxTextureSize;
@@ -18,8 +18,20 @@
 
 #include "ProgramCache.h"
 
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <optional>
+
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <log/log.h>
 #include <renderengine/private/Description.h>
 #include <utils/String8.h>
@@ -77,7 +89,20 @@ Formatter& dedent(Formatter& f) {
     return f;
 }
 
+namespace {
+
+// First line of the keys file. Bump the version whenever the meaning of the
+// Key bits changes, so that stale files are ignored.
+constexpr char kKeysFileHeader[] = "renderengine program keys v1";
+
+} // namespace
+
+ProgramCache::~ProgramCache() {
+    stopWarmup();
+}
+
 void ProgramCache::primeCache(EGLContext context, bool useColorManagement) {
+    std::lock_guard<std::mutex> lock(mMutex);
     auto& cache = mCaches[context];
     uint32_t shaderCount = 0;
     uint32_t keyMask = Key::BLEND_MASK | Key::OPACITY_MASK | Key::ALPHA_MASK | Key::TEXTURE_MASK
@@ -707,31 +732,232 @@ std::unique_ptr<Program> ProgramCache::generateProgram(const Key& needs) {
     return std::make_unique<Program>(needs, vs.string(), fs.string());
 }
 
+Program* ProgramCache::findEquivalentProgram(const Cache& cache, const Key& needs,
+                                            const Description& description) {
+    // Multiplying by an alpha of exactly one, and clipping to rounded corners
+    // with a radius of zero, leave the color unchanged.
+    Key::key_t neutralBits = 0;
+    if (!needs.hasAlpha() && description.color.a == 1.0f) {
+        neutralBits |= Key::ALPHA_LT_ONE;
+    }
+    if (!needs.hasRoundedCorners() && description.cornerRadius == 0.0f) {
+        neutralBits |= Key::ROUNDED_CORNERS_ON;
+    }
+
+    const Key::key_t candidates[] = {Key::ALPHA_LT_ONE, Key::ROUNDED_CORNERS_ON,
+                                     Key::ALPHA_LT_ONE | Key::ROUNDED_CORNERS_ON};
+    for (const Key::key_t extraBits : candidates) {
+        if ((extraBits & neutralBits) != extraBits) {
+            continue;
+        }
+        Key superset(needs);
+        superset.mKey |= extraBits;
+        auto it = cache.find(superset);
+        if (it != cache.end() && it->second->isValid()) {
+            return it->second.get();
+        }
+    }
+    return nullptr;
+}
+
 void ProgramCache::useProgram(EGLContext context, const Description& description) {
     // generate the key for the shader based on the description
     Key needs(computeKey(description));
 
     // look-up the program in the cache
-    auto& cache = mCaches[context];
-    auto it = cache.find(needs);
-    if (it == cache.end()) {
+    Program* program = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto& cache = mCaches[context];
+        auto it = cache.find(needs);
+        if (it != cache.end()) {
+            program = it->second.get();
+        } else if (mWarmupRunning && context == mWarmupTargetContext) {
+            // Draw with an equivalent program, if there is one, rather than
+            // wait for this one to be generated.
+            program = findEquivalentProgram(cache, needs, description);
+            ALOGV_IF(program, ">>> using equivalent program for context %p: needs=%08X", context,
+                     needs.mKey);
+            // Without one, the program is generated right below, so the
+            // warmup thread only has to persist the key.
+            recordKeyLocked(needs, /*generate*/ program != nullptr);
+        }
+    }
+
+    if (program == nullptr) {
         // we didn't find our program, so generate one...
         nsecs_t time = systemTime();
-        it = cache.emplace(needs, generateProgram(needs)).first;
+        std::unique_ptr<Program> generated = generateProgram(needs);
         time = systemTime() - time;
 
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto& cache = mCaches[context];
+        // The warmup thread may have generated it in the meantime.
+        program = cache.try_emplace(needs, std::move(generated)).first->second.get();
+
         ALOGV(">>> generated new program for context %p: needs=%08X, time=%u ms (%zu programs)",
               context, needs.mKey, uint32_t(ns2ms(time)), cache.size());
     }
 
     // here we have a suitable program for this description
-    std::unique_ptr<Program>& program = it->second;
     if (program->isValid()) {
         program->use();
         program->setUniforms(description);
     }
 }
 
+size_t ProgramCache::getSize(const EGLContext context) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mCaches[context].size();
+}
+
+void ProgramCache::startWarmup(EGLDisplay display, EGLContext context, EGLContext warmupContext,
+                               EGLSurface warmupSurface, const std::string& keysPath) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mWarmupRunning || mWarmupThread.joinable()) {
+        return;
+    }
+    mWarmupRunning = true;
+    mWarmupDisplay = display;
+    mWarmupTargetContext = context;
+    mWarmupContext = warmupContext;
+    mWarmupSurface = warmupSurface;
+    mKeysPath = keysPath;
+    mWarmupThread = std::thread([this]() { warmupThreadMain(); });
+    pthread_setname_np(mWarmupThread.native_handle(), "ProgramWarmup");
+}
+
+void ProgramCache::stopWarmup() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWarmupRunning = false;
+    }
+    mWarmupCondition.notify_all();
+    if (mWarmupThread.joinable()) {
+        mWarmupThread.join();
+    }
+}
+
+void ProgramCache::recordKeyLocked(const Key& needs, bool generate) {
+    if (!mRecordedKeys.insert(needs).second) {
+        return;
+    }
+    if (generate) {
+        mPendingKeys.push_back(needs);
+    }
+    mRecordedKeysChanged = true;
+    mWarmupCondition.notify_one();
+}
+
+void ProgramCache::warmupThreadMain() {
+    std::string keysPath;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!eglMakeCurrent(mWarmupDisplay, mWarmupSurface, mWarmupSurface, mWarmupContext)) {
+            ALOGE("Can't make the program warmup context current, programs will not be warmed up");
+            mWarmupRunning = false;
+            return;
+        }
+        keysPath = mKeysPath;
+    }
+
+    const std::vector<Key> keys = loadKeys(keysPath);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // The keys that were recorded while the file was read go after these.
+        mPendingKeys.insert(mPendingKeys.begin(), keys.begin(), keys.end());
+        mRecordedKeys.insert(keys.begin(), keys.end());
+    }
+
+    nsecs_t timeBefore = systemTime();
+    uint32_t shaderCount = 0;
+    while (true) {
+        std::optional<Key> needs;
+        std::vector<Key> recordedKeys;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            const auto& cache = mCaches[mWarmupTargetContext];
+            while (!mPendingKeys.empty() && cache.count(mPendingKeys.front()) != 0) {
+                mPendingKeys.pop_front();
+            }
+            if (!mPendingKeys.empty()) {
+                needs = mPendingKeys.front();
+                mPendingKeys.pop_front();
+            } else if (mRecordedKeysChanged) {
+                mRecordedKeysChanged = false;
+                recordedKeys.assign(mRecordedKeys.begin(), mRecordedKeys.end());
+            } else {
+                if (shaderCount > 0) {
+                    const float compileTimeMs =
+                            static_cast<float>(systemTime() - timeBefore) / 1.0E6;
+                    ALOGD("shader cache warmed up - %u shaders in %f ms", shaderCount,
+                          compileTimeMs);
+                    shaderCount = 0;
+                }
+                mWarmupCondition.wait(mMutex, [this]() REQUIRES(mMutex) {
+                    return !mWarmupRunning || !mPendingKeys.empty() || mRecordedKeysChanged;
+                });
+                timeBefore = systemTime();
+            }
+            if (!mWarmupRunning) {
+                break;
+            }
+        }
+
+        if (needs) {
+            std::unique_ptr<Program> program = generateProgram(*needs);
+            // The program has to be complete before another context uses it.
+            glFinish();
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCaches[mWarmupTargetContext].try_emplace(*needs, std::move(program));
+            shaderCount++;
+        } else if (!recordedKeys.empty()) {
+            saveKeys(keysPath, recordedKeys);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    eglMakeCurrent(mWarmupDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+std::vector<ProgramCache::Key> ProgramCache::loadKeys(const std::string& path) {
+    std::vector<Key> keys;
+    std::string contents;
+    if (!base::ReadFileToString(path, &contents)) {
+        ALOGI("No program keys read from %s", path.c_str());
+        return keys;
+    }
+
+    const std::vector<std::string> lines = base::Split(contents, "\n");
+    if (lines.empty() || lines[0] != kKeysFileHeader) {
+        ALOGW("Ignoring program keys in %s, written by another version", path.c_str());
+        return keys;
+    }
+    for (size_t i = 1; i < lines.size(); i++) {
+        Key key;
+        if (lines[i].empty() || !base::ParseUint(("0x" + lines[i]).c_str(), &key.mKey) ||
+            !key.isValid()) {
+            continue;
+        }
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+void ProgramCache::saveKeys(const std::string& path, const std::vector<Key>& keys) {
+    std::string contents = kKeysFileHeader;
+    for (const Key& key : keys) {
+        contents += base::StringPrintf("\n%08X", key.mKey);
+    }
+
+    // Write to a temporary file first, so a crash never leaves half a file.
+    const std::string tempPath = path + ".tmp";
+    if (!base::WriteStringToFile(contents, tempPath) || rename(tempPath.c_str(), path.c_str())) {
+        ALOGW("Can't save program keys to %s: %s", path.c_str(), strerror(errno));
+        unlink(tempPath.c_str());
+    }
+}
+
 } // namespace gl
 } // namespace renderengine
 } // namespace android
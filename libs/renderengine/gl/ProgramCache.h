@@ -17,11 +17,19 @@
 #ifndef SF_RENDER_ENGINE_PROGRAMCACHE_H
 #define SF_RENDER_ENGINE_PROGRAMCACHE_H
 
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <EGL/egl.h>
 #include <GLES2/gl2.h>
+#include <android-base/thread_annotations.h>
 #include <renderengine/private/Description.h>
 #include <utils/Singleton.h>
 #include <utils/TypeHelpers.h>
@@ -38,6 +46,7 @@ namespace gl {
 
 class Formatter;
 class Program;
+class ProgramCacheTest;
 
 /*
  * This class generates GLSL programs suitable to handle a given
@@ -166,6 +175,16 @@ public:
         }
         inline bool isY410BT2020() const { return (mKey & Y410_BT2020_MASK) == Y410_BT2020_ON; }
 
+        // Whether this is a key that computeKey() can return, e.g. when it
+        // was read back from a file.
+        inline bool isValid() const {
+            constexpr key_t knownBits = BLEND_MASK | OPACITY_MASK | ALPHA_MASK | TEXTURE_MASK |
+                    ROUNDED_CORNERS_MASK | INPUT_TRANSFORM_MATRIX_MASK |
+                    OUTPUT_TRANSFORM_MATRIX_MASK | INPUT_TF_MASK | OUTPUT_TF_MASK |
+                    Y410_BT2020_MASK;
+            return (mKey & ~knownBits) == 0 && getTextureTarget() != TEXTURE_MASK;
+        }
+
         // for use by std::unordered_map
 
         bool operator==(const Key& other) const { return mKey == other.mKey; }
@@ -176,18 +195,44 @@ public:
     };
 
     ProgramCache() = default;
-    ~ProgramCache() = default;
+    ~ProgramCache();
 
     // Generate shaders to populate the cache
     void primeCache(const EGLContext context, bool useColorManagement);
 
-    size_t getSize(const EGLContext context) { return mCaches[context].size(); }
+    // Starts generating programs for |context| on a background thread, with
+    // |warmupContext| current. That context must be in the same share group.
+    // The keys used by earlier runs are read from |keysPath| and generated
+    // first; the keys that miss the cache from now on are generated next, and
+    // added to the file.
+    void startWarmup(EGLDisplay display, EGLContext context, EGLContext warmupContext,
+                     EGLSurface warmupSurface, const std::string& keysPath) EXCLUDES(mMutex);
+    // Stops the background thread. Must be called before the contexts given
+    // to startWarmup() are destroyed.
+    void stopWarmup() EXCLUDES(mMutex);
+
+    size_t getSize(const EGLContext context) EXCLUDES(mMutex);
 
     // useProgram lookup a suitable program in the cache or generates one
     // if none can be found.
-    void useProgram(const EGLContext context, const Description& description);
+    void useProgram(const EGLContext context, const Description& description) EXCLUDES(mMutex);
 
 private:
+    friend class ProgramCacheTest;
+
+    using Cache = std::unordered_map<Key, std::unique_ptr<Program>, Key::Hash>;
+
+    // Returns a cached program that draws |description| exactly like the one
+    // for |needs| would, only with some extra work that has no effect.
+    static Program* findEquivalentProgram(const Cache& cache, const Key& needs,
+                                          const Description& description);
+    // Adds |needs| to the keys to persist and, if |generate| is set, to the
+    // keys to generate in the background.
+    void recordKeyLocked(const Key& needs, bool generate) REQUIRES(mMutex);
+    void warmupThreadMain() EXCLUDES(mMutex);
+    static std::vector<Key> loadKeys(const std::string& path);
+    static void saveKeys(const std::string& path, const std::vector<Key>& keys);
+
     // compute a cache Key from a Description
     static Key computeKey(const Description& description);
     // Generate EOTF based from Key.
@@ -205,10 +250,26 @@ private:
     // generates the fragment shader from the Key
     static String8 generateFragmentShader(const Key& needs);
 
+    // Guards the caches, which the warmup thread adds to, and the warmup state.
+    std::mutex mMutex;
+
     // Key/Value map used for caching Programs. Currently the cache
     // is never shrunk (and the GL program objects are never deleted).
-    std::unordered_map<EGLContext, std::unordered_map<Key, std::unique_ptr<Program>, Key::Hash>>
-            mCaches;
+    std::unordered_map<EGLContext, Cache> mCaches GUARDED_BY(mMutex);
+
+    std::thread mWarmupThread;
+    std::condition_variable_any mWarmupCondition;
+    bool mWarmupRunning GUARDED_BY(mMutex) = false;
+    EGLDisplay mWarmupDisplay GUARDED_BY(mMutex) = EGL_NO_DISPLAY;
+    EGLContext mWarmupTargetContext GUARDED_BY(mMutex) = EGL_NO_CONTEXT;
+    EGLContext mWarmupContext GUARDED_BY(mMutex) = EGL_NO_CONTEXT;
+    EGLSurface mWarmupSurface GUARDED_BY(mMutex) = EGL_NO_SURFACE;
+    std::string mKeysPath GUARDED_BY(mMutex);
+    // Keys waiting to be generated for mWarmupTargetContext.
+    std::deque<Key> mPendingKeys GUARDED_BY(mMutex);
+    // All the keys that are, or are about to be, in the keys file.
+    std::unordered_set<Key, Key::Hash> mRecordedKeys GUARDED_BY(mMutex);
+    bool mRecordedKeysChanged GUARDED_BY(mMutex) = false;
 };
 
 } // namespace gl
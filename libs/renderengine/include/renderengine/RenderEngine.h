@@ -66,6 +66,10 @@ public:
 
         // Create a protected context when if possible
         ENABLE_PROTECTED_CONTEXT = 1 << 2,
+
+        // Generate programs in the background, from the keys persisted by
+        // earlier runs and from cache misses
+        ENABLE_PROGRAM_WARMUP = 1 << 3,
     };
 
     static std::unique_ptr<impl::RenderEngine> create(int hwcFormat, uint32_t featureFlags,
@@ -0,0 +1,260 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <android-base/test_utils.h>
+#include <gtest/gtest.h>
+#include <renderengine/private/Description.h>
+#include "../gl/Program.h"
+#include "../gl/ProgramCache.h"
+
+namespace android {
+namespace renderengine {
+namespace gl {
+
+using Key = ProgramCache::Key;
+
+// Drives a ProgramCache of its own, with a context for rendering and one in
+// the same share group for the warmup thread.
+class ProgramCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        ASSERT_NE(EGL_NO_DISPLAY, mDisplay);
+        ASSERT_TRUE(eglInitialize(mDisplay, nullptr, nullptr));
+
+        const EGLint configAttribs[] = {EGL_SURFACE_TYPE,
+                                        EGL_PBUFFER_BIT,
+                                        EGL_RENDERABLE_TYPE,
+                                        EGL_OPENGL_ES2_BIT,
+                                        EGL_RED_SIZE,
+                                        8,
+                                        EGL_GREEN_SIZE,
+                                        8,
+                                        EGL_BLUE_SIZE,
+                                        8,
+                                        EGL_ALPHA_SIZE,
+                                        8,
+                                        EGL_NONE};
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        ASSERT_TRUE(eglChooseConfig(mDisplay, configAttribs, &config, 1, &numConfigs));
+        ASSERT_EQ(1, numConfigs);
+
+        const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+        mContext = eglCreateContext(mDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+        ASSERT_NE(EGL_NO_CONTEXT, mContext);
+        mWarmupContext = eglCreateContext(mDisplay, config, mContext, contextAttribs);
+        ASSERT_NE(EGL_NO_CONTEXT, mWarmupContext);
+
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        mSurface = eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+        ASSERT_NE(EGL_NO_SURFACE, mSurface);
+        mWarmupSurface = eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+        ASSERT_NE(EGL_NO_SURFACE, mWarmupSurface);
+
+        ASSERT_TRUE(eglMakeCurrent(mDisplay, mSurface, mSurface, mContext));
+        mCache = std::make_unique<ProgramCache>();
+        mKeysPath = std::string(mKeysDir.path) + "/program_keys";
+    }
+
+    void TearDown() override {
+        // The warmup thread must be done with its context first.
+        mCache = nullptr;
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(mDisplay, mWarmupSurface);
+        eglDestroySurface(mDisplay, mSurface);
+        eglDestroyContext(mDisplay, mWarmupContext);
+        eglDestroyContext(mDisplay, mContext);
+    }
+
+    static Description opaqueColor() {
+        Description description;
+        description.color = half4(1.0f, 0.0f, 0.0f, 1.0f);
+        description.isOpaque = true;
+        return description;
+    }
+
+    static Key computeKey(const Description& description) {
+        return ProgramCache::computeKey(description);
+    }
+
+    static Key withBits(Key key, uint32_t mask, uint32_t value) {
+        return key.set(mask, value);
+    }
+
+    void startWarmup() {
+        mCache->startWarmup(mDisplay, mContext, mWarmupContext, mWarmupSurface, mKeysPath);
+    }
+
+    void addProgram(const Key& key) {
+        std::unique_ptr<Program> program = ProgramCache::generateProgram(key);
+        ASSERT_TRUE(program->isValid());
+        std::lock_guard<std::mutex> lock(mCache->mMutex);
+        mCache->mCaches[mContext].emplace(key, std::move(program));
+    }
+
+    Program* getProgram(const Key& key) {
+        std::lock_guard<std::mutex> lock(mCache->mMutex);
+        auto& cache = mCache->mCaches[mContext];
+        auto it = cache.find(key);
+        return it == cache.end() ? nullptr : it->second.get();
+    }
+
+    Program* findEquivalentProgram(const Description& description) {
+        std::lock_guard<std::mutex> lock(mCache->mMutex);
+        return ProgramCache::findEquivalentProgram(mCache->mCaches[mContext],
+                                                   computeKey(description), description);
+    }
+
+    size_t getPendingKeyCount() {
+        std::lock_guard<std::mutex> lock(mCache->mMutex);
+        return mCache->mPendingKeys.size();
+    }
+
+    void saveKeys(const std::vector<Key>& keys) { ProgramCache::saveKeys(mKeysPath, keys); }
+
+    bool isKeySaved(const Key& key) {
+        const std::vector<Key> keys = ProgramCache::loadKeys(mKeysPath);
+        return std::find(keys.begin(), keys.end(), key) != keys.end();
+    }
+
+    static bool waitFor(const std::function<bool()>& condition) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    }
+
+    EGLDisplay mDisplay = EGL_NO_DISPLAY;
+    EGLContext mContext = EGL_NO_CONTEXT;
+    EGLContext mWarmupContext = EGL_NO_CONTEXT;
+    EGLSurface mSurface = EGL_NO_SURFACE;
+    EGLSurface mWarmupSurface = EGL_NO_SURFACE;
+    TemporaryDir mKeysDir;
+    std::string mKeysPath;
+    std::unique_ptr<ProgramCache> mCache;
+};
+
+TEST_F(ProgramCacheTest, keysRoundTripThroughFile) {
+    const Key key = computeKey(opaqueColor());
+    Description rounded = opaqueColor();
+    rounded.cornerRadius = 4.0f;
+    const Key roundedKey = computeKey(rounded);
+
+    saveKeys({key, roundedKey});
+    const std::vector<Key> keys = ProgramCache::loadKeys(mKeysPath);
+    ASSERT_EQ(2u, keys.size());
+    EXPECT_EQ(key, keys[0]);
+    EXPECT_EQ(roundedKey, keys[1]);
+}
+
+TEST_F(ProgramCacheTest, equivalentProgramForNeutralAlpha) {
+    const Description description = opaqueColor();
+    const Key needs = computeKey(description);
+    ASSERT_FALSE(needs.hasAlpha());
+    EXPECT_EQ(nullptr, findEquivalentProgram(description));
+
+    const Key superset = withBits(needs, Key::ALPHA_MASK, Key::ALPHA_LT_ONE);
+    addProgram(superset);
+    EXPECT_EQ(getProgram(superset), findEquivalentProgram(description));
+}
+
+TEST_F(ProgramCacheTest, equivalentProgramForNeutralRoundedCorners) {
+    const Description description = opaqueColor();
+    const Key needs = computeKey(description);
+    ASSERT_FALSE(needs.hasRoundedCorners());
+
+    const Key superset = withBits(needs, Key::ROUNDED_CORNERS_MASK, Key::ROUNDED_CORNERS_ON);
+    addProgram(superset);
+    EXPECT_EQ(getProgram(superset), findEquivalentProgram(description));
+}
+
+TEST_F(ProgramCacheTest, equivalentProgramForNeutralAlphaAndRoundedCorners) {
+    const Description description = opaqueColor();
+    const Key superset =
+            withBits(withBits(computeKey(description), Key::ALPHA_MASK, Key::ALPHA_LT_ONE),
+                     Key::ROUNDED_CORNERS_MASK, Key::ROUNDED_CORNERS_ON);
+    addProgram(superset);
+    EXPECT_EQ(getProgram(superset), findEquivalentProgram(description));
+}
+
+TEST_F(ProgramCacheTest, noEquivalentProgramThatChangesOutput) {
+    const Description description = opaqueColor();
+    const Key needs = computeKey(description);
+
+    // Other blending, or another output transfer function, draws differently.
+    addProgram(withBits(needs, Key::BLEND_MASK,
+                        needs.isPremultiplied() ? Key::BLEND_NORMAL : Key::BLEND_PREMULT));
+    addProgram(withBits(withBits(needs, Key::ALPHA_MASK, Key::ALPHA_LT_ONE), Key::OUTPUT_TF_MASK,
+                        needs.getOutputTF() == Key::OUTPUT_TF_SRGB ? Key::OUTPUT_TF_LINEAR
+                                                                   : Key::OUTPUT_TF_SRGB));
+    EXPECT_EQ(nullptr, findEquivalentProgram(description));
+}
+
+TEST_F(ProgramCacheTest, warmupGeneratesSavedKeys) {
+    Description description = opaqueColor();
+    description.cornerRadius = 4.0f;
+    const Key key = computeKey(description);
+    saveKeys({key});
+    ASSERT_EQ(nullptr, getProgram(key));
+
+    startWarmup();
+    EXPECT_TRUE(waitFor([&]() { return getProgram(key) != nullptr; }));
+    EXPECT_TRUE(getProgram(key)->isValid());
+}
+
+TEST_F(ProgramCacheTest, missWithEquivalentIsGeneratedInBackground) {
+    const Description description = opaqueColor();
+    const Key needs = computeKey(description);
+    const Key superset = withBits(needs, Key::ALPHA_MASK, Key::ALPHA_LT_ONE);
+    addProgram(superset);
+
+    startWarmup();
+    mCache->useProgram(mContext, description);
+
+    EXPECT_TRUE(waitFor([&]() { return getProgram(needs) != nullptr; }));
+    EXPECT_TRUE(waitFor([&]() { return isKeySaved(needs); }));
+}
+
+TEST_F(ProgramCacheTest, missWithoutEquivalentIsOnlySaved) {
+    const Description description = opaqueColor();
+    const Key needs = computeKey(description);
+
+    startWarmup();
+    mCache->useProgram(mContext, description);
+
+    // Generated right away, so the warmup thread has nothing to generate.
+    EXPECT_NE(nullptr, getProgram(needs));
+    EXPECT_EQ(0u, getPendingKeyCount());
+    EXPECT_TRUE(waitFor([&]() { return isKeySaved(needs); }));
+}
+
+} // namespace gl
+} // namespace renderengine
+} // namespace android
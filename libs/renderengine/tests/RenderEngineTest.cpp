@@ -31,6 +31,8 @@ namespace android {
 
 struct RenderEngineTest : public ::testing::Test {
     static void SetUpTestSuite() {
+        // No ENABLE_PROGRAM_WARMUP: the warmup thread would save the program
+        // keys under /data/misc/surfaceflinger. ProgramCacheTest covers it.
         sRE = renderengine::gl::GLESRenderEngine::create(static_cast<int32_t>(
                                                                  ui::PixelFormat::RGBA_8888),
                                                          0, 1);
@@ -18,6 +18,9 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include <android-base/stringprintf.h>
 
@@ -65,10 +68,43 @@ enum {
 
 const Region Region::INVALID_REGION(Rect::INVALID_RECT);
 
+// Empty regions share this storage, so creating or clearing one doesn't
+// allocate. It is never destroyed since regions may outlive it otherwise.
+static const Vector<Rect>& emptyStorage() {
+    static const Vector<Rect>* const storage = [] {
+        Vector<Rect>* v = new Vector<Rect>();
+        v->add(Rect(0, 0));
+        return v;
+    }();
+    return *storage;
+}
+
+// Rect is four int32_t, so a whole rect can be processed as one 128-bit
+// vector, which the compiler lowers to SSE2 or NEON.
+typedef int32_t rect_vector __attribute__((vector_size(16)));
+typedef float rect_vector_f __attribute__((vector_size(16)));
+static_assert(sizeof(Rect) == sizeof(rect_vector), "Rect must be four int32_t");
+
+static inline rect_vector loadRect(const ARect& rect) {
+    rect_vector v;
+    memcpy(&v, &rect, sizeof(v));
+    return v;
+}
+
+static inline void storeRect(ARect& rect, rect_vector v) {
+    memcpy(&rect, &v, sizeof(v));
+}
+
+static inline bool containsRect(const Rect& outer, const Rect& inner) {
+    return outer.left <= inner.left && outer.top <= inner.top &&
+            outer.right >= inner.right && outer.bottom >= inner.bottom;
+}
+
 // ----------------------------------------------------------------------------
 
-Region::Region() {
-    mStorage.add(Rect(0,0));
+Region::Region()
+    : mStorage(emptyStorage())
+{
 }
 
 Region::Region(const Region& rhs)
@@ -255,8 +291,7 @@ bool Region::contains(int x, int y) const {
 
 void Region::clear()
 {
-    mStorage.clear();
-    mStorage.add(Rect(0,0));
+    mStorage = emptyStorage();
 }
 
 void Region::set(const Rect& r)
@@ -336,13 +371,14 @@ Region& Region::translateSelf(int x, int y) {
 }
 
 Region& Region::scaleSelf(float sx, float sy) {
+    const rect_vector_f scale = {sx, sy, sx, sy};
+    const rect_vector_f rounding = {0.5f, 0.5f, 0.5f, 0.5f};
     size_t count = mStorage.size();
     Rect* rects = mStorage.editArray();
     while (count) {
-        rects->left = static_cast<int32_t>(static_cast<float>(rects->left) * sx + 0.5f);
-        rects->right = static_cast<int32_t>(static_cast<float>(rects->right) * sx + 0.5f);
-        rects->top = static_cast<int32_t>(static_cast<float>(rects->top) * sy + 0.5f);
-        rects->bottom = static_cast<int32_t>(static_cast<float>(rects->bottom) * sy + 0.5f);
+        const rect_vector_f scaled =
+                __builtin_convertvector(loadRect(*rects), rect_vector_f) * scale + rounding;
+        storeRect(*rects, __builtin_convertvector(scaled, rect_vector));
         rects++;
         count--;
     }
@@ -438,18 +474,22 @@ const Region Region::operation(const Region& rhs, int dx, int dy, uint32_t op) c
 // ----------------------------------------------------------------------------
 
 // This is our region rasterizer, which merges rects and spans together
-// to obtain an optimal region.
+// to obtain an optimal region. Spans are written straight into the
+// destination and merged with the span above them in place, so rasterizing
+// doesn't need a buffer of its own.
 class Region::rasterizer : public region_operator<Rect>::region_rasterizer
 {
     Rect bounds;
     Vector<Rect>& storage;
-    Rect* head;
-    Rect* tail;
-    Vector<Rect> span;
-    Rect* cur;
+    // storage[head, tail) is the previous span and storage[tail, size) the
+    // current one. Rects past size are left over from merged spans and get
+    // overwritten or trimmed.
+    size_t head;
+    size_t tail;
+    size_t size;
 public:
     explicit rasterizer(Region& reg)
-        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), cur() {
+        : bounds(INT_MAX, 0, INT_MIN, 0), storage(reg.mStorage), head(), tail(), size() {
         storage.clear();
     }
 
@@ -468,47 +508,55 @@ private:
 
 Region::rasterizer::~rasterizer()
 {
-    if (span.size()) {
+    if (size > tail) {
         flushSpan();
     }
-    if (storage.size()) {
+    if (storage.size() > size) {
+        storage.removeItemsAt(size, storage.size() - size);
+    }
+    if (size == 0) {
+        storage = emptyStorage();
+    } else if (size > 1) {
         bounds.top = storage.itemAt(0).top;
-        bounds.bottom = storage.top().bottom;
-        if (storage.size() == 1) {
-            storage.clear();
-        }
-    } else {
-        bounds.left  = 0;
-        bounds.right = 0;
+        bounds.bottom = storage.itemAt(size - 1).bottom;
+        storage.add(bounds);
     }
-    storage.add(bounds);
+    // else the only rect is also the bounds
 }
 
 void Region::rasterizer::operator()(const Rect& rect)
 {
     //ALOGD(">>> %3d, %3d, %3d, %3d",
     //        rect.left, rect.top, rect.right, rect.bottom);
-    if (span.size()) {
-        if (cur->top != rect.top) {
+    if (size > tail) {
+        Rect& cur = storage.editItemAt(size - 1);
+        if (cur.top != rect.top) {
             flushSpan();
-        } else if (cur->right == rect.left) {
-            cur->right = rect.right;
+        } else if (cur.right == rect.left) {
+            cur.right = rect.right;
             return;
         }
     }
-    span.add(rect);
-    cur = span.editArray() + (span.size() - 1);
+    if (size < storage.size()) {
+        storage.editItemAt(size) = rect;
+    } else {
+        storage.add(rect);
+    }
+    size++;
 }
 
 void Region::rasterizer::flushSpan()
 {
+    Rect* const rects = storage.editArray();
+    Rect* const span = rects + tail;
+    const size_t count = size - tail;
     bool merge = false;
-    if (tail-head == ssize_t(span.size())) {
-        Rect const* p = span.editArray();
-        Rect const* q = head;
+    if (tail - head == count) {
+        Rect const* p = span;
+        Rect const* q = rects + head;
         if (p->top == q->bottom) {
             merge = true;
-            while (q != tail) {
+            while (q != span) {
                 if ((p->left != q->left) || (p->right != q->right)) {
                     merge = false;
                     break;
@@ -519,20 +567,19 @@ void Region::rasterizer::flushSpan()
         }
     }
     if (merge) {
-        const int bottom = span[0].bottom;
-        Rect* r = head;
-        while (r != tail) {
+        const int bottom = span->bottom;
+        Rect* r = rects + head;
+        while (r != span) {
             r->bottom = bottom;
             r++;
         }
+        size = tail;
     } else {
-        bounds.left = min(span.itemAt(0).left, bounds.left);
-        bounds.right = max(span.top().right, bounds.right);
-        storage.appendVector(span);
-        tail = storage.editArray() + storage.size();
-        head = tail - span.size();
+        bounds.left = min(span->left, bounds.left);
+        bounds.right = max(rects[size - 1].right, bounds.right);
+        head = tail;
+        tail = size;
     }
-    span.clear();
 }
 
 bool Region::validate(const Region& reg, const char* name, bool silent)
@@ -615,6 +662,102 @@ bool Region::validate(const Region& reg, const char* name, bool silent)
     return result;
 }
 
+/*
+ * Most operations are on layer bounds, where the result is empty, one of the
+ * operands, or a single rect. Those are handled here without rasterizing;
+ * false is returned when the general path is needed. |rhs| is null when the
+ * right hand side is the rect |rhsBounds|, which is already translated.
+ */
+static bool trivial_operation(uint32_t op, Region& dst, const Region& lhs,
+        const Region* rhs, const Rect& rhsBounds, int dx, int dy)
+{
+    const Rect lhsBounds(lhs.getBounds());
+    const bool lhsEmpty = lhsBounds.isEmpty();
+    const bool rhsEmpty = rhsBounds.isEmpty();
+    const bool lhsIsRect = lhs.isRect();
+    const bool rhsIsRect = rhs == nullptr || rhs->isRect();
+
+    Rect overlap;
+    const bool overlapping = !lhsEmpty && !rhsEmpty && lhsBounds.intersect(rhsBounds, &overlap);
+
+    // the operands are only read before dst is written, as dst may be one of them
+    auto setLhs = [&]() {
+        dst = lhs;
+    };
+    auto setRhs = [&]() {
+        if (rhs == nullptr) {
+            dst.set(rhsBounds);
+        } else {
+            dst = *rhs;
+            dst.translateSelf(dx, dy);
+        }
+    };
+
+    switch (op) {
+        case op_and:
+            if (!overlapping) {
+                dst.clear();
+            } else if (lhsIsRect && rhsIsRect) {
+                dst.set(overlap);
+            } else if (rhsIsRect && containsRect(rhsBounds, lhsBounds)) {
+                setLhs();
+            } else if (lhsIsRect && containsRect(lhsBounds, rhsBounds)) {
+                setRhs();
+            } else {
+                return false;
+            }
+            return true;
+        case op_nand:
+            if (lhsEmpty) {
+                dst.clear();
+            } else if (!overlapping) {
+                setLhs();
+            } else if (rhsIsRect && containsRect(rhsBounds, lhsBounds)) {
+                dst.clear();
+            } else {
+                return false;
+            }
+            return true;
+        case op_or:
+            if (lhsEmpty && rhsEmpty) {
+                dst.clear();
+            } else if (lhsEmpty) {
+                setRhs();
+            } else if (rhsEmpty) {
+                setLhs();
+            } else if (lhsIsRect && containsRect(lhsBounds, rhsBounds)) {
+                setLhs();
+            } else if (rhsIsRect && containsRect(rhsBounds, lhsBounds)) {
+                setRhs();
+            } else if (lhsIsRect && rhsIsRect &&
+                    ((lhsBounds.left == rhsBounds.left && lhsBounds.right == rhsBounds.right &&
+                      lhsBounds.top <= rhsBounds.bottom && rhsBounds.top <= lhsBounds.bottom) ||
+                     (lhsBounds.top == rhsBounds.top && lhsBounds.bottom == rhsBounds.bottom &&
+                      lhsBounds.left <= rhsBounds.right && rhsBounds.left <= lhsBounds.right))) {
+                // two rects that line up and touch or overlap make one rect
+                dst.set(Rect(std::min(lhsBounds.left, rhsBounds.left),
+                             std::min(lhsBounds.top, rhsBounds.top),
+                             std::max(lhsBounds.right, rhsBounds.right),
+                             std::max(lhsBounds.bottom, rhsBounds.bottom)));
+            } else {
+                return false;
+            }
+            return true;
+        case op_xor:
+            if (lhsEmpty && rhsEmpty) {
+                dst.clear();
+            } else if (lhsEmpty) {
+                setRhs();
+            } else if (rhsEmpty) {
+                setLhs();
+            } else {
+                return false;
+            }
+            return true;
+    }
+    return false;
+}
+
 void Region::boolean_operation(uint32_t op, Region& dst,
         const Region& lhs,
         const Region& rhs, int dx, int dy)
@@ -625,6 +768,15 @@ void Region::boolean_operation(uint32_t op, Region& dst,
     validate(dst, "boolean_operation (before): dst");
 #endif
 
+#if !VALIDATE_WITH_CORECG
+    if (trivial_operation(op, dst, lhs, &rhs, rhs.getBounds().offsetBy(dx, dy), dx, dy)) {
+#if defined(VALIDATE_REGIONS)
+        validate(dst, "boolean_operation (trivial): dst");
+#endif
+        return;
+    }
+#endif
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -740,6 +892,10 @@ void Region::boolean_operation(uint32_t op, Region& dst,
 #if VALIDATE_WITH_CORECG || defined(VALIDATE_REGIONS)
     boolean_operation(op, dst, lhs, Region(rhs), dx, dy);
 #else
+    if (trivial_operation(op, dst, lhs, nullptr, Rect(rhs).offsetBy(dx, dy), dx, dy)) {
+        return;
+    }
+
     size_t lhs_count;
     Rect const * const lhs_rects = lhs.getArray(&lhs_count);
 
@@ -772,10 +928,11 @@ void Region::translate(Region& reg, int dx, int dy)
 #if defined(VALIDATE_REGIONS)
         validate(reg, "translate (before)");
 #endif
+        const rect_vector offset = {dx, dy, dx, dy};
         size_t count = reg.mStorage.size();
         Rect* rects = reg.mStorage.editArray();
         while (count) {
-            rects->offsetBy(dx, dy);
+            storeRect(*rects, loadRect(*rects) + offset);
             rects++;
             count--;
         }
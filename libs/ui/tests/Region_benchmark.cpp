@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the Region boolean operations with the reference implementation
+// they replaced: every operation rasterized through a heap allocated span
+// buffer, with no shortcut for results that are empty, one of the operands,
+// or a single rect.
+
+#include <benchmark/benchmark.h>
+#include <ui/Rect.h>
+#include <ui/Region.h>
+#include <utils/Vector.h>
+
+#include <private/ui/RegionHelper.h>
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace android {
+namespace {
+
+using Operator = region_operator<Rect>;
+
+class ReferenceRasterizer : public Operator::region_rasterizer {
+public:
+    explicit ReferenceRasterizer(Vector<Rect>& storage)
+          : mBounds(INT_MAX, 0, INT_MIN, 0), mStorage(storage), mHead(), mTail(), mCur() {
+        mStorage.clear();
+    }
+
+    ~ReferenceRasterizer() override {
+        if (mSpan.size()) {
+            flushSpan();
+        }
+        if (mStorage.size()) {
+            mBounds.top = mStorage.itemAt(0).top;
+            mBounds.bottom = mStorage.top().bottom;
+            if (mStorage.size() == 1) {
+                mStorage.clear();
+            }
+        } else {
+            mBounds.left = 0;
+            mBounds.right = 0;
+        }
+        mStorage.add(mBounds);
+    }
+
+    void operator()(const Rect& rect) override {
+        if (mSpan.size()) {
+            if (mCur->top != rect.top) {
+                flushSpan();
+            } else if (mCur->right == rect.left) {
+                mCur->right = rect.right;
+                return;
+            }
+        }
+        mSpan.add(rect);
+        mCur = mSpan.editArray() + (mSpan.size() - 1);
+    }
+
+private:
+    void flushSpan() {
+        bool merge = false;
+        if (mTail - mHead == ssize_t(mSpan.size())) {
+            const Rect* p = mSpan.editArray();
+            const Rect* q = mHead;
+            if (p->top == q->bottom) {
+                merge = true;
+                while (q != mTail) {
+                    if ((p->left != q->left) || (p->right != q->right)) {
+                        merge = false;
+                        break;
+                    }
+                    p++;
+                    q++;
+                }
+            }
+        }
+        if (merge) {
+            const int bottom = mSpan[0].bottom;
+            for (Rect* r = mHead; r != mTail; r++) {
+                r->bottom = bottom;
+            }
+        } else {
+            mBounds.left = std::min(mSpan.itemAt(0).left, mBounds.left);
+            mBounds.right = std::max(mSpan.top().right, mBounds.right);
+            mStorage.appendVector(mSpan);
+            mTail = mStorage.editArray() + mStorage.size();
+            mHead = mTail - mSpan.size();
+        }
+        mSpan.clear();
+    }
+
+    Rect mBounds;
+    Vector<Rect>& mStorage;
+    Rect* mHead;
+    Rect* mTail;
+    Vector<Rect> mSpan;
+    Rect* mCur;
+};
+
+// Regions of the reference implementation are kept in the same layout as
+// Region::mStorage: the rects followed by the bounds, or just one rect.
+Vector<Rect> referenceRegion(const Rect& rect) {
+    Vector<Rect> storage;
+    storage.add(rect);
+    return storage;
+}
+
+Vector<Rect> referenceOperation(uint32_t op, const Vector<Rect>& lhs, const Vector<Rect>& rhs) {
+    const size_t lhsCount = lhs.size() == 1 ? 1 : lhs.size() - 1;
+    const size_t rhsCount = rhs.size() == 1 ? 1 : rhs.size() - 1;
+
+    Vector<Rect> result;
+    Operator::region lhsRegion(lhs.array(), lhsCount);
+    Operator::region rhsRegion(rhs.array(), rhsCount);
+    Operator operation(op, lhsRegion, rhsRegion);
+    { // scope for rasterizer (dtor has side effects)
+        ReferenceRasterizer r(result);
+        operation(r);
+    }
+    return result;
+}
+
+// Layer-like rects on a 1080x2340 screen: mostly full width bars and
+// windows, some of them stacked on top of each other.
+std::vector<Rect> makeLayerRects(size_t count) {
+    srandom(1234);
+    std::vector<Rect> rects;
+    rects.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        const int top = random() % 2200;
+        const int height = 40 + random() % 800;
+        if (random() % 2) {
+            rects.emplace_back(0, top, 1080, top + height);
+        } else {
+            const int left = random() % 900;
+            rects.emplace_back(left, top, left + 100 + random() % 600, top + height);
+        }
+    }
+    return rects;
+}
+
+// The region math of computeVisibleRegions() for a stack of layers.
+void BM_VisibleRegions(benchmark::State& state) {
+    const auto rects = makeLayerRects(state.range(0));
+    for (auto _ : state) {
+        Region aboveOpaque;
+        Region aboveCovered;
+        for (const Rect& rect : rects) {
+            const Region footprint(rect);
+            benchmark::DoNotOptimize(aboveCovered.intersect(footprint));
+            aboveCovered.orSelf(footprint);
+            benchmark::DoNotOptimize(footprint.subtract(aboveOpaque));
+            aboveOpaque.orSelf(footprint);
+        }
+    }
+}
+BENCHMARK(BM_VisibleRegions)->Arg(8)->Arg(32)->Arg(120);
+
+void BM_VisibleRegions_Reference(benchmark::State& state) {
+    const auto rects = makeLayerRects(state.range(0));
+    for (auto _ : state) {
+        Vector<Rect> aboveOpaque = referenceRegion(Rect(0, 0));
+        Vector<Rect> aboveCovered = referenceRegion(Rect(0, 0));
+        for (const Rect& rect : rects) {
+            const Vector<Rect> footprint = referenceRegion(rect);
+            benchmark::DoNotOptimize(
+                    referenceOperation(Operator::op_and, aboveCovered, footprint));
+            aboveCovered = referenceOperation(Operator::op_or, aboveCovered, footprint);
+            benchmark::DoNotOptimize(
+                    referenceOperation(Operator::op_nand, footprint, aboveOpaque));
+            aboveOpaque = referenceOperation(Operator::op_or, aboveOpaque, footprint);
+        }
+    }
+}
+BENCHMARK(BM_VisibleRegions_Reference)->Arg(8)->Arg(32)->Arg(120);
+
+void BM_IntersectRects(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 2340));
+    const Region rhs(Rect(100, 200, 700, 900));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(lhs.intersect(rhs));
+    }
+}
+BENCHMARK(BM_IntersectRects);
+
+void BM_IntersectRects_Reference(benchmark::State& state) {
+    const Vector<Rect> lhs = referenceRegion(Rect(0, 0, 1080, 2340));
+    const Vector<Rect> rhs = referenceRegion(Rect(100, 200, 700, 900));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(referenceOperation(Operator::op_and, lhs, rhs));
+    }
+}
+BENCHMARK(BM_IntersectRects_Reference);
+
+void BM_SubtractRect(benchmark::State& state) {
+    const Region lhs(Rect(0, 0, 1080, 2340));
+    const Region rhs(Rect(100, 200, 700, 900));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(lhs.subtract(rhs));
+    }
+}
+BENCHMARK(BM_SubtractRect);
+
+void BM_SubtractRect_Reference(benchmark::State& state) {
+    const Vector<Rect> lhs = referenceRegion(Rect(0, 0, 1080, 2340));
+    const Vector<Rect> rhs = referenceRegion(Rect(100, 200, 700, 900));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(referenceOperation(Operator::op_nand, lhs, rhs));
+    }
+}
+BENCHMARK(BM_SubtractRect_Reference);
+
+void BM_Translate(benchmark::State& state) {
+    Region region;
+    for (const Rect& rect : makeLayerRects(state.range(0))) {
+        region.orSelf(rect);
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(region.translate(3, -7));
+    }
+}
+BENCHMARK(BM_Translate)->Arg(8)->Arg(120);
+
+} // namespace
+} // namespace android
+
+BENCHMARK_MAIN();
@@ -152,5 +152,62 @@ TEST_F(RegionTest, Random_TJunction) {
     }
 }
 
+TEST_F(RegionTest, Random_BooleanOperations) {
+    srandom(54321);
+    auto randomRect = []() {
+        const int l = random() % X_MAX;
+        const int t = random() % Y_MAX;
+        return Rect(l, t, l + random() % (X_MAX - l + 1), t + random() % (Y_MAX - t + 1));
+    };
+    auto randomRegion = [&]() {
+        Region r;
+        for (int i = random() % 4; i > 0; i--) {
+            if (random() % 3) {
+                r.orSelf(randomRect());
+            } else {
+                r.subtractSelf(randomRect());
+            }
+        }
+        return r;
+    };
+
+    for (int iter = 0; iter < ITER_MAX; iter++) {
+        const Region lhs = randomRegion();
+        const Region rhs = randomRegion();
+        const Rect rect = randomRect();
+        const Region results[] = {lhs.merge(rhs), lhs.intersect(rhs), lhs.subtract(rhs),
+                                  lhs.mergeExclusive(rhs), lhs.merge(rect), lhs.intersect(rect),
+                                  lhs.subtract(rect), lhs.mergeExclusive(rect)};
+        for (int y = -1; y <= Y_MAX; y++) {
+            for (int x = -1; x <= X_MAX; x++) {
+                const bool a = lhs.contains(x, y);
+                const bool b = rhs.contains(x, y);
+                const bool c = x >= rect.left && x < rect.right && y >= rect.top && y < rect.bottom;
+                ASSERT_EQ(a || b, results[0].contains(x, y));
+                ASSERT_EQ(a && b, results[1].contains(x, y));
+                ASSERT_EQ(a && !b, results[2].contains(x, y));
+                ASSERT_EQ(a != b, results[3].contains(x, y));
+                ASSERT_EQ(a || c, results[4].contains(x, y));
+                ASSERT_EQ(a && c, results[5].contains(x, y));
+                ASSERT_EQ(a && !c, results[6].contains(x, y));
+                ASSERT_EQ(a != c, results[7].contains(x, y));
+            }
+        }
+    }
+}
+
+TEST_F(RegionTest, EmptyResults) {
+    // an empty result is always the canonical empty region, whatever the operands
+    const Region results[] = {Region::INVALID_REGION.subtract(Rect(0, 0, 10, 10)),
+                              Region(Rect(0, 0, 10, 10)).intersect(Rect(20, 20, 30, 30)),
+                              Region(Rect(0, 0, 10, 10)).subtract(Rect(-5, -5, 15, 15)),
+                              Region().merge(Region::INVALID_REGION)};
+    for (const Region& r : results) {
+        EXPECT_TRUE(r.isEmpty());
+        EXPECT_TRUE(r.isRect());
+        EXPECT_EQ(Rect(0, 0), r.getBounds());
+    }
+}
+
 }; // namespace android
 
@@ -1781,7 +1781,8 @@ void SensorService::UidPolicy::unregisterSelf() {
     am.unregisterUidObserver(this);
 }
 
-void SensorService::UidPolicy::onUidGone(__unused uid_t uid, __unused bool disabled) {
+void SensorService::UidPolicy::onUidGone(uid_t uid, bool disabled) {
+    PermissionCache::purgeUid(uid);
     onUidIdle(uid, disabled);
 }
 
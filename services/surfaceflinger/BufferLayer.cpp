@@ -266,8 +266,13 @@ void BufferLayer::setPerFrameData(const sp<const DisplayDevice>& displayDevice,
     const auto outputLayer = findOutputLayerForDisplay(displayDevice);
     LOG_FATAL_IF(!outputLayer || !outputLayer->getState().hwc);
 
-    auto& hwcLayer = (*outputLayer->getState().hwc).hwcLayer;
-    auto error = hwcLayer->setVisibleRegion(visible);
+    auto& hwcState = *outputLayer->editState().hwc;
+    auto& hwcLayer = hwcState.hwcLayer;
+    auto& committed = hwcState.committed;
+    auto error = hwcState.writeIfChanged(committed.visibleRegion, visible,
+                                         [&](const Region& region) {
+                                             return hwcLayer->setVisibleRegion(region);
+                                         });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set visible region: %s (%d)", mName.string(),
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -277,7 +282,10 @@ void BufferLayer::setPerFrameData(const sp<const DisplayDevice>& displayDevice,
 
     auto& layerCompositionState = getCompositionLayer()->editState().frontEnd;
 
-    error = hwcLayer->setSurfaceDamage(surfaceDamageRegion);
+    error = hwcState.writeIfChanged(committed.surfaceDamage, surfaceDamageRegion,
+                                    [&](const Region& damage) {
+                                        return hwcLayer->setSurfaceDamage(damage);
+                                    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set surface damage: %s (%d)", mName.string(),
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -311,7 +319,9 @@ void BufferLayer::setPerFrameData(const sp<const DisplayDevice>& displayDevice,
     ui::Dataspace dataspace = isColorSpaceAgnostic() && targetDataspace != ui::Dataspace::UNKNOWN
             ? targetDataspace
             : mCurrentDataSpace;
-    error = hwcLayer->setDataspace(dataspace);
+    error = hwcState.writeIfChanged(committed.dataspace, dataspace, [&](ui::Dataspace value) {
+        return hwcLayer->setDataspace(value);
+    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set dataspace %d: %s (%d)", mName.string(), dataspace,
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -396,6 +406,19 @@ bool BufferLayer::onPostComposition(const std::optional<DisplayId>& displayId,
 }
 
 bool BufferLayer::latchBuffer(bool& recomputeVisibleRegions, nsecs_t latchTime) {
+    // Anything latched along with the buffer that can move or resize the layer
+    // (buffer size, transform, scaling mode, a resize accepted by the
+    // LayerRejecter, or a new sideband stream) also recomputes visible regions.
+    bool geometryChanged = false;
+    const bool refreshRequired = latchBufferAndGeometry(geometryChanged, latchTime);
+    if (geometryChanged) {
+        setGeometryDirty();
+        recomputeVisibleRegions = true;
+    }
+    return refreshRequired;
+}
+
+bool BufferLayer::latchBufferAndGeometry(bool& recomputeVisibleRegions, nsecs_t latchTime) {
     ATRACE_CALL();
 
     bool refreshRequired = latchSidebandStream(recomputeVisibleRegions);
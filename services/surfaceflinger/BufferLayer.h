@@ -158,6 +158,10 @@ protected:
     // be latched have signaled
     bool allTransactionsSignaled();
 
+    // Does the work of latchBuffer(), setting recomputeVisibleRegions only for
+    // changes made to this layer.
+    bool latchBufferAndGeometry(bool& recomputeVisibleRegions, nsecs_t latchTime);
+
     static bool getOpacityForFormat(uint32_t format);
 
     // from GLES
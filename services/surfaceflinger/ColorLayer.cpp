@@ -102,9 +102,14 @@ void ColorLayer::setPerFrameData(const sp<const DisplayDevice>& display,
     const auto outputLayer = findOutputLayerForDisplay(display);
     LOG_FATAL_IF(!outputLayer || !outputLayer->getState().hwc);
 
-    auto& hwcLayer = (*outputLayer->getState().hwc).hwcLayer;
-
-    auto error = hwcLayer->setVisibleRegion(visible);
+    auto& hwcState = *outputLayer->editState().hwc;
+    auto& hwcLayer = hwcState.hwcLayer;
+    auto& committed = hwcState.committed;
+
+    auto error = hwcState.writeIfChanged(committed.visibleRegion, visible,
+                                         [&](const Region& region) {
+                                             return hwcLayer->setVisibleRegion(region);
+                                         });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set visible region: %s (%d)", mName.string(),
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -117,7 +122,9 @@ void ColorLayer::setPerFrameData(const sp<const DisplayDevice>& display,
     const ui::Dataspace dataspace =
             isColorSpaceAgnostic() && targetDataspace != ui::Dataspace::UNKNOWN ? targetDataspace
                                                                                 : mCurrentDataSpace;
-    error = hwcLayer->setDataspace(dataspace);
+    error = hwcState.writeIfChanged(committed.dataspace, dataspace, [&](ui::Dataspace value) {
+        return hwcLayer->setDataspace(value);
+    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set dataspace %d: %s (%d)", mName.string(), dataspace,
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -127,19 +134,26 @@ void ColorLayer::setPerFrameData(const sp<const DisplayDevice>& display,
     layerCompositionState.dataspace = mCurrentDataSpace;
 
     half4 color = getColor();
-    error = hwcLayer->setColor({static_cast<uint8_t>(std::round(255.0f * color.r)),
-                                static_cast<uint8_t>(std::round(255.0f * color.g)),
-                                static_cast<uint8_t>(std::round(255.0f * color.b)), 255});
+    const Hwc2::IComposerClient::Color hwcColor{static_cast<uint8_t>(std::round(255.0f * color.r)),
+                                                static_cast<uint8_t>(std::round(255.0f * color.g)),
+                                                static_cast<uint8_t>(std::round(255.0f * color.b)),
+                                                255};
+    error = hwcState.writeIfChanged(committed.color, hwcColor,
+                                    [&](const Hwc2::IComposerClient::Color& value) {
+                                        return hwcLayer->setColor(
+                                                {value.r, value.g, value.b, value.a});
+                                    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set color: %s (%d)", mName.string(), to_string(error).c_str(),
               static_cast<int32_t>(error));
     }
-    layerCompositionState.color = {static_cast<uint8_t>(std::round(255.0f * color.r)),
-                                   static_cast<uint8_t>(std::round(255.0f * color.g)),
-                                   static_cast<uint8_t>(std::round(255.0f * color.b)), 255};
+    layerCompositionState.color = hwcColor;
 
     // Clear out the transform, because it doesn't make sense absent a source buffer
-    error = hwcLayer->setTransform(HWC2::Transform::None);
+    error = hwcState.writeIfChanged(committed.bufferTransform, static_cast<Hwc2::Transform>(0),
+                                    [&](Hwc2::Transform) {
+                                        return hwcLayer->setTransform(HWC2::Transform::None);
+                                    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to clear transform: %s (%d)", mName.string(), to_string(error).c_str(),
               static_cast<int32_t>(error));
@@ -153,7 +167,10 @@ void ColorLayer::setPerFrameData(const sp<const DisplayDevice>& display,
     }
     layerCompositionState.colorTransform = getColorTransform();
 
-    error = hwcLayer->setSurfaceDamage(surfaceDamageRegion);
+    error = hwcState.writeIfChanged(committed.surfaceDamage, surfaceDamageRegion,
+                                    [&](const Region& damage) {
+                                        return hwcLayer->setSurfaceDamage(damage);
+                                    });
     if (error != HWC2::Error::None) {
         ALOGE("[%s] Failed to set surface damage: %s (%d)", mName.string(),
               to_string(error).c_str(), static_cast<int32_t>(error));
@@ -19,6 +19,7 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <utility>
 
 #include <compositionengine/impl/HwcBufferCache.h>
 #include <renderengine/Mesh.h>
@@ -38,6 +39,14 @@ class HWComposer;
 
 namespace compositionengine::impl {
 
+// Value comparison used to decide whether HWC layer state needs to be sent
+// again. Regions compare equal when they hold the same rectangles.
+template <typename T>
+bool isSameHwcValue(const T& a, const T& b) {
+    return a == b;
+}
+bool isSameHwcValue(const Region& a, const Region& b);
+
 struct OutputLayerCompositionState {
     // The region of this layer which is visible on this output
     Region visibleRegion;
@@ -77,6 +86,45 @@ struct OutputLayerCompositionState {
         // The buffer cache for this layer. This is used to lower the
         // cost of sending reused buffers to the HWC.
         HwcBufferCache hwcBufferCache;
+
+        // The state last sent to the HWC for this layer. A value that has
+        // not been sent, or whose command failed, is unset.
+        struct Committed {
+            std::optional<Rect> displayFrame;
+            std::optional<FloatRect> sourceCrop;
+            std::optional<uint32_t> z;
+            std::optional<Hwc2::Transform> bufferTransform;
+            std::optional<Hwc2::IComposerClient::BlendMode> blendMode;
+            std::optional<float> planeAlpha;
+            std::optional<std::pair<int, int>> info;
+            std::optional<Region> visibleRegion;
+            std::optional<Region> surfaceDamage;
+            std::optional<ui::Dataspace> dataspace;
+            std::optional<Hwc2::IComposerClient::Color> color;
+        };
+        Committed committed;
+
+        // The number of commands left out because the HWC already had the
+        // value, since the count was last reset.
+        uint32_t skippedCommandCount{0};
+
+        // Calls |write| with |value|, unless |value| is what |committedValue|
+        // says the HWC already has. Returns the error from |write|.
+        template <typename T, typename Write>
+        auto writeIfChanged(std::optional<T>& committedValue, const T& value, Write&& write) {
+            using Error = decltype(write(value));
+            if (committedValue && isSameHwcValue(*committedValue, value)) {
+                skippedCommandCount++;
+                return Error::None;
+            }
+            const Error error = write(value);
+            if (error == Error::None) {
+                committedValue = value;
+            } else {
+                committedValue.reset();
+            }
+            return error;
+        }
     };
 
     // The HWC state is optional, and is only set up if there is any potential
@@ -303,13 +303,14 @@ void OutputLayer::updateCompositionState(bool includeGeometry) {
     }
 }
 
-void OutputLayer::writeStateToHWC(bool includeGeometry) const {
+void OutputLayer::writeStateToHWC(bool includeGeometry) {
     // Skip doing this if there is no HWC interface
     if (!mState.hwc) {
         return;
     }
 
-    auto& hwcLayer = (*mState.hwc).hwcLayer;
+    auto& hwcState = *mState.hwc;
+    auto& hwcLayer = hwcState.hwcLayer;
     if (!hwcLayer) {
         ALOGE("[%s] failed to write composition state to HWC -- no hwcLayer for output %s",
               mLayerFE->getDebugName(), mOutput.getName().c_str());
@@ -317,9 +318,14 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) const {
     }
 
     if (includeGeometry) {
+        auto& committed = hwcState.committed;
+
         // Output dependent state
 
-        if (auto error = hwcLayer->setDisplayFrame(mState.displayFrame);
+        if (auto error = hwcState.writeIfChanged(committed.displayFrame, mState.displayFrame,
+                                                 [&](const Rect& frame) {
+                                                     return hwcLayer->setDisplayFrame(frame);
+                                                 });
             error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set display frame [%d, %d, %d, %d]: %s (%d)",
                   mLayerFE->getDebugName(), mState.displayFrame.left, mState.displayFrame.top,
@@ -327,7 +333,11 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) const {
                   static_cast<int32_t>(error));
         }
 
-        if (auto error = hwcLayer->setSourceCrop(mState.sourceCrop); error != HWC2::Error::None) {
+        if (auto error = hwcState.writeIfChanged(committed.sourceCrop, mState.sourceCrop,
+                                                 [&](const FloatRect& crop) {
+                                                     return hwcLayer->setSourceCrop(crop);
+                                                 });
+            error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set source crop [%.3f, %.3f, %.3f, %.3f]: "
                   "%s (%d)",
                   mLayerFE->getDebugName(), mState.sourceCrop.left, mState.sourceCrop.top,
@@ -335,13 +345,22 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) const {
                   static_cast<int32_t>(error));
         }
 
-        if (auto error = hwcLayer->setZOrder(mState.z); error != HWC2::Error::None) {
+        if (auto error = hwcState.writeIfChanged(committed.z, mState.z,
+                                                 [&](uint32_t z) {
+                                                     return hwcLayer->setZOrder(z);
+                                                 });
+            error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set Z %u: %s (%d)", mLayerFE->getDebugName(), mState.z,
                   to_string(error).c_str(), static_cast<int32_t>(error));
         }
 
-        if (auto error =
-                    hwcLayer->setTransform(static_cast<HWC2::Transform>(mState.bufferTransform));
+        if (auto error = hwcState.writeIfChanged(committed.bufferTransform,
+                                                 mState.bufferTransform,
+                                                 [&](Hwc2::Transform transform) {
+                                                     return hwcLayer->setTransform(
+                                                             static_cast<HWC2::Transform>(
+                                                                     transform));
+                                                 });
             error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set transform %s: %s (%d)", mLayerFE->getDebugName(),
                   toString(mState.bufferTransform).c_str(), to_string(error).c_str(),
@@ -352,23 +371,36 @@ void OutputLayer::writeStateToHWC(bool includeGeometry) const {
 
         const auto& outputIndependentState = mLayer->getState().frontEnd;
 
-        if (auto error = hwcLayer->setBlendMode(
-                    static_cast<HWC2::BlendMode>(outputIndependentState.blendMode));
+        if (auto error = hwcState.writeIfChanged(committed.blendMode,
+                                                 outputIndependentState.blendMode,
+                                                 [&](Hwc2::IComposerClient::BlendMode mode) {
+                                                     return hwcLayer->setBlendMode(
+                                                             static_cast<HWC2::BlendMode>(mode));
+                                                 });
             error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set blend mode %s: %s (%d)", mLayerFE->getDebugName(),
                   toString(outputIndependentState.blendMode).c_str(), to_string(error).c_str(),
                   static_cast<int32_t>(error));
         }
 
-        if (auto error = hwcLayer->setPlaneAlpha(outputIndependentState.alpha);
+        if (auto error = hwcState.writeIfChanged(committed.planeAlpha,
+                                                 outputIndependentState.alpha,
+                                                 [&](float alpha) {
+                                                     return hwcLayer->setPlaneAlpha(alpha);
+                                                 });
             error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set plane alpha %.3f: %s (%d)", mLayerFE->getDebugName(),
                   outputIndependentState.alpha, to_string(error).c_str(),
                   static_cast<int32_t>(error));
         }
 
-        if (auto error =
-                    hwcLayer->setInfo(outputIndependentState.type, outputIndependentState.appId);
+        if (auto error = hwcState.writeIfChanged(committed.info,
+                                                 std::make_pair(outputIndependentState.type,
+                                                                outputIndependentState.appId),
+                                                 [&](const std::pair<int, int>& info) {
+                                                     return hwcLayer->setInfo(info.first,
+                                                                              info.second);
+                                                 });
             error != HWC2::Error::None) {
             ALOGE("[%s] Failed to set info %s (%d)", mLayerFE->getDebugName(),
                   to_string(error).c_str(), static_cast<int32_t>(error));
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <compositionengine/impl/DumpHelpers.h>
 #include <compositionengine/impl/OutputLayerCompositionState.h>
 
@@ -21,6 +23,17 @@
 
 namespace android::compositionengine::impl {
 
+bool isSameHwcValue(const Region& a, const Region& b) {
+    if (a.isTriviallyEqual(b)) {
+        return true;
+    }
+    size_t aCount = 0;
+    size_t bCount = 0;
+    const Rect* aRects = a.getArray(&aCount);
+    const Rect* bRects = b.getArray(&bCount);
+    return aCount == bCount && std::equal(aRects, aRects + aCount, bRects);
+}
+
 namespace {
 
 void dumpHwc(const OutputLayerCompositionState::Hwc& hwc, std::string& out) {
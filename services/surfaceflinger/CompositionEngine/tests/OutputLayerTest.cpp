@@ -310,5 +310,38 @@ TEST_F(OutputLayerWriteStateToHWCTest, canSetsAllState) {
     mOutputLayer.writeStateToHWC(true);
 }
 
+TEST_F(OutputLayerWriteStateToHWCTest, onlySendsStateTheHwcDoesNotHave) {
+    EXPECT_CALL(*mHwcLayer, setDisplayFrame(kDisplayFrame)).WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setSourceCrop(kSourceCrop)).WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setZOrder(kZOrder)).WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setTransform(static_cast<HWC2::Transform>(kBufferTransform)))
+            .WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setBlendMode(static_cast<HWC2::BlendMode>(kBlendMode)))
+            .WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setPlaneAlpha(kAlpha)).WillOnce(Return(HWC2::Error::None));
+    EXPECT_CALL(*mHwcLayer, setInfo(kType, kAppId)).WillOnce(Return(HWC2::Error::None));
+
+    mOutputLayer.writeStateToHWC(true);
+    EXPECT_EQ(0u, mOutputLayer.getState().hwc->skippedCommandCount);
+
+    mOutputLayer.writeStateToHWC(true);
+    EXPECT_EQ(7u, mOutputLayer.getState().hwc->skippedCommandCount);
+
+    mOutputLayer.editState().z = kZOrder + 1;
+    EXPECT_CALL(*mHwcLayer, setZOrder(kZOrder + 1)).WillOnce(Return(HWC2::Error::None));
+
+    mOutputLayer.writeStateToHWC(true);
+    EXPECT_EQ(13u, mOutputLayer.getState().hwc->skippedCommandCount);
+}
+
+TEST_F(OutputLayerWriteStateToHWCTest, resendsStateThatFailedToBeSet) {
+    expectGeometryCommonCalls();
+    mOutputLayer.writeStateToHWC(true);
+
+    expectGeometryCommonCalls();
+    mOutputLayer.writeStateToHWC(true);
+    EXPECT_EQ(0u, mOutputLayer.getState().hwc->skippedCommandCount);
+}
+
 } // namespace
 } // namespace android::compositionengine
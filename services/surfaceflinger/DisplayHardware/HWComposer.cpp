@@ -20,8 +20,11 @@
 #define LOG_TAG "HWComposer"
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
 
+#include <android-base/stringprintf.h>
+#include <compositionengine/Layer.h>
 #include <compositionengine/Output.h>
 #include <compositionengine/OutputLayer.h>
+#include <compositionengine/impl/LayerCompositionState.h>
 #include <compositionengine/impl/OutputLayerCompositionState.h>
 #include <log/log.h>
 #include <ui/DebugUtils.h>
@@ -29,6 +32,8 @@
 #include <utils/Errors.h>
 #include <utils/Trace.h>
 
+#include <functional>
+
 #include "HWComposer.h"
 #include "HWC2.h"
 #include "ComposerHal.h"
@@ -71,6 +76,79 @@ HWComposer::~HWComposer() = default;
 
 namespace impl {
 
+namespace {
+
+template <typename T>
+void hashCombine(size_t& seed, const T& value) {
+    seed ^= std::hash<T>{}(value) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+void hashCombine(size_t& seed, const mat4& matrix) {
+    const float* values = matrix.asArray();
+    for (size_t i = 0; i < mat4::ROW_SIZE * mat4::COL_SIZE; i++) {
+        hashCombine(seed, values[i]);
+    }
+}
+
+void hashCombine(size_t& seed, const Rect& rect) {
+    hashCombine(seed, rect.left);
+    hashCombine(seed, rect.top);
+    hashCombine(seed, rect.right);
+    hashCombine(seed, rect.bottom);
+}
+
+// Hashes what the HWC bases its composition strategy on: the color state of
+// the display, then the layers in Z order with the composition type requested
+// for each of them, their geometry and their per-frame state. Only the buffer
+// contents and the surface damage are left out, as they change with every
+// frame of any animation.
+size_t computeLayerStackSignature(const compositionengine::Output& output) {
+    size_t signature = 0;
+    const auto& outputState = output.getState();
+    hashCombine(signature, static_cast<int32_t>(outputState.colorTransform));
+    hashCombine(signature, outputState.colorTransformMat);
+    hashCombine(signature, static_cast<int32_t>(outputState.colorMode));
+    hashCombine(signature, static_cast<int32_t>(outputState.renderIntent));
+    hashCombine(signature, static_cast<int32_t>(outputState.dataspace));
+
+    for (const auto& outputLayer : output.getOutputLayersOrderedByZ()) {
+        const auto& state = outputLayer->getState();
+        if (!state.hwc || !state.hwc->hwcLayer) {
+            continue;
+        }
+        hashCombine(signature, state.hwc->hwcLayer->getId());
+        hashCombine(signature, static_cast<int32_t>(state.hwc->hwcCompositionType));
+        hashCombine(signature, state.z);
+        hashCombine(signature, state.displayFrame);
+        hashCombine(signature, state.sourceCrop.left);
+        hashCombine(signature, state.sourceCrop.top);
+        hashCombine(signature, state.sourceCrop.right);
+        hashCombine(signature, state.sourceCrop.bottom);
+        hashCombine(signature, static_cast<int32_t>(state.bufferTransform));
+        for (const Rect& rect : state.visibleRegion) {
+            hashCombine(signature, rect);
+        }
+
+        const auto& frontEnd = outputLayer->getLayer().getState().frontEnd;
+        hashCombine(signature, static_cast<int32_t>(frontEnd.blendMode));
+        hashCombine(signature, frontEnd.alpha);
+        hashCombine(signature, static_cast<int32_t>(frontEnd.dataspace));
+        hashCombine(signature, frontEnd.hdrMetadata.validTypes);
+        hashCombine(signature, frontEnd.colorTransform);
+        hashCombine(signature, frontEnd.color.r);
+        hashCombine(signature, frontEnd.color.g);
+        hashCombine(signature, frontEnd.color.b);
+        hashCombine(signature, frontEnd.color.a);
+        hashCombine(signature, frontEnd.isSecure);
+        hashCombine(signature, frontEnd.sidebandStream != nullptr);
+        hashCombine(signature,
+                    frontEnd.buffer != nullptr ? frontEnd.buffer->getPixelFormat() : -1);
+    }
+    return signature;
+}
+
+} // namespace
+
 HWComposer::HWComposer(std::unique_ptr<Hwc2::Composer> composer)
       : mHwcDevice(std::make_unique<HWC2::Device>(std::move(composer))) {}
 
@@ -415,16 +493,28 @@ status_t HWComposer::prepare(DisplayId displayId, const compositionengine::Outpu
 
     HWC2::Error error = HWC2::Error::None;
 
+    // Only strategies without client composition are cached. When the HWC
+    // already accepted one for this exact layer stack, it is tried again even
+    // if the last frame had client composition, saving the validate that
+    // would otherwise precede the present.
+    const size_t signature = computeLayerStackSignature(output);
+    const auto& cached = displayData.acceptedStrategy;
+    const bool strategyCached = cached && cached->signature == signature;
+    if (strategyCached) {
+        displayData.strategyCacheHits++;
+    }
+    const bool expectClientComposition = !strategyCached && displayData.hasClientComposition;
+
     // First try to skip validate altogether when there is no client
     // composition.  When there is client composition, since we haven't
     // rendered to the client target yet, we should not attempt to skip
     // validate.
     //
-    // displayData.hasClientComposition hasn't been updated for this frame.
-    // The check below is incorrect.  We actually rely on HWC here to fall
-    // back to validate when there is any client layer.
+    // Without a cached strategy the check below can be wrong, as the layer
+    // stack may have changed since the last validate. We rely on HWC here to
+    // fall back to validate when there is any client layer.
     displayData.validateWasSkipped = false;
-    if (!displayData.hasClientComposition) {
+    if (!expectClientComposition) {
         sp<Fence> outPresentFence;
         uint32_t state = UINT32_MAX;
         error = hwcDisplay->presentOrValidate(&numTypes, &numRequests, &outPresentFence , &state);
@@ -438,6 +528,13 @@ status_t HWComposer::prepare(DisplayId displayId, const compositionengine::Outpu
             displayData.lastPresentFence = outPresentFence;
             displayData.validateWasSkipped = true;
             displayData.presentError = error;
+            displayData.validatesSkipped++;
+            // The last frame may have had client composition, but this one
+            // has nothing to render into the client target.
+            displayData.hasClientComposition = false;
+            if (strategyCached) {
+                displayData.hasDeviceComposition = cached->hasDeviceComposition;
+            }
             return NO_ERROR;
         }
         // Present failed but Validate ran.
@@ -445,6 +542,10 @@ status_t HWComposer::prepare(DisplayId displayId, const compositionengine::Outpu
         error = hwcDisplay->validate(&numTypes, &numRequests);
     }
     ALOGV("SkipValidate failed, Falling back to SLOW validate/present");
+    if (strategyCached) {
+        // The HWC no longer presents this layer stack as it did.
+        displayData.acceptedStrategy.reset();
+    }
     if (error != HWC2::Error::HasChanges) {
         RETURN_IF_HWC_ERROR_FOR("validate", error, displayId, BAD_INDEX);
     }
@@ -505,6 +606,10 @@ status_t HWComposer::prepare(DisplayId displayId, const compositionengine::Outpu
     error = hwcDisplay->acceptChanges();
     RETURN_IF_HWC_ERROR_FOR("acceptChanges", error, displayId, BAD_INDEX);
 
+    if (!displayData.hasClientComposition) {
+        displayData.acceptedStrategy =
+                CompositionStrategy{signature, displayData.hasDeviceComposition};
+    }
     return NO_ERROR;
 }
 
@@ -588,12 +693,15 @@ status_t HWComposer::presentAndGetReleaseFences(DisplayId displayId) {
 status_t HWComposer::setPowerMode(DisplayId displayId, int32_t intMode) {
     RETURN_IF_INVALID_DISPLAY(displayId, BAD_INDEX);
 
-    const auto& displayData = mDisplayData[displayId];
+    auto& displayData = mDisplayData[displayId];
     if (displayData.isVirtual) {
         LOG_DISPLAY_ERROR(displayId, "Invalid operation on virtual display");
         return INVALID_OPERATION;
     }
 
+    // The HWC may not keep its composition state across power modes.
+    displayData.acceptedStrategy.reset();
+
     auto mode = static_cast<HWC2::PowerMode>(intMode);
     if (mode == HWC2::PowerMode::Off) {
         setVsyncEnabled(displayId, HWC2::Vsync::Disable);
@@ -650,6 +758,7 @@ status_t HWComposer::setActiveConfig(DisplayId displayId, size_t configId) {
         return BAD_INDEX;
     }
 
+    displayData.acceptedStrategy.reset();
     auto error = displayData.hwcDisplay->setActiveConfig(displayData.configMap[configId]);
     RETURN_IF_HWC_ERROR(error, displayId, UNKNOWN_ERROR);
     return NO_ERROR;
@@ -806,6 +915,14 @@ void HWComposer::dump(std::string& result) const {
     // all the state going into the layers. This is probably better done in
     // Layer itself, but it's going to take a bit of work to get there.
     result.append(mHwcDevice->dump());
+
+    for (const auto& [displayId, displayData] : mDisplayData) {
+        base::StringAppendF(&result,
+                            "Display %s: validate skipped %" PRIu64
+                            " times, strategy cache hit %" PRIu64 " times\n",
+                            to_string(displayId).c_str(), displayData.validatesSkipped,
+                            displayData.strategyCacheHits);
+    }
 }
 
 std::optional<DisplayId> HWComposer::toPhysicalDisplayId(hwc2_display_t hwcDisplayId) const {
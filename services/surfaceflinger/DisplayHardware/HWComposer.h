@@ -328,6 +328,13 @@ private:
 
     static void validateChange(HWC2::Composition from, HWC2::Composition to);
 
+    // A validate without client composition, for the layer stack with the
+    // given signature.
+    struct CompositionStrategy {
+        size_t signature;
+        bool hasDeviceComposition;
+    };
+
     struct DisplayData {
         bool isVirtual = false;
         bool hasClientComposition = false;
@@ -344,6 +351,12 @@ private:
         bool validateWasSkipped;
         HWC2::Error presentError;
 
+        // Kept while other layer stacks are validated. Cleared when the HWC
+        // does not present it again, and on config and power mode changes.
+        std::optional<CompositionStrategy> acceptedStrategy;
+        uint64_t strategyCacheHits = 0;
+        uint64_t validatesSkipped = 0;
+
         bool vsyncTraceToggle = false;
 
         std::mutex vsyncEnabledLock;
@@ -361,7 +361,40 @@ FloatRect Layer::getBoundsPreScaling(const ui::Transform& bufferScaleTransform)
     return bufferScaleTransform.inverse().transform(mBounds);
 }
 
+static bool isSameTransform(const ui::Transform& a, const ui::Transform& b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+static bool isSameGeometry(const Layer::Geometry& a, const Layer::Geometry& b) {
+    return a.w == b.w && a.h == b.h && isSameTransform(a.transform, b.transform);
+}
+
 void Layer::computeBounds(FloatRect parentBounds, ui::Transform parentTransform) {
+    const bool parentChanged = !(parentBounds == mLastParentBounds) ||
+            !isSameTransform(parentTransform, mLastParentTransform);
+    if (!parentChanged && !mGeometryDirty && !mChildGeometryDirty) {
+        return;
+    }
+
+    // If only descendants changed, the cached bounds of this layer are still
+    // good and just the children need to be visited.
+    if (parentChanged || mGeometryDirty) {
+        mLastParentBounds = parentBounds;
+        mLastParentTransform = parentTransform;
+        computeOwnBounds(parentBounds, parentTransform);
+    }
+    mGeometryDirty = false;
+    mChildGeometryDirty = false;
+
+    // Add any buffer scaling to the layer's children.
+    ui::Transform bufferScaleTransform = getBufferScaleTransform();
+    for (const sp<Layer>& child : mDrawingChildren) {
+        child->computeBounds(getBoundsPreScaling(bufferScaleTransform),
+                             getTransformWithScale(bufferScaleTransform));
+    }
+}
+
+void Layer::computeOwnBounds(FloatRect parentBounds, const ui::Transform& parentTransform) {
     const State& s(getDrawingState());
 
     // Calculate effective layer transform
@@ -383,15 +416,25 @@ void Layer::computeBounds(FloatRect parentBounds, ui::Transform parentTransform)
 
     mBounds = bounds;
     mScreenBounds = mEffectiveTransform.transform(mBounds);
+}
 
-    // Add any buffer scaling to the layer's children.
-    ui::Transform bufferScaleTransform = getBufferScaleTransform();
-    for (const sp<Layer>& child : mDrawingChildren) {
-        child->computeBounds(getBoundsPreScaling(bufferScaleTransform),
-                             getTransformWithScale(bufferScaleTransform));
+void Layer::setGeometryDirty() {
+    mGeometryDirty = true;
+    for (sp<Layer> parent = mDrawingParent.promote(); parent != nullptr;
+         parent = parent->mDrawingParent.promote()) {
+        parent->mChildGeometryDirty = true;
     }
 }
 
+bool Layer::hasGeometryChanged(const State& oldState, const State& newState) const {
+    return !isSameGeometry(oldState.active_legacy, newState.active_legacy) ||
+            oldState.crop_legacy != newState.crop_legacy ||
+            !isSameGeometry(oldState.active, newState.active) ||
+            oldState.crop != newState.crop || oldState.transform != newState.transform ||
+            oldState.transformToDisplayInverse != newState.transformToDisplayInverse ||
+            oldState.sidebandStream != newState.sidebandStream;
+}
+
 Rect Layer::getCroppedBufferSize(const State& s) const {
     Rect size = getBufferSize(s);
     Rect crop = getCrop(s);
@@ -874,6 +917,11 @@ uint32_t Layer::doTransaction(uint32_t flags) {
         mChildrenChanged = false;
     }
 
+    if (mDrawingOverrideScalingMode != mOverrideScalingMode) {
+        mDrawingOverrideScalingMode = mOverrideScalingMode;
+        setGeometryDirty();
+    }
+
     pushPendingState();
     State c = getCurrentState();
     if (!applyPendingStates(&c)) {
@@ -912,6 +960,9 @@ uint32_t Layer::doTransaction(uint32_t flags) {
 }
 
 void Layer::commitTransaction(const State& stateToCommit) {
+    if (hasGeometryChanged(mDrawingState, stateToCommit)) {
+        setGeometryDirty();
+    }
     mDrawingState = stateToCommit;
 }
 
@@ -1848,7 +1899,10 @@ void Layer::commitChildList() {
         child->commitChildList();
     }
     mDrawingChildren = mCurrentChildren;
-    mDrawingParent = mCurrentParent;
+    if (mDrawingParent != mCurrentParent) {
+        mDrawingParent = mCurrentParent;
+        setGeometryDirty();
+    }
 }
 
 static wp<Layer> extractLayerFromBinder(const wp<IBinder>& weakBinderHandle) {
@@ -1875,129 +1929,188 @@ void Layer::setInputInfo(const InputWindowInfo& info) {
 }
 
 void Layer::writeToProtoDrawingState(LayerProto* layerInfo, uint32_t traceFlags) const {
-    ui::Transform transform = getTransform();
+    writeToProto(getProtoSnapshot(traceFlags), layerInfo);
+}
+
+LayerProtoSnapshot Layer::getProtoSnapshot(uint32_t traceFlags) const {
+    const State& state = mDrawingState;
+    LayerProtoSnapshot snapshot;
+    snapshot.traceFlags = traceFlags;
 
     if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
+        snapshot.id = sequence;
+        snapshot.name = getName().c_str();
+        snapshot.type = getTypeId();
+
+        for (const auto& child : mDrawingChildren) {
+            snapshot.children.push_back(child->sequence);
+        }
+
+        for (const wp<Layer>& weakRelative : state.zOrderRelatives) {
+            sp<Layer> strongRelative = weakRelative.promote();
+            if (strongRelative != nullptr) {
+                snapshot.relatives.push_back(strongRelative->sequence);
+            }
+        }
+
+        auto parent = mDrawingParent.promote();
+        if (parent != nullptr) {
+            snapshot.parent = parent->sequence;
+        }
+
+        auto zOrderRelativeOf = state.zOrderRelativeOf.promote();
+        if (zOrderRelativeOf != nullptr) {
+            snapshot.zOrderRelativeOf = zOrderRelativeOf->sequence;
+        }
+
         for (const auto& pendingState : mPendingStatesSnapshot) {
             auto barrierLayer = pendingState.barrierLayer_legacy.promote();
             if (barrierLayer != nullptr) {
-                BarrierLayerProto* barrierLayerProto = layerInfo->add_barrier_layer();
-                barrierLayerProto->set_id(barrierLayer->sequence);
-                barrierLayerProto->set_frame_number(pendingState.frameNumber_legacy);
+                snapshot.barrierLayers.emplace_back(barrierLayer->sequence,
+                                                    pendingState.frameNumber_legacy);
             }
         }
 
-        auto buffer = mActiveBuffer;
-        if (buffer != nullptr) {
-            LayerProtoHelper::writeToProto(buffer,
-                                           [&]() { return layerInfo->mutable_active_buffer(); });
-            LayerProtoHelper::writeToProto(ui::Transform(mCurrentTransform),
-                                           layerInfo->mutable_buffer_transform());
+        snapshot.activeBuffer = mActiveBuffer;
+        snapshot.bufferTransform = mCurrentTransform;
+        snapshot.invalidate = contentDirty;
+        snapshot.isProtected = isProtected();
+        snapshot.dataspace = mCurrentDataSpace;
+        snapshot.queuedFrames = getQueuedFrameCount();
+        snapshot.refreshPending = isBufferLatched();
+        snapshot.currFrame = mCurrentFrameNumber;
+        snapshot.effectiveScalingMode = getEffectiveScalingMode();
+        snapshot.cornerRadius = getRoundedCornerState().radius;
+        snapshot.transform = getTransform();
+        snapshot.bounds = mBounds;
+        snapshot.visibleRegion = visibleRegion;
+        snapshot.damageRegion = surfaceDamageRegion;
+
+        snapshot.transparentRegion = state.activeTransparentRegion_legacy;
+        snapshot.layerStack = getLayerStack();
+        snapshot.z = state.z;
+        snapshot.requestedTransform = state.active_legacy.transform;
+        snapshot.w = state.active_legacy.w;
+        snapshot.h = state.active_legacy.h;
+        snapshot.crop = state.crop_legacy;
+        snapshot.isOpaque = isOpaque(state);
+        snapshot.pixelFormat = getPixelFormat();
+        snapshot.color = getColor();
+        snapshot.requestedColor = state.color;
+        snapshot.flags = state.flags;
+    }
+
+    if (traceFlags & SurfaceTracing::TRACE_INPUT) {
+        snapshot.inputInfo = state.inputInfo;
+        auto cropLayer = state.touchableRegionCrop.promote();
+        if (cropLayer != nullptr) {
+            snapshot.touchableRegionCropId = cropLayer->sequence;
+            snapshot.touchableRegionCrop =
+                    cropLayer->getScreenBounds(false /* reduceTransparentRegion */);
         }
-        layerInfo->set_invalidate(contentDirty);
-        layerInfo->set_is_protected(isProtected());
-        layerInfo->set_dataspace(
-                dataspaceDetails(static_cast<android_dataspace>(mCurrentDataSpace)));
-        layerInfo->set_queued_frames(getQueuedFrameCount());
-        layerInfo->set_refresh_pending(isBufferLatched());
-        layerInfo->set_curr_frame(mCurrentFrameNumber);
-        layerInfo->set_effective_scaling_mode(getEffectiveScalingMode());
-
-        layerInfo->set_corner_radius(getRoundedCornerState().radius);
-        LayerProtoHelper::writeToProto(transform, layerInfo->mutable_transform());
-        LayerProtoHelper::writePositionToProto(transform.tx(), transform.ty(),
-                                               [&]() { return layerInfo->mutable_position(); });
-        LayerProtoHelper::writeToProto(mBounds, [&]() { return layerInfo->mutable_bounds(); });
-        LayerProtoHelper::writeToProto(visibleRegion,
-                                       [&]() { return layerInfo->mutable_visible_region(); });
-        LayerProtoHelper::writeToProto(surfaceDamageRegion,
-                                       [&]() { return layerInfo->mutable_damage_region(); });
     }
 
     if (traceFlags & SurfaceTracing::TRACE_EXTRA) {
-        LayerProtoHelper::writeToProto(mSourceBounds,
-                                       [&]() { return layerInfo->mutable_source_bounds(); });
-        LayerProtoHelper::writeToProto(mScreenBounds,
-                                       [&]() { return layerInfo->mutable_screen_bounds(); });
+        snapshot.sourceBounds = mSourceBounds;
+        snapshot.screenBounds = mScreenBounds;
+        snapshot.metadata = state.metadata;
     }
-}
 
-void Layer::writeToProtoCommonState(LayerProto* layerInfo, LayerVector::StateSet stateSet,
-                                    uint32_t traceFlags) const {
-    const bool useDrawing = stateSet == LayerVector::StateSet::Drawing;
-    const LayerVector& children = useDrawing ? mDrawingChildren : mCurrentChildren;
-    const State& state = useDrawing ? mDrawingState : mCurrentState;
+    return snapshot;
+}
 
-    ui::Transform requestedTransform = state.active_legacy.transform;
+void Layer::writeToProto(const LayerProtoSnapshot& snapshot, LayerProto* layerInfo) {
+    const uint32_t traceFlags = snapshot.traceFlags;
 
     if (traceFlags & SurfaceTracing::TRACE_CRITICAL) {
-        layerInfo->set_id(sequence);
-        layerInfo->set_name(getName().c_str());
-        layerInfo->set_type(String8(getTypeId()));
+        layerInfo->set_id(snapshot.id);
+        layerInfo->set_name(snapshot.name);
+        layerInfo->set_type(snapshot.type);
 
-        for (const auto& child : children) {
-            layerInfo->add_children(child->sequence);
+        for (int32_t child : snapshot.children) {
+            layerInfo->add_children(child);
+        }
+        for (int32_t relative : snapshot.relatives) {
+            layerInfo->add_relatives(relative);
         }
+        layerInfo->set_parent(snapshot.parent);
+        layerInfo->set_z_order_relative_of(snapshot.zOrderRelativeOf);
 
-        for (const wp<Layer>& weakRelative : state.zOrderRelatives) {
-            sp<Layer> strongRelative = weakRelative.promote();
-            if (strongRelative != nullptr) {
-                layerInfo->add_relatives(strongRelative->sequence);
-            }
+        for (const auto& [id, frameNumber] : snapshot.barrierLayers) {
+            BarrierLayerProto* barrierLayerProto = layerInfo->add_barrier_layer();
+            barrierLayerProto->set_id(id);
+            barrierLayerProto->set_frame_number(frameNumber);
         }
 
-        LayerProtoHelper::writeToProto(state.activeTransparentRegion_legacy,
+        if (snapshot.activeBuffer != nullptr) {
+            LayerProtoHelper::writeToProto(snapshot.activeBuffer,
+                                           [&]() { return layerInfo->mutable_active_buffer(); });
+            LayerProtoHelper::writeToProto(ui::Transform(snapshot.bufferTransform),
+                                           layerInfo->mutable_buffer_transform());
+        }
+        layerInfo->set_invalidate(snapshot.invalidate);
+        layerInfo->set_is_protected(snapshot.isProtected);
+        layerInfo->set_dataspace(
+                dataspaceDetails(static_cast<android_dataspace>(snapshot.dataspace)));
+        layerInfo->set_queued_frames(snapshot.queuedFrames);
+        layerInfo->set_refresh_pending(snapshot.refreshPending);
+        layerInfo->set_curr_frame(snapshot.currFrame);
+        layerInfo->set_effective_scaling_mode(snapshot.effectiveScalingMode);
+
+        layerInfo->set_corner_radius(snapshot.cornerRadius);
+        LayerProtoHelper::writeToProto(snapshot.transform, layerInfo->mutable_transform());
+        LayerProtoHelper::writePositionToProto(snapshot.transform.tx(), snapshot.transform.ty(),
+                                               [&]() { return layerInfo->mutable_position(); });
+        LayerProtoHelper::writeToProto(snapshot.bounds,
+                                       [&]() { return layerInfo->mutable_bounds(); });
+        LayerProtoHelper::writeToProto(snapshot.visibleRegion,
+                                       [&]() { return layerInfo->mutable_visible_region(); });
+        LayerProtoHelper::writeToProto(snapshot.damageRegion,
+                                       [&]() { return layerInfo->mutable_damage_region(); });
+
+        LayerProtoHelper::writeToProto(snapshot.transparentRegion,
                                        [&]() { return layerInfo->mutable_transparent_region(); });
 
-        layerInfo->set_layer_stack(getLayerStack());
-        layerInfo->set_z(state.z);
+        layerInfo->set_layer_stack(snapshot.layerStack);
+        layerInfo->set_z(snapshot.z);
 
-        LayerProtoHelper::writePositionToProto(requestedTransform.tx(), requestedTransform.ty(),
-                                               [&]() {
+        LayerProtoHelper::writePositionToProto(snapshot.requestedTransform.tx(),
+                                               snapshot.requestedTransform.ty(), [&]() {
                                                    return layerInfo->mutable_requested_position();
                                                });
 
-        LayerProtoHelper::writeSizeToProto(state.active_legacy.w, state.active_legacy.h,
+        LayerProtoHelper::writeSizeToProto(snapshot.w, snapshot.h,
                                            [&]() { return layerInfo->mutable_size(); });
 
-        LayerProtoHelper::writeToProto(state.crop_legacy,
-                                       [&]() { return layerInfo->mutable_crop(); });
+        LayerProtoHelper::writeToProto(snapshot.crop, [&]() { return layerInfo->mutable_crop(); });
 
-        layerInfo->set_is_opaque(isOpaque(state));
+        layerInfo->set_is_opaque(snapshot.isOpaque);
 
-
-        layerInfo->set_pixel_format(decodePixelFormat(getPixelFormat()));
-        LayerProtoHelper::writeToProto(getColor(), [&]() { return layerInfo->mutable_color(); });
-        LayerProtoHelper::writeToProto(state.color,
+        layerInfo->set_pixel_format(decodePixelFormat(snapshot.pixelFormat));
+        LayerProtoHelper::writeToProto(snapshot.color,
+                                       [&]() { return layerInfo->mutable_color(); });
+        LayerProtoHelper::writeToProto(snapshot.requestedColor,
                                        [&]() { return layerInfo->mutable_requested_color(); });
-        layerInfo->set_flags(state.flags);
+        layerInfo->set_flags(snapshot.flags);
 
-        LayerProtoHelper::writeToProto(requestedTransform,
+        LayerProtoHelper::writeToProto(snapshot.requestedTransform,
                                        layerInfo->mutable_requested_transform());
-
-        auto parent = useDrawing ? mDrawingParent.promote() : mCurrentParent.promote();
-        if (parent != nullptr) {
-            layerInfo->set_parent(parent->sequence);
-        } else {
-            layerInfo->set_parent(-1);
-        }
-
-        auto zOrderRelativeOf = state.zOrderRelativeOf.promote();
-        if (zOrderRelativeOf != nullptr) {
-            layerInfo->set_z_order_relative_of(zOrderRelativeOf->sequence);
-        } else {
-            layerInfo->set_z_order_relative_of(-1);
-        }
     }
 
     if (traceFlags & SurfaceTracing::TRACE_INPUT) {
-        LayerProtoHelper::writeToProto(state.inputInfo, state.touchableRegionCrop,
+        LayerProtoHelper::writeToProto(snapshot.inputInfo, snapshot.touchableRegionCropId,
+                                       snapshot.touchableRegionCrop,
                                        [&]() { return layerInfo->mutable_input_window_info(); });
     }
 
     if (traceFlags & SurfaceTracing::TRACE_EXTRA) {
+        LayerProtoHelper::writeToProto(snapshot.sourceBounds,
+                                       [&]() { return layerInfo->mutable_source_bounds(); });
+        LayerProtoHelper::writeToProto(snapshot.screenBounds,
+                                       [&]() { return layerInfo->mutable_screen_bounds(); });
+
         auto protoMap = layerInfo->mutable_metadata();
-        for (const auto& entry : state.metadata.mMap) {
+        for (const auto& entry : snapshot.metadata.mMap) {
             (*protoMap)[entry.first] = std::string(entry.second.cbegin(), entry.second.cend());
         }
     }
@@ -2012,7 +2125,6 @@ void Layer::writeToProtoCompositionState(LayerProto* layerInfo,
     }
 
     writeToProtoDrawingState(layerInfo, traceFlags);
-    writeToProtoCommonState(layerInfo, LayerVector::StateSet::Drawing, traceFlags);
 
     const auto& compositionState = outputLayer->getState();
 
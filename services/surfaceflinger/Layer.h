@@ -40,6 +40,8 @@
 #include <cstdint>
 #include <list>
 #include <optional>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "Client.h"
@@ -93,6 +95,60 @@ struct LayerCreationArgs {
     LayerMetadata metadata;
 };
 
+// What Layer::writeToProto() writes for the drawing state of a layer. Taking it only copies
+// values and references, so that the tracing thread can take it under the drawing state lock
+// and build the LayerProto after releasing the lock.
+struct LayerProtoSnapshot {
+    uint32_t traceFlags = 0;
+
+    // TRACE_CRITICAL
+    int32_t id = -1;
+    std::string name;
+    const char* type = "";
+    std::vector<int32_t> children;
+    std::vector<int32_t> relatives;
+    int32_t parent = -1;
+    int32_t zOrderRelativeOf = -1;
+    // barrier layer id and frame number of each pending state
+    std::vector<std::pair<int32_t, uint64_t>> barrierLayers;
+    sp<GraphicBuffer> activeBuffer;
+    uint32_t bufferTransform = 0;
+    bool invalidate = false;
+    bool isProtected = false;
+    ui::Dataspace dataspace = ui::Dataspace::UNKNOWN;
+    int32_t queuedFrames = 0;
+    bool refreshPending = false;
+    uint64_t currFrame = 0;
+    uint32_t effectiveScalingMode = 0;
+    float cornerRadius = 0.0f;
+    ui::Transform transform;
+    FloatRect bounds;
+    Region visibleRegion;
+    Region damageRegion;
+    Region transparentRegion;
+    uint32_t layerStack = 0;
+    int32_t z = 0;
+    ui::Transform requestedTransform;
+    uint32_t w = 0;
+    uint32_t h = 0;
+    Rect crop;
+    bool isOpaque = false;
+    PixelFormat pixelFormat = PIXEL_FORMAT_NONE;
+    half4 color;
+    half4 requestedColor;
+    uint32_t flags = 0;
+
+    // TRACE_INPUT
+    InputWindowInfo inputInfo;
+    int32_t touchableRegionCropId = -1;
+    Rect touchableRegionCrop;
+
+    // TRACE_EXTRA
+    FloatRect sourceBounds;
+    FloatRect screenBounds;
+    LayerMetadata metadata;
+};
+
 class Layer : public virtual compositionengine::LayerFE {
     static std::atomic<int32_t> sSequence;
 
@@ -362,9 +418,14 @@ public:
     FloatRect getBounds(const Region& activeTransparentRegion) const;
     FloatRect getBounds() const;
 
-    // Compute bounds for the layer and cache the results.
+    // Compute bounds for the layer and cache the results. Subtrees whose inputs
+    // haven't changed since the last call keep their cached results.
     void computeBounds(FloatRect parentBounds, ui::Transform parentTransform);
 
+    // Flags a change to the geometry of this layer that computeBounds() can't
+    // tell from its parent inputs, so the next call recomputes the layer.
+    void setGeometryDirty();
+
     // Returns the buffer scale transform if a scaling mode is set.
     ui::Transform getBufferScaleTransform() const;
 
@@ -442,16 +503,16 @@ public:
     // thread.
     void writeToProtoDrawingState(LayerProto* layerInfo,
                                   uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
+    // Copy what writeToProtoDrawingState() writes. This should be called in the main or
+    // tracing thread.
+    LayerProtoSnapshot getProtoSnapshot(uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
+    // Write a snapshot taken by getProtoSnapshot(). This can be called on any thread.
+    static void writeToProto(const LayerProtoSnapshot& snapshot, LayerProto* layerInfo);
     // Write states that are modified by the main thread. This includes drawing
     // state as well as buffer data and composition data for layers on the specified
     // display. This should be called in the main or tracing thread.
     void writeToProtoCompositionState(LayerProto* layerInfo, const sp<DisplayDevice>& displayDevice,
                                       uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
-    // Write drawing or current state. If writing current state, the caller should hold the
-    // external mStateLock. If writing drawing state, this function should be called on the
-    // main or tracing thread.
-    void writeToProtoCommonState(LayerProto* layerInfo, LayerVector::StateSet stateSet,
-                                 uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
 
     virtual Geometry getActiveGeometry(const Layer::State& s) const { return s.active_legacy; }
     virtual uint32_t getActiveWidth(const Layer::State& s) const { return s.active_legacy.w; }
@@ -953,6 +1014,23 @@ private:
     // Layer bounds in screen space.
     FloatRect mScreenBounds;
 
+    // Parent inputs of the last computeBounds() call.
+    FloatRect mLastParentBounds;
+    ui::Transform mLastParentTransform;
+
+    // Whether the geometry of this layer, or of any layer below it, changed
+    // since the last computeBounds() call.
+    bool mGeometryDirty{true};
+    bool mChildGeometryDirty{true};
+
+    // mOverrideScalingMode as of the last transaction. It is set outside of
+    // the layer state, so it is tracked separately for setGeometryDirty().
+    int32_t mDrawingOverrideScalingMode{-1};
+
+    // Computes the cached bounds of this layer alone.
+    void computeOwnBounds(FloatRect parentBounds, const ui::Transform& parentTransform);
+    bool hasGeometryChanged(const State& oldState, const State& newState) const;
+
     void setZOrderRelativeOf(const wp<Layer>& relativeOf);
 
     bool mGetHandleCalled = false;
@@ -120,7 +120,8 @@ void LayerProtoHelper::writeToProto(const sp<GraphicBuffer>& buffer,
 }
 
 void LayerProtoHelper::writeToProto(
-        const InputWindowInfo& inputInfo, const wp<Layer>& touchableRegionBounds,
+        const InputWindowInfo& inputInfo, int32_t touchableRegionCropId,
+        const Rect& touchableRegionCrop,
         std::function<InputWindowInfoProto*()> getInputWindowInfoProto) {
     if (inputInfo.token == nullptr) {
         return;
@@ -146,11 +147,9 @@ void LayerProtoHelper::writeToProto(
     proto->set_window_x_scale(inputInfo.windowXScale);
     proto->set_window_y_scale(inputInfo.windowYScale);
     proto->set_replace_touchable_region_with_crop(inputInfo.replaceTouchableRegionWithCrop);
-    auto cropLayer = touchableRegionBounds.promote();
-    if (cropLayer != nullptr) {
-        proto->set_crop_layer_id(cropLayer->sequence);
-        LayerProtoHelper::writeToProto(cropLayer->getScreenBounds(
-                                               false /* reduceTransparentRegion */),
+    if (touchableRegionCropId != -1) {
+        proto->set_crop_layer_id(touchableRegionCropId);
+        LayerProtoHelper::writeToProto(touchableRegionCrop,
                                        [&]() { return proto->mutable_touchable_region_crop(); });
     }
 }
@@ -40,8 +40,9 @@ public:
     static void writeToProto(const ui::Transform& transform, TransformProto* transformProto);
     static void writeToProto(const sp<GraphicBuffer>& buffer,
                              std::function<ActiveBufferProto*()> getActiveBufferProto);
-    static void writeToProto(const InputWindowInfo& inputInfo,
-                             const wp<Layer>& touchableRegionBounds,
+    // touchableRegionCropId is -1 without a crop layer.
+    static void writeToProto(const InputWindowInfo& inputInfo, int32_t touchableRegionCropId,
+                             const Rect& touchableRegionCrop,
                              std::function<InputWindowInfoProto*()> getInputWindowInfoProto);
 };
 
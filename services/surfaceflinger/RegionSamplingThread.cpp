@@ -26,6 +26,10 @@
 #include <utils/Trace.h>
 #include <string>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include <compositionengine/Display.h>
 #include <compositionengine/impl/OutputCompositionState.h>
 #include "DisplayDevice.h"
@@ -55,6 +59,9 @@ constexpr auto maxRegionSamplingSkips = 10;
 constexpr auto defaultRegionSamplingOffset = -3ms;
 constexpr auto defaultRegionSamplingPeriod = 100ms;
 constexpr auto defaultRegionSamplingTimerTimeout = 100ms;
+// The sampled region is captured at 1/regionSamplingDownscale of its size in each
+// dimension, which is plenty to find the median luma.
+constexpr int32_t regionSamplingDownscale = 4;
 // TODO: (b/127403193) duration to string conversion could probably be constexpr
 template <typename Rep, typename Per>
 inline std::string toNsString(std::chrono::duration<Rep, Per> t) {
@@ -208,6 +215,7 @@ void RegionSamplingThread::addListener(const Rect& samplingArea, const sp<IBinde
     asBinder->linkToDeath(this);
     std::lock_guard lock(mSamplingMutex);
     mDescriptors.emplace(wp<IBinder>(asBinder), Descriptor{samplingArea, stopLayer, listener});
+    mNewDescriptorAdded = true;
 }
 
 void RegionSamplingThread::removeListener(const sp<IRegionSamplingListener>& listener) {
@@ -225,7 +233,11 @@ void RegionSamplingThread::checkForStaleLuma() {
     }
 }
 
-void RegionSamplingThread::notifyNewContent() {
+void RegionSamplingThread::notifyNewContent(const Region& dirtyRegion) {
+    {
+        std::lock_guard lock(mThreadControlMutex);
+        mDirtyRegion.orSelf(dirtyRegion);
+    }
     doSample();
 }
 
@@ -272,15 +284,87 @@ void RegionSamplingThread::binderDied(const wp<IBinder>& who) {
 }
 
 namespace {
-// Using Rec. 709 primaries
-inline float getLuma(float r, float g, float b) {
-    constexpr auto rec709_red_primary = 0.2126f;
-    constexpr auto rec709_green_primary = 0.7152f;
-    constexpr auto rec709_blue_primary = 0.0722f;
-    return rec709_red_primary * r + rec709_green_primary * g + rec709_blue_primary * b;
+// Rec. 709 luma coefficients in 8.8 fixed point. They add up to 256, so white
+// maps to a luma of 255.
+constexpr uint16_t rec709RedWeight = 54;
+constexpr uint16_t rec709GreenWeight = 183;
+constexpr uint16_t rec709BlueWeight = 19;
+
+inline uint8_t getLuma(uint32_t pixel) {
+    const uint32_t r = pixel & 0xFF;
+    const uint32_t g = (pixel >> 8) & 0xFF;
+    const uint32_t b = (pixel >> 16) & 0xFF;
+    return (rec709RedWeight * r + rec709GreenWeight * g + rec709BlueWeight * b + 128) >> 8;
+}
+
+// Computes the luma of |count| RGBA_8888 pixels.
+void computeLumas(const uint32_t* pixels, int32_t count, uint8_t* lumas) {
+    int32_t i = 0;
+#ifdef __ARM_NEON
+    const uint8x8_t redWeight = vdup_n_u8(rec709RedWeight);
+    const uint8x8_t greenWeight = vdup_n_u8(rec709GreenWeight);
+    const uint8x8_t blueWeight = vdup_n_u8(rec709BlueWeight);
+    for (; i + 8 <= count; i += 8) {
+        const uint8x8x4_t rgba = vld4_u8(reinterpret_cast<const uint8_t*>(pixels + i));
+        uint16x8_t sum = vmull_u8(rgba.val[0], redWeight);
+        sum = vmlal_u8(sum, rgba.val[1], greenWeight);
+        sum = vmlal_u8(sum, rgba.val[2], blueWeight);
+        vst1_u8(lumas + i, vrshrn_n_u16(sum, 8));
+    }
+#endif
+    for (; i < count; i++) {
+        lumas[i] = getLuma(pixels[i]);
+    }
 }
 } // anonymous namespace
 
+Rect scaleSampleArea(const Rect& area, int32_t sourceWidth, int32_t sourceHeight, int32_t width,
+                     int32_t height) {
+    if (sourceWidth <= 0 || sourceHeight <= 0) {
+        return Rect::EMPTY_RECT;
+    }
+    const auto scaleDown = [](int32_t value, int32_t scaled, int32_t source) {
+        return static_cast<int32_t>(int64_t{value} * scaled / source);
+    };
+    const auto scaleUp = [](int32_t value, int32_t scaled, int32_t source) {
+        return static_cast<int32_t>((int64_t{value} * scaled + source - 1) / source);
+    };
+    Rect scaled(scaleDown(area.left, width, sourceWidth), scaleDown(area.top, height, sourceHeight),
+                scaleUp(area.right, width, sourceWidth), scaleUp(area.bottom, height, sourceHeight));
+    scaled.intersect(Rect(width, height), &scaled);
+    return scaled;
+}
+
+Region displayToLayerStackSpace(const Region& region, uint32_t orientation, int32_t displayWidth,
+                                int32_t displayHeight) {
+    auto dx = 0;
+    auto dy = 0;
+    switch (orientation) {
+        case ui::Transform::ROT_90:
+            dx = displayWidth;
+            break;
+        case ui::Transform::ROT_180:
+            dx = displayWidth;
+            dy = displayHeight;
+            break;
+        case ui::Transform::ROT_270:
+            dy = displayHeight;
+            break;
+        default:
+            break;
+    }
+
+    ui::Transform t(orientation);
+    return t.transform(region).translate(dx, dy);
+}
+
+bool isSampleAreaDirty(const Region& dirtyRegion, const Rect& area, uint32_t orientation,
+                       int32_t displayWidth, int32_t displayHeight) {
+    const Region captured =
+            displayToLayerStackSpace(Region(area), orientation, displayWidth, displayHeight);
+    return !dirtyRegion.intersect(captured).isEmpty();
+}
+
 float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
                  uint32_t orientation, const Rect& sample_area) {
     if (!sample_area.isValid() || (sample_area.getWidth() > width) ||
@@ -304,14 +388,10 @@ float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t st
     std::array<int32_t, 256> brightnessBuckets = {};
     const int32_t majoritySampleNum = area.getWidth() * area.getHeight() / 2;
 
+    std::vector<uint8_t> rowLumas(area.getWidth());
     for (int32_t row = area.top; row < area.bottom; ++row) {
-        const uint32_t* rowBase = data + row * stride;
-        for (int32_t column = area.left; column < area.right; ++column) {
-            uint32_t pixel = rowBase[column];
-            const float r = pixel & 0xFF;
-            const float g = (pixel >> 8) & 0xFF;
-            const float b = (pixel >> 16) & 0xFF;
-            const uint8_t luma = std::round(getLuma(r, g, b));
+        computeLumas(data + row * stride + area.left, area.getWidth(), rowLumas.data());
+        for (const uint8_t luma : rowLumas) {
             ++brightnessBuckets[luma];
             if (brightnessBuckets[luma] > majoritySampleNum) return luma / 255.0f;
         }
@@ -328,7 +408,7 @@ float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t st
 }
 
 std::vector<float> RegionSamplingThread::sampleBuffer(
-        const sp<GraphicBuffer>& buffer, const Point& leftTop,
+        const sp<GraphicBuffer>& buffer, const Rect& sampledArea,
         const std::vector<RegionSamplingThread::Descriptor>& descriptors, uint32_t orientation) {
     void* data_raw = nullptr;
     buffer->lock(GRALLOC_USAGE_SW_READ_OFTEN, &data_raw);
@@ -343,13 +423,23 @@ std::vector<float> RegionSamplingThread::sampleBuffer(
     std::transform(descriptors.begin(), descriptors.end(), lumas.begin(),
                    [&](auto const& descriptor) {
                        return sampleArea(data.get(), width, height, stride, orientation,
-                                         descriptor.area - leftTop);
+                                         scaleSampleArea(descriptor.area - sampledArea.leftTop(),
+                                                         sampledArea.getWidth(),
+                                                         sampledArea.getHeight(), width,
+                                                         height));
                    });
     return lumas;
 }
 
 void RegionSamplingThread::captureSample() {
     ATRACE_CALL();
+
+    Region dirtyRegion;
+    {
+        std::lock_guard lock(mThreadControlMutex);
+        std::swap(dirtyRegion, mDirtyRegion);
+    }
+
     std::lock_guard lock(mSamplingMutex);
 
     if (mDescriptors.empty()) {
@@ -371,6 +461,20 @@ void RegionSamplingThread::captureSample() {
         }
     }(device->getOrientation());
 
+    // Listeners already have the luma of areas where nothing was redrawn since
+    // the last sample, so the capture is only needed if one of them changed.
+    // The display is redrawn in layer stack space, like it is captured.
+    const bool areaChanged =
+            std::any_of(mDescriptors.begin(), mDescriptors.end(), [&](const auto& entry) {
+                return isSampleAreaDirty(dirtyRegion, entry.second.area, orientation,
+                                         device->getWidth(), device->getHeight());
+            });
+    if (!areaChanged && !mNewDescriptorAdded) {
+        ATRACE_INT(lumaSamplingStepTag, static_cast<int>(samplingStep::noWorkNeeded));
+        return;
+    }
+    mNewDescriptorAdded = false;
+
     std::vector<RegionSamplingThread::Descriptor> descriptors;
     Region sampleRegion;
     for (const auto& [listener, descriptor] : mDescriptors) {
@@ -380,28 +484,15 @@ void RegionSamplingThread::captureSample() {
 
     const Rect sampledArea = sampleRegion.bounds();
 
-    auto dx = 0;
-    auto dy = 0;
-    switch (orientation) {
-        case ui::Transform::ROT_90:
-            dx = device->getWidth();
-            break;
-        case ui::Transform::ROT_180:
-            dx = device->getWidth();
-            dy = device->getHeight();
-            break;
-        case ui::Transform::ROT_270:
-            dy = device->getHeight();
-            break;
-        default:
-            break;
-    }
-
-    ui::Transform t(orientation);
-    auto screencapRegion = t.transform(sampleRegion);
-    screencapRegion = screencapRegion.translate(dx, dy);
-    DisplayRenderArea renderArea(device, screencapRegion.bounds(), sampledArea.getWidth(),
-                                 sampledArea.getHeight(), ui::Dataspace::V0_SRGB, orientation);
+    const Region screencapRegion = displayToLayerStackSpace(sampleRegion, orientation,
+                                                            device->getWidth(),
+                                                            device->getHeight());
+    const int32_t captureWidth =
+            (sampledArea.getWidth() + regionSamplingDownscale - 1) / regionSamplingDownscale;
+    const int32_t captureHeight =
+            (sampledArea.getHeight() + regionSamplingDownscale - 1) / regionSamplingDownscale;
+    DisplayRenderArea renderArea(device, screencapRegion.bounds(), captureWidth, captureHeight,
+                                 ui::Dataspace::V0_SRGB, orientation);
 
     std::unordered_set<sp<IRegionSamplingListener>, SpHash<IRegionSamplingListener>> listeners;
 
@@ -447,13 +538,13 @@ void RegionSamplingThread::captureSample() {
     };
 
     sp<GraphicBuffer> buffer = nullptr;
-    if (mCachedBuffer && mCachedBuffer->getWidth() == sampledArea.getWidth() &&
-        mCachedBuffer->getHeight() == sampledArea.getHeight()) {
+    if (mCachedBuffer && mCachedBuffer->getWidth() == static_cast<uint32_t>(captureWidth) &&
+        mCachedBuffer->getHeight() == static_cast<uint32_t>(captureHeight)) {
         buffer = mCachedBuffer;
     } else {
         const uint32_t usage = GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_HW_RENDER;
-        buffer = new GraphicBuffer(sampledArea.getWidth(), sampledArea.getHeight(),
-                                   PIXEL_FORMAT_RGBA_8888, 1, usage, "RegionSamplingThread");
+        buffer = new GraphicBuffer(captureWidth, captureHeight, PIXEL_FORMAT_RGBA_8888, 1, usage,
+                                   "RegionSamplingThread");
     }
 
     bool ignored;
@@ -468,7 +559,7 @@ void RegionSamplingThread::captureSample() {
 
     ALOGV("Sampling %zu descriptors", activeDescriptors.size());
     std::vector<float> lumas =
-            sampleBuffer(buffer, sampledArea.leftTop(), activeDescriptors, orientation);
+            sampleBuffer(buffer, sampledArea, activeDescriptors, orientation);
     if (lumas.size() != activeDescriptors.size()) {
         ALOGW("collected %zu median luma values for %zu descriptors", lumas.size(),
               activeDescriptors.size());
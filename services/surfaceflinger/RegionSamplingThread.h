@@ -26,6 +26,7 @@
 #include <binder/IBinder.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/Rect.h>
+#include <ui/Region.h>
 #include <utils/StrongPointer.h>
 #include "Scheduler/IdleTimer.h"
 
@@ -40,6 +41,22 @@ struct SamplingOffsetCallback;
 float sampleArea(const uint32_t* data, int32_t width, int32_t height, int32_t stride,
                  uint32_t orientation, const Rect& area);
 
+// Maps |area|, relative to a sampled area of |sourceWidth| x |sourceHeight|, to
+// the |width| x |height| buffer it was captured into. Rounds outwards, so that
+// small areas still cover at least one pixel.
+Rect scaleSampleArea(const Rect& area, int32_t sourceWidth, int32_t sourceHeight, int32_t width,
+                     int32_t height);
+
+// Maps |region| of a display with the given orientation and size, as sampling
+// areas are given, to the layer stack space the display is captured from.
+Region displayToLayerStackSpace(const Region& region, uint32_t orientation, int32_t displayWidth,
+                                int32_t displayHeight);
+
+// Returns whether the sampling |area| of the display was redrawn, given the
+// |dirtyRegion| of its layer stack.
+bool isSampleAreaDirty(const Region& dirtyRegion, const Rect& area, uint32_t orientation,
+                       int32_t displayWidth, int32_t displayHeight);
+
 class RegionSamplingThread : public IBinder::DeathRecipient {
 public:
     struct TimingTunables {
@@ -74,9 +91,10 @@ public:
     // Remove the listener to stop receiving median luma notifications.
     void removeListener(const sp<IRegionSamplingListener>& listener);
 
-    // Notifies sampling engine that new content is available. This will trigger a sampling
-    // pass at some point in the future.
-    void notifyNewContent();
+    // Notifies sampling engine that new content is available in |dirtyRegion|. This will
+    // trigger a sampling pass at some point in the future, which is skipped if no sampling
+    // area was redrawn in the meantime.
+    void notifyNewContent(const Region& dirtyRegion);
 
     // Notifies the sampling engine that it has a good timing window in which to sample.
     void notifySamplingOffset();
@@ -94,7 +112,7 @@ private:
         }
     };
     std::vector<float> sampleBuffer(
-            const sp<GraphicBuffer>& buffer, const Point& leftTop,
+            const sp<GraphicBuffer>& buffer, const Rect& sampledArea,
             const std::vector<RegionSamplingThread::Descriptor>& descriptors, uint32_t orientation);
 
     void doSample();
@@ -119,10 +137,14 @@ private:
     bool mSampleRequested GUARDED_BY(mThreadControlMutex) = false;
     uint32_t mDiscardedFrames GUARDED_BY(mThreadControlMutex) = 0;
     std::chrono::nanoseconds lastSampleTime GUARDED_BY(mThreadControlMutex);
+    // Area of the default display redrawn since the last sample was captured.
+    Region mDirtyRegion GUARDED_BY(mThreadControlMutex);
 
     std::mutex mSamplingMutex;
     std::unordered_map<wp<IBinder>, Descriptor, WpHash> mDescriptors GUARDED_BY(mSamplingMutex);
     sp<GraphicBuffer> mCachedBuffer GUARDED_BY(mSamplingMutex) = nullptr;
+    // Set when a listener was added, which needs a sample even if nothing changed.
+    bool mNewDescriptorAdded GUARDED_BY(mSamplingMutex) = false;
 };
 
 } // namespace android
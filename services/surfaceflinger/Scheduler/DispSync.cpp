@@ -35,6 +35,7 @@
 #include "DispSync.h"
 #include "EventLog/EventLog.h"
 #include "SurfaceFlinger.h"
+#include "VsyncModel.h"
 
 using android::base::StringAppendF;
 using std::max;
@@ -53,10 +54,16 @@ static const bool kEnableZeroPhaseTracer = false;
 
 // This is the threshold used to determine when hardware vsync events are
 // needed to re-synchronize the software vsync model with the hardware.  The
-// error metric used is the mean of the squared difference between each
-// present time and the nearest software-predicted vsync.
+// error metric used is the median of the squared difference between each
+// present time and the nearest software-predicted vsync, so that a few late
+// present fences don't force a resync on their own.
 static const nsecs_t kErrorThreshold = 160000000000; // 400 usec squared
 
+// The model is only trusted enough to turn hardware vsync off once the
+// hardware vsync events it was fitted to are, on average, within this
+// distance of it.
+static const nsecs_t kMaxLockedModelResidual = 200000; // 200 usec
+
 #undef LOG_TAG
 #define LOG_TAG "DispSyncThread"
 class DispSyncThread : public Thread {
@@ -512,6 +519,9 @@ void DispSync::resetLocked() {
         mReferenceTime = mResyncSamples[lastSampleIdx];
     }
     mModelUpdated = false;
+    mModelResidual = 0;
+    mModelInlierCount = 0;
+    mModelOutlierCount = 0;
     for (size_t i = 0; i < MAX_RESYNC_SAMPLES; i++) {
         mResyncSamples[i] = 0;
     }
@@ -535,7 +545,11 @@ bool DispSync::addPresentFence(const std::shared_ptr<FenceTime>& fenceTime) {
 
     updateErrorLocked();
 
-    return !mModelUpdated || mError > kErrorThreshold;
+    const bool needsResync = !mModelUpdated || mError > kErrorThreshold;
+    if (needsResync && mModelUpdated) {
+        mNumErrorResyncs++;
+    }
+    return needsResync;
 }
 
 void DispSync::beginResync() {
@@ -603,8 +617,13 @@ bool DispSync::addResyncSample(nsecs_t timestamp, bool* periodFlushed) {
     }
 
     // Check against kErrorThreshold / 2 to add some hysteresis before having to
-    // resync again
-    bool modelLocked = mModelUpdated && mError < (kErrorThreshold / 2) && mPendingPeriod == 0;
+    // resync again. A model that doesn't fit the hardware vsync events well
+    // would soon have to be resynced anyway, so keep collecting samples until
+    // more of them can't help.
+    const bool modelTrusted = mModelResidual <= kMaxLockedModelResidual ||
+            mNumResyncSamples == MAX_RESYNC_SAMPLES;
+    bool modelLocked = mModelUpdated && mError < (kErrorThreshold / 2) && modelTrusted &&
+            mPendingPeriod == 0;
     ALOGV("[%s] addResyncSample returning %s", mName, modelLocked ? "locked" : "unlocked");
     if (modelLocked) {
         *periodFlushed = true;
@@ -665,51 +684,35 @@ void DispSync::updateModelLocked() {
     ALOGV("[%s] updateModelLocked %zu", mName, mNumResyncSamples);
     if (mNumResyncSamples >= MIN_RESYNC_SAMPLES_FOR_UPDATE) {
         ALOGV("[%s] Computing...", mName);
-        nsecs_t durationSum = 0;
-        nsecs_t minDuration = INT64_MAX;
-        nsecs_t maxDuration = 0;
         // We skip the first 2 samples because the first vsync duration on some
         // devices may be much more inaccurate than on other devices, e.g. due
         // to delays in ramping up from a power collapse. By doing so this
         // actually increases the accuracy of the DispSync model even though
         // we're effectively relying on fewer sample points.
         static constexpr size_t numSamplesSkipped = 2;
+        nsecs_t samples[MAX_RESYNC_SAMPLES];
+        size_t numSamples = 0;
         for (size_t i = numSamplesSkipped; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            size_t prev = (idx + MAX_RESYNC_SAMPLES - 1) % MAX_RESYNC_SAMPLES;
-            nsecs_t duration = mResyncSamples[idx] - mResyncSamples[prev];
-            durationSum += duration;
-            minDuration = min(minDuration, duration);
-            maxDuration = max(maxDuration, duration);
+            samples[numSamples++] = mResyncSamples[(mFirstResyncSample + i) % MAX_RESYNC_SAMPLES];
         }
 
-        // Exclude the min and max from the average
-        durationSum -= minDuration + maxDuration;
-        mPeriod = durationSum / (mNumResyncSamples - numSamplesSkipped - 2);
-
-        ALOGV("[%s] mPeriod = %" PRId64, mName, ns2us(mPeriod));
-
-        double sampleAvgX = 0;
-        double sampleAvgY = 0;
-        double scale = 2.0 * M_PI / double(mPeriod);
-        for (size_t i = numSamplesSkipped; i < mNumResyncSamples; i++) {
-            size_t idx = (mFirstResyncSample + i) % MAX_RESYNC_SAMPLES;
-            nsecs_t sample = mResyncSamples[idx] - mReferenceTime;
-            double samplePhase = double(sample % mPeriod) * scale;
-            sampleAvgX += cos(samplePhase);
-            sampleAvgY += sin(samplePhase);
+        const auto model = scheduler::fitVsyncModel(samples, numSamples, mReferenceTime);
+        if (!model) {
+            ALOGV("[%s] No model fits the samples", mName);
+            return;
         }
 
-        sampleAvgX /= double(mNumResyncSamples - numSamplesSkipped);
-        sampleAvgY /= double(mNumResyncSamples - numSamplesSkipped);
-
-        mPhase = nsecs_t(atan2(sampleAvgY, sampleAvgX) / scale);
+        mPeriod = model->period;
+        mPhase = model->phase;
+        mModelResidual = model->residual;
+        mModelInlierCount = model->inlierCount;
+        mModelOutlierCount = model->outlierCount;
 
-        ALOGV("[%s] mPhase = %" PRId64, mName, ns2us(mPhase));
-
-        if (mPhase < -(mPeriod / 2)) {
-            mPhase += mPeriod;
-            ALOGV("[%s] Adjusting mPhase -> %" PRId64, mName, ns2us(mPhase));
+        ALOGV("[%s] mPeriod = %" PRId64 ", mPhase = %" PRId64 ", residual = %" PRId64
+              ", %zu outliers",
+              mName, ns2us(mPeriod), ns2us(mPhase), ns2us(mModelResidual), mModelOutlierCount);
+        if (mTraceDetailedInfo) {
+            ATRACE_INT64("DispSync:ModelResidual", mModelResidual);
         }
 
         // Artificially inflate the period if requested.
@@ -729,8 +732,8 @@ void DispSync::updateErrorLocked() {
     // since they might arrive between two events.
     nsecs_t period = mPeriod / (1 + mRefreshSkipCount);
 
-    int numErrSamples = 0;
-    nsecs_t sqErrSum = 0;
+    size_t numErrSamples = 0;
+    nsecs_t sampleErrs[NUM_PRESENT_SAMPLES];
 
     for (size_t i = 0; i < NUM_PRESENT_SAMPLES; i++) {
         // Only check for the cached value of signal time to avoid unecessary
@@ -751,14 +754,21 @@ void DispSync::updateErrorLocked() {
         if (sampleErr > period / 2) {
             sampleErr -= period;
         }
-        sqErrSum += sampleErr * sampleErr;
-        numErrSamples++;
+        sampleErrs[numErrSamples++] = sampleErr;
     }
 
     if (numErrSamples > 0) {
-        mError = sqErrSum / numErrSamples;
+        // The median error is the error of the model, the others are either
+        // noise in the present times or present fences that signaled late.
+        auto sampleErrsEnd = sampleErrs + numErrSamples;
+        auto middle = sampleErrs + numErrSamples / 2;
+        std::nth_element(sampleErrs, middle, sampleErrsEnd,
+                         [](nsecs_t a, nsecs_t b) { return std::abs(a) < std::abs(b); });
+        mPhaseError = *middle;
+        mError = mPhaseError * mPhaseError;
         mZeroErrSamplesCount = 0;
     } else {
+        mPhaseError = 0;
         mError = 0;
         // Use mod ACCEPTABLE_ZERO_ERR_SAMPLES_COUNT to avoid log spam.
         mZeroErrSamplesCount++;
@@ -768,11 +778,13 @@ void DispSync::updateErrorLocked() {
 
     if (mTraceDetailedInfo) {
         ATRACE_INT64("DispSync:Error", mError);
+        ATRACE_INT64("DispSync:PhaseError", mPhaseError);
     }
 }
 
 void DispSync::resetErrorLocked() {
     mPresentSampleOffset = 0;
+    mPhaseError = 0;
     mError = 0;
     mZeroErrSamplesCount = 0;
     if (mTraceDetailedInfo) {
@@ -784,8 +796,11 @@ void DispSync::resetErrorLocked() {
 }
 
 nsecs_t DispSync::computeNextRefresh(int periodOffset) const {
+    return computeNextRefreshAfter(systemTime(SYSTEM_TIME_MONOTONIC), periodOffset);
+}
+
+nsecs_t DispSync::computeNextRefreshAfter(nsecs_t now, int periodOffset) const {
     Mutex::Autolock lock(mMutex);
-    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
     nsecs_t phase = mReferenceTime + mPhase;
     if (mPeriod == 0) {
         return 0;
@@ -807,7 +822,11 @@ void DispSync::dump(std::string& result) const {
     StringAppendF(&result, "mPeriod: %" PRId64 " ns (%.3f fps; skipCount=%d)\n", mPeriod,
                   1000000000.0 / mPeriod, mRefreshSkipCount);
     StringAppendF(&result, "mPhase: %" PRId64 " ns\n", mPhase);
-    StringAppendF(&result, "mError: %" PRId64 " ns (sqrt=%.1f)\n", mError, sqrt(mError));
+    StringAppendF(&result, "mError: %" PRId64 " ns (sqrt=%.1f, phase error %" PRId64 " ns)\n",
+                  mError, sqrt(mError), mPhaseError);
+    StringAppendF(&result, "mModelResidual: %" PRId64 " ns (%zu samples, %zu outliers)\n",
+                  mModelResidual, mModelInlierCount, mModelOutlierCount);
+    StringAppendF(&result, "mNumErrorResyncs: %zu\n", mNumErrorResyncs);
     StringAppendF(&result, "mNumResyncSamplesSincePresent: %d (limit %d)\n",
                   mNumResyncSamplesSincePresent, MAX_RESYNC_SAMPLES_WITHOUT_PRESENT);
     StringAppendF(&result, "mNumResyncSamples: %zd (max %d)\n", mNumResyncSamples,
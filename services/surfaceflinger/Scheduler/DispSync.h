@@ -175,6 +175,10 @@ public:
     // the refresh after next. etc.
     nsecs_t computeNextRefresh(int periodOffset) const override;
 
+    // Same as computeNextRefresh, from the given time instead of now. This
+    // lets recorded vsync timelines be replayed against the model.
+    nsecs_t computeNextRefreshAfter(nsecs_t now, int periodOffset) const;
+
     // In certain situations the present fences aren't a good indicator of vsync
     // time, e.g. when vr flinger is active, or simply aren't available,
     // e.g. when the sync framework isn't present. Use this method to toggle
@@ -231,6 +235,14 @@ private:
     // mPresentFences array.
     nsecs_t mError;
 
+    // mPhaseError is the median signed difference between the present times
+    // in the mPresentFences array and the nearest software-predicted vsync.
+    nsecs_t mPhaseError = 0;
+
+    // mNumErrorResyncs counts the present fences that found the model error
+    // over the threshold, and so asked for hardware vsync to be turned on.
+    size_t mNumErrorResyncs = 0;
+
     // mZeroErrSamplesCount keeps track of how many times in a row there were
     // zero timestamps available in the mPresentFences array.
     // Used to sanity check that we are able to calculate the model error.
@@ -239,6 +251,12 @@ private:
     // Whether we have updated the vsync event model since the last resync.
     bool mModelUpdated;
 
+    // How well the model fits the hardware vsync events it was computed from,
+    // see scheduler::VsyncModel.
+    nsecs_t mModelResidual = 0;
+    size_t mModelInlierCount = 0;
+    size_t mModelOutlierCount = 0;
+
     // These member variables are the state used during the resynchronization
     // process to store information about the hardware vsync event times used
     // to compute the model.
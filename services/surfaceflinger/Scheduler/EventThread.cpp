@@ -20,6 +20,7 @@
 #include <sched.h>
 #include <sys/types.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <optional>
@@ -227,6 +228,15 @@ status_t EventThread::registerDisplayEventConnection(const sp<EventThreadConnect
         return ALREADY_EXISTS;
     }
 
+    // VSYNC events only go through mVSyncConnections, so connections that went away without
+    // ever requesting VSYNC are pruned here instead of on every event.
+    mDisplayEventConnections.erase(std::remove_if(mDisplayEventConnections.begin(),
+                                                  mDisplayEventConnections.end(),
+                                                  [](const wp<EventThreadConnection>& ptr) {
+                                                      return ptr.promote() == nullptr;
+                                                  }),
+                                   mDisplayEventConnections.end());
+
     mDisplayEventConnections.push_back(connection);
     mCondition.notify_all();
     return NO_ERROR;
@@ -238,6 +248,29 @@ void EventThread::removeDisplayEventConnectionLocked(const wp<EventThreadConnect
     if (it != mDisplayEventConnections.cend()) {
         mDisplayEventConnections.erase(it);
     }
+
+    auto vsyncIt = std::find(mVSyncConnections.cbegin(), mVSyncConnections.cend(), connection);
+    if (vsyncIt != mVSyncConnections.cend()) {
+        mVSyncConnections.erase(vsyncIt);
+    }
+}
+
+void EventThread::setVSyncRequestLocked(const sp<EventThreadConnection>& connection,
+                                        VSyncRequest request) {
+    if (connection->vsyncRequest == request) {
+        return;
+    }
+
+    if (connection->vsyncRequest == VSyncRequest::None) {
+        mVSyncConnections.push_back(connection);
+    } else if (request == VSyncRequest::None) {
+        auto it = std::find(mVSyncConnections.cbegin(), mVSyncConnections.cend(), connection);
+        if (it != mVSyncConnections.cend()) {
+            mVSyncConnections.erase(it);
+        }
+    }
+
+    connection->vsyncRequest = request;
 }
 
 void EventThread::setVsyncRate(uint32_t rate, const sp<EventThreadConnection>& connection) {
@@ -249,7 +282,7 @@ void EventThread::setVsyncRate(uint32_t rate, const sp<EventThreadConnection>& c
 
     const auto request = rate == 0 ? VSyncRequest::None : static_cast<VSyncRequest>(rate);
     if (connection->vsyncRequest != request) {
-        connection->vsyncRequest = request;
+        setVSyncRequestLocked(connection, request);
         mCondition.notify_all();
     }
 }
@@ -262,7 +295,7 @@ void EventThread::requestNextVsync(const sp<EventThreadConnection>& connection)
     std::lock_guard<std::mutex> lock(mMutex);
 
     if (connection->vsyncRequest == VSyncRequest::None) {
-        connection->vsyncRequest = VSyncRequest::Single;
+        setVSyncRequestLocked(connection, VSyncRequest::Single);
         mCondition.notify_all();
     }
 }
@@ -338,29 +371,52 @@ void EventThread::threadMain(std::unique_lock<std::mutex>& lock) {
             }
         }
 
-        bool vsyncRequested = false;
-
-        // Find connections that should consume this event.
-        auto it = mDisplayEventConnections.begin();
-        while (it != mDisplayEventConnections.end()) {
-            if (const auto connection = it->promote()) {
-                vsyncRequested |= connection->vsyncRequest != VSyncRequest::None;
-
-                if (event && shouldConsumeEvent(*event, connection)) {
+        // Find connections that should consume this event. Only connections that requested
+        // VSYNC are looked at for VSYNC events, so idle connections cost nothing per frame.
+        if (event && event->header.type == DisplayEventReceiver::DISPLAY_EVENT_VSYNC) {
+            auto it = mVSyncConnections.begin();
+            while (it != mVSyncConnections.end()) {
+                const auto connection = it->promote();
+                if (connection && shouldConsumeEvent(*event, connection)) {
                     consumers.push_back(connection);
                 }
 
-                ++it;
-            } else {
-                it = mDisplayEventConnections.erase(it);
+                if (!connection || connection->vsyncRequest == VSyncRequest::None) {
+                    it = mVSyncConnections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        } else if (event) {
+            auto it = mDisplayEventConnections.begin();
+            while (it != mDisplayEventConnections.end()) {
+                if (const auto connection = it->promote()) {
+                    if (shouldConsumeEvent(*event, connection)) {
+                        consumers.push_back(connection);
+                    }
+
+                    ++it;
+                } else {
+                    it = mDisplayEventConnections.erase(it);
+                }
             }
         }
 
         if (!consumers.empty()) {
-            dispatchEvent(*event, consumers);
+            // Send without holding the lock, so that clients requesting the next VSYNC from
+            // their callback, and VSYNC callbacks from the source, are not blocked on the sends.
+            lock.unlock();
+            const auto failedConsumers = dispatchEvent(*event, consumers);
             consumers.clear();
+            lock.lock();
+
+            for (const auto& consumer : failedConsumers) {
+                removeDisplayEventConnectionLocked(consumer);
+            }
         }
 
+        const bool vsyncRequested = !mVSyncConnections.empty();
+
         State nextState;
         if (mVSyncState && vsyncRequested) {
             nextState = mVSyncState->synthetic ? State::SyntheticVSync : State::VSync;
@@ -429,8 +485,9 @@ bool EventThread::shouldConsumeEvent(const DisplayEventReceiver::Event& event,
     }
 }
 
-void EventThread::dispatchEvent(const DisplayEventReceiver::Event& event,
-                                const DisplayEventConsumers& consumers) {
+EventThread::DisplayEventConsumers EventThread::dispatchEvent(
+        const DisplayEventReceiver::Event& event, const DisplayEventConsumers& consumers) {
+    DisplayEventConsumers failedConsumers;
     for (const auto& consumer : consumers) {
         switch (consumer->postEvent(event)) {
             case NO_ERROR:
@@ -444,9 +501,10 @@ void EventThread::dispatchEvent(const DisplayEventReceiver::Event& event,
 
             default:
                 // Treat EPIPE and other errors as fatal.
-                removeDisplayEventConnectionLocked(consumer);
+                failedConsumers.push_back(consumer);
         }
     }
+    return failedConsumers;
 }
 
 void EventThread::dump(std::string& result) const {
@@ -466,7 +524,8 @@ void EventThread::dump(std::string& result) const {
         StringAppendF(&result, "    %s\n", toString(event).c_str());
     }
 
-    StringAppendF(&result, "  connections (count=%zu):\n", mDisplayEventConnections.size());
+    StringAppendF(&result, "  connections (count=%zu, requesting VSYNC=%zu):\n",
+                  mDisplayEventConnections.size(), mVSyncConnections.size());
     for (const auto& ptr : mDisplayEventConnections) {
         if (const auto connection = ptr.promote()) {
             StringAppendF(&result, "    %s\n", toString(*connection).c_str());
@@ -165,12 +165,17 @@ private:
 
     bool shouldConsumeEvent(const DisplayEventReceiver::Event& event,
                             const sp<EventThreadConnection>& connection) const REQUIRES(mMutex);
-    void dispatchEvent(const DisplayEventReceiver::Event& event,
-                       const DisplayEventConsumers& consumers) REQUIRES(mMutex);
+    // Posts the event to the consumers, and returns those that failed fatally.
+    DisplayEventConsumers dispatchEvent(const DisplayEventReceiver::Event& event,
+                                        const DisplayEventConsumers& consumers) EXCLUDES(mMutex);
 
     void removeDisplayEventConnectionLocked(const wp<EventThreadConnection>& connection)
             REQUIRES(mMutex);
 
+    // Updates the VSYNC request of the connection, keeping mVSyncConnections in sync with it.
+    void setVSyncRequestLocked(const sp<EventThreadConnection>& connection, VSyncRequest request)
+            REQUIRES(mMutex);
+
     // Implements VSyncSource::Callback
     void onVSyncEvent(nsecs_t timestamp) override;
 
@@ -186,6 +191,10 @@ private:
     mutable std::condition_variable mCondition;
 
     std::vector<wp<EventThreadConnection>> mDisplayEventConnections GUARDED_BY(mMutex);
+
+    // Subset of mDisplayEventConnections whose vsyncRequest is not VSyncRequest::None. VSYNC
+    // events are only dispatched to these, and VSYNC is enabled as long as there are any.
+    std::vector<wp<EventThreadConnection>> mVSyncConnections GUARDED_BY(mMutex);
     std::deque<DisplayEventReceiver::Event> mPendingEvents GUARDED_BY(mMutex);
 
     // VSYNC state of connected display.
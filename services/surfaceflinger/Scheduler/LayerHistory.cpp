@@ -23,7 +23,6 @@
 #include <limits>
 #include <numeric>
 #include <string>
-#include <unordered_map>
 
 #include <cutils/properties.h>
 #include <utils/Log.h>
@@ -49,96 +48,76 @@ std::unique_ptr<LayerHistory::LayerHandle> LayerHistory::createLayer(const std::
                                                                      float minRefreshRate,
                                                                      float maxRefreshRate) {
     const int64_t id = sNextId++;
+    auto layerInfo = std::make_unique<LayerInfo>(name, minRefreshRate, maxRefreshRate);
+    LayerInfo& layerInfoRef = *layerInfo;
 
     std::lock_guard lock(mLock);
-    mInactiveLayerInfos.emplace(id,
-                                std::make_shared<LayerInfo>(name, minRefreshRate, maxRefreshRate));
-    return std::make_unique<LayerHistory::LayerHandle>(*this, id);
+    size_t slot;
+    if (mFreeSlots.empty()) {
+        slot = mLayerInfos.size();
+        mLayerInfos.push_back(std::move(layerInfo));
+    } else {
+        slot = mFreeSlots.back();
+        mFreeSlots.pop_back();
+        mLayerInfos[slot] = std::move(layerInfo);
+    }
+    return std::make_unique<LayerHistory::LayerHandle>(*this, id, slot, layerInfoRef);
 }
 
-void LayerHistory::destroyLayer(const int64_t id) {
+void LayerHistory::destroyLayer(size_t slot) {
     std::lock_guard lock(mLock);
-    auto it = mActiveLayerInfos.find(id);
-    if (it != mActiveLayerInfos.end()) {
-        mActiveLayerInfos.erase(it);
-    }
-
-    it = mInactiveLayerInfos.find(id);
-    if (it != mInactiveLayerInfos.end()) {
-        mInactiveLayerInfos.erase(it);
-    }
+    mLayerInfos[slot].reset();
+    mFreeSlots.push_back(slot);
 }
 
 void LayerHistory::insert(const std::unique_ptr<LayerHandle>& layerHandle, nsecs_t presentTime,
                           bool isHdr) {
-    std::shared_ptr<LayerInfo> layerInfo;
-    {
-        std::lock_guard lock(mLock);
-        auto layerInfoIterator = mInactiveLayerInfos.find(layerHandle->mId);
-        if (layerInfoIterator != mInactiveLayerInfos.end()) {
-            layerInfo = layerInfoIterator->second;
-            mInactiveLayerInfos.erase(layerInfoIterator);
-            mActiveLayerInfos.insert({layerHandle->mId, layerInfo});
-        } else {
-            layerInfoIterator = mActiveLayerInfos.find(layerHandle->mId);
-            if (layerInfoIterator != mActiveLayerInfos.end()) {
-                layerInfo = layerInfoIterator->second;
-            } else {
-                ALOGW("Inserting information about layer that is not registered: %" PRId64,
-                      layerHandle->mId);
-                return;
-            }
-        }
-    }
-    layerInfo->setLastPresentTime(presentTime);
-    layerInfo->setHDRContent(isHdr);
+    // The LayerInfo lives exactly as long as the handle: ~LayerHandle calls destroyLayer(),
+    // which resets it. This takes no lock only because the caller keeps the owning Layer, and
+    // with it the handle, alive for the duration of the call.
+    LayerInfo& layerInfo = layerHandle->mLayerInfo;
+    layerInfo.setLastPresentTime(presentTime);
+    layerInfo.setHDRContent(isHdr);
 }
 
 void LayerHistory::setVisibility(const std::unique_ptr<LayerHandle>& layerHandle, bool visible) {
-    std::shared_ptr<LayerInfo> layerInfo;
-    {
-        std::lock_guard lock(mLock);
-        auto layerInfoIterator = mInactiveLayerInfos.find(layerHandle->mId);
-        if (layerInfoIterator != mInactiveLayerInfos.end()) {
-            layerInfo = layerInfoIterator->second;
-            if (visible) {
-                mInactiveLayerInfos.erase(layerInfoIterator);
-                mActiveLayerInfos.insert({layerHandle->mId, layerInfo});
-            }
-        } else {
-            layerInfoIterator = mActiveLayerInfos.find(layerHandle->mId);
-            if (layerInfoIterator != mActiveLayerInfos.end()) {
-                layerInfo = layerInfoIterator->second;
-            } else {
-                ALOGW("Inserting information about layer that is not registered: %" PRId64,
-                      layerHandle->mId);
-                return;
-            }
-        }
-    }
-    layerInfo->setVisibility(visible);
+    layerHandle->mLayerInfo.setVisibility(visible);
 }
 
 std::pair<float, bool> LayerHistory::getDesiredRefreshRateAndHDR() {
     bool isHDR = false;
     float newRefreshRate = 0.f;
+    const nsecs_t now = systemTime();
     std::lock_guard lock(mLock);
 
-    removeIrrelevantLayers();
-
     // Iterate through all layers that have been recently updated, and find the max refresh rate.
-    for (const auto& [layerId, layerInfo] : mActiveLayerInfos) {
-        const float layerRefreshRate = layerInfo->getDesiredRefreshRate();
+    // Layers that have been idle for a given amount of time become inactive.
+    for (const auto& layerInfo : mLayerInfos) {
+        if (!layerInfo || !layerInfo->isActive()) {
+            continue;
+        }
+
+        const auto vote = layerInfo->evaluate(now);
+        if (!vote) {
+            if (mTraceEnabled) {
+                ALOGD("Layer %s obsolete", layerInfo->getName().c_str());
+                // Make sure to update systrace to indicate that the layer was erased.
+                std::string layerName = "LFPS " + layerInfo->getName();
+                ATRACE_INT(layerName.c_str(), 0);
+            }
+            continue;
+        }
+
         if (mTraceEnabled) {
             // Store the refresh rate in traces for easy debugging.
             std::string layerName = "LFPS " + layerInfo->getName();
-            ATRACE_INT(layerName.c_str(), std::round(layerRefreshRate));
-            ALOGD("%s: %f", layerName.c_str(), std::round(layerRefreshRate));
+            ATRACE_INT(layerName.c_str(), std::round(vote->refreshRate));
+            ALOGD("%s: %f", layerName.c_str(), std::round(vote->refreshRate));
         }
-        if (layerInfo->isRecentlyActive() && layerRefreshRate > newRefreshRate) {
-            newRefreshRate = layerRefreshRate;
+        if (vote->isRecentlyActive && vote->refreshRate > newRefreshRate) {
+            newRefreshRate = vote->refreshRate;
         }
-        isHDR |= layerInfo->getHDRContent();
+        isHDR |= vote->isHDR;
     }
     if (mTraceEnabled) {
         ALOGD("LayerHistory DesiredRefreshRate: %.2f", newRefreshRate);
@@ -147,44 +126,13 @@ std::pair<float, bool> LayerHistory::getDesiredRefreshRateAndHDR() {
     return {newRefreshRate, isHDR};
 }
 
-void LayerHistory::removeIrrelevantLayers() {
-    const int64_t obsoleteEpsilon = systemTime() - scheduler::OBSOLETE_TIME_EPSILON_NS.count();
-    // Iterator pointing to first element in map
-    auto it = mActiveLayerInfos.begin();
-    while (it != mActiveLayerInfos.end()) {
-        // If last updated was before the obsolete time, remove it.
-        // Keep HDR layer around as long as they are visible.
-        if (!it->second->isVisible() ||
-            (!it->second->getHDRContent() && it->second->getLastUpdatedTime() < obsoleteEpsilon)) {
-            // erase() function returns the iterator of the next
-            // to last deleted element.
-            if (mTraceEnabled) {
-                ALOGD("Layer %s obsolete", it->second->getName().c_str());
-                // Make sure to update systrace to indicate that the layer was erased.
-                std::string layerName = "LFPS " + it->second->getName();
-                ATRACE_INT(layerName.c_str(), 0);
-            }
-            auto id = it->first;
-            auto layerInfo = it->second;
-            layerInfo->clearHistory();
-            mInactiveLayerInfos.insert({id, layerInfo});
-            it = mActiveLayerInfos.erase(it);
-        } else {
-            ++it;
-        }
-    }
-}
-
 void LayerHistory::clearHistory() {
     std::lock_guard lock(mLock);
 
-    auto it = mActiveLayerInfos.begin();
-    while (it != mActiveLayerInfos.end()) {
-        auto id = it->first;
-        auto layerInfo = it->second;
-        layerInfo->clearHistory();
-        mInactiveLayerInfos.insert({id, layerInfo});
-        it = mActiveLayerInfos.erase(it);
+    for (const auto& layerInfo : mLayerInfos) {
+        if (layerInfo) {
+            layerInfo->clearHistory();
+        }
     }
 }
 
@@ -20,8 +20,9 @@
 #include <cinttypes>
 #include <cstdint>
 #include <numeric>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include <utils/Timers.h>
 
@@ -32,21 +33,27 @@ namespace android {
 namespace scheduler {
 
 /*
- * This class represents information about layers that are considered current. We keep an
- * unordered map between layer name and LayerInfo.
+ * This class represents information about layers that are considered current. Each layer
+ * gets a slot holding its LayerInfo for as long as its handle lives, so that frames are
+ * recorded through the handle without looking the layer up or taking mLock.
  */
 class LayerHistory {
 public:
     // Handle for each layer we keep track of.
     class LayerHandle {
     public:
-        LayerHandle(LayerHistory& lh, int64_t id) : mId(id), mLayerHistory(lh) {}
-        ~LayerHandle() { mLayerHistory.destroyLayer(mId); }
+        LayerHandle(LayerHistory& lh, int64_t id, size_t slot, LayerInfo& layerInfo)
+              : mId(id), mLayerHistory(lh), mSlot(slot), mLayerInfo(layerInfo) {}
+        ~LayerHandle() { mLayerHistory.destroyLayer(mSlot); }
 
         const int64_t mId;
 
     private:
+        friend LayerHistory;
+
         LayerHistory& mLayerHistory;
+        const size_t mSlot;
+        LayerInfo& mLayerInfo;
     };
 
     LayerHistory();
@@ -56,7 +63,8 @@ public:
     std::unique_ptr<LayerHandle> createLayer(const std::string name, float minRefreshRate,
                                              float maxRefreshRate);
 
-    // Method for inserting layers and their requested present time into the unordered map.
+    // Method for recording layers' requested present time. Safe to call from any thread
+    // while the handle is alive, and does not take mLock.
     void insert(const std::unique_ptr<LayerHandle>& layerHandle, nsecs_t presentTime, bool isHdr);
     // Method for setting layer visibility
     void setVisibility(const std::unique_ptr<LayerHandle>& layerHandle, bool visible);
@@ -68,17 +76,15 @@ public:
     // Clears all layer history.
     void clearHistory();
 
-    // Removes the handle and the object from the map.
-    void destroyLayer(const int64_t id);
-
 private:
-    // Removes the layers that have been idle for a given amount of time from mLayerInfos.
-    void removeIrrelevantLayers() REQUIRES(mLock);
+    // Frees the slot of a layer whose handle is destroyed.
+    void destroyLayer(size_t slot);
 
-    // Information about currently active layers.
+    // Slots of the registered layers, indexed by LayerHandle::mSlot. Slots of destroyed
+    // layers are null until reused for a new layer.
     std::mutex mLock;
-    std::unordered_map<int64_t, std::shared_ptr<LayerInfo>> mActiveLayerInfos GUARDED_BY(mLock);
-    std::unordered_map<int64_t, std::shared_ptr<LayerInfo>> mInactiveLayerInfos GUARDED_BY(mLock);
+    std::vector<std::unique_ptr<LayerInfo>> mLayerInfos GUARDED_BY(mLock);
+    std::vector<size_t> mFreeSlots GUARDED_BY(mLock);
 
     // Each layer has it's own ID. This variable keeps track of the count.
     static std::atomic<int64_t> sNextId;
@@ -38,6 +38,7 @@ void LayerInfo::setLastPresentTime(nsecs_t lastPresentTime) {
     // Buffers can come with a present time far in the future. That keeps them relevant.
     mLastUpdatedTime = std::max(lastPresentTime, systemTime());
     mPresentTimeHistory.insertPresentTime(mLastUpdatedTime);
+    mIsActive = true;
 
     if (mLastPresentTime == 0) {
         // First frame
@@ -54,5 +55,21 @@ void LayerInfo::setLastPresentTime(nsecs_t lastPresentTime) {
     mRefreshRateHistory.insertRefreshRate(fps);
 }
 
+std::optional<LayerInfo::Vote> LayerInfo::evaluate(nsecs_t now) {
+    std::lock_guard lock(mLock);
+
+    // Keep HDR layer around as long as they are visible.
+    const int64_t obsoleteEpsilon = now - OBSOLETE_TIME_EPSILON_NS.count();
+    if (!mIsVisible || (!mIsHDR && mLastUpdatedTime < obsoleteEpsilon)) {
+        clearHistoryLocked();
+        return {};
+    }
+
+    const float refreshRate = mPresentTimeHistory.isLowActivityLayer(now)
+            ? 1e9f / mLowActivityRefreshDuration
+            : mRefreshRateHistory.getRefreshRateAvg();
+    return Vote{refreshRate, mPresentTimeHistory.isRelevant(now), mIsHDR};
+}
+
 } // namespace scheduler
 } // namespace android
@@ -16,11 +16,13 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cinttypes>
 #include <cstdint>
-#include <deque>
 #include <mutex>
 #include <numeric>
+#include <optional>
 #include <string>
 
 #include <log/log.h>
@@ -37,6 +39,43 @@ namespace scheduler {
  * This class represents information about individial layers.
  */
 class LayerInfo {
+    /**
+     * Fixed capacity FIFO that overwrites its oldest element once full, so that keeping the
+     * history of a layer does not allocate on every frame.
+     */
+    template <typename T, size_t N>
+    class RingBuffer {
+    public:
+        void push(T value) {
+            mElements[(mBegin + mSize) % N] = value;
+            if (mSize < N) {
+                mSize++;
+            } else {
+                mBegin = (mBegin + 1) % N;
+            }
+        }
+
+        // Returns the i-th oldest element.
+        T operator[](size_t i) const { return mElements[(mBegin + i) % N]; }
+
+        T front() const { return (*this)[0]; }
+        T back() const { return (*this)[mSize - 1]; }
+
+        size_t size() const { return mSize; }
+        bool empty() const { return mSize == 0; }
+        bool full() const { return mSize == N; }
+
+        void clear() {
+            mBegin = 0;
+            mSize = 0;
+        }
+
+    private:
+        std::array<T, N> mElements;
+        size_t mBegin = 0;
+        size_t mSize = 0;
+    };
+
     /**
      * Struct that keeps the information about the refresh rate for last
      * HISTORY_SIZE frames. This is used to better determine the refresh rate
@@ -47,10 +86,11 @@ class LayerInfo {
         explicit RefreshRateHistory(nsecs_t minRefreshDuration)
               : mMinRefreshDuration(minRefreshDuration) {}
         void insertRefreshRate(int refreshRate) {
-            mElements.push_back(refreshRate);
-            if (mElements.size() > HISTORY_SIZE) {
-                mElements.pop_front();
+            if (mElements.full()) {
+                mSum -= mElements.front();
             }
+            mElements.push(refreshRate);
+            mSum += refreshRate;
         }
 
         float getRefreshRateAvg() const {
@@ -58,14 +98,19 @@ class LayerInfo {
                 return 1e9f / mMinRefreshDuration;
             }
 
-            return scheduler::calculate_mean(mElements);
+            // Integer mean, as calculate_mean() computes it over the elements.
+            return mSum / static_cast<nsecs_t>(mElements.size());
         }
 
-        void clearHistory() { mElements.clear(); }
+        void clearHistory() {
+            mElements.clear();
+            mSum = 0;
+        }
 
     private:
-        std::deque<nsecs_t> mElements;
         static constexpr size_t HISTORY_SIZE = 30;
+        RingBuffer<nsecs_t, HISTORY_SIZE> mElements;
+        nsecs_t mSum = 0;
         const nsecs_t mMinRefreshDuration;
     };
 
@@ -76,49 +121,41 @@ class LayerInfo {
      */
     class PresentTimeHistory {
     public:
-        void insertPresentTime(nsecs_t presentTime) {
-            mElements.push_back(presentTime);
-            if (mElements.size() > HISTORY_SIZE) {
-                mElements.pop_front();
-            }
-        }
+        void insertPresentTime(nsecs_t presentTime) { mElements.push(presentTime); }
 
         // Checks whether the present time that was inserted HISTORY_SIZE ago is within a
         // certain threshold: TIME_EPSILON_NS.
-        bool isRelevant() const {
+        bool isRelevant(nsecs_t now) const {
             if (mElements.size() < 2) {
                 return false;
             }
 
             // The layer had to publish at least HISTORY_SIZE or HISTORY_TIME of updates
-            if (mElements.size() != HISTORY_SIZE &&
-                mElements.at(mElements.size() - 1) - mElements.at(0) < HISTORY_TIME.count()) {
+            if (!mElements.full() && mElements.back() - mElements.front() < HISTORY_TIME.count()) {
                 return false;
             }
 
             // The last update should not be older than OBSOLETE_TIME_EPSILON_NS nanoseconds.
-            const int64_t obsoleteEpsilon =
-                    systemTime() - scheduler::OBSOLETE_TIME_EPSILON_NS.count();
-            if (mElements.at(mElements.size() - 1) < obsoleteEpsilon) {
+            const int64_t obsoleteEpsilon = now - scheduler::OBSOLETE_TIME_EPSILON_NS.count();
+            if (mElements.back() < obsoleteEpsilon) {
                 return false;
             }
 
             return true;
         }
 
-        bool isLowActivityLayer() const {
+        bool isLowActivityLayer(nsecs_t now) const {
             // We want to make sure that we received more than two frames from the layer
             // in order to check low activity.
             if (mElements.size() < scheduler::LOW_ACTIVITY_BUFFERS + 1) {
                 return false;
             }
 
-            const int64_t obsoleteEpsilon =
-                    systemTime() - scheduler::LOW_ACTIVITY_EPSILON_NS.count();
+            const int64_t obsoleteEpsilon = now - scheduler::LOW_ACTIVITY_EPSILON_NS.count();
             // Check the frame before last to determine whether there is low activity.
             // If that frame is older than LOW_ACTIVITY_EPSILON_NS, the layer is sending
             // infrequent updates.
-            if (mElements.at(mElements.size() - (scheduler::LOW_ACTIVITY_BUFFERS + 1)) <
+            if (mElements[mElements.size() - (scheduler::LOW_ACTIVITY_BUFFERS + 1)] <
                 obsoleteEpsilon) {
                 return true;
             }
@@ -129,12 +166,19 @@ class LayerInfo {
         void clearHistory() { mElements.clear(); }
 
     private:
-        std::deque<nsecs_t> mElements;
         static constexpr size_t HISTORY_SIZE = 90;
         static constexpr std::chrono::nanoseconds HISTORY_TIME = 1s;
+        RingBuffer<nsecs_t, HISTORY_SIZE> mElements;
     };
 
 public:
+    // What an active layer contributes to the refresh rate decision.
+    struct Vote {
+        float refreshRate;
+        bool isRecentlyActive;
+        bool isHDR;
+    };
+
     LayerInfo(const std::string name, float minRefreshRate, float maxRefreshRate);
     ~LayerInfo();
 
@@ -143,7 +187,7 @@ public:
 
     // Records the last requested oresent time. It also stores information about when
     // the layer was last updated. If the present time is farther in the future than the
-    // updated time, the updated time is the present time.
+    // updated time, the updated time is the present time. This makes the layer active.
     void setLastPresentTime(nsecs_t lastPresentTime);
 
     void setHDRContent(bool isHdr) {
@@ -151,53 +195,39 @@ public:
         mIsHDR = isHdr;
     }
 
+    // Making the layer visible makes it active.
     void setVisibility(bool visible) {
         std::lock_guard lock(mLock);
         mIsVisible = visible;
-    }
-
-    // Checks the present time history to see whether the layer is relevant.
-    bool isRecentlyActive() const {
-        std::lock_guard lock(mLock);
-        return mPresentTimeHistory.isRelevant();
-    }
-
-    // Calculate the average refresh rate.
-    float getDesiredRefreshRate() const {
-        std::lock_guard lock(mLock);
-
-        if (mPresentTimeHistory.isLowActivityLayer()) {
-            return 1e9f / mLowActivityRefreshDuration;
+        if (visible) {
+            mIsActive = true;
         }
-        return mRefreshRateHistory.getRefreshRateAvg();
     }
 
-    bool getHDRContent() {
-        std::lock_guard lock(mLock);
-        return mIsHDR;
-    }
+    // Whether the layer was updated or made visible since it was last found obsolete or its
+    // history was cleared. Only active layers take part in the refresh rate decision.
+    bool isActive() const { return mIsActive; }
 
-    bool isVisible() {
-        std::lock_guard lock(mLock);
-        return mIsVisible;
-    }
-
-    // Return the last updated time. If the present time is farther in the future than the
-    // updated time, the updated time is the present time.
-    nsecs_t getLastUpdatedTime() {
-        std::lock_guard lock(mLock);
-        return mLastUpdatedTime;
-    }
+    // Evaluates an active layer at the given time, with a single lock acquisition. If the
+    // layer is not visible, or it was last updated before the obsolete time and has no HDR
+    // content, its history is cleared, it becomes inactive, and nothing is returned.
+    std::optional<Vote> evaluate(nsecs_t now);
 
     std::string getName() const { return mName; }
 
+    // Clears the history, and makes the layer inactive.
     void clearHistory() {
         std::lock_guard lock(mLock);
+        clearHistoryLocked();
+    }
+
+private:
+    void clearHistoryLocked() REQUIRES(mLock) {
         mRefreshRateHistory.clearHistory();
         mPresentTimeHistory.clearHistory();
+        mIsActive = false;
     }
 
-private:
     const std::string mName;
     const nsecs_t mMinRefreshDuration;
     const nsecs_t mLowActivityRefreshDuration;
@@ -208,6 +238,10 @@ private:
     PresentTimeHistory mPresentTimeHistory GUARDED_BY(mLock);
     bool mIsHDR GUARDED_BY(mLock) = false;
     bool mIsVisible GUARDED_BY(mLock) = false;
+
+    // Written with mLock held, but read without it so that inactive layers are skipped
+    // without locking them.
+    std::atomic<bool> mIsActive = false;
 };
 
 } // namespace scheduler
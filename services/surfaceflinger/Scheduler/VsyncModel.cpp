@@ -0,0 +1,169 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VsyncModel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace android {
+namespace scheduler {
+
+namespace {
+
+// A line needs at least this many points to say anything about how well it
+// fits them.
+constexpr size_t kMinSamples = 3;
+
+// Samples further than this many times the median residual from the first fit
+// are left out. For normally distributed jitter, this is about 2.7 standard
+// deviations.
+constexpr double kOutlierScale = 4.0;
+
+// Samples within this distance of the first fit are always kept, so that
+// perfectly regular timestamps don't make every small jitter an outlier.
+constexpr double kMinOutlierDistance = 100000.0; // 100 usec
+
+template <typename T>
+T median(std::vector<T> values) {
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+}
+
+struct Line {
+    double intercept;
+    double slope;
+};
+
+// Least-squares fit of y = intercept + slope * x over the points in use.
+std::optional<Line> fitLine(const std::vector<double>& x, const std::vector<double>& y,
+                            const std::vector<bool>& inUse) {
+    double count = 0;
+    double sumX = 0;
+    double sumY = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        if (inUse[i]) {
+            count++;
+            sumX += x[i];
+            sumY += y[i];
+        }
+    }
+    if (count < kMinSamples) {
+        return {};
+    }
+
+    const double meanX = sumX / count;
+    const double meanY = sumY / count;
+    double sumXX = 0;
+    double sumXY = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        if (inUse[i]) {
+            sumXX += (x[i] - meanX) * (x[i] - meanX);
+            sumXY += (x[i] - meanX) * (y[i] - meanY);
+        }
+    }
+    if (sumXX == 0) {
+        return {};
+    }
+
+    const double slope = sumXY / sumXX;
+    return Line{meanY - slope * meanX, slope};
+}
+
+} // namespace
+
+std::optional<VsyncModel> fitVsyncModel(const nsecs_t* samples, size_t count,
+                                        nsecs_t referenceTime) {
+    if (count < kMinSamples) {
+        return {};
+    }
+
+    std::vector<nsecs_t> intervals;
+    intervals.reserve(count - 1);
+    for (size_t i = 1; i < count; i++) {
+        intervals.push_back(samples[i] - samples[i - 1]);
+    }
+    const nsecs_t typicalInterval = median(intervals);
+    if (typicalInterval <= 0) {
+        return {};
+    }
+
+    // Times are taken relative to the first sample, so that they fit in a
+    // double without losing precision.
+    std::vector<double> vsyncNumbers(count);
+    std::vector<double> times(count);
+    for (size_t i = 0; i < count; i++) {
+        times[i] = double(samples[i] - samples[0]);
+        vsyncNumbers[i] = std::round(times[i] / double(typicalInterval));
+    }
+
+    std::vector<bool> inUse(count, true);
+    auto line = fitLine(vsyncNumbers, times, inUse);
+    if (!line) {
+        return {};
+    }
+
+    std::vector<double> residuals(count);
+    for (size_t i = 0; i < count; i++) {
+        residuals[i] = std::abs(times[i] - (line->intercept + line->slope * vsyncNumbers[i]));
+    }
+    const double maxDistance =
+            std::max(kOutlierScale * median(residuals), kMinOutlierDistance);
+    size_t outlierCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (residuals[i] > maxDistance) {
+            inUse[i] = false;
+            outlierCount++;
+        }
+    }
+    if (outlierCount > 0) {
+        line = fitLine(vsyncNumbers, times, inUse);
+        if (!line) {
+            return {};
+        }
+    }
+
+    VsyncModel model;
+    model.period = nsecs_t(std::llround(line->slope));
+    if (model.period <= 0) {
+        return {};
+    }
+    model.inlierCount = count - outlierCount;
+    model.outlierCount = outlierCount;
+
+    double sumSquares = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (inUse[i]) {
+            const double residual = times[i] - (line->intercept + line->slope * vsyncNumbers[i]);
+            sumSquares += residual * residual;
+        }
+    }
+    model.residual = nsecs_t(std::llround(std::sqrt(sumSquares / double(model.inlierCount))));
+
+    const nsecs_t firstVsync = samples[0] + nsecs_t(std::llround(line->intercept));
+    model.phase = (firstVsync - referenceTime) % model.period;
+    if (model.phase < -(model.period / 2)) {
+        model.phase += model.period;
+    } else if (model.phase >= model.period / 2) {
+        model.phase -= model.period;
+    }
+    return model;
+}
+
+} // namespace scheduler
+} // namespace android
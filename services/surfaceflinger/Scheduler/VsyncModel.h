@@ -0,0 +1,58 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <optional>
+
+#include <utils/Timers.h>
+
+namespace android {
+namespace scheduler {
+
+// A vsync model fitted to hardware vsync timestamps.
+struct VsyncModel {
+    // The period between two vsync events.
+    nsecs_t period = 0;
+
+    // The offset of the modeled vsync events from the reference time the
+    // model was fitted against, between -period / 2 and period / 2.
+    nsecs_t phase = 0;
+
+    // The root mean square distance of the samples used by the fit to the
+    // modeled vsync events. This is how far off a prediction is expected to
+    // be, so the smaller it is the more the model can be trusted.
+    nsecs_t residual = 0;
+
+    // The number of samples the model was fitted to, and the number of
+    // samples left out because they were too far from the others.
+    size_t inlierCount = 0;
+    size_t outlierCount = 0;
+};
+
+// Fits a vsync model to |count| hardware vsync timestamps, given in
+// chronological order, with a least-squares fit of the timestamps against
+// their vsync number. Vsync numbers are assigned from the median interval
+// between timestamps, so that a missed vsync shows up as a gap rather than as
+// a longer period. After a first fit, timestamps that are far from it
+// compared to the others are left out, and the model is fitted again.
+// Returns nothing if there are too few timestamps to fit a model.
+std::optional<VsyncModel> fitVsyncModel(const nsecs_t* samples, size_t count,
+                                        nsecs_t referenceTime);
+
+} // namespace scheduler
+} // namespace android
@@ -22,12 +22,15 @@
 #include <dlfcn.h>
 
 #include <algorithm>
+#include <charconv>
 #include <cinttypes>
 #include <cmath>
 #include <cstdint>
 #include <functional>
+#include <limits>
 #include <mutex>
 #include <optional>
+#include <string_view>
 #include <unordered_map>
 
 #include <cutils/properties.h>
@@ -219,6 +222,36 @@ bool validateCompositionDataspace(Dataspace dataspace) {
     return dataspace == Dataspace::V0_SRGB || dataspace == Dataspace::DISPLAY_P3;
 }
 
+bool hasSameRects(const Region& a, const Region& b) {
+    if (a.isTriviallyEqual(b)) {
+        return true;
+    }
+    size_t countA, countB;
+    const Rect* rectsA = a.getArray(&countA);
+    const Rect* rectsB = b.getArray(&countB);
+    return countA == countB && std::equal(rectsA, rectsA + countA, rectsB);
+}
+
+// Do not present if the desiredPresentTime has not passed unless it is more than one second
+// in the future. We ignore timestamps more than 1 second in the future for stability reasons.
+bool isDesiredPresentTimeDue(int64_t desiredPresentTime, nsecs_t expectedPresentTime) {
+    return desiredPresentTime < 0 || desiredPresentTime < expectedPresentTime ||
+            desiredPresentTime >= expectedPresentTime + s2ns(1);
+}
+
+// Returns the index of the first state, starting at |first|, with an acquire fence that has not
+// signaled yet, or states.size() if there is none.
+size_t findUnsignaledAcquireFence(const Vector<ComposerState>& states, size_t first) {
+    for (size_t i = first; i < states.size(); i++) {
+        const layer_state_t& s = states[i].state;
+        if ((s.what & layer_state_t::eAcquireFenceChanged) && s.acquireFence &&
+            s.acquireFence->getStatus() == Fence::Status::Unsignaled) {
+            return i;
+        }
+    }
+    return states.size();
+}
+
 }  // namespace anonymous
 
 // ---------------------------------------------------------------------------
@@ -386,6 +419,10 @@ SurfaceFlinger::SurfaceFlinger(Factory& factory) : SurfaceFlinger(factory, SkipI
     property_get("debug.sf.luma_sampling", value, "1");
     mLumaSampling = atoi(value);
 
+    property_get("debug.sf.incremental_visible_regions", value, "1");
+    mIncrementalVisibleRegions = atoi(value);
+    ALOGI_IF(!mIncrementalVisibleRegions, "Disabling incremental visible region computation");
+
     const auto [early, gl, late] = mPhaseOffsets->getCurrentOffsets();
     mVsyncModulator.setPhaseOffsets(early, gl, late,
                                     mPhaseOffsets->getOffsetThresholdForNextVsync());
@@ -655,6 +692,7 @@ void SurfaceFlinger::init() {
     renderEngineFeature |=
             (enable_protected_contents(false) ? renderengine::RenderEngine::ENABLE_PROTECTED_CONTEXT
                                               : 0);
+    renderEngineFeature |= renderengine::RenderEngine::ENABLE_PROGRAM_WARMUP;
 
     // TODO(b/77156734): We need to stop casting and use HAL types when possible.
     // Sending maxFrameBufferAcquiredBuffers as the cache size is tightly tuned to single-display.
@@ -1826,7 +1864,10 @@ void SurfaceFlinger::handleMessageRefresh() {
     rebuildLayerStacks();
     calculateWorkingSet();
     long compositionTime = elapsedRealtimeNano();
-    for (const auto& [token, display] : mDisplays) {
+    // Displays are composited one after another on this thread. They share
+    // the RenderEngine context, the HWC client and the front-end state of
+    // layers shown on more than one display, none of which is thread safe.
+    for (const auto& display : getDisplaysInCompositionOrder()) {
         beginFrame(display);
         prepareFrame(display);
         doDebugFlashRegions(display, repaintEverything);
@@ -1852,6 +1893,7 @@ void SurfaceFlinger::handleMessageRefresh() {
     mVsyncModulator.onRefreshed(mHadClientComposition);
 
     mLayersWithQueuedFrames.clear();
+    mLayerSnapshotsValid = false;
     if (mVisibleRegionsDirty) {
         mVisibleRegionsDirty = false;
         if (mTracingEnabled) {
@@ -1867,6 +1909,7 @@ bool SurfaceFlinger::handleMessageInvalidate() {
 
     if (mVisibleRegionsDirty) {
         computeLayerBounds();
+        mLayerSnapshotsValid = false;
     }
 
     for (auto& layer : mLayersPendingRefresh) {
@@ -1878,6 +1921,22 @@ bool SurfaceFlinger::handleMessageInvalidate() {
     return refreshNeeded;
 }
 
+std::vector<sp<DisplayDevice>> SurfaceFlinger::getDisplaysInCompositionOrder() const {
+    std::vector<sp<DisplayDevice>> displays;
+    displays.reserve(mDisplays.size());
+    for (const auto& [token, display] : mDisplays) {
+        displays.push_back(display);
+    }
+
+    // mDisplays is keyed by token address, so its order is arbitrary.
+    const auto rank = [](const sp<DisplayDevice>& display) {
+        return display->isPrimary() ? 0 : display->isVirtual() ? 2 : 1;
+    };
+    std::stable_sort(displays.begin(), displays.end(),
+                     [&](const auto& lhs, const auto& rhs) { return rank(lhs) < rank(rhs); });
+    return displays;
+}
+
 void SurfaceFlinger::calculateWorkingSet() {
     ATRACE_CALL();
     ALOGV(__FUNCTION__);
@@ -1885,6 +1944,22 @@ void SurfaceFlinger::calculateWorkingSet() {
     // build the h/w work list
     if (CC_UNLIKELY(mGeometryInvalid)) {
         mGeometryInvalid = false;
+        // Update the display independent composition state. This goes to the
+        // general composition layer state structure, which is shared by the
+        // output layers of every display the layer is on, so it is latched
+        // once per compositionengine::Layer before any of them reads it.
+        std::unordered_set<compositionengine::Layer*> latchedLayers;
+        for (const auto& [token, displayDevice] : mDisplays) {
+            auto display = displayDevice->getCompositionDisplay();
+            for (auto& layer : display->getOutputLayersOrderedByZ()) {
+                auto& compositionLayer = layer->getLayer();
+                if (latchedLayers.insert(&compositionLayer).second) {
+                    layer->getLayerFE().latchCompositionState(compositionLayer.editState().frontEnd,
+                                                              true);
+                }
+            }
+        }
+
         for (const auto& [token, displayDevice] : mDisplays) {
             auto display = displayDevice->getCompositionDisplay();
 
@@ -1900,12 +1975,6 @@ void SurfaceFlinger::calculateWorkingSet() {
                 // The output Z order is set here based on a simple counter.
                 compositionState.z = zOrder++;
 
-                // Update the display independent composition state. This goes
-                // to the general composition layer state structure.
-                // TODO: Do this once per compositionengine::CompositionLayer.
-                layer->getLayerFE().latchCompositionState(layer->getLayer().editState().frontEnd,
-                                                          true);
-
                 // Recalculate the geometry state of the output layer.
                 layer->updateCompositionState(true);
 
@@ -1981,6 +2050,21 @@ void SurfaceFlinger::calculateWorkingSet() {
                     layer->getCompositionType(displayDevice));
         }
     }
+
+    // Count the layer commands that were left out because the HWC already had
+    // the values, to show how much of the command buffer was saved.
+    uint32_t skippedCommandCount = 0;
+    for (const auto& [token, displayDevice] : mDisplays) {
+        auto display = displayDevice->getCompositionDisplay();
+        for (auto& layer : display->getOutputLayersOrderedByZ()) {
+            auto& hwcState = layer->editState().hwc;
+            if (hwcState) {
+                skippedCommandCount += hwcState->skippedCommandCount;
+                hwcState->skippedCommandCount = 0;
+            }
+        }
+    }
+    ATRACE_INT("HwcCommandsSkipped", skippedCommandCount);
 }
 
 void SurfaceFlinger::doDebugFlashRegions(const sp<DisplayDevice>& displayDevice,
@@ -2240,8 +2324,9 @@ void SurfaceFlinger::postComposition()
         mTransactionCompletedThread.sendCallbacks();
     }
 
-    if (mLumaSampling && mRegionSamplingThread) {
-        mRegionSamplingThread->notifyNewContent();
+    if (mLumaSampling && mRegionSamplingThread && !mRegionSamplingDirtyRegion.isEmpty()) {
+        mRegionSamplingThread->notifyNewContent(mRegionSamplingDirtyRegion);
+        mRegionSamplingDirtyRegion.clear();
     }
 
     // Even though ATRACE_INT64 already checks if tracing is enabled, it doesn't prevent the
@@ -2266,6 +2351,50 @@ void SurfaceFlinger::computeLayerBounds() {
     }
 }
 
+void SurfaceFlinger::updateLayerSnapshots() {
+    if (mLayerSnapshotsValid) {
+        return;
+    }
+    ATRACE_CALL();
+
+    mLayerSnapshots.clear();
+    mDrawingState.traverseInZOrder([&](Layer* layer) {
+        LayerSnapshot& snapshot = mLayerSnapshots.emplace_back();
+        snapshot.layer = layer;
+        snapshot.sequence = layer->getSequence();
+        snapshot.layerStack = layer->getLayerStack();
+        snapshot.primaryDisplayOnly = layer->getPrimaryDisplayOnly();
+        snapshot.hasInput = layer->hasInput();
+        snapshot.alpha = layer->getAlpha();
+        snapshot.transform = layer->getTransform();
+
+        // hidden surfaces keep empty bounds
+        if (CC_LIKELY(layer->isVisible())) {
+            const Layer::State& s(layer->getDrawingState());
+            const bool translucent = !layer->isOpaque(s);
+            const Rect bounds(layer->getScreenBounds());
+            if (!bounds.isEmpty()) {
+                const ui::Transform& tr = snapshot.transform;
+                snapshot.bounds = bounds;
+
+                // Remove the transparent area from the visible region. If the
+                // transformation is too complex, we can't do the transparent
+                // region optimization.
+                if (translucent && tr.preserveRects()) {
+                    snapshot.transparentRegion =
+                            tr.transform(layer->getActiveTransparentRegion(s));
+                }
+
+                const int32_t layerOrientation = tr.getOrientation();
+                snapshot.opaque = snapshot.alpha == 1.0f && !translucent &&
+                        layer->getRoundedCornerState().radius == 0.0f &&
+                        ((layerOrientation & ui::Transform::ROT_INVALID) == false);
+            }
+        }
+    });
+    mLayerSnapshotsValid = true;
+}
+
 void SurfaceFlinger::rebuildLayerStacks() {
     ATRACE_CALL();
     ALOGV("rebuildLayerStacks");
@@ -2275,6 +2404,15 @@ void SurfaceFlinger::rebuildLayerStacks() {
         ATRACE_NAME("rebuildLayerStacks VR Dirty");
         invalidateHwcGeometry();
 
+        // forget what was computed for displays that went away
+        for (auto it = mVisibleRegionsCache.begin(); it != mVisibleRegionsCache.end();) {
+            if (mDisplays.count(it->first) == 0) {
+                it = mVisibleRegionsCache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
         for (const auto& pair : mDisplays) {
             const auto& displayDevice = pair.second;
             auto display = displayDevice->getCompositionDisplay();
@@ -2289,10 +2427,11 @@ void SurfaceFlinger::rebuildLayerStacks() {
             if (displayState.isEnabled) {
                 computeVisibleRegions(displayDevice, dirtyRegion, opaqueRegion);
 
-                mDrawingState.traverseInZOrder([&](Layer* layer) {
+                for (const auto& snapshot : mLayerSnapshots) {
+                    Layer* layer = snapshot.layer;
                     auto compositionLayer = layer->getCompositionLayer();
                     if (compositionLayer == nullptr) {
-                        return;
+                        continue;
                     }
 
                     const auto displayId = displayDevice->getId();
@@ -2301,8 +2440,8 @@ void SurfaceFlinger::rebuildLayerStacks() {
 
                     bool needsOutputLayer = false;
 
-                    if (display->belongsInOutput(layer->getLayerStack(),
-                                                 layer->getPrimaryDisplayOnly())) {
+                    if (display->belongsInOutput(snapshot.layerStack,
+                                                 snapshot.primaryDisplayOnly)) {
                         Region drawRegion(tr.transform(
                                 layer->visibleNonTransparentRegion));
                         drawRegion.andSelf(bounds);
@@ -2334,7 +2473,7 @@ void SurfaceFlinger::rebuildLayerStacks() {
                             layersNeedingFences.add(layer);
                         }
                     }
-                });
+                }
             }
 
             display->setOutputLayersOrderedByZ(std::move(layersSortedByZ));
@@ -2512,6 +2651,10 @@ void SurfaceFlinger::doComposition(const sp<DisplayDevice>& displayDevice, bool
         // repaint the framebuffer (if needed)
         doDisplayComposition(displayDevice, dirtyRegion);
 
+        if (mLumaSampling && displayDevice->isPrimary()) {
+            mRegionSamplingDirtyRegion.orSelf(dirtyRegion);
+        }
+
         display->editState().dirtyRegion.clear();
         display->getRenderSurface()->flip();
     }
@@ -2914,6 +3057,10 @@ void SurfaceFlinger::handleTransactionLocked(uint32_t transactionFlags)
     if (transactionFlags & eDisplayTransactionNeeded) {
         processDisplayChangesLocked();
         processDisplayHotplugEventsLocked();
+
+        // Layers with transformToDisplayInverse depend on the primary display
+        // orientation, which computeBounds() doesn't see as an input.
+        mDrawingState.traverseInZOrder([](Layer* layer) { layer->setGeometryDirty(); });
     }
 
     if (transactionFlags & (eDisplayLayerStackChanged|eDisplayTransactionNeeded)) {
@@ -3035,13 +3182,14 @@ void SurfaceFlinger::updateInputFlinger() {
 void SurfaceFlinger::updateInputWindowInfo() {
     std::vector<InputWindowInfo> inputHandles;
 
-    mDrawingState.traverseInReverseZOrder([&](Layer* layer) {
-        if (layer->hasInput()) {
+    updateLayerSnapshots();
+    for (auto it = mLayerSnapshots.crbegin(); it != mLayerSnapshots.crend(); ++it) {
+        if (it->hasInput) {
             // When calculating the screen bounds we ignore the transparent region since it may
             // result in an unwanted offset.
-            inputHandles.push_back(layer->fillInputInfo());
+            inputHandles.push_back(it->layer->fillInputInfo());
         }
-    });
+    }
 
     mInputFlinger->setInputWindows(inputHandles,
                                    mInputWindowCommands.syncInputWindows ? mSetInputWindowsListener
@@ -3103,6 +3251,7 @@ void SurfaceFlinger::commitTransaction()
 
     withTracingLock([&]() {
         mDrawingState = mCurrentState;
+        mLayerSnapshotsValid = false;
         // clear the "changed" flags in current state
         mCurrentState.colorMatrixChanged = false;
 
@@ -3162,139 +3311,234 @@ void SurfaceFlinger::computeVisibleRegions(const sp<const DisplayDevice>& displa
     ALOGV("computeVisibleRegions");
 
     auto display = displayDevice->getCompositionDisplay();
+    VisibleRegionsCache& cache = mVisibleRegionsCache[displayDevice->getDisplayToken()];
+    const bool incremental = mIncrementalVisibleRegions && cache.valid;
 
-    Region aboveOpaqueLayers;
-    Region aboveCoveredLayers;
-    Region dirty;
+    struct LayerInput {
+        const LayerSnapshot* snapshot = nullptr;
 
-    outDirtyRegion.clear();
+        // index of the layer in cache.entries, or -1 if it is new on this display
+        ssize_t cached = -1;
+
+        // true if the cached visibility of the layer can still be used
+        bool unchanged = false;
+    };
 
-    mDrawingState.traverseInReverseZOrder([&](Layer* layer) {
-        // start with the whole surface at its current location
-        const Layer::State& s(layer->getDrawingState());
+    std::vector<LayerInput> inputs;
+    inputs.reserve(cache.entries.size());
 
+    updateLayerSnapshots();
+    for (auto it = mLayerSnapshots.crbegin(); it != mLayerSnapshots.crend(); ++it) {
         // only consider the layers on the given layer stack
-        if (!display->belongsInOutput(layer->getLayerStack(), layer->getPrimaryDisplayOnly())) {
-            return;
+        if (!display->belongsInOutput(it->layerStack, it->primaryDisplayOnly)) {
+            continue;
         }
+        inputs.push_back({&*it});
+    }
 
-        /*
-         * opaqueRegion: area of a surface that is fully opaque.
-         */
-        Region opaqueRegion;
-
-        /*
-         * visibleRegion: area of a surface that is visible on screen
-         * and not fully transparent. This is essentially the layer's
-         * footprint minus the opaque regions above it.
-         * Areas covered by a translucent surface are considered visible.
-         */
-        Region visibleRegion;
-
-        /*
-         * coveredRegion: area of a surface that is covered by all
-         * visible regions above it (which includes the translucent areas).
-         */
-        Region coveredRegion;
-
-        /*
-         * transparentRegion: area of a surface that is hinted to be completely
-         * transparent. This is only used to tell when the layer has no visible
-         * non-transparent regions and can be removed from the layer list. It
-         * does not affect the visibleRegion of this layer or any layers
-         * beneath it. The hint may not be correct if apps don't respect the
-         * SurfaceView restrictions (which, sadly, some don't).
-         */
-        Region transparentRegion;
-
-
-        // handle hidden surfaces by setting the visible region to empty
-        if (CC_LIKELY(layer->isVisible())) {
-            const bool translucent = !layer->isOpaque(s);
-            Rect bounds(layer->getScreenBounds());
-
-            visibleRegion.set(bounds);
-            ui::Transform tr = layer->getTransform();
-            if (!visibleRegion.isEmpty()) {
-                // Remove the transparent area from the visible region
-                if (translucent) {
-                    if (tr.preserveRects()) {
-                        // transform the transparent region
-                        transparentRegion = tr.transform(layer->getActiveTransparentRegion(s));
-                    } else {
-                        // transformation too complex, can't do the
-                        // transparent region optimization.
-                        transparentRegion.clear();
-                    }
-                }
+    /*
+     * A layer keeps its cached visibility when nothing about its footprint
+     * changed and it kept its order relative to the other such layers. Every
+     * other layer is handled as if it was removed from its old position and
+     * added at its new one.
+     */
+    const auto& entries = cache.entries;
+    std::vector<bool> retired(entries.size(), true);
+    if (incremental) {
+        std::unordered_map<int32_t, size_t> indexBySequence;
+        indexBySequence.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            indexBySequence.emplace(entries[i].sequence, i);
+        }
+
+        ssize_t lastUnchanged = -1;
+        for (auto& input : inputs) {
+            const LayerSnapshot& snapshot = *input.snapshot;
+            const auto it = indexBySequence.find(snapshot.sequence);
+            if (it == indexBySequence.end()) {
+                continue;
+            }
+            input.cached = it->second;
+
+            const auto& entry = entries[input.cached];
+            if (input.cached > lastUnchanged && !snapshot.layer->contentDirty &&
+                entry.bounds == snapshot.bounds && entry.opaque == snapshot.opaque &&
+                hasSameRects(entry.transparentRegion, snapshot.transparentRegion)) {
+                input.unchanged = true;
+                retired[input.cached] = false;
+                lastUnchanged = input.cached;
+            }
+        }
+    }
 
-                // compute the opaque region
-                const int32_t layerOrientation = tr.getOrientation();
-                if (layer->getAlpha() == 1.0f && !translucent &&
-                        layer->getRoundedCornerState().radius == 0.0f &&
-                        ((layerOrientation & ui::Transform::ROT_INVALID) == false)) {
-                    // the opaque region is the layer's footprint
-                    opaqueRegion = visibleRegion;
+    /*
+     * affectedRegion: the screen area where visibility can have changed, which
+     * is wherever a changed layer was or now is. Outside of it, every layer's
+     * visibility is the cached one.
+     */
+    Region affectedRegion;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (retired[i] && !entries[i].bounds.isEmpty()) {
+            affectedRegion.orSelf(entries[i].bounds);
+        }
+    }
+    for (const auto& input : inputs) {
+        if (!input.unchanged && !input.snapshot->bounds.isEmpty()) {
+            affectedRegion.orSelf(input.snapshot->bounds);
+        }
+    }
+    const Rect affectedBounds = affectedRegion.getBounds();
+
+    // Both are only tracked within the affected region.
+    Region aboveOpaqueLayers;
+    Region aboveCoveredLayers;
+
+    // The part of the affected region changed by layers above the current one.
+    Region changedAboveRegion;
+    size_t nextEntry = 0;
+
+    std::vector<VisibleRegionsCache::Entry> newEntries;
+    newEntries.reserve(inputs.size());
+
+    outDirtyRegion.clear();
+
+    for (auto& input : inputs) {
+        const LayerSnapshot& snapshot = *input.snapshot;
+        Layer* layer = snapshot.layer;
+
+        if (input.unchanged) {
+            // account for the changed layers that used to be above this one
+            for (; nextEntry < size_t(input.cached); nextEntry++) {
+                if (retired[nextEntry] && !entries[nextEntry].bounds.isEmpty()) {
+                    changedAboveRegion.orSelf(entries[nextEntry].bounds);
                 }
             }
         }
 
-        if (visibleRegion.isEmpty()) {
+        auto& entry = newEntries.emplace_back();
+        entry.sequence = snapshot.sequence;
+        entry.bounds = snapshot.bounds;
+        entry.opaque = snapshot.opaque;
+        entry.transparentRegion = snapshot.transparentRegion;
+
+        if (snapshot.bounds.isEmpty()) {
             layer->clearVisibilityRegions();
-            return;
+            continue;
         }
 
-        // Clip the covered region to the visible region
-        coveredRegion = aboveCoveredLayers.intersect(visibleRegion);
-
-        // Update aboveCoveredLayers for next (lower) layer
-        aboveCoveredLayers.orSelf(visibleRegion);
+        Rect clipped;
+        Region footprint;
+        if (!incremental) {
+            footprint.set(snapshot.bounds);
+        } else if (affectedBounds.intersect(snapshot.bounds, &clipped)) {
+            footprint = affectedRegion.intersect(snapshot.bounds);
+        }
 
-        // subtract the opaque region covered by the layers above us
-        visibleRegion.subtractSelf(aboveOpaqueLayers);
+        const bool changedAbove = input.unchanged &&
+                changedAboveRegion.getBounds().intersect(snapshot.bounds, &clipped) &&
+                !changedAboveRegion.intersect(snapshot.bounds).isEmpty();
 
-        // compute this layer's dirty region
-        if (layer->contentDirty) {
-            // we need to invalidate the whole region
-            dirty = visibleRegion;
-            // as well, as the old visible region
-            dirty.orSelf(layer->visibleRegion);
-            layer->contentDirty = false;
+        if (input.unchanged && !changedAbove) {
+            // nothing above this layer changed where it is, so neither did
+            // its visibility
+            const auto& cached = entries[input.cached];
+            entry.visibleRegion = cached.visibleRegion;
+            entry.coveredRegion = cached.coveredRegion;
+            entry.visibleNonTransparentRegion = cached.visibleNonTransparentRegion;
         } else {
-            /* compute the exposed region:
-             *   the exposed region consists of two components:
-             *   1) what's VISIBLE now and was COVERED before
-             *   2) what's EXPOSED now less what was EXPOSED before
-             *
-             * note that (1) is conservative, we start with the whole
-             * visible region but only keep what used to be covered by
-             * something -- which mean it may have been exposed.
-             *
-             * (2) handles areas that were not covered by anything but got
-             * exposed because of a resize.
+            /*
+             * visibleRegion: area of a surface that is visible on screen
+             * and not fully transparent. This is essentially the layer's
+             * footprint minus the opaque regions above it.
+             * Areas covered by a translucent surface are considered visible.
              */
-            const Region newExposed = visibleRegion - coveredRegion;
-            const Region oldVisibleRegion = layer->visibleRegion;
-            const Region oldCoveredRegion = layer->coveredRegion;
-            const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
-            dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
-        }
-        dirty.subtractSelf(aboveOpaqueLayers);
+            Region visibleRegion = footprint.subtract(aboveOpaqueLayers);
 
-        // accumulate to the screen dirty region
-        outDirtyRegion.orSelf(dirty);
+            /*
+             * coveredRegion: area of a surface that is covered by all
+             * visible regions above it (which includes the translucent areas).
+             */
+            Region coveredRegion = aboveCoveredLayers.intersect(footprint);
 
-        // Update aboveOpaqueLayers for next (lower) layer
-        aboveOpaqueLayers.orSelf(opaqueRegion);
+            if (input.unchanged) {
+                // outside of the affected region nothing changed
+                const auto& cached = entries[input.cached];
+                visibleRegion.orSelf(cached.visibleRegion.subtract(affectedRegion));
+                coveredRegion.orSelf(cached.coveredRegion.subtract(affectedRegion));
+            }
+
+            const Region& oldVisibleRegion =
+                    input.cached >= 0 ? entries[input.cached].visibleRegion : layer->visibleRegion;
+            const Region& oldCoveredRegion =
+                    input.cached >= 0 ? entries[input.cached].coveredRegion : layer->coveredRegion;
+
+            // compute this layer's dirty region
+            Region dirty;
+            if (layer->contentDirty) {
+                // we need to invalidate the whole region
+                dirty = visibleRegion;
+                // as well, as the old visible region
+                dirty.orSelf(oldVisibleRegion);
+                layer->contentDirty = false;
+            } else {
+                /* compute the exposed region:
+                 *   the exposed region consists of two components:
+                 *   1) what's VISIBLE now and was COVERED before
+                 *   2) what's EXPOSED now less what was EXPOSED before
+                 *
+                 * note that (1) is conservative, we start with the whole
+                 * visible region but only keep what used to be covered by
+                 * something -- which mean it may have been exposed.
+                 *
+                 * (2) handles areas that were not covered by anything but got
+                 * exposed because of a resize.
+                 */
+                const Region newExposed = visibleRegion - coveredRegion;
+                const Region oldExposed = oldVisibleRegion - oldCoveredRegion;
+                dirty = (visibleRegion&oldCoveredRegion) | (newExposed-oldExposed);
+            }
+            if (incremental) {
+                dirty.andSelf(affectedRegion);
+            }
+            dirty.subtractSelf(aboveOpaqueLayers);
+
+            // accumulate to the screen dirty region
+            outDirtyRegion.orSelf(dirty);
+
+            entry.visibleRegion = visibleRegion;
+            entry.coveredRegion = coveredRegion;
+            entry.visibleNonTransparentRegion = visibleRegion.subtract(snapshot.transparentRegion);
+        }
 
         // Store the visible region in screen space
-        layer->setVisibleRegion(visibleRegion);
-        layer->setCoveredRegion(coveredRegion);
-        layer->setVisibleNonTransparentRegion(
-                visibleRegion.subtract(transparentRegion));
-    });
+        layer->setVisibleRegion(entry.visibleRegion);
+        layer->setCoveredRegion(entry.coveredRegion);
+        layer->setVisibleNonTransparentRegion(entry.visibleNonTransparentRegion);
+
+        // Update aboveCoveredLayers and aboveOpaqueLayers for next (lower) layer
+        if (!footprint.isEmpty()) {
+            aboveCoveredLayers.orSelf(footprint);
+            if (snapshot.opaque) {
+                // the opaque region is the layer's footprint
+                aboveOpaqueLayers.orSelf(footprint);
+            }
+        }
+
+        if (!input.unchanged) {
+            changedAboveRegion.orSelf(snapshot.bounds);
+        }
+    }
+
+    if (incremental) {
+        outOpaqueRegion = cache.opaqueRegion.subtract(affectedRegion);
+        outOpaqueRegion.orSelf(aboveOpaqueLayers);
+    } else {
+        outOpaqueRegion = aboveOpaqueLayers;
+    }
 
-    outOpaqueRegion = aboveOpaqueLayers;
+    cache.entries = std::move(newEntries);
+    cache.opaqueRegion = outOpaqueRegion;
+    cache.valid = true;
 }
 
 void SurfaceFlinger::invalidateLayerStack(const sp<const Layer>& layer, const Region& dirty) {
@@ -3661,30 +3905,50 @@ bool SurfaceFlinger::flushTransactionQueues() {
     // to prevent onHandleDestroyed from being called while the lock is held,
     // we must keep a copy of the transactions (specifically the composer
     // states) around outside the scope of the lock
-    std::vector<const TransactionState> transactions;
-    bool flushedATransaction = false;
+    std::vector<TransactionState> transactions;
     {
         Mutex::Autolock _l(mStateLock);
 
+        const nsecs_t expectedPresentTime = getExpectedPresentTime();
+        nsecs_t nextDesiredPresentTime = std::numeric_limits<nsecs_t>::max();
+        bool waitingOnFence = false;
+
+        // The transactions that are ready are applied as one batch, which sets
+        // the transaction flags once for all of them.
+        uint32_t transactionFlags = 0;
+        bool earlyWakeup = false;
+
         auto it = mTransactionQueues.begin();
         while (it != mTransactionQueues.end()) {
             auto& [applyToken, transactionQueue] = *it;
 
             while (!transactionQueue.empty()) {
-                const auto& transaction = transactionQueue.front();
-                if (!transactionIsReadyToBeApplied(transaction.desiredPresentTime,
-                                                   transaction.states)) {
-                    setTransactionFlags(eTransactionFlushNeeded);
+                auto& transaction = transactionQueue.front();
+                if (!isDesiredPresentTimeDue(transaction.desiredPresentTime, expectedPresentTime)) {
+                    nextDesiredPresentTime =
+                            std::min(nextDesiredPresentTime, transaction.desiredPresentTime);
                     break;
                 }
-                transactions.push_back(transaction);
-                applyTransactionState(transaction.states, transaction.displays, transaction.flags,
-                                      mPendingInputWindowCommands, transaction.desiredPresentTime,
-                                      transaction.buffer, transaction.callback,
-                                      transaction.postTime, transaction.privileged,
-                                      /*isMainThread*/ true);
+                // Fences seen signaled in an earlier frame are not checked again.
+                transaction.unsignaledFence =
+                        findUnsignaledAcquireFence(transaction.states,
+                                                   transaction.unsignaledFence);
+                if (transaction.unsignaledFence < transaction.states.size()) {
+                    waitingOnFence = true;
+                    break;
+                }
+
+                const uint32_t flags =
+                        applyTransactionStateLocked(transaction.states, transaction.displays,
+                                                    transaction.flags, mPendingInputWindowCommands,
+                                                    transaction.desiredPresentTime,
+                                                    transaction.buffer, transaction.callback,
+                                                    transaction.postTime, transaction.privileged,
+                                                    /*isMainThread*/ true);
+                transactionFlags |= flags;
+                earlyWakeup = earlyWakeup || (flags && (transaction.flags & eEarlyWakeup));
+                transactions.push_back(std::move(transaction));
                 transactionQueue.pop();
-                flushedATransaction = true;
             }
 
             if (transactionQueue.empty()) {
@@ -3694,12 +3958,51 @@ bool SurfaceFlinger::flushTransactionQueues() {
                 it = std::next(it, 1);
             }
         }
+
+        if (transactionFlags) {
+            setTransactionFlags(transactionFlags,
+                                earlyWakeup ? Scheduler::TransactionStart::EARLY
+                                            : Scheduler::TransactionStart::NORMAL);
+        }
+
+        // A fence can signal at any time, so transactions waiting on one are
+        // checked again every frame. Transactions waiting for their desired
+        // present time only wake us up when it is close.
+        mTransactionQueuesNeedPolling = waitingOnFence;
+        if (nextDesiredPresentTime != std::numeric_limits<nsecs_t>::max()) {
+            scheduleTransactionFlush(nextDesiredPresentTime, expectedPresentTime);
+        }
+    }
+    return !transactions.empty();
+}
+
+void SurfaceFlinger::scheduleTransactionFlush(int64_t desiredPresentTime,
+                                              nsecs_t expectedPresentTime) {
+    // The current frame presents at expectedPresentTime, so the transaction is
+    // due in the frame that starts desiredPresentTime - expectedPresentTime
+    // from now. Wake up one vsync before that, to be in time for it.
+    const nsecs_t now = systemTime();
+    const nsecs_t flushTime = now + (desiredPresentTime - expectedPresentTime) - getVsyncPeriod();
+    if (flushTime <= now) {
+        mTransactionQueuesNeedPolling = true;
+        return;
+    }
+    if (flushTime >= mScheduledTransactionFlushTime) {
+        return;
     }
-    return flushedATransaction;
+
+    mScheduledTransactionFlushTime = flushTime;
+    postMessageAsync(new LambdaMessage([this, flushTime]() {
+                         if (mScheduledTransactionFlushTime == flushTime) {
+                             mScheduledTransactionFlushTime = std::numeric_limits<nsecs_t>::max();
+                         }
+                         setTransactionFlags(eTransactionFlushNeeded);
+                     }),
+                     flushTime - now);
 }
 
 bool SurfaceFlinger::transactionFlushNeeded() {
-    return !mTransactionQueues.empty();
+    return mTransactionQueuesNeedPolling;
 }
 
 bool SurfaceFlinger::containsAnyInvalidClientState(const Vector<ComposerState>& states) {
@@ -3726,24 +4029,8 @@ bool SurfaceFlinger::containsAnyInvalidClientState(const Vector<ComposerState>&
 
 bool SurfaceFlinger::transactionIsReadyToBeApplied(int64_t desiredPresentTime,
                                                    const Vector<ComposerState>& states) {
-    nsecs_t expectedPresentTime = getExpectedPresentTime();
-    // Do not present if the desiredPresentTime has not passed unless it is more than one second
-    // in the future. We ignore timestamps more than 1 second in the future for stability reasons.
-    if (desiredPresentTime >= 0 && desiredPresentTime >= expectedPresentTime &&
-        desiredPresentTime < expectedPresentTime + s2ns(1)) {
-        return false;
-    }
-
-    for (const ComposerState& state : states) {
-        const layer_state_t& s = state.state;
-        if (!(s.what & layer_state_t::eAcquireFenceChanged)) {
-            continue;
-        }
-        if (s.acquireFence && s.acquireFence->getStatus() == Fence::Status::Unsignaled) {
-            return false;
-        }
-    }
-    return true;
+    return isDesiredPresentTimeDue(desiredPresentTime, getExpectedPresentTime()) &&
+            findUnsignaledAcquireFence(states, 0) == states.size();
 }
 
 void SurfaceFlinger::setTransactionState(const Vector<ComposerState>& states,
@@ -3800,14 +4087,11 @@ void SurfaceFlinger::applyTransactionState(const Vector<ComposerState>& states,
                                            const int64_t desiredPresentTime,
                                            const client_cache_t& uncacheBuffer,
                                            const std::vector<ListenerCallbacks>& listenerCallbacks,
-                                           const int64_t postTime, bool privileged,
-                                           bool isMainThread) {
-    uint32_t transactionFlags = 0;
-
+                                           const int64_t postTime, bool privileged) {
     if (flags & eAnimation) {
         // For window updates that are part of an animation we must wait for
         // previous animation "frames" to be handled.
-        while (!isMainThread && mAnimTransactionPending) {
+        while (mAnimTransactionPending) {
             status_t err = mTransactionCV.waitRelative(mStateLock, s2ns(5));
             if (CC_UNLIKELY(err != NO_ERROR)) {
                 // just in case something goes wrong in SF, return to the
@@ -3820,6 +4104,40 @@ void SurfaceFlinger::applyTransactionState(const Vector<ComposerState>& states,
         }
     }
 
+    const uint32_t transactionFlags =
+            applyTransactionStateLocked(states, displays, flags, inputWindowCommands,
+                                        desiredPresentTime, uncacheBuffer, listenerCallbacks,
+                                        postTime, privileged, /*isMainThread*/ false);
+    if (transactionFlags) {
+        // this triggers the transaction
+        const auto start = (flags & eEarlyWakeup) ? Scheduler::TransactionStart::EARLY
+                                                  : Scheduler::TransactionStart::NORMAL;
+        setTransactionFlags(transactionFlags, start);
+
+        // if this is a synchronous transaction, wait for it to take effect
+        // before returning.
+        while (mTransactionPending || mPendingSyncInputWindows) {
+            status_t err = mTransactionCV.waitRelative(mStateLock, s2ns(5));
+            if (CC_UNLIKELY(err != NO_ERROR)) {
+                // just in case something goes wrong in SF, return to the
+                // called after a few seconds.
+                ALOGW_IF(err == TIMED_OUT, "setTransactionState timed out!");
+                mTransactionPending = false;
+                mPendingSyncInputWindows = false;
+                break;
+            }
+        }
+    }
+}
+
+uint32_t SurfaceFlinger::applyTransactionStateLocked(
+        const Vector<ComposerState>& states, const Vector<DisplayState>& displays, uint32_t flags,
+        const InputWindowCommands& inputWindowCommands, const int64_t desiredPresentTime,
+        const client_cache_t& uncacheBuffer,
+        const std::vector<ListenerCallbacks>& listenerCallbacks, const int64_t postTime,
+        bool privileged, bool isMainThread) {
+    uint32_t transactionFlags = 0;
+
     for (const DisplayState& display : displays) {
         transactionFlags |= setDisplayStateLocked(display);
     }
@@ -3874,13 +4192,6 @@ void SurfaceFlinger::applyTransactionState(const Vector<ComposerState>& states,
             mInterceptor->saveTransaction(states, mCurrentState.displays, displays, flags);
         }
 
-        // this triggers the transaction
-        const auto start = (flags & eEarlyWakeup) ? Scheduler::TransactionStart::EARLY
-                                                  : Scheduler::TransactionStart::NORMAL;
-        setTransactionFlags(transactionFlags, start);
-
-        // if this is a synchronous transaction, wait for it to take effect
-        // before returning.
         if (flags & eSynchronous) {
             mTransactionPending = true;
         }
@@ -3890,23 +4201,8 @@ void SurfaceFlinger::applyTransactionState(const Vector<ComposerState>& states,
         if (mPendingInputWindowCommands.syncInputWindows) {
             mPendingSyncInputWindows = true;
         }
-
-        // applyTransactionState can be called by either the main SF thread or by
-        // another process through setTransactionState.  While a given process may wish
-        // to wait on synchronous transactions, the main SF thread should never
-        // be blocked.  Therefore, we only wait if isMainThread is false.
-        while (!isMainThread && (mTransactionPending || mPendingSyncInputWindows)) {
-            status_t err = mTransactionCV.waitRelative(mStateLock, s2ns(5));
-            if (CC_UNLIKELY(err != NO_ERROR)) {
-                // just in case something goes wrong in SF, return to the
-                // called after a few seconds.
-                ALOGW_IF(err == TIMED_OUT, "setTransactionState timed out!");
-                mTransactionPending = false;
-                mPendingSyncInputWindows = false;
-                break;
-            }
-        }
     }
+    return transactionFlags;
 }
 
 uint32_t SurfaceFlinger::setDisplayStateLocked(const DisplayState& s) {
@@ -4339,25 +4635,18 @@ status_t SurfaceFlinger::createLayer(const String8& name, const sp<Client>& clie
 
 String8 SurfaceFlinger::getUniqueLayerName(const String8& name)
 {
-    bool matchFound = true;
-    uint32_t dupeCounter = 0;
+    std::lock_guard<std::mutex> lock(mLayerNamesLock);
 
     // Tack on our counter whether there is a hit or not, so everyone gets a tag
-    String8 uniqueName = name + "#" + String8(std::to_string(dupeCounter).c_str());
-
-    // Grab the state lock since we're accessing mCurrentState
-    Mutex::Autolock lock(mStateLock);
-
-    // Loop over layers until we're sure there is no matching name
-    while (matchFound) {
-        matchFound = false;
-        mCurrentState.traverseInZOrder([&](Layer* layer) {
-            if (layer->getName() == uniqueName) {
-                matchFound = true;
-                uniqueName = name + "#" + String8(std::to_string(++dupeCounter).c_str());
-            }
-        });
+    auto& suffixes = mLayerNames[std::string(name.c_str(), name.size())];
+    uint32_t dupeCounter;
+    if (suffixes.released.empty()) {
+        dupeCounter = suffixes.next++;
+    } else {
+        dupeCounter = *suffixes.released.begin();
+        suffixes.released.erase(suffixes.released.begin());
     }
+    const String8 uniqueName = name + "#" + String8(std::to_string(dupeCounter).c_str());
 
     ALOGV_IF(dupeCounter > 0, "duplicate layer name: changing %s to %s", name.c_str(),
              uniqueName.c_str());
@@ -4365,6 +4654,49 @@ String8 SurfaceFlinger::getUniqueLayerName(const String8& name)
     return uniqueName;
 }
 
+void SurfaceFlinger::onLayerDestroyed(Layer* layer) {
+    mNumLayers--;
+    mOffscreenLayers.erase(layer);
+    releaseUniqueLayerName(layer->getName());
+}
+
+void SurfaceFlinger::releaseUniqueLayerName(const String8& uniqueName) {
+    const std::string_view view(uniqueName.c_str(), uniqueName.size());
+    const size_t separator = view.rfind('#');
+    if (separator == std::string_view::npos) {
+        return;
+    }
+    uint32_t dupeCounter = 0;
+    const char* const last = view.data() + view.size();
+    if (const auto [end, error] = std::from_chars(view.data() + separator + 1, last, dupeCounter);
+        error != std::errc() || end != last) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mLayerNamesLock);
+    const auto it = mLayerNames.find(std::string(view.substr(0, separator)));
+    // Layers that were not named by getUniqueLayerName() are not tracked.
+    if (it == mLayerNames.end() || dupeCounter >= it->second.next) {
+        return;
+    }
+
+    auto& suffixes = it->second;
+    if (dupeCounter + 1 < suffixes.next) {
+        suffixes.released.insert(dupeCounter);
+        return;
+    }
+
+    // Keep |released| small by giving back the free suffixes at the end.
+    suffixes.next--;
+    while (!suffixes.released.empty() && *suffixes.released.rbegin() + 1 == suffixes.next) {
+        suffixes.released.erase(std::prev(suffixes.released.end()));
+        suffixes.next--;
+    }
+    if (suffixes.next == 0) {
+        mLayerNames.erase(it);
+    }
+}
+
 status_t SurfaceFlinger::createBufferQueueLayer(const sp<Client>& client, const String8& name,
                                                 uint32_t w, uint32_t h, uint32_t flags,
                                                 LayerMetadata metadata, PixelFormat& format,
@@ -4922,12 +5254,19 @@ LayersProto SurfaceFlinger::dumpDrawingStateProto(uint32_t traceFlags) const {
     mDrawingState.traverseInZOrder([&](Layer* layer) {
         LayerProto* layerProto = layersProto.add_layers();
         layer->writeToProtoDrawingState(layerProto, traceFlags);
-        layer->writeToProtoCommonState(layerProto, LayerVector::StateSet::Drawing, traceFlags);
     });
 
     return layersProto;
 }
 
+std::vector<LayerProtoSnapshot> SurfaceFlinger::getDrawingStateProtoSnapshots(
+        uint32_t traceFlags) const {
+    std::vector<LayerProtoSnapshot> snapshots;
+    mDrawingState.traverseInZOrder(
+            [&](Layer* layer) { snapshots.push_back(layer->getProtoSnapshot(traceFlags)); });
+    return snapshots;
+}
+
 LayersProto SurfaceFlinger::dumpProtoFromMainThread(uint32_t traceFlags) {
     LayersProto layersProto;
     postMessageSync(new LambdaMessage([&]() { layersProto = dumpDrawingStateProto(traceFlags); }));
@@ -5278,9 +5617,9 @@ status_t SurfaceFlinger::CheckTransactCodeCredentials(uint32_t code) {
         code == IBinder::SYSPROPS_TRANSACTION) {
         return OK;
     }
-    // Numbers from 1000 to 1034 are currently used for backdoors. The code
+    // Numbers from 1000 to 1036 are currently used for backdoors. The code
     // in onTransact verifies that the user is root, and has access to use SF.
-    if (code >= 1000 && code <= 1035) {
+    if (code >= 1000 && code <= 1036) {
         ALOGV("Accessing SurfaceFlinger through backdoor code: %u", code);
         return OK;
     }
@@ -5625,6 +5964,13 @@ status_t SurfaceFlinger::onTransact(uint32_t code, const Parcel& data, Parcel* r
                 }
                 return NO_ERROR;
             }
+            case 1036: { // Stream layer trace entries to the trace file
+                n = data.readInt32();
+                ALOGD("Layer trace streaming %s", n ? "enabled" : "disabled");
+                mTracing.setStreaming(n != 0);
+                reply->writeInt32(NO_ERROR);
+                return NO_ERROR;
+            }
         }
     }
     return err;
@@ -34,11 +34,13 @@
 #include <hardware/hwcomposer_defs.h>
 #include <input/ISetInputWindowsListener.h>
 #include <layerproto/LayerProtoHeader.h>
+#include <math/half.h>
 #include <math/mat4.h>
 #include <serviceutils/PriorityDumper.h>
 #include <system/graphics.h>
 #include <ui/FenceTime.h>
 #include <ui/PixelFormat.h>
+#include <ui/Transform.h>
 #include <utils/Errors.h>
 #include <utils/KeyedVector.h>
 #include <utils/RefBase.h>
@@ -65,6 +67,7 @@
 #include <atomic>
 #include <cstdint>
 #include <functional>
+#include <limits>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -88,6 +91,7 @@ class IGraphicBufferProducer;
 class IInputFlinger;
 class InjectVSyncSource;
 class Layer;
+struct LayerProtoSnapshot;
 class MessageBase;
 class RefreshRateOverlay;
 class RegionSamplingThread;
@@ -318,10 +322,7 @@ public:
         const sp<IGraphicBufferProducer>& bufferProducer) const;
 
     inline void onLayerCreated() { mNumLayers++; }
-    inline void onLayerDestroyed(Layer* layer) {
-        mNumLayers--;
-        mOffscreenLayers.erase(layer);
-    }
+    void onLayerDestroyed(Layer* layer);
 
     TransactionCompletedThread& getTransactionCompletedThread() {
         return mTransactionCompletedThread;
@@ -572,11 +573,24 @@ private:
                                const int64_t desiredPresentTime,
                                const client_cache_t& uncacheBuffer,
                                const std::vector<ListenerCallbacks>& listenerCallbacks,
-                               const int64_t postTime, bool privileged, bool isMainThread = false)
-            REQUIRES(mStateLock);
+                               const int64_t postTime, bool privileged) REQUIRES(mStateLock);
+    // Applies the state of one transaction without waiting for anything, and
+    // returns the transaction flags the caller has to set for it.
+    uint32_t applyTransactionStateLocked(const Vector<ComposerState>& state,
+                                         const Vector<DisplayState>& displays, uint32_t flags,
+                                         const InputWindowCommands& inputWindowCommands,
+                                         const int64_t desiredPresentTime,
+                                         const client_cache_t& uncacheBuffer,
+                                         const std::vector<ListenerCallbacks>& listenerCallbacks,
+                                         const int64_t postTime, bool privileged,
+                                         bool isMainThread) REQUIRES(mStateLock);
     // Returns true if at least one transaction was flushed
     bool flushTransactionQueues();
-    // Returns true if there is at least one transaction that needs to be flushed
+    // Wakes up the main thread in time to apply a queued transaction that
+    // wants to be presented at desiredPresentTime.
+    void scheduleTransactionFlush(int64_t desiredPresentTime, nsecs_t expectedPresentTime)
+            REQUIRES(mStateLock);
+    // Returns true if a queued transaction has to be checked again next frame
     bool transactionFlushNeeded();
     uint32_t getTransactionFlags(uint32_t flags);
     uint32_t peekTransactionFlags();
@@ -621,7 +635,12 @@ private:
                                   uint32_t h, uint32_t flags, LayerMetadata metadata,
                                   sp<IBinder>* outHandle, sp<Layer>* outLayer);
 
+    // Returns |name| with a "#<n>" suffix that no other live layer with the
+    // same name has, using the smallest free n.
     String8 getUniqueLayerName(const String8& name);
+    // Makes the suffix of a name returned by getUniqueLayerName() available
+    // again. Called when the layer is destroyed.
+    void releaseUniqueLayerName(const String8& uniqueName);
 
     // called when all clients have released all their references to
     // this layer meaning it is entirely safe to destroy all
@@ -750,6 +769,8 @@ private:
     void invalidateHwcGeometry();
     void computeVisibleRegions(const sp<const DisplayDevice>& display, Region& dirtyRegion,
                                Region& opaqueRegion);
+    // Rebuilds mLayerSnapshots from the drawing state if it is out of date.
+    void updateLayerSnapshots();
 
     void preComposition();
     void postComposition();
@@ -769,6 +790,10 @@ private:
     void pickColorMode(const sp<DisplayDevice>& display, ui::ColorMode* outMode,
                        ui::Dataspace* outDataSpace, ui::RenderIntent* outRenderIntent) const;
 
+    // Returns the displays in the order they are composited: the primary
+    // display first, so it is never held up by the others, then external
+    // displays and then virtual displays.
+    std::vector<sp<DisplayDevice>> getDisplaysInCompositionOrder() const;
     void calculateWorkingSet();
     /*
      * beginFrame - This function handles any pre-frame processing that needs to be
@@ -901,6 +926,8 @@ private:
     void dumpDisplayIdentificationData(std::string& result) const;
     void dumpWideColorInfo(std::string& result) const;
     LayersProto dumpDrawingStateProto(uint32_t traceFlags = SurfaceTracing::TRACE_ALL) const;
+    // What dumpDrawingStateProto() writes, to be written with Layer::writeToProto() later.
+    std::vector<LayerProtoSnapshot> getDrawingStateProtoSnapshots(uint32_t traceFlags) const;
     LayersProto dumpProtoFromMainThread(uint32_t traceFlags = SurfaceTracing::TRACE_ALL)
             EXCLUDES(mStateLock);
     void withTracingLock(std::function<void()> operation) REQUIRES(mStateLock);
@@ -977,6 +1004,49 @@ private:
     // don't need synchronization
     State mDrawingState{LayerVector::StateSet::Drawing};
     bool mVisibleRegionsDirty = false;
+
+    // What the composition loops need from a layer of the drawing state,
+    // resolved once per frame so they walk a flat array instead of the layer
+    // tree and each layer's parent chain.
+    struct LayerSnapshot {
+        Layer* layer = nullptr; // kept alive by mDrawingState
+        int32_t sequence = 0;
+        uint32_t layerStack = 0;
+        bool primaryDisplayOnly = false;
+        bool hasInput = false;
+        half alpha = 1.0f;
+        ui::Transform transform;
+        // screen bounds, empty when the layer is hidden
+        Rect bounds;
+        // true if the whole of |bounds| is fully opaque
+        bool opaque = false;
+        // screen space hint of the fully transparent area, if known
+        Region transparentRegion;
+    };
+    // In Z order. Only valid for the frame it was built in, see
+    // updateLayerSnapshots().
+    std::vector<LayerSnapshot> mLayerSnapshots;
+    bool mLayerSnapshotsValid = false;
+
+    // What computeVisibleRegions() last computed for a display, so the next
+    // pass only has to revisit the layers below a change, and only within the
+    // screen area the change can affect.
+    struct VisibleRegionsCache {
+        struct Entry {
+            int32_t sequence;
+            Rect bounds;    // screen bounds, empty when the layer is hidden
+            bool opaque;
+            Region transparentRegion;
+            Region visibleRegion;
+            Region coveredRegion;
+            Region visibleNonTransparentRegion;
+        };
+        std::vector<Entry> entries; // in reverse Z order
+        Region opaqueRegion;
+        bool valid = false;
+    };
+    std::map<wp<IBinder>, VisibleRegionsCache> mVisibleRegionsCache;
+    bool mIncrementalVisibleRegions = true;
     // Set during transaction commit stage to track if the input info for a layer has changed.
     bool mInputInfoChanged = false;
     bool mGeometryInvalid = false;
@@ -1085,8 +1155,16 @@ private:
         std::vector<ListenerCallbacks> callback;
         const int64_t postTime;
         bool privileged;
+        // Index of the first state whose acquire fence was not signaled when
+        // last checked.
+        size_t unsignaledFence = 0;
     };
     std::unordered_map<sp<IBinder>, std::queue<TransactionState>, IBinderHash> mTransactionQueues;
+    // Whether a queued transaction is waiting on a fence, or is due next frame.
+    bool mTransactionQueuesNeedPolling = false;
+    // When the main thread is next woken up to flush the transaction queues.
+    // Only used on the main thread.
+    nsecs_t mScheduledTransactionFlushTime = std::numeric_limits<nsecs_t>::max();
 
     /* ------------------------------------------------------------------------
      * Feature prototyping
@@ -1099,6 +1177,16 @@ private:
 
     size_t mNumLayers = 0;
 
+    // The suffixes in use for each name passed to getUniqueLayerName(). Layers
+    // can be destroyed on any thread, with or without mStateLock held, so this
+    // has its own lock.
+    struct LayerNameSuffixes {
+        uint32_t next = 0;           // all suffixes from here on are free
+        std::set<uint32_t> released; // free suffixes below next
+    };
+    std::mutex mLayerNamesLock;
+    std::unordered_map<std::string, LayerNameSuffixes> mLayerNames GUARDED_BY(mLayerNamesLock);
+
     // Verify that transaction is being called by an approved process:
     // either AID_GRAPHICS or AID_SYSTEM.
     status_t CheckTransactCodeCredentials(uint32_t code);
@@ -1158,6 +1246,9 @@ private:
 
     bool mLumaSampling = true;
     sp<RegionSamplingThread> mRegionSamplingThread;
+    // Area of the primary display redrawn since the sampling thread was last notified.
+    // Only accessed by the main thread.
+    Region mRegionSamplingDirtyRegion;
     ui::DisplayPrimaries mInternalDisplayPrimaries;
 
     sp<IInputFlinger> mInputFlinger;
@@ -19,13 +19,23 @@
 
 #include "SurfaceTracing.h"
 #include <SurfaceFlinger.h>
+#include "Layer.h"
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
+#include <fcntl.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include <log/log.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utils/SystemClock.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <cstring>
+
 namespace android {
 
 SurfaceTracing::SurfaceTracing(SurfaceFlinger& flinger)
@@ -41,11 +51,14 @@ void SurfaceTracing::mainLoop() {
 }
 
 void SurfaceTracing::addFirstEntry() {
-    LayersTraceProto entry;
+    long compositionTime;
+    std::vector<LayerProtoSnapshot> layers;
     {
         std::scoped_lock lock(mSfLock);
-        entry = traceLayersLocked("tracing.enable");
+        compositionTime = mCompositionTime;
+        layers = snapshotLayersLocked();
     }
+    LayersTraceProto entry = traceLayers(compositionTime, "tracing.enable", layers);
     addTraceToBuffer(entry);
 }
 
@@ -53,14 +66,20 @@ LayersTraceProto SurfaceTracing::traceWhenNotified() {
     std::unique_lock<std::mutex> lock(mSfLock);
     mCanStartTrace.wait(lock);
     android::base::ScopedLockAssertion assumeLock(mSfLock);
-    LayersTraceProto entry = traceLayersLocked(mWhere);
+    const long compositionTime = mCompositionTime;
+    const char* where = mWhere;
+    const std::vector<LayerProtoSnapshot> layers = snapshotLayersLocked();
     lock.unlock();
-    return entry;
+    return traceLayers(compositionTime, where, layers);
 }
 
 bool SurfaceTracing::addTraceToBuffer(LayersTraceProto& entry) {
     std::scoped_lock lock(mTraceLock);
-    mBuffer.emplace(std::move(entry));
+    if (mStream.isOpen()) {
+        streamEntryLocked(entry);
+    } else {
+        mBuffer.emplace(std::move(entry));
+    }
     if (mWriteToFile) {
         writeProtoFileLocked();
         mWriteToFile = false;
@@ -112,6 +131,162 @@ void SurfaceTracing::LayersTraceBuffer::flush(LayersTraceFileProto* fileProto) {
     }
 }
 
+status_t SurfaceTracing::LayersTraceStream::open(const char* path, size_t sizeInBytes) {
+    close();
+
+    mFd.reset(::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                     S_IRWXU | S_IRGRP));
+    if (mFd.get() < 0) {
+        const status_t err = -errno;
+        ALOGE("Could not open %s: %s", path, strerror(-err));
+        return err;
+    }
+    fchmod(mFd.get(), S_IRWXU | S_IRGRP);
+
+    mWindowOffset = 0U;
+    mUsedInBytes = 0U;
+    mSizeInBytes = sizeInBytes;
+    mFrameCount = 0U;
+    mDroppedFrameCount = 0U;
+
+    LayersTraceFileProto header;
+    header.set_magic_number(uint64_t(LayersTraceFileProto_MagicNumber_MAGIC_NUMBER_H) << 32 |
+                            LayersTraceFileProto_MagicNumber_MAGIC_NUMBER_L);
+    const status_t err = append(header.SerializeAsString());
+    mFrameCount = 0U;
+    return err;
+}
+
+status_t SurfaceTracing::LayersTraceStream::append(const std::string& data) {
+    if (mUsedInBytes + data.size() > mSizeInBytes) {
+        ALOGW_IF(mDroppedFrameCount == 0, "Trace file is full, dropping entries");
+        mDroppedFrameCount++;
+        return NO_MEMORY;
+    }
+
+    const size_t start = mUsedInBytes;
+    size_t written = 0U;
+    while (written < data.size()) {
+        if (mWindow == nullptr || mUsedInBytes == mWindowOffset + kWindowSizeInBytes) {
+            const status_t err = mapWindow();
+            if (err != NO_ERROR) {
+                // The next entry overwrites what was written of this one.
+                mUsedInBytes = start;
+                mDroppedFrameCount++;
+                return err;
+            }
+        }
+        const size_t windowUsed = mUsedInBytes - mWindowOffset;
+        const size_t count = std::min(data.size() - written, kWindowSizeInBytes - windowUsed);
+        memcpy(mWindow + windowUsed, data.data() + written, count);
+        written += count;
+        mUsedInBytes += count;
+    }
+    mFrameCount++;
+    return NO_ERROR;
+}
+
+status_t SurfaceTracing::LayersTraceStream::mapWindow() {
+    if (mWindow != nullptr) {
+        munmap(mWindow, kWindowSizeInBytes);
+        mWindow = nullptr;
+    }
+
+    // Blocks are allocated for the part of the window that can be used, so that running out of
+    // disk space fails here rather than with SIGBUS on a write through the mapping. The file
+    // is trimmed again by flush().
+    mWindowOffset = mUsedInBytes - mUsedInBytes % kWindowSizeInBytes;
+    const size_t length = std::min(kWindowSizeInBytes, mSizeInBytes - mWindowOffset);
+    if (const int err = posix_fallocate(mFd.get(), mWindowOffset, length); err != 0) {
+        ALOGE("Could not grow the trace file: %s", strerror(err));
+        return -err;
+    }
+    void* window = mmap(nullptr, kWindowSizeInBytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        mFd.get(), mWindowOffset);
+    if (window == MAP_FAILED) {
+        const status_t err = -errno;
+        ALOGE("Could not map the trace file: %s", strerror(-err));
+        return err;
+    }
+    mWindow = static_cast<uint8_t*>(window);
+    return NO_ERROR;
+}
+
+status_t SurfaceTracing::LayersTraceStream::flush() {
+    if (mWindow != nullptr) {
+        munmap(mWindow, kWindowSizeInBytes);
+        mWindow = nullptr;
+    }
+    if (isOpen() && ftruncate(mFd.get(), mUsedInBytes) != 0) {
+        const status_t err = -errno;
+        ALOGE("Could not trim the trace file: %s", strerror(-err));
+        return err;
+    }
+    return NO_ERROR;
+}
+
+status_t SurfaceTracing::LayersTraceStream::close() {
+    if (!isOpen()) {
+        return NO_ERROR;
+    }
+    const status_t err = flush();
+    mFd.reset();
+    return err;
+}
+
+LayersTraceProto SurfaceTracing::makeDeltaEntry(LayersTraceProto& entry,
+                                                const EncodedLayers& previousLayers,
+                                                EncodedLayers* outLayers) {
+    LayersTraceProto delta;
+    delta.set_elapsed_realtime_nanos(entry.elapsed_realtime_nanos());
+    delta.set_where(entry.where());
+    delta.set_layers_delta(true);
+
+    outLayers->clear();
+    outLayers->reserve(previousLayers.size());
+    for (LayerProto& layer : *entry.mutable_layers()->mutable_layers()) {
+        // Map fields would otherwise be encoded in any order, and show up as changes.
+        std::string encoded;
+        {
+            google::protobuf::io::StringOutputStream stream(&encoded);
+            google::protobuf::io::CodedOutputStream output(&stream);
+            output.SetSerializationDeterministic(true);
+            layer.SerializeToCodedStream(&output);
+        }
+
+        const int32_t id = layer.id();
+        const auto previous = previousLayers.find(id);
+        if (previous == previousLayers.end() || previous->second != encoded) {
+            delta.mutable_layers()->add_layers()->Swap(&layer);
+        }
+        outLayers->emplace(id, std::move(encoded));
+    }
+    for (const auto& [id, encoded] : previousLayers) {
+        if (outLayers->count(id) == 0) {
+            delta.add_removed_layers(id);
+        }
+    }
+    return delta;
+}
+
+void SurfaceTracing::streamEntryLocked(LayersTraceProto& entry) {
+    ATRACE_CALL();
+
+    EncodedLayers layers;
+    LayersTraceProto delta = makeDeltaEntry(entry, mStreamedLayers, &layers);
+    LayersTraceFileProto fileProto;
+    fileProto.add_entry()->Swap(&delta);
+
+    // A dropped entry is not in the file, so the next one must be a delta from the last entry
+    // that is.
+    const status_t err = mStream.append(fileProto.SerializeAsString());
+    if (err == NO_ERROR) {
+        mStreamedLayers.swap(layers);
+    } else if (err != NO_MEMORY) {
+        mLastErr = err;
+    }
+}
+
 void SurfaceTracing::enable() {
     std::scoped_lock lock(mTraceLock);
 
@@ -119,6 +294,13 @@ void SurfaceTracing::enable() {
         return;
     }
     mBuffer.reset(mBufferSize);
+    if (mStreaming) {
+        mStreamedLayers.clear();
+        if (mStream.open(kDefaultFileName, mBufferSize) != NO_ERROR) {
+            ALOGE("Could not stream the trace, keeping it in memory instead");
+            mStream.close();
+        }
+    }
     mEnabled = true;
     mThread = std::thread(&SurfaceTracing::mainLoop, this);
 }
@@ -152,19 +334,33 @@ void SurfaceTracing::setBufferSize(size_t bufferSizeInByte) {
     mBuffer.setSize(bufferSizeInByte);
 }
 
+void SurfaceTracing::setStreaming(bool streaming) {
+    std::scoped_lock lock(mTraceLock);
+    mStreaming = streaming;
+}
+
 void SurfaceTracing::setTraceFlags(uint32_t flags) {
     std::scoped_lock lock(mSfLock);
     mTraceFlags = flags;
 }
 
-LayersTraceProto SurfaceTracing::traceLayersLocked(const char* where) {
+std::vector<LayerProtoSnapshot> SurfaceTracing::snapshotLayersLocked() {
+    ATRACE_CALL();
+    return mFlinger.getDrawingStateProtoSnapshots(mTraceFlags);
+}
+
+LayersTraceProto SurfaceTracing::traceLayers(long compositionTime, const char* where,
+                                             const std::vector<LayerProtoSnapshot>& layers) {
     ATRACE_CALL();
 
     LayersTraceProto entry;
-    entry.set_elapsed_realtime_nanos(mCompositionTime);
+    entry.set_elapsed_realtime_nanos(compositionTime);
     entry.set_where(where);
-    LayersProto layers(mFlinger.dumpDrawingStateProto(mTraceFlags));
-    entry.mutable_layers()->Swap(&layers);
+    LayersProto* layersProto = entry.mutable_layers();
+    layersProto->mutable_layers()->Reserve(layers.size());
+    for (const LayerProtoSnapshot& layer : layers) {
+        Layer::writeToProto(layer, layersProto->add_layers());
+    }
 
     return entry;
 }
@@ -172,6 +368,12 @@ LayersTraceProto SurfaceTracing::traceLayersLocked(const char* where) {
 void SurfaceTracing::writeProtoFileLocked() {
     ATRACE_CALL();
 
+    if (mStream.isOpen()) {
+        // The entries are already in the file, it only needs to end after the last one.
+        mLastErr = mEnabled ? mStream.flush() : mStream.close();
+        return;
+    }
+
     LayersTraceFileProto fileProto;
     std::string output;
 
@@ -196,6 +398,15 @@ void SurfaceTracing::writeProtoFileLocked() {
 void SurfaceTracing::dump(std::string& result) const {
     std::scoped_lock lock(mTraceLock);
     base::StringAppendF(&result, "Tracing state: %s\n", mEnabled ? "enabled" : "disabled");
+    if (mStream.isOpen()) {
+        base::StringAppendF(&result,
+                            "  streaming to %s\n"
+                            "  number of entries: %zu (%.2fMB / %.2fMB), %zu dropped\n",
+                            kDefaultFileName, mStream.frameCount(),
+                            float(mStream.used()) / float(1_MB),
+                            float(mStream.size()) / float(1_MB), mStream.droppedFrameCount());
+        return;
+    }
     base::StringAppendF(&result, "  number of entries: %zu (%.2fMB / %.2fMB)\n",
                         mBuffer.frameCount(), float(mBuffer.used()) / float(1_MB),
                         float(mBuffer.size()) / float(1_MB));
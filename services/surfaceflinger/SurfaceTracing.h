@@ -21,17 +21,22 @@
 #include <utils/StrongPointer.h>
 
 #include <android-base/thread_annotations.h>
+#include <android-base/unique_fd.h>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace android::surfaceflinger;
 
 namespace android {
 
 class SurfaceFlinger;
+struct LayerProtoSnapshot;
 
 constexpr auto operator""_MB(unsigned long long const num) {
     return num * 1024 * 1024;
@@ -49,6 +54,10 @@ public:
     void notify(long compositionTime, const char* where);
 
     void setBufferSize(size_t bufferSizeInByte);
+    // When set, the next trace is streamed to the trace file as it is recorded, with each entry
+    // only holding the layers that changed since the previous one. The buffer size then caps
+    // the size of the file.
+    void setStreaming(bool streaming);
     void writeToFileAsync();
     void dump(std::string& result) const;
 
@@ -61,6 +70,8 @@ public:
     void setTraceFlags(uint32_t flags);
 
 private:
+    friend class SurfaceTracingTest;
+
     static constexpr auto kDefaultBufferCapInByte = 100_MB;
     static constexpr auto kDefaultFileName = "/data/misc/wmtrace/layers_trace.pb";
 
@@ -81,15 +92,61 @@ private:
         std::queue<LayersTraceProto> mStorage;
     };
 
+    class LayersTraceStream { // appends to the trace file through a fixed size mapping
+        friend class SurfaceTracingTest;
+
+    public:
+        ~LayersTraceStream() { close(); }
+
+        bool isOpen() const { return mFd.get() >= 0; }
+        size_t size() const { return mSizeInBytes; }
+        size_t used() const { return mUsedInBytes; }
+        size_t frameCount() const { return mFrameCount; }
+        size_t droppedFrameCount() const { return mDroppedFrameCount; }
+
+        status_t open(const char* path, size_t sizeInBytes);
+        // Appends an encoded LayersTraceFileProto. Returns NO_MEMORY and drops it if the file
+        // would outgrow its size. On any error, nothing of it is kept.
+        status_t append(const std::string& data);
+        // Unmaps the window and trims the file, so that it is complete up to the last entry.
+        status_t flush();
+        status_t close();
+
+    private:
+        static constexpr size_t kWindowSizeInBytes = 1_MB;
+
+        status_t mapWindow();
+
+        android::base::unique_fd mFd;
+        uint8_t* mWindow = nullptr;
+        size_t mWindowOffset = 0U;
+        size_t mUsedInBytes = 0U;
+        size_t mSizeInBytes = 0U;
+        size_t mFrameCount = 0U;
+        size_t mDroppedFrameCount = 0U;
+    };
+
     long mCompositionTime;
 
     void mainLoop();
     void addFirstEntry();
     LayersTraceProto traceWhenNotified();
-    LayersTraceProto traceLayersLocked(const char* where) REQUIRES(mSfLock);
+    // Only copies the layer state, the entry is built by traceLayers() after releasing the lock.
+    std::vector<LayerProtoSnapshot> snapshotLayersLocked() REQUIRES(mSfLock);
+    static LayersTraceProto traceLayers(long compositionTime, const char* where,
+                                        const std::vector<LayerProtoSnapshot>& layers);
 
     // Returns true if trace is enabled.
     bool addTraceToBuffer(LayersTraceProto& entry);
+    void streamEntryLocked(LayersTraceProto& entry) REQUIRES(mTraceLock);
+
+    // Encoded layers of an entry, by layer id.
+    using EncodedLayers = std::unordered_map<int32_t, std::string>;
+    // Moves the layers of |entry| that changed since |previousLayers| into a delta entry, and
+    // returns the encoded layers of |entry| in |outLayers|.
+    static LayersTraceProto makeDeltaEntry(LayersTraceProto& entry,
+                                           const EncodedLayers& previousLayers,
+                                           EncodedLayers* outLayers);
     void writeProtoFileLocked() REQUIRES(mTraceLock);
 
     const SurfaceFlinger& mFlinger;
@@ -106,6 +163,10 @@ private:
     size_t mBufferSize GUARDED_BY(mTraceLock) = kDefaultBufferCapInByte;
     bool mEnabled GUARDED_BY(mTraceLock) = false;
     bool mWriteToFile GUARDED_BY(mTraceLock) = false;
+    bool mStreaming GUARDED_BY(mTraceLock) = false;
+    LayersTraceStream mStream GUARDED_BY(mTraceLock);
+    // Layers of the last entry written to the stream.
+    EncodedLayers mStreamedLayers GUARDED_BY(mTraceLock);
 };
 
 } // namespace android
@@ -22,8 +22,10 @@
 #include "TransactionCompletedThread.h"
 
 #include <cinttypes>
+#include <optional>
 
 #include <binder/IInterface.h>
+#include <binder/IPCThreadState.h>
 #include <gui/ITransactionCompletedListener.h>
 #include <utils/RefBase.h>
 
@@ -226,6 +228,10 @@ void TransactionCompletedThread::threadMain() {
     while (mKeepRunning) {
         mConditionVariable.wait(mMutex);
         std::vector<ListenerStats> completedListenerStats;
+        std::vector<sp<IBinder>> notifiedListeners;
+
+        // Callbacks are sent to the driver together, once every listener has been visited.
+        std::optional<IPCThreadState::OnewayBatch> batch(std::in_place);
 
         // For each listener
         auto completedTransactionsItr = mCompletedTransactions.begin();
@@ -265,7 +271,7 @@ void TransactionCompletedThread::threadMain() {
                 if (IInterface::asBinder(listener)->isBinderAlive()) {
                     // Send callback
                     listenerStats.listener->onTransactionCompleted(listenerStats);
-                    IInterface::asBinder(listener)->unlinkToDeath(mDeathRecipient);
+                    notifiedListeners.push_back(IInterface::asBinder(listener));
                 }
                 completedTransactionsItr = mCompletedTransactions.erase(completedTransactionsItr);
             } else {
@@ -275,6 +281,12 @@ void TransactionCompletedThread::threadMain() {
             completedListenerStats.push_back(std::move(listenerStats));
         }
 
+        // unlinkToDeath() talks to the driver, so it would send each callback on its own.
+        batch.reset();
+        for (const auto& binder : notifiedListeners) {
+            binder->unlinkToDeath(mDeathRecipient);
+        }
+
         if (mPresentFence) {
             mPresentFence.clear();
         }
@@ -80,9 +80,12 @@ int main(int, char**) {
 
     startGraphicsAllocatorService();
 
-    // When SF is launched in its own process, limit the number of
-    // binder threads to 4.
-    ProcessState::self()->setThreadPoolMaxThreadCount(4);
+    // When SF is launched in its own process, start with 4 binder threads
+    // and only grow the pool when composer calls queue behind each other.
+    // dump() runs on borrowed threads, so it never delays frame-critical calls.
+    ProcessState::self()->setThreadPoolAdaptive(4, 8);
+    ProcessState::self()->setInterfaceDispatchClass(ISurfaceComposer::descriptor,
+            ProcessState::DispatchClass::LATENCY_CRITICAL);
 
     // start the thread pool
     sp<ProcessState> ps(ProcessState::self());
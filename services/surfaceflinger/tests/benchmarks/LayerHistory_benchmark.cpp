@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures what LayerHistory costs per queued buffer, which every
+// BufferQueueLayer::onFrameAvailable pays, and per refresh rate decision,
+// with as many layers as a busy home screen has.
+//
+// The module builds for the device only, so run it there:
+//   adb shell /data/benchmarktest64/LayerHistory_benchmark/LayerHistory_benchmark
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Scheduler/LayerHistory.h"
+
+namespace android {
+namespace scheduler {
+namespace {
+
+constexpr size_t kLayerCount = 200;
+constexpr float kMinRefreshRate = 60.f;
+constexpr float kMaxRefreshRate = 90.f;
+
+struct Layers {
+    explicit Layers(LayerHistory& history) {
+        for (size_t i = 0; i < kLayerCount; i++) {
+            handles.push_back(history.createLayer("Layer" + std::to_string(i), kMinRefreshRate,
+                                                  kMaxRefreshRate));
+            history.setVisibility(handles.back(), true);
+        }
+    }
+
+    std::vector<std::unique_ptr<LayerHistory::LayerHandle>> handles;
+};
+
+// Queues a buffer on one of the layers, from one or more binder threads.
+void BM_insert(benchmark::State& state) {
+    static LayerHistory history;
+    static Layers layers(history);
+
+    size_t i = size_t(state.thread_index);
+    nsecs_t presentTime = systemTime();
+    for (auto _ : state) {
+        history.insert(layers.handles[i % kLayerCount], presentTime, false /*isHdr*/);
+        i += size_t(state.threads);
+        presentTime += 11111111;
+    }
+}
+BENCHMARK(BM_insert)->ThreadRange(1, 4);
+
+// Decides the refresh rate with every layer active and relevant.
+void BM_getDesiredRefreshRateAndHDR(benchmark::State& state) {
+    LayerHistory history;
+    Layers layers(history);
+
+    nsecs_t presentTime = systemTime();
+    for (size_t frame = 0; frame < 90; frame++) {
+        for (const auto& handle : layers.handles) {
+            history.insert(handle, presentTime, false /*isHdr*/);
+        }
+        presentTime += 11111111;
+    }
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(history.getDesiredRefreshRateAndHDR());
+    }
+}
+BENCHMARK(BM_getDesiredRefreshRateAndHDR);
+
+} // namespace
+} // namespace scheduler
+} // namespace android
+
+BENCHMARK_MAIN();
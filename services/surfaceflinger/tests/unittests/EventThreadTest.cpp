@@ -350,6 +350,31 @@ TEST_F(EventThreadTest, setVsyncRateTwoPostsEveryOtherEventToThatConnection) {
     expectVsyncEventReceivedByConnection(101112, 4u);
 }
 
+TEST_F(EventThreadTest, setVsyncRateZeroAfterNonzeroStopsVSyncEvents) {
+    mThread->setVsyncRate(1, mConnection);
+
+    // EventThread should enable vsync callbacks.
+    expectVSyncSetEnabledCallReceived(true);
+
+    mCallback->onVSyncEvent(123);
+    expectInterceptCallReceived(123);
+    expectVsyncEventReceivedByConnection(123, 1u);
+
+    // Once the connection no longer wants events, EventThread should disable
+    // vsync callbacks.
+    mThread->setVsyncRate(0, mConnection);
+    expectVSyncSetEnabledCallReceived(false);
+
+    // A later request should be served again.
+    mThread->requestNextVsync(mConnection);
+    EXPECT_TRUE(mResyncCallRecorder.waitForCall().has_value());
+    expectVSyncSetEnabledCallReceived(true);
+
+    mCallback->onVSyncEvent(456);
+    expectInterceptCallReceived(456);
+    expectVsyncEventReceivedByConnection(456, 2u);
+}
+
 TEST_F(EventThreadTest, connectionsRemovedIfInstanceDestroyed) {
     mThread->setVsyncRate(1, mConnection);
 
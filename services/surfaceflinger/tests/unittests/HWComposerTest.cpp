@@ -0,0 +1,236 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "HWComposerTest"
+
+#include <compositionengine/mock/Layer.h>
+#include <compositionengine/mock/Output.h>
+#include <compositionengine/mock/OutputLayer.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <unordered_set>
+
+#include "TestableSurfaceFlinger.h"
+#include "mock/DisplayHardware/MockComposer.h"
+
+namespace android {
+namespace {
+
+using testing::_;
+using testing::DoAll;
+using testing::Return;
+using testing::ReturnRef;
+using testing::SetArgPointee;
+
+using Hwc2::Error;
+using Hwc2::IComposerClient;
+
+using FakeHwcDisplayInjector = TestableSurfaceFlinger::FakeHwcDisplayInjector;
+
+constexpr DisplayId kDisplayId = DisplayId{42};
+constexpr hwc2_display_t kHwcDisplayId = FakeHwcDisplayInjector::DEFAULT_HWC_DISPLAY_ID;
+constexpr hwc2_layer_t kHwcLayerId = 7;
+
+/*
+ * Drives HWComposer::prepare() for one display with a single layer, and checks
+ * when the strategy accepted on an earlier frame is reused.
+ */
+class HWComposerStrategyCacheTest : public testing::Test {
+protected:
+    HWComposerStrategyCacheTest() {
+        mFlinger.setupComposer(std::unique_ptr<Hwc2::Composer>(mComposer));
+        FakeHwcDisplayInjector(kDisplayId, HWC2::DisplayType::Physical, true /* isPrimary */)
+                .setPowerMode(HWC_POWER_MODE_NORMAL)
+                .inject(&mFlinger, mComposer);
+
+        static const std::unordered_set<HWC2::Capability> capabilities;
+        mOutputLayerState.hwc.emplace(std::make_shared<HWC2::impl::Layer>(*mComposer, capabilities,
+                                                                          kHwcDisplayId,
+                                                                          kHwcLayerId));
+        mOutputLayerState.hwc->hwcCompositionType = IComposerClient::Composition::DEVICE;
+        mOutputLayerState.displayFrame = Rect(0, 0, 100, 100);
+        mOutputLayerState.visibleRegion = Region(Rect(0, 0, 100, 100));
+
+        auto outputLayer = std::make_unique<compositionengine::mock::OutputLayer>();
+        EXPECT_CALL(*outputLayer, getState()).WillRepeatedly(ReturnRef(mOutputLayerState));
+        EXPECT_CALL(*outputLayer, editState()).WillRepeatedly(ReturnRef(mOutputLayerState));
+        EXPECT_CALL(*outputLayer, getLayer()).WillRepeatedly(ReturnRef(mLayer));
+        mOutputLayers.push_back(std::move(outputLayer));
+
+        EXPECT_CALL(mLayer, getState()).WillRepeatedly(ReturnRef(mLayerState));
+        EXPECT_CALL(mOutput, getState()).WillRepeatedly(ReturnRef(mOutputState));
+        EXPECT_CALL(mOutput, getOutputLayersOrderedByZ()).WillRepeatedly(ReturnRef(mOutputLayers));
+    }
+
+    ~HWComposerStrategyCacheTest() override {
+        // The layer must go before the HWC it was created with.
+        mOutputLayerState.hwc.reset();
+    }
+
+    // The HWC presents without validating.
+    void expectPresent() {
+        EXPECT_CALL(*mComposer, presentOrValidateDisplay(kHwcDisplayId, _, _, _, _))
+                .WillOnce(DoAll(SetArgPointee<3>(-1), SetArgPointee<4>(1u), Return(Error::NONE)));
+        EXPECT_CALL(*mComposer, getReleaseFences(kHwcDisplayId, _, _))
+                .WillOnce(Return(Error::NONE));
+    }
+
+    // The HWC validates instead of presenting, and accepts the requested types.
+    void expectValidateInsteadOfPresent() {
+        EXPECT_CALL(*mComposer, presentOrValidateDisplay(kHwcDisplayId, _, _, _, _))
+                .WillOnce(DoAll(SetArgPointee<1>(0u), SetArgPointee<2>(0u), SetArgPointee<4>(0u),
+                                Return(Error::NONE)));
+        expectAcceptChanges();
+    }
+
+    void expectAcceptChanges() {
+        EXPECT_CALL(*mComposer, getChangedCompositionTypes(kHwcDisplayId, _, _))
+                .WillOnce(Return(Error::NONE));
+        EXPECT_CALL(*mComposer, getDisplayRequests(kHwcDisplayId, _, _, _))
+                .WillOnce(DoAll(SetArgPointee<1>(0u), Return(Error::NONE)));
+        EXPECT_CALL(*mComposer, acceptDisplayChanges(kHwcDisplayId)).WillOnce(Return(Error::NONE));
+    }
+
+    status_t prepare() { return mFlinger.getHwComposer().prepare(kDisplayId, mOutput); }
+
+    auto& displayData() { return mFlinger.mutableHwcDisplayData()[kDisplayId]; }
+
+    TestableSurfaceFlinger mFlinger;
+    Hwc2::mock::Composer* mComposer = new Hwc2::mock::Composer();
+
+    compositionengine::mock::Output mOutput;
+    compositionengine::impl::OutputCompositionState mOutputState;
+    compositionengine::Output::OutputLayers mOutputLayers;
+    compositionengine::impl::OutputLayerCompositionState mOutputLayerState;
+    compositionengine::mock::Layer mLayer;
+    compositionengine::impl::LayerCompositionState mLayerState;
+};
+
+TEST_F(HWComposerStrategyCacheTest, sameLayerStackHitsCache) {
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+
+    expectPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(1u, displayData().strategyCacheHits);
+    EXPECT_EQ(1u, displayData().validatesSkipped);
+    EXPECT_TRUE(mFlinger.getHwComposer().hasDeviceComposition(kDisplayId));
+    EXPECT_FALSE(mFlinger.getHwComposer().hasClientComposition(kDisplayId));
+}
+
+TEST_F(HWComposerStrategyCacheTest, changedFrameStateMissesCache) {
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+
+    mOutputLayerState.visibleRegion = Region(Rect(0, 0, 50, 100));
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+
+    mOutputState.colorTransformMat = mat4::scale(vec4(0.5f, 0.5f, 0.5f, 1.0f));
+    mOutputState.colorTransform = HAL_COLOR_TRANSFORM_ARBITRARY_MATRIX;
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+
+    mLayerState.frontEnd.color = IComposerClient::Color{255, 0, 0, 255};
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+
+    expectPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(1u, displayData().strategyCacheHits);
+}
+
+TEST_F(HWComposerStrategyCacheTest, clientCompositionNeverSkipsValidate) {
+    mOutputLayerState.hwc->hwcCompositionType = IComposerClient::Composition::CLIENT;
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_TRUE(mFlinger.getHwComposer().hasClientComposition(kDisplayId));
+
+    // The client target is not rendered yet, so the same layer stack must not
+    // be presented without validating.
+    EXPECT_CALL(*mComposer, presentOrValidateDisplay(_, _, _, _, _)).Times(0);
+    EXPECT_CALL(*mComposer, validateDisplay(kHwcDisplayId, _, _)).WillOnce(Return(Error::NONE));
+    expectAcceptChanges();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+    EXPECT_TRUE(mFlinger.getHwComposer().hasClientComposition(kDisplayId));
+}
+
+TEST_F(HWComposerStrategyCacheTest, cachedStrategyOverridesLastClientComposition) {
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+
+    // A frame with client composition does not replace the cached strategy.
+    mOutputLayerState.hwc->hwcCompositionType = IComposerClient::Composition::CLIENT;
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    ASSERT_TRUE(mFlinger.getHwComposer().hasClientComposition(kDisplayId));
+    ASSERT_TRUE(displayData().acceptedStrategy);
+
+    // Back to the cached layer stack, the HWC presents it without the
+    // validate the last frame's client composition would otherwise require.
+    mOutputLayerState.hwc->hwcCompositionType = IComposerClient::Composition::DEVICE;
+    EXPECT_CALL(*mComposer, validateDisplay(_, _, _)).Times(0);
+    expectPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(1u, displayData().strategyCacheHits);
+    EXPECT_TRUE(displayData().validateWasSkipped);
+    EXPECT_FALSE(mFlinger.getHwComposer().hasClientComposition(kDisplayId));
+    EXPECT_TRUE(mFlinger.getHwComposer().hasDeviceComposition(kDisplayId));
+}
+
+TEST_F(HWComposerStrategyCacheTest, powerModeChangeInvalidatesCache) {
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    ASSERT_TRUE(displayData().acceptedStrategy);
+
+    EXPECT_CALL(*mComposer, setPowerMode(kHwcDisplayId, IComposerClient::PowerMode::ON))
+            .WillOnce(Return(Error::NONE));
+    ASSERT_EQ(NO_ERROR, mFlinger.getHwComposer().setPowerMode(kDisplayId, HWC_POWER_MODE_NORMAL));
+    EXPECT_FALSE(displayData().acceptedStrategy);
+
+    expectPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(0u, displayData().strategyCacheHits);
+}
+
+TEST_F(HWComposerStrategyCacheTest, failedValidateInvalidatesCache) {
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+
+    // The HWC rejects presenting the cached strategy, and validating fails.
+    EXPECT_CALL(*mComposer, presentOrValidateDisplay(kHwcDisplayId, _, _, _, _))
+            .WillOnce(DoAll(SetArgPointee<4>(0u), Return(Error::NONE)));
+    EXPECT_CALL(*mComposer, getChangedCompositionTypes(kHwcDisplayId, _, _))
+            .WillOnce(Return(Error::BAD_LAYER));
+    EXPECT_NE(NO_ERROR, prepare());
+    EXPECT_EQ(1u, displayData().strategyCacheHits);
+    EXPECT_FALSE(displayData().acceptedStrategy);
+
+    expectValidateInsteadOfPresent();
+    ASSERT_EQ(NO_ERROR, prepare());
+    EXPECT_EQ(1u, displayData().strategyCacheHits);
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "LayerBoundsTest"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <gui/LayerMetadata.h>
+#include <utils/String8.h>
+
+#include "ContainerLayer.h"
+#include "TestableScheduler.h"
+#include "TestableSurfaceFlinger.h"
+#include "mock/MockDispSync.h"
+#include "mock/MockEventControlThread.h"
+#include "mock/MockEventThread.h"
+
+namespace android {
+namespace {
+
+using testing::_;
+
+const FloatRect kViewport(0, 0, 1000, 1000);
+
+class LayerBoundsTest : public testing::Test {
+protected:
+    LayerBoundsTest() {
+        mScheduler = new TestableScheduler(mFlinger.mutableRefreshRateConfigs());
+        mScheduler->mutableEventControlThread().reset(new mock::EventControlThread());
+        mScheduler->mutablePrimaryDispSync().reset(new mock::DispSync());
+        EXPECT_CALL(*mEventThread, registerDisplayEventConnection(_));
+        mFlinger.mutableSfConnectionHandle() = mScheduler->addConnection(std::move(mEventThread));
+        mFlinger.mutableScheduler().reset(mScheduler);
+
+        mParent = createLayer("parent");
+        mChild = createLayer("child");
+        mParent->addChild(mChild);
+        commit(mParent);
+        commit(mChild);
+
+        mChild->setCrop_legacy(Rect(0, 0, 10, 10), true);
+        commit(mChild);
+    }
+
+    sp<Layer> createLayer(const char* name) {
+        return new ContainerLayer(LayerCreationArgs(mFlinger.mFlinger.get(), sp<Client>(),
+                                                    String8(name), 0, 0, 0, LayerMetadata()));
+    }
+
+    // Does what SurfaceFlinger does for a layer when it handles a transaction.
+    void commit(const sp<Layer>& layer) {
+        layer->doTransaction(0);
+        layer->commitChildList();
+    }
+
+    void computeBounds() { mParent->computeBounds(kViewport, ui::Transform()); }
+
+    TestableSurfaceFlinger mFlinger;
+    TestableScheduler* mScheduler;
+    std::unique_ptr<mock::EventThread> mEventThread = std::make_unique<mock::EventThread>();
+
+    sp<Layer> mParent;
+    sp<Layer> mChild;
+};
+
+TEST_F(LayerBoundsTest, movingALayerUpdatesItsBounds) {
+    computeBounds();
+    EXPECT_EQ(Rect(0, 0, 10, 10), mChild->getScreenBounds());
+
+    mChild->setPosition(20, 30, true);
+    commit(mChild);
+    computeBounds();
+    EXPECT_EQ(Rect(20, 30, 30, 40), mChild->getScreenBounds());
+}
+
+TEST_F(LayerBoundsTest, movingTheParentUpdatesChildBounds) {
+    computeBounds();
+
+    mParent->setPosition(100, 200, true);
+    commit(mParent);
+    computeBounds();
+    EXPECT_EQ(Rect(100, 200, 110, 210), mChild->getScreenBounds());
+}
+
+TEST_F(LayerBoundsTest, changingTheViewportUpdatesChildBounds) {
+    computeBounds();
+
+    mChild->setPosition(995, 0, true);
+    commit(mChild);
+    computeBounds();
+    EXPECT_EQ(Rect(995, 0, 1000, 10), mChild->getScreenBounds());
+
+    mParent->computeBounds(FloatRect(0, 0, 2000, 1000), ui::Transform());
+    EXPECT_EQ(Rect(995, 0, 1005, 10), mChild->getScreenBounds());
+}
+
+TEST_F(LayerBoundsTest, cleanSubtreesKeepTheirBounds) {
+    computeBounds();
+
+    // Changes made behind the back of the layer aren't picked up until it is
+    // flagged as dirty.
+    mFlinger.mutableLayerDrawingState(mChild).crop_legacy = Rect(0, 0, 50, 50);
+    computeBounds();
+    EXPECT_EQ(Rect(0, 0, 10, 10), mChild->getScreenBounds());
+
+    mChild->setGeometryDirty();
+    computeBounds();
+    EXPECT_EQ(Rect(0, 0, 50, 50), mChild->getScreenBounds());
+}
+
+TEST_F(LayerBoundsTest, reparentingUpdatesBounds) {
+    sp<Layer> newParent = createLayer("new-parent");
+    mParent->addChild(newParent);
+    newParent->setPosition(300, 400, true);
+    commit(newParent);
+    commit(mParent);
+    computeBounds();
+    EXPECT_EQ(Rect(0, 0, 10, 10), mChild->getScreenBounds());
+
+    mParent->removeChild(mChild);
+    newParent->addChild(mChild);
+    commit(mChild);
+    commit(newParent);
+    commit(mParent);
+    computeBounds();
+    EXPECT_EQ(Rect(300, 400, 310, 410), mChild->getScreenBounds());
+}
+
+} // namespace
+} // namespace android
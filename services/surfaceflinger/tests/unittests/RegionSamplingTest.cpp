@@ -17,6 +17,7 @@
 #undef LOG_TAG
 #define LOG_TAG "RegionSamplingTest"
 
+#include <ui/Region.h>
 #include <ui/Transform.h>
 
 #include <gmock/gmock.h>
@@ -73,6 +74,25 @@ TEST_F(RegionSamplingTest, calculate_mean_mixed_values) {
                 testing::FloatNear(0.083f, 0.01f));
 }
 
+TEST_F(RegionSamplingTest, calculate_luma_of_primaries) {
+    static uint32_t constexpr kRed = 0xFF0000FF;
+    static uint32_t constexpr kGreen = 0xFF00FF00;
+    static uint32_t constexpr kBlue = 0xFFFF0000;
+    static float constexpr kTolerance = 1.0f / 255.0f;
+
+    std::fill(buffer.begin(), buffer.end(), kRed);
+    EXPECT_THAT(sampleArea(buffer.data(), kWidth, kHeight, kStride, kOrientation, whole_area),
+                testing::FloatNear(0.2126f, kTolerance));
+
+    std::fill(buffer.begin(), buffer.end(), kGreen);
+    EXPECT_THAT(sampleArea(buffer.data(), kWidth, kHeight, kStride, kOrientation, whole_area),
+                testing::FloatNear(0.7152f, kTolerance));
+
+    std::fill(buffer.begin(), buffer.end(), kBlue);
+    EXPECT_THAT(sampleArea(buffer.data(), kWidth, kHeight, kStride, kOrientation, whole_area),
+                testing::FloatNear(0.0722f, kTolerance));
+}
+
 TEST_F(RegionSamplingTest, bimodal_tiebreaker) {
     std::generate(buffer.begin(), buffer.end(),
                   [n = 0]() mutable { return (n++ % 2) ? kBlack : kWhite; });
@@ -136,4 +156,71 @@ TEST_F(RegionSamplingTest, orientation_90) {
                 testing::Eq(1.0));
 }
 
+TEST_F(RegionSamplingTest, scale_sample_area) {
+    // 98x29 is captured into a ceil(98/4) x ceil(29/4) buffer.
+    EXPECT_EQ(Rect(0, 0, 25, 8), scaleSampleArea(whole_area, kWidth, kHeight, 25, 8));
+
+    // Small areas round outwards to at least one pixel.
+    EXPECT_EQ(Rect(0, 0, 1, 1), scaleSampleArea(Rect(1, 1, 2, 2), kWidth, kHeight, 25, 8));
+
+    // A 6 pixel wide capture scales by 2/6, not by 1/4.
+    EXPECT_EQ(Rect(1, 0, 2, 2), scaleSampleArea(Rect(3, 0, 6, 6), 6, 6, 2, 2));
+    EXPECT_EQ(Rect(0, 0, 2, 2), scaleSampleArea(Rect(0, 0, 4, 4), 6, 6, 2, 2));
+
+    // Areas are clipped to the buffer.
+    EXPECT_EQ(Rect(20, 6, 25, 8),
+              scaleSampleArea(Rect(80, 24, kWidth + 40, kHeight + 40), kWidth, kHeight, 25, 8));
+
+    EXPECT_TRUE(scaleSampleArea(whole_area, 0, kHeight, 25, 8).isEmpty());
+}
+
+TEST_F(RegionSamplingTest, display_to_layer_stack_space) {
+    static int32_t constexpr kDisplayWidth = 1000;
+    static int32_t constexpr kDisplayHeight = 2000;
+    Rect const area{0, 0, 100, 50};
+
+    EXPECT_EQ(area,
+              displayToLayerStackSpace(Region(area), ui::Transform::ROT_0, kDisplayWidth,
+                                       kDisplayHeight)
+                      .getBounds());
+    EXPECT_EQ(Rect(950, 0, 1000, 100),
+              displayToLayerStackSpace(Region(area), ui::Transform::ROT_90, kDisplayWidth,
+                                       kDisplayHeight)
+                      .getBounds());
+    EXPECT_EQ(Rect(900, 1950, 1000, 2000),
+              displayToLayerStackSpace(Region(area), ui::Transform::ROT_180, kDisplayWidth,
+                                       kDisplayHeight)
+                      .getBounds());
+    EXPECT_EQ(Rect(0, 1900, 50, 2000),
+              displayToLayerStackSpace(Region(area), ui::Transform::ROT_270, kDisplayWidth,
+                                       kDisplayHeight)
+                      .getBounds());
+}
+
+TEST_F(RegionSamplingTest, skip_clean_sample_area) {
+    static int32_t constexpr kDisplayWidth = 1000;
+    static int32_t constexpr kDisplayHeight = 2000;
+    Rect const area{0, 0, 100, 50};
+
+    EXPECT_TRUE(isSampleAreaDirty(Region(Rect(50, 20, 60, 30)), area, ui::Transform::ROT_0,
+                                  kDisplayWidth, kDisplayHeight));
+    EXPECT_FALSE(isSampleAreaDirty(Region(Rect(200, 200, 300, 300)), area, ui::Transform::ROT_0,
+                                   kDisplayWidth, kDisplayHeight));
+    EXPECT_FALSE(isSampleAreaDirty(Region(), area, ui::Transform::ROT_0, kDisplayWidth,
+                                   kDisplayHeight));
+
+    // On a rotated display the area is captured from elsewhere in the layer
+    // stack: a redraw where the unrotated area would be does not count.
+    EXPECT_FALSE(isSampleAreaDirty(Region(area), area, ui::Transform::ROT_90, kDisplayWidth,
+                                   kDisplayHeight));
+    EXPECT_TRUE(isSampleAreaDirty(Region(Rect(990, 90, 1000, 100)), area, ui::Transform::ROT_90,
+                                  kDisplayWidth, kDisplayHeight));
+    EXPECT_FALSE(isSampleAreaDirty(Region(area), area, ui::Transform::ROT_180, kDisplayWidth,
+                                   kDisplayHeight));
+    EXPECT_TRUE(isSampleAreaDirty(Region(Rect(900, 1950, 910, 1960)), area,
+                                  ui::Transform::ROT_180, kDisplayWidth, kDisplayHeight));
+    EXPECT_TRUE(isSampleAreaDirty(Region(Rect(0, 1990, 10, 2000)), area, ui::Transform::ROT_270,
+                                  kDisplayWidth, kDisplayHeight));
+}
+
 } // namespace android
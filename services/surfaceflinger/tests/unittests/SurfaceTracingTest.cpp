@@ -0,0 +1,264 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "SurfaceTracingTest"
+
+#include <android-base/file.h>
+#include <android-base/test_utils.h>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "SurfaceTracing.h"
+#include "TestableSurfaceFlinger.h"
+
+namespace android {
+
+/*
+ * Streams entries to a trace file and reads them back the way a trace viewer
+ * would: the file parses as one LayersTraceFileProto, and the layers at each
+ * entry are those of the previous entry with the delta applied.
+ */
+class SurfaceTracingTest : public testing::Test {
+protected:
+    using LayersTraceStream = SurfaceTracing::LayersTraceStream;
+    using EncodedLayers = SurfaceTracing::EncodedLayers;
+    // encoded layers by id
+    using State = std::map<int32_t, std::string>;
+
+    static constexpr size_t kWindowSizeInBytes = LayersTraceStream::kWindowSizeInBytes;
+
+    SurfaceTracingTest() { mPath = std::string(mDir.path) + "/layers_trace.pb"; }
+
+    static LayerProto makeLayer(int32_t id, const std::string& name, int32_t z = 0) {
+        LayerProto layer;
+        layer.set_id(id);
+        layer.set_name(name);
+        layer.set_z(z);
+        return layer;
+    }
+
+    static LayersTraceProto makeEntry(int64_t time, const std::vector<LayerProto>& layers) {
+        LayersTraceProto entry;
+        entry.set_elapsed_realtime_nanos(time);
+        entry.set_where("test");
+        for (const LayerProto& layer : layers) {
+            *entry.mutable_layers()->add_layers() = layer;
+        }
+        return entry;
+    }
+
+    static State stateOf(const LayersTraceProto& entry) {
+        State state;
+        for (const LayerProto& layer : entry.layers().layers()) {
+            state[layer.id()] = layer.SerializeAsString();
+        }
+        return state;
+    }
+
+    static std::vector<int32_t> idsOf(const LayersTraceProto& entry) {
+        std::vector<int32_t> ids;
+        for (const LayerProto& layer : entry.layers().layers()) {
+            ids.push_back(layer.id());
+        }
+        return ids;
+    }
+
+    static LayersTraceProto makeDeltaEntry(LayersTraceProto entry, const EncodedLayers& previous,
+                                           EncodedLayers* outLayers) {
+        return SurfaceTracing::makeDeltaEntry(entry, previous, outLayers);
+    }
+
+    status_t openStream(size_t sizeInBytes) {
+        std::scoped_lock lock(mTracing.mTraceLock);
+        mTracing.mStreamedLayers.clear();
+        return mTracing.mStream.open(mPath.c_str(), sizeInBytes);
+    }
+
+    // Streams |entry| as the tracing thread does, and returns the layers it had.
+    State streamEntry(LayersTraceProto entry) {
+        const State state = stateOf(entry);
+        std::scoped_lock lock(mTracing.mTraceLock);
+        mTracing.streamEntryLocked(entry);
+        return state;
+    }
+
+    status_t closeStream() {
+        std::scoped_lock lock(mTracing.mTraceLock);
+        return mTracing.mStream.close();
+    }
+
+    const LayersTraceStream& stream() {
+        std::scoped_lock lock(mTracing.mTraceLock);
+        return mTracing.mStream;
+    }
+
+    void reopenStreamFd(int flags) {
+        std::scoped_lock lock(mTracing.mTraceLock);
+        mTracing.mStream.mFd.reset(open(mPath.c_str(), flags | O_CLOEXEC));
+        ASSERT_GE(mTracing.mStream.mFd.get(), 0);
+    }
+
+    LayersTraceFileProto readTrace() {
+        std::string data;
+        LayersTraceFileProto trace;
+        EXPECT_TRUE(android::base::ReadFileToString(mPath, &data));
+        EXPECT_TRUE(trace.ParseFromString(data));
+        return trace;
+    }
+
+    static std::vector<State> replay(const LayersTraceFileProto& trace) {
+        std::vector<State> states;
+        State state;
+        for (const LayersTraceProto& entry : trace.entry()) {
+            if (!entry.layers_delta()) {
+                state.clear();
+            }
+            for (int32_t id : entry.removed_layers()) {
+                state.erase(id);
+            }
+            for (const LayerProto& layer : entry.layers().layers()) {
+                state[layer.id()] = layer.SerializeAsString();
+            }
+            states.push_back(state);
+        }
+        return states;
+    }
+
+    TestableSurfaceFlinger mFlinger;
+    SurfaceTracing mTracing{*mFlinger.mFlinger};
+    TemporaryDir mDir;
+    std::string mPath;
+};
+
+namespace {
+
+TEST_F(SurfaceTracingTest, deltaEntryOnlyHoldsChanges) {
+    EncodedLayers first;
+    LayersTraceProto delta =
+            makeDeltaEntry(makeEntry(1, {makeLayer(1, "a"), makeLayer(2, "b")}), {}, &first);
+    EXPECT_TRUE(delta.layers_delta());
+    EXPECT_EQ(1u, delta.elapsed_realtime_nanos());
+    EXPECT_EQ("test", delta.where());
+    EXPECT_EQ((std::vector<int32_t>{1, 2}), idsOf(delta));
+    EXPECT_EQ(0, delta.removed_layers_size());
+
+    EncodedLayers second;
+    delta = makeDeltaEntry(makeEntry(2, {makeLayer(1, "a"), makeLayer(2, "b", 1)}), first,
+                           &second);
+    EXPECT_EQ((std::vector<int32_t>{2}), idsOf(delta));
+    EXPECT_EQ(0, delta.removed_layers_size());
+
+    EncodedLayers third;
+    delta = makeDeltaEntry(makeEntry(3, {makeLayer(2, "b", 1), makeLayer(3, "c")}), second,
+                           &third);
+    EXPECT_EQ((std::vector<int32_t>{3}), idsOf(delta));
+    ASSERT_EQ(1, delta.removed_layers_size());
+    EXPECT_EQ(1, delta.removed_layers(0));
+
+    EncodedLayers fourth;
+    delta = makeDeltaEntry(makeEntry(4, {makeLayer(2, "b", 1), makeLayer(3, "c")}), third,
+                           &fourth);
+    EXPECT_EQ(0, delta.layers().layers_size());
+    EXPECT_EQ(0, delta.removed_layers_size());
+}
+
+TEST_F(SurfaceTracingTest, streamedTraceReadsBack) {
+    ASSERT_EQ(NO_ERROR, openStream(1_MB));
+
+    std::vector<State> expected;
+    expected.push_back(streamEntry(makeEntry(1, {makeLayer(1, "a"), makeLayer(2, "b")})));
+    expected.push_back(streamEntry(makeEntry(2, {makeLayer(1, "a", 5), makeLayer(2, "b")})));
+    expected.push_back(streamEntry(makeEntry(3, {makeLayer(2, "b"), makeLayer(3, "c")})));
+    expected.push_back(streamEntry(makeEntry(4, {makeLayer(2, "b"), makeLayer(3, "c")})));
+    expected.push_back(streamEntry(makeEntry(5, {})));
+    EXPECT_EQ(5u, stream().frameCount());
+    ASSERT_EQ(NO_ERROR, closeStream());
+
+    const LayersTraceFileProto trace = readTrace();
+    EXPECT_EQ(uint64_t(LayersTraceFileProto_MagicNumber_MAGIC_NUMBER_H) << 32 |
+                      LayersTraceFileProto_MagicNumber_MAGIC_NUMBER_L,
+              trace.magic_number());
+    ASSERT_EQ(5, trace.entry_size());
+    for (int i = 0; i < trace.entry_size(); i++) {
+        EXPECT_TRUE(trace.entry(i).layers_delta());
+        EXPECT_EQ(static_cast<uint64_t>(i + 1), trace.entry(i).elapsed_realtime_nanos());
+    }
+    EXPECT_EQ(expected, replay(trace));
+}
+
+TEST_F(SurfaceTracingTest, entriesSpanMappingWindows) {
+    ASSERT_EQ(NO_ERROR, openStream(10 * kWindowSizeInBytes));
+
+    // Each entry changes a large layer, so every one of them is written out.
+    std::vector<State> expected;
+    for (int i = 0; i < 8; i++) {
+        const std::string name(kWindowSizeInBytes * 3 / 8, static_cast<char>('a' + i));
+        expected.push_back(
+                streamEntry(makeEntry(i, {makeLayer(1, name), makeLayer(2, "small")})));
+    }
+    EXPECT_GT(stream().used(), 2 * kWindowSizeInBytes);
+    const size_t used = stream().used();
+    ASSERT_EQ(NO_ERROR, closeStream());
+
+    std::string data;
+    ASSERT_TRUE(android::base::ReadFileToString(mPath, &data));
+    EXPECT_EQ(used, data.size());
+    EXPECT_EQ(expected, replay(readTrace()));
+}
+
+TEST_F(SurfaceTracingTest, droppedEntryIsNotADeltaBase) {
+    ASSERT_EQ(NO_ERROR, openStream(4096));
+
+    std::vector<State> expected;
+    expected.push_back(streamEntry(makeEntry(1, {makeLayer(1, "a")})));
+    // Does not fit, and must not be what the next entry is a delta from.
+    streamEntry(makeEntry(2, {makeLayer(1, "a", 1), makeLayer(2, std::string(8192, 'b'))}));
+    EXPECT_EQ(1u, stream().droppedFrameCount());
+    expected.push_back(streamEntry(makeEntry(3, {makeLayer(1, "a", 1)})));
+    EXPECT_EQ(2u, stream().frameCount());
+    ASSERT_EQ(NO_ERROR, closeStream());
+
+    EXPECT_EQ(expected, replay(readTrace()));
+}
+
+TEST_F(SurfaceTracingTest, failedWriteIsNotKept) {
+    ASSERT_EQ(NO_ERROR, openStream(10 * kWindowSizeInBytes));
+
+    std::vector<State> expected;
+    expected.push_back(streamEntry(makeEntry(1, {makeLayer(1, "a")})));
+    const size_t used = stream().used();
+
+    // Writing the next window fails, after part of the entry is in the current one.
+    reopenStreamFd(O_RDONLY);
+    streamEntry(makeEntry(2, {makeLayer(1, std::string(kWindowSizeInBytes, 'b'))}));
+    EXPECT_EQ(used, stream().used());
+    EXPECT_EQ(1u, stream().frameCount());
+
+    reopenStreamFd(O_RDWR);
+    expected.push_back(streamEntry(makeEntry(3, {makeLayer(1, "a", 1)})));
+    ASSERT_EQ(NO_ERROR, closeStream());
+
+    EXPECT_EQ(expected, replay(readTrace()));
+}
+
+} // namespace
+} // namespace android
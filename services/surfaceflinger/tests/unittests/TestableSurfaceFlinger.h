@@ -277,6 +277,11 @@ public:
 
     auto onMessageReceived(int32_t what) { return mFlinger->onMessageReceived(what); }
 
+    auto getUniqueLayerName(const String8& name) { return mFlinger->getUniqueLayerName(name); }
+    auto releaseUniqueLayerName(const String8& uniqueName) {
+        return mFlinger->releaseUniqueLayerName(uniqueName);
+    }
+
     auto captureScreenImplLocked(
             const RenderArea& renderArea, SurfaceFlinger::TraverseLayersFunction traverseLayers,
             ANativeWindowBuffer* buffer, bool useIdentityTransform, bool forSystem, int* outSyncFd) {
@@ -296,6 +301,11 @@ public:
         return mFlinger->SurfaceFlinger::getDisplayNativePrimaries(displayToken, primaries);
     }
 
+    auto computeVisibleRegions(const sp<const DisplayDevice>& display, Region& outDirtyRegion,
+                               Region& outOpaqueRegion) {
+        return mFlinger->computeVisibleRegions(display, outDirtyRegion, outOpaqueRegion);
+    }
+
     /* ------------------------------------------------------------------------
      * Read-only access to private data to assert post-conditions.
      */
@@ -325,12 +335,16 @@ public:
     auto& mutableEventQueue() { return mFlinger->mEventQueue; }
     auto& mutableGeometryInvalid() { return mFlinger->mGeometryInvalid; }
     auto& mutableInterceptor() { return mFlinger->mInterceptor; }
+    auto& mutableIncrementalVisibleRegions() { return mFlinger->mIncrementalVisibleRegions; }
+    auto& mutableLayerSnapshots() { return mFlinger->mLayerSnapshots; }
+    auto& mutableLayerSnapshotsValid() { return mFlinger->mLayerSnapshotsValid; }
     auto& mutableMainThreadId() { return mFlinger->mMainThreadId; }
     auto& mutablePendingHotplugEvents() { return mFlinger->mPendingHotplugEvents; }
     auto& mutablePhysicalDisplayTokens() { return mFlinger->mPhysicalDisplayTokens; }
     auto& mutableTexturePool() { return mFlinger->mTexturePool; }
     auto& mutableTransactionFlags() { return mFlinger->mTransactionFlags; }
     auto& mutableUseHwcVirtualDisplays() { return mFlinger->mUseHwcVirtualDisplays; }
+    auto& mutableVisibleRegionsCache() { return mFlinger->mVisibleRegionsCache; }
     auto& mutablePowerAdvisor() { return mFlinger->mPowerAdvisor; }
 
     auto& mutableComposerSequenceId() { return mFlinger->getBE().mComposerSequenceId; }
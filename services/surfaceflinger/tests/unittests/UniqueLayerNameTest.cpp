@@ -0,0 +1,91 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "UniqueLayerNameTest"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "TestableSurfaceFlinger.h"
+
+namespace android {
+namespace {
+
+class UniqueLayerNameTest : public testing::Test {
+protected:
+    String8 getUniqueLayerName(const char* name) {
+        return mFlinger.getUniqueLayerName(String8(name));
+    }
+    void release(const String8& uniqueName) { mFlinger.releaseUniqueLayerName(uniqueName); }
+
+    TestableSurfaceFlinger mFlinger;
+};
+
+TEST_F(UniqueLayerNameTest, everyNameGetsASuffix) {
+    EXPECT_EQ(String8("Wallpaper#0"), getUniqueLayerName("Wallpaper"));
+    EXPECT_EQ(String8("StatusBar#0"), getUniqueLayerName("StatusBar"));
+    EXPECT_EQ(String8("Wallpaper#1"), getUniqueLayerName("Wallpaper"));
+    EXPECT_EQ(String8("Wallpaper#2"), getUniqueLayerName("Wallpaper"));
+}
+
+TEST_F(UniqueLayerNameTest, reusesTheSmallestReleasedSuffix) {
+    std::vector<String8> names;
+    for (int i = 0; i < 5; i++) {
+        names.push_back(getUniqueLayerName("SurfaceView"));
+    }
+
+    release(names[3]);
+    release(names[1]);
+    EXPECT_EQ(String8("SurfaceView#1"), getUniqueLayerName("SurfaceView"));
+    EXPECT_EQ(String8("SurfaceView#3"), getUniqueLayerName("SurfaceView"));
+    EXPECT_EQ(String8("SurfaceView#5"), getUniqueLayerName("SurfaceView"));
+}
+
+TEST_F(UniqueLayerNameTest, releasingEverythingStartsOver) {
+    const String8 first = getUniqueLayerName("Video");
+    const String8 second = getUniqueLayerName("Video");
+    const String8 third = getUniqueLayerName("Video");
+
+    release(second);
+    release(third);
+    release(first);
+    EXPECT_EQ(String8("Video#0"), getUniqueLayerName("Video"));
+    EXPECT_EQ(String8("Video#1"), getUniqueLayerName("Video"));
+}
+
+TEST_F(UniqueLayerNameTest, namesContainingSeparatorsAreKeptApart) {
+    EXPECT_EQ(String8("a#0"), getUniqueLayerName("a"));
+    EXPECT_EQ(String8("a#0#0"), getUniqueLayerName("a#0"));
+
+    release(String8("a#0#0"));
+    EXPECT_EQ(String8("a#1"), getUniqueLayerName("a"));
+    EXPECT_EQ(String8("a#0#0"), getUniqueLayerName("a#0"));
+}
+
+TEST_F(UniqueLayerNameTest, ignoresNamesItDidNotHandOut) {
+    EXPECT_EQ(String8("Toast#0"), getUniqueLayerName("Toast"));
+
+    release(String8("Toast"));
+    release(String8("Toast#"));
+    release(String8("Toast#x"));
+    release(String8("Toast#7"));
+    release(String8("Dialog#0"));
+    EXPECT_EQ(String8("Toast#1"), getUniqueLayerName("Toast"));
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "VisibleRegionsTest"
+
+#include <compositionengine/mock/DisplaySurface.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <gui/LayerMetadata.h>
+#include <system/window.h>
+#include <utils/String8.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ContainerLayer.h"
+#include "TestableScheduler.h"
+#include "TestableSurfaceFlinger.h"
+#include "mock/MockDispSync.h"
+#include "mock/MockEventControlThread.h"
+#include "mock/MockEventThread.h"
+#include "mock/system/window/MockNativeWindow.h"
+
+namespace android {
+namespace {
+
+using testing::_;
+using testing::DoAll;
+using testing::Return;
+using testing::SetArgPointee;
+
+using FakeDisplayDeviceInjector = TestableSurfaceFlinger::FakeDisplayDeviceInjector;
+
+constexpr int32_t kDisplayWidth = 1080;
+constexpr int32_t kDisplayHeight = 1920;
+constexpr uint32_t kLayerStack = 7000;
+
+constexpr size_t kLayerCount = 16;
+constexpr int kFrames = 200;
+
+/*
+ * Runs computeVisibleRegions() on random layer configurations, once with the
+ * cache of the previous (incremental) pass and once from scratch, and checks
+ * that both agree on every layer's regions and on the opaque region.
+ *
+ * The layers are fed in through the per-frame layer snapshots, so the test
+ * controls exactly what changed from one frame to the next.
+ */
+class VisibleRegionsTest : public testing::Test {
+protected:
+    struct TestLayer {
+        sp<Layer> layer;
+        Rect bounds;
+        bool opaque = false;
+        Region transparentRegion;
+    };
+
+    VisibleRegionsTest() {
+        mScheduler = new TestableScheduler(mFlinger.mutableRefreshRateConfigs());
+        mScheduler->mutableEventControlThread().reset(new mock::EventControlThread());
+        mScheduler->mutablePrimaryDispSync().reset(new mock::DispSync());
+        EXPECT_CALL(*mEventThread, registerDisplayEventConnection(_));
+        mFlinger.mutableSfConnectionHandle() = mScheduler->addConnection(std::move(mEventThread));
+        mFlinger.mutableScheduler().reset(mScheduler);
+
+        EXPECT_CALL(*mNativeWindow, query(NATIVE_WINDOW_WIDTH, _))
+                .WillRepeatedly(DoAll(SetArgPointee<1>(kDisplayWidth), Return(0)));
+        EXPECT_CALL(*mNativeWindow, query(NATIVE_WINDOW_HEIGHT, _))
+                .WillRepeatedly(DoAll(SetArgPointee<1>(kDisplayHeight), Return(0)));
+        EXPECT_CALL(*mNativeWindow, perform(_)).WillRepeatedly(Return(0));
+        mDisplay = FakeDisplayDeviceInjector(mFlinger, std::nullopt, true /* isVirtual */,
+                                             false /* isPrimary */)
+                           .setDisplaySurface(mDisplaySurface)
+                           .setNativeWindow(mNativeWindow)
+                           .inject();
+        mDisplay->setLayerStack(kLayerStack);
+
+        for (size_t i = 0; i < kLayerCount; i++) {
+            const std::string name = "layer" + std::to_string(i);
+            TestLayer& layer = mPool.emplace_back();
+            layer.layer = new ContainerLayer(LayerCreationArgs(mFlinger.mFlinger.get(),
+                                                               sp<Client>(), String8(name.c_str()),
+                                                               0, 0, 0, LayerMetadata()));
+        }
+    }
+
+    Rect randomRect() {
+        const int32_t left = randomInt(-200, kDisplayWidth);
+        const int32_t top = randomInt(-200, kDisplayHeight);
+        return Rect(left, top, left + randomInt(1, 800), top + randomInt(1, 800));
+    }
+
+    int32_t randomInt(int32_t min, int32_t max) {
+        return std::uniform_int_distribution<int32_t>(min, max)(mRandom);
+    }
+
+    size_t randomIndex(size_t size) {
+        return std::uniform_int_distribution<size_t>(0, size - 1)(mRandom);
+    }
+
+    bool randomBool(double p = 0.5) { return std::bernoulli_distribution(p)(mRandom); }
+
+    void setOpacity(TestLayer& layer, bool opaque) {
+        layer.opaque = opaque && !layer.bounds.isEmpty();
+        layer.transparentRegion.clear();
+        if (!layer.opaque && !layer.bounds.isEmpty() && randomBool()) {
+            // a transparent hole somewhere in the layer
+            const Rect& b = layer.bounds;
+            const int32_t left = randomInt(b.left, b.right - 1);
+            const int32_t top = randomInt(b.top, b.bottom - 1);
+            layer.transparentRegion.set(Rect(left, top, randomInt(left + 1, b.right),
+                                             randomInt(top + 1, b.bottom)));
+        }
+    }
+
+    void moveLayer(TestLayer& layer) {
+        if (layer.bounds.isEmpty() || randomBool(0.3)) {
+            layer.bounds = randomRect();
+        } else {
+            layer.bounds.offsetBy(randomInt(-100, 100), randomInt(-100, 100));
+        }
+        // the transparent region is in screen space, so it goes with the layer
+        setOpacity(layer, layer.opaque);
+    }
+
+    // Applies a few random changes to the layers on the display, in Z order.
+    void mutate() {
+        const int changes = randomInt(0, 3);
+        for (int i = 0; i < changes; i++) {
+            switch (randomInt(0, 6)) {
+                case 0:
+                case 1:
+                    if (!mLayers.empty()) {
+                        moveLayer(mLayers[randomIndex(mLayers.size())]);
+                    }
+                    break;
+                case 2:
+                    if (!mLayers.empty()) {
+                        TestLayer& layer = mLayers[randomIndex(mLayers.size())];
+                        setOpacity(layer, !layer.opaque);
+                    }
+                    break;
+                case 3:
+                    if (mLayers.size() > 1) {
+                        // z-reorder
+                        const size_t from = randomIndex(mLayers.size());
+                        TestLayer layer = mLayers[from];
+                        mLayers.erase(mLayers.begin() + from);
+                        mLayers.insert(mLayers.begin() + randomIndex(mLayers.size() + 1), layer);
+                    }
+                    break;
+                case 4:
+                    if (!mLayers.empty()) {
+                        // hide or show
+                        TestLayer& layer = mLayers[randomIndex(mLayers.size())];
+                        if (layer.bounds.isEmpty()) {
+                            layer.bounds = randomRect();
+                        } else {
+                            layer.bounds.clear();
+                        }
+                        setOpacity(layer, randomBool());
+                    }
+                    break;
+                case 5:
+                    if (!mLayers.empty()) {
+                        // new content
+                        mLayers[randomIndex(mLayers.size())].layer->contentDirty = true;
+                    }
+                    break;
+                case 6:
+                    addOrRemoveLayer();
+                    break;
+            }
+        }
+    }
+
+    void addOrRemoveLayer() {
+        if (!mLayers.empty() && (mPool.empty() || randomBool())) {
+            const size_t index = randomIndex(mLayers.size());
+            mPool.push_back(mLayers[index]);
+            mLayers.erase(mLayers.begin() + index);
+        } else if (!mPool.empty()) {
+            const size_t index = randomIndex(mPool.size());
+            TestLayer layer = mPool[index];
+            mPool.erase(mPool.begin() + index);
+            layer.bounds = randomRect();
+            setOpacity(layer, randomBool());
+            mLayers.insert(mLayers.begin() + randomIndex(mLayers.size() + 1), layer);
+        }
+    }
+
+    // Does what updateLayerSnapshots() would do for the current layers.
+    void updateLayerSnapshots() {
+        auto& snapshots = mFlinger.mutableLayerSnapshots();
+        snapshots.clear();
+        for (const TestLayer& layer : mLayers) {
+            auto& snapshot = snapshots.emplace_back();
+            snapshot.layer = layer.layer.get();
+            snapshot.sequence = layer.layer->getSequence();
+            snapshot.layerStack = kLayerStack;
+            snapshot.bounds = layer.bounds;
+            snapshot.opaque = layer.opaque;
+            snapshot.transparentRegion = layer.transparentRegion;
+        }
+        mFlinger.mutableLayerSnapshotsValid() = true;
+    }
+
+    struct Result {
+        std::vector<Region> visibleRegions;
+        std::vector<Region> coveredRegions;
+        std::vector<Region> visibleNonTransparentRegions;
+        Region opaqueRegion;
+    };
+
+    Result computeVisibleRegions(bool incremental) {
+        mFlinger.mutableIncrementalVisibleRegions() = incremental;
+        Region dirtyRegion;
+        Result result;
+        mFlinger.computeVisibleRegions(mDisplay, dirtyRegion, result.opaqueRegion);
+        for (const TestLayer& layer : mLayers) {
+            result.visibleRegions.push_back(layer.layer->visibleRegion);
+            result.coveredRegions.push_back(layer.layer->coveredRegion);
+            result.visibleNonTransparentRegions.push_back(layer.layer->visibleNonTransparentRegion);
+        }
+        return result;
+    }
+
+    static testing::AssertionResult sameArea(const Region& expected, const Region& actual) {
+        if (expected.subtract(actual).isEmpty() && actual.subtract(expected).isEmpty()) {
+            return testing::AssertionSuccess();
+        }
+        std::string out;
+        expected.dump(out, "expected");
+        actual.dump(out, "actual");
+        return testing::AssertionFailure() << out;
+    }
+
+    void runFrames(uint32_t seed) {
+        mRandom.seed(seed);
+        for (int i = 0; i < 4; i++) {
+            addOrRemoveLayer();
+        }
+
+        for (int frame = 0; frame < kFrames; frame++) {
+            SCOPED_TRACE("seed " + std::to_string(seed) + " frame " + std::to_string(frame));
+            mutate();
+            updateLayerSnapshots();
+
+            const Result incremental = computeVisibleRegions(true);
+
+            // The full pass must not replace what the incremental pass
+            // cached, or errors could not build up over several frames.
+            const auto cache = mFlinger.mutableVisibleRegionsCache();
+            const Result full = computeVisibleRegions(false);
+            mFlinger.mutableVisibleRegionsCache() = cache;
+
+            EXPECT_TRUE(sameArea(full.opaqueRegion, incremental.opaqueRegion));
+            for (size_t i = 0; i < mLayers.size(); i++) {
+                SCOPED_TRACE("layer " + std::to_string(i));
+                EXPECT_TRUE(sameArea(full.visibleRegions[i], incremental.visibleRegions[i]));
+                EXPECT_TRUE(sameArea(full.coveredRegions[i], incremental.coveredRegions[i]));
+                EXPECT_TRUE(sameArea(full.visibleNonTransparentRegions[i],
+                                     incremental.visibleNonTransparentRegions[i]));
+            }
+            if (HasFailure()) {
+                return;
+            }
+        }
+    }
+
+    TestableSurfaceFlinger mFlinger;
+    TestableScheduler* mScheduler;
+    std::unique_ptr<mock::EventThread> mEventThread = std::make_unique<mock::EventThread>();
+    sp<mock::NativeWindow> mNativeWindow = new mock::NativeWindow();
+    sp<compositionengine::mock::DisplaySurface> mDisplaySurface =
+            new compositionengine::mock::DisplaySurface();
+    sp<DisplayDevice> mDisplay;
+
+    std::mt19937 mRandom;
+    // on the display, in Z order
+    std::vector<TestLayer> mLayers;
+    // not on the display
+    std::vector<TestLayer> mPool;
+};
+
+TEST_F(VisibleRegionsTest, incrementalMatchesFullComputation) {
+    for (uint32_t seed = 1; seed <= 8; seed++) {
+        runFrames(seed);
+        if (HasFailure()) {
+            return;
+        }
+    }
+}
+
+TEST_F(VisibleRegionsTest, unchangedFrameKeepsRegions) {
+    mRandom.seed(42);
+    for (size_t i = 0; i < kLayerCount / 2; i++) {
+        addOrRemoveLayer();
+    }
+    updateLayerSnapshots();
+    const Result first = computeVisibleRegions(true);
+    const Result second = computeVisibleRegions(true);
+
+    EXPECT_TRUE(sameArea(first.opaqueRegion, second.opaqueRegion));
+    for (size_t i = 0; i < mLayers.size(); i++) {
+        EXPECT_TRUE(sameArea(first.visibleRegions[i], second.visibleRegions[i]));
+        EXPECT_TRUE(sameArea(first.coveredRegions[i], second.coveredRegions[i]));
+    }
+}
+
+} // namespace
+} // namespace android
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#undef LOG_TAG
+#define LOG_TAG "SchedulerUnittests"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "Scheduler/VsyncModel.h"
+
+namespace android {
+namespace scheduler {
+namespace {
+
+constexpr nsecs_t kPeriod = 8333333;
+constexpr nsecs_t kStart = 1000000000;
+
+std::vector<nsecs_t> regularVsyncs(size_t count) {
+    std::vector<nsecs_t> vsyncs;
+    for (size_t i = 0; i < count; i++) {
+        vsyncs.push_back(kStart + nsecs_t(i) * kPeriod);
+    }
+    return vsyncs;
+}
+
+TEST(VsyncModelTest, needsEnoughSamples) {
+    const auto vsyncs = regularVsyncs(2);
+    EXPECT_FALSE(fitVsyncModel(vsyncs.data(), vsyncs.size(), vsyncs.back()));
+}
+
+TEST(VsyncModelTest, fitsRegularVsyncs) {
+    const auto vsyncs = regularVsyncs(10);
+    const auto model = fitVsyncModel(vsyncs.data(), vsyncs.size(), vsyncs.back());
+    ASSERT_TRUE(model);
+    EXPECT_EQ(kPeriod, model->period);
+    EXPECT_EQ(0, model->phase);
+    EXPECT_EQ(0, model->residual);
+    EXPECT_EQ(10u, model->inlierCount);
+    EXPECT_EQ(0u, model->outlierCount);
+}
+
+TEST(VsyncModelTest, phaseIsRelativeToTheReferenceTime) {
+    const auto vsyncs = regularVsyncs(10);
+    const auto model = fitVsyncModel(vsyncs.data(), vsyncs.size(), vsyncs.back() - 1000000);
+    ASSERT_TRUE(model);
+    EXPECT_EQ(1000000, model->phase);
+}
+
+TEST(VsyncModelTest, missedVsyncsDontChangeThePeriod) {
+    auto vsyncs = regularVsyncs(12);
+    vsyncs.erase(vsyncs.begin() + 5);
+    vsyncs.erase(vsyncs.begin() + 8);
+    const auto model = fitVsyncModel(vsyncs.data(), vsyncs.size(), vsyncs.back());
+    ASSERT_TRUE(model);
+    EXPECT_EQ(kPeriod, model->period);
+    EXPECT_EQ(0u, model->outlierCount);
+}
+
+TEST(VsyncModelTest, leavesOutLateVsyncs) {
+    auto vsyncs = regularVsyncs(12);
+    for (size_t i = 0; i < vsyncs.size(); i++) {
+        vsyncs[i] += (i % 2) ? 20000 : -20000;
+    }
+    vsyncs[6] += 2000000;
+    const auto model = fitVsyncModel(vsyncs.data(), vsyncs.size(), vsyncs.back());
+    ASSERT_TRUE(model);
+    EXPECT_EQ(1u, model->outlierCount);
+    EXPECT_EQ(11u, model->inlierCount);
+    EXPECT_NEAR(kPeriod, model->period, 5000);
+    EXPECT_LE(model->residual, 25000);
+}
+
+} // namespace
+} // namespace scheduler
+} // namespace android
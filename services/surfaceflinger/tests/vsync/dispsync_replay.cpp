@@ -0,0 +1,226 @@
+/*
+ * Copyright 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Replays a recorded timeline of hardware vsync and present fence timestamps
+// against DispSync, turning hardware vsync on and off the way the Scheduler
+// does, and reports how far off the predicted vsyncs were and how long
+// hardware vsync had to stay on.
+//
+// The timeline is a text file with one event per line, either
+// "vsync <timestamp>" or "present <timestamp>", with timestamps in
+// nanoseconds and in chronological order. Lines starting with '#' are
+// ignored. The vsync events must be recorded with hardware vsync forced on,
+// as they are also the ground truth the predictions are checked against.
+// Without a file, a synthetic 120Hz timeline with jitter, late vsyncs and
+// late present fences is replayed instead.
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <ui/FenceTime.h>
+
+#include "Scheduler/DispSync.h"
+
+using namespace android;
+
+namespace {
+
+struct Event {
+    enum class Type { Vsync, Present };
+    Type type;
+    nsecs_t timestamp;
+};
+
+bool readTimeline(const char* path, std::vector<Event>* events) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream stream(line);
+        std::string type;
+        nsecs_t timestamp;
+        if (!(stream >> type >> timestamp) || (type != "vsync" && type != "present")) {
+            fprintf(stderr, "%s:%zu: expected \"vsync|present <timestamp>\"\n", path, lineNumber);
+            return false;
+        }
+        events->push_back(
+                {type == "vsync" ? Event::Type::Vsync : Event::Type::Present, timestamp});
+    }
+    return true;
+}
+
+std::vector<Event> syntheticTimeline() {
+    constexpr nsecs_t kPeriod = 8333333;
+    constexpr size_t kVsyncCount = 20000;
+
+    std::mt19937 random(0);
+    std::normal_distribution<double> jitter(0.0, 30000.0);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<Event> events;
+    nsecs_t vsync = 1000000000;
+    for (size_t i = 0; i < kVsyncCount; i++) {
+        vsync += kPeriod;
+        nsecs_t timestamp = vsync + nsecs_t(jitter(random));
+        if (percent(random) == 0) {
+            // The vsync callback was delayed.
+            timestamp += 2000000;
+        }
+        events.push_back({Event::Type::Vsync, timestamp});
+
+        // Present about every other frame, sometimes with a late fence.
+        if (percent(random) < 50) {
+            nsecs_t present = vsync + nsecs_t(jitter(random));
+            if (percent(random) < 2) {
+                present += 1500000;
+            }
+            events.push_back({Event::Type::Present, present});
+        }
+    }
+    return events;
+}
+
+nsecs_t percentile(const std::vector<nsecs_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))];
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<Event> events;
+    if (argc > 2 || (argc == 2 && !strcmp(argv[1], "--help"))) {
+        fprintf(stderr, "usage: %s [timeline]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        if (!readTimeline(argv[1], &events)) {
+            return 1;
+        }
+    } else {
+        events = syntheticTimeline();
+    }
+
+    impl::DispSync dispSync("Replay");
+    dispSync.init(true, 0);
+
+    bool hwVsyncEnabled = true;
+    nsecs_t hwVsyncOnSince = 0;
+    nsecs_t hwVsyncOnTime = 0;
+    size_t resyncCount = 0;
+    size_t vsyncCount = 0;
+    size_t samplesUsed = 0;
+    nsecs_t firstTimestamp = 0;
+    nsecs_t lastTimestamp = 0;
+    std::vector<nsecs_t> errors;
+
+    auto enableHardwareVsync = [&](nsecs_t now) {
+        if (!hwVsyncEnabled) {
+            dispSync.beginResync();
+            hwVsyncEnabled = true;
+            hwVsyncOnSince = now;
+            resyncCount++;
+        }
+    };
+    auto disableHardwareVsync = [&](nsecs_t now) {
+        if (hwVsyncEnabled) {
+            dispSync.endResync();
+            hwVsyncEnabled = false;
+            hwVsyncOnTime += now - hwVsyncOnSince;
+        }
+    };
+
+    if (!events.empty()) {
+        firstTimestamp = events.front().timestamp;
+        hwVsyncOnSince = firstTimestamp;
+    }
+    for (const auto& event : events) {
+        lastTimestamp = event.timestamp;
+
+        if (event.type == Event::Type::Present) {
+            if (dispSync.addPresentFence(std::make_shared<FenceTime>(event.timestamp))) {
+                enableHardwareVsync(event.timestamp);
+            } else {
+                disableHardwareVsync(event.timestamp);
+            }
+            continue;
+        }
+
+        // Check the prediction from half a period before the vsync, which
+        // is where the model is furthest from any vsync it has seen.
+        vsyncCount++;
+        if (const nsecs_t period = dispSync.getPeriod(); period > 0) {
+            const nsecs_t predicted =
+                    dispSync.computeNextRefreshAfter(event.timestamp - period / 2, 0);
+            errors.push_back(std::abs(predicted - event.timestamp));
+        }
+
+        if (hwVsyncEnabled) {
+            samplesUsed++;
+            bool periodFlushed = false;
+            if (!dispSync.addResyncSample(event.timestamp, &periodFlushed)) {
+                disableHardwareVsync(event.timestamp);
+            }
+        }
+    }
+    if (hwVsyncEnabled) {
+        hwVsyncOnTime += lastTimestamp - hwVsyncOnSince;
+    }
+
+    std::vector<nsecs_t> sorted = errors;
+    std::sort(sorted.begin(), sorted.end());
+    double meanError = 0;
+    for (nsecs_t error : errors) {
+        meanError += double(error);
+    }
+    if (!errors.empty()) {
+        meanError /= double(errors.size());
+    }
+    const nsecs_t duration = lastTimestamp - firstTimestamp;
+
+    printf("{\"vsyncs\":%zu,\"predictions\":%zu,\"samplesUsed\":%zu,\"resyncs\":%zu,"
+           "\"meanErrorUs\":%.1f,\"p50ErrorUs\":%.1f,\"p99ErrorUs\":%.1f,\"maxErrorUs\":%.1f,"
+           "\"hwVsyncOnPercent\":%.2f}\n",
+           vsyncCount, errors.size(), samplesUsed, resyncCount, meanError / 1000.0,
+           percentile(sorted, 0.5) / 1000.0, percentile(sorted, 0.99) / 1000.0,
+           (sorted.empty() ? 0 : sorted.back()) / 1000.0,
+           duration > 0 ? 100.0 * double(hwVsyncOnTime) / double(duration) : 0.0);
+
+    std::string dump;
+    dispSync.dump(dump);
+    fprintf(stderr, "%s", dump.c_str());
+    return 0;
+}